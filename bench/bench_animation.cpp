@@ -0,0 +1,116 @@
+#include "microbench.h"
+#include "benchscene.h"
+
+#include "../animation.h"
+#include "../scene.h"
+
+// Frames are decoded from every loaded sequence in turn, so the numbers don't depend on one sequence's channels
+static void BM_DecodeFrame(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    std::vector<SQT> frame;
+
+    int animID = 0;
+    int frameID = 0;
+    int64_t numBones = 0;
+    while (state.KeepRunning())
+    {
+        DecodeFrame(scene, animID, frameID, frame);
+        DoNotOptimize(frame.data());
+        numBones += frame.size();
+
+        if (++frameID == scene->AnimSequences[animID].NumFrames)
+        {
+            frameID = 0;
+            animID = (animID + 1) % (int)scene->AnimSequences.size();
+        }
+    }
+
+    state.SetItemsProcessed(numBones);
+}
+BENCHMARK(BM_DecodeFrame);
+
+static void BM_InterpolateFrames(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    std::vector<SQT> frame;
+
+    int animID = 0;
+    int frameID = 0;
+    int64_t numBones = 0;
+    while (state.KeepRunning())
+    {
+        const AnimSequence& animSequence = scene->AnimSequences[animID];
+        InterpolateFrames(scene, animID, frameID, (frameID + 1) % animSequence.NumFrames, 0.37f, frame);
+        DoNotOptimize(frame.data());
+        numBones += frame.size();
+
+        if (++frameID == animSequence.NumFrames)
+        {
+            frameID = 0;
+            animID = (animID + 1) % (int)scene->AnimSequences.size();
+        }
+    }
+
+    state.SetItemsProcessed(numBones);
+}
+BENCHMARK(BM_InterpolateFrames);
+
+// Arg: 1 to interpolate between frames
+static void BM_GetFrameAtTime(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    std::vector<SQT> frame;
+    bool interpolate = state.Range(0) != 0;
+
+    // Steps of a 60 Hz frame, through every sequence in turn
+    int animID = 0;
+    int animTime = 0;
+    int64_t numBones = 0;
+    while (state.KeepRunning())
+    {
+        GetFrameAtTime(scene, animID, animTime, interpolate, frame);
+        DoNotOptimize(frame.data());
+        numBones += frame.size();
+
+        const AnimSequence& animSequence = scene->AnimSequences[animID];
+        animTime += 1000 / 60;
+        if (animTime >= animSequence.NumFrames * 1000 / animSequence.FramesPerSecond)
+        {
+            animTime = 0;
+            animID = (animID + 1) % (int)scene->AnimSequences.size();
+        }
+    }
+
+    state.SetItemsProcessed(numBones);
+}
+BENCHMARK(BM_GetFrameAtTime)->Arg(0)->Arg(1);
+
+// Poses every animated skeleton and computes its skinning palettes. Arg: hellknight crowd members animated with the hellknight.
+static void BM_UpdateAnimatedSkeletons(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numCrowdMembers = (int)state.Range(0);
+
+    int savedNumCrowdMembers = scene->Crowds[scene->HellknightCrowdID].NumMembers;
+    SetCrowdSize(scene, scene->HellknightCrowdID, numCrowdMembers);
+
+    // Crowd members stay in the table once added, and all skeletons in the table are animated.
+    // Args are increasing so each instance animates the members it asks for.
+    int64_t numBonesPerUpdate = 0;
+    for (const AnimatedSkeleton& animSkeleton : scene->AnimatedSkeletons)
+    {
+        numBonesPerUpdate += animSkeleton.BoneTransformDualQuats.size();
+    }
+
+    while (state.KeepRunning())
+    {
+        UpdateAnimatedSkeletons(scene, 1000 / 60);
+    }
+
+    state.SetItemsProcessed(state.Iterations() * numBonesPerUpdate);
+    state.SetLabel(std::to_string(scene->AnimatedSkeletons.size()) + " skeletons");
+
+    SetCrowdSize(scene, scene->HellknightCrowdID, savedNumCrowdMembers);
+}
+BENCHMARK(BM_UpdateAnimatedSkeletons)->Arg(0)->Arg(16)->Arg(256)->Arg(1000)->Unit(BENCHMARK_MICROSECOND);
@@ -0,0 +1,386 @@
+#include "microbench.h"
+#include "benchscene.h"
+
+#include "../dynamics.h"
+#include "../scene.h"
+#include "../threadpool.h"
+
+#include <algorithm>
+
+// Copies of the hellknight's ragdoll side by side, simulated as one system
+struct RagdollCopies
+{
+    std::vector<glm::vec3> Positions;
+    std::vector<glm::vec3> Velocities;
+    std::vector<float> Masses;
+    std::vector<glm::vec3> ExternalForces;
+    std::vector<Hull> Hulls;
+    std::vector<Constraint> Constraints;
+    std::vector<int> ConstraintParticleIDs; // Constraints point into this
+};
+
+static void InitRagdollCopies(RagdollCopies* copies, Scene* scene, int numCopies, bool withAngularConstraints)
+{
+    const Ragdoll& ragdoll = scene->Ragdolls[0];
+    const AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[ragdoll.AnimatedSkeletonID];
+    int numParticles = (int)animSkeleton.JointPositions.size();
+
+    std::vector<Constraint> constraints;
+    for (const Constraint& constraint : ragdoll.BoneConstraints)
+    {
+        if (withAngularConstraints || constraint.Func != CONSTRAINTFUNC_ANGULAR)
+        {
+            constraints.push_back(constraint);
+        }
+    }
+
+    int numParticleIDs = 0;
+    for (const Constraint& constraint : constraints)
+    {
+        numParticleIDs += constraint.NumParticles;
+    }
+
+    // Particle IDs are stored first so the constraints can point into them
+    copies->ConstraintParticleIDs.clear();
+    copies->ConstraintParticleIDs.reserve(numCopies * numParticleIDs);
+    for (int copyIdx = 0; copyIdx < numCopies; copyIdx++)
+    {
+        for (const Constraint& constraint : constraints)
+        {
+            for (int i = 0; i < constraint.NumParticles; i++)
+            {
+                copies->ConstraintParticleIDs.push_back(constraint.ParticleIDs[i] + copyIdx * numParticles);
+            }
+        }
+    }
+
+    copies->Positions.clear();
+    copies->Velocities.clear();
+    copies->Hulls.clear();
+    copies->Constraints.clear();
+    int* particleIDs = copies->ConstraintParticleIDs.data();
+    for (int copyIdx = 0; copyIdx < numCopies; copyIdx++)
+    {
+        glm::vec3 offset(copyIdx * 200.0f, 0.0f, 0.0f);
+        for (int particleIdx = 0; particleIdx < numParticles; particleIdx++)
+        {
+            copies->Positions.push_back(animSkeleton.JointPositions[particleIdx] + offset);
+            copies->Velocities.push_back(animSkeleton.JointVelocities[particleIdx]);
+
+            Hull hull = ragdoll.JointHulls[particleIdx];
+            if (hull.Type == HULLTYPE_CAPSULE)
+            {
+                hull.Capsule.OtherParticleID += copyIdx * numParticles;
+            }
+            copies->Hulls.push_back(hull);
+        }
+
+        for (Constraint constraint : constraints)
+        {
+            constraint.ParticleIDs = particleIDs;
+            particleIDs += constraint.NumParticles;
+            copies->Constraints.push_back(constraint);
+        }
+    }
+
+    copies->Masses.assign(copies->Positions.size(), 1.0f);
+    copies->ExternalForces.assign(copies->Positions.size(), glm::vec3(0.0f, scene->Gravity, 0.0f));
+}
+
+// Args: ragdoll copies, 1 to include the angular joint constraints.
+// Every iteration steps the same initial state, so the collision constraints are the same each time.
+// Goes through the stateless entry point, which batches the constraints and allocates every step.
+static void BM_SimulateDynamics(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numCopies = (int)state.Range(0);
+    bool withAngularConstraints = state.Range(1) != 0;
+
+    RagdollCopies copies;
+    InitRagdollCopies(&copies, scene, numCopies, withAngularConstraints);
+
+    int numParticles = (int)copies.Positions.size();
+    std::vector<glm::vec3> newPositions(numParticles);
+    std::vector<glm::vec3> newVelocities(numParticles);
+
+    while (state.KeepRunning())
+    {
+        SimulateDynamics(
+            1.0f / 60.0f,
+            (float*)copies.Positions.data(),
+            (float*)copies.Velocities.data(),
+            copies.Masses.data(),
+            (float*)copies.ExternalForces.data(),
+            copies.Hulls.data(),
+            numParticles, DEFAULT_DYNAMICS_NUM_ITERATIONS,
+            copies.Constraints.data(), (int)copies.Constraints.size(),
+            scene->RagdollDampingK,
+            (float*)newPositions.data(),
+            (float*)newVelocities.data());
+        DoNotOptimize(newPositions.data());
+    }
+
+    state.SetItemsProcessed(state.Iterations() * numParticles);
+    state.SetLabel(std::to_string(numParticles) + " particles, " + std::to_string(copies.Constraints.size()) + " constraints");
+}
+BENCHMARK(BM_SimulateDynamics)
+    ->Args({ 1, 0 })->Args({ 1, 1 })
+    ->Args({ 8, 0 })->Args({ 8, 1 })
+    ->Args({ 64, 0 })->Args({ 64, 1 })
+    ->Args({ 512, 0 })->Args({ 512, 1 })
+    ->Unit(BENCHMARK_MICROSECOND);
+
+// Same as above with a solver kept across steps, projecting the constraints in their original order
+static void BM_SolveDynamics(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numCopies = (int)state.Range(0);
+    bool withAngularConstraints = state.Range(1) != 0;
+
+    RagdollCopies copies;
+    InitRagdollCopies(&copies, scene, numCopies, withAngularConstraints);
+
+    int numParticles = (int)copies.Positions.size();
+    std::vector<glm::vec3> newPositions(numParticles);
+    std::vector<glm::vec3> newVelocities(numParticles);
+
+    DynamicsSolver solver;
+    InitDynamicsSolver(
+        &solver,
+        copies.Masses.data(),
+        copies.Hulls.data(),
+        numParticles,
+        copies.Constraints.data(), (int)copies.Constraints.size());
+    solver.Projection = DYNAMICSPROJECTION_SEQUENTIAL;
+
+    while (state.KeepRunning())
+    {
+        SolveDynamics(
+            &solver,
+            1.0f / 60.0f,
+            (float*)copies.Positions.data(),
+            (float*)copies.Velocities.data(),
+            (float*)copies.ExternalForces.data(),
+            DEFAULT_DYNAMICS_NUM_ITERATIONS,
+            scene->RagdollDampingK,
+            (float*)newPositions.data(),
+            (float*)newVelocities.data());
+        DoNotOptimize(newPositions.data());
+    }
+
+    state.SetItemsProcessed(state.Iterations() * numParticles);
+    state.SetLabel(std::to_string(numParticles) + " particles, " + std::to_string(copies.Constraints.size()) + " constraints");
+}
+BENCHMARK(BM_SolveDynamics)
+    ->Args({ 1, 0 })->Args({ 1, 1 })
+    ->Args({ 8, 0 })->Args({ 8, 1 })
+    ->Args({ 64, 0 })->Args({ 64, 1 })
+    ->Args({ 512, 0 })->Args({ 512, 1 })
+    ->Unit(BENCHMARK_MICROSECOND);
+
+// Colored projection of the bone constraints, as the scene runs it. Args: ragdoll copies, max threads.
+// Counts distance constraint projections, and labels the largest difference to the sequential projection after one step.
+static void BM_SolveDynamicsColored(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numCopies = (int)state.Range(0);
+
+    RagdollCopies copies;
+    InitRagdollCopies(&copies, scene, numCopies, false);
+
+    int numParticles = (int)copies.Positions.size();
+    std::vector<glm::vec3> newPositions(numParticles);
+    std::vector<glm::vec3> newVelocities(numParticles);
+    std::vector<glm::vec3> sequentialPositions(numParticles);
+
+    DynamicsSolver solver;
+    InitDynamicsSolver(
+        &solver,
+        copies.Masses.data(),
+        copies.Hulls.data(),
+        numParticles,
+        copies.Constraints.data(), (int)copies.Constraints.size());
+    solver.NumThreads = (int)state.Range(1);
+    solver.Threads = GetThreadPool();
+
+    auto step = [&](glm::vec3* positions)
+    {
+        SolveDynamics(
+            &solver,
+            1.0f / 60.0f,
+            (float*)copies.Positions.data(),
+            (float*)copies.Velocities.data(),
+            (float*)copies.ExternalForces.data(),
+            DEFAULT_DYNAMICS_NUM_ITERATIONS,
+            scene->RagdollDampingK,
+            (float*)positions,
+            (float*)newVelocities.data());
+    };
+
+    solver.Projection = DYNAMICSPROJECTION_SEQUENTIAL;
+    step(sequentialPositions.data());
+    solver.Projection = DYNAMICSPROJECTION_COLORED;
+    step(newPositions.data());
+
+    float maxError = 0.0f;
+    for (int i = 0; i < numParticles; i++)
+    {
+        glm::vec3 error = glm::abs(newPositions[i] - sequentialPositions[i]);
+        maxError = std::max(maxError, std::max(error.x, std::max(error.y, error.z)));
+    }
+
+    while (state.KeepRunning())
+    {
+        step(newPositions.data());
+        DoNotOptimize(newPositions.data());
+    }
+
+    int numColors = (int)solver.DistanceColorOffsets.size() - 1;
+    state.SetItemsProcessed(state.Iterations() * DEFAULT_DYNAMICS_NUM_ITERATIONS * (int64_t)solver.ColoredDistanceConstraints.Distances.size());
+    state.SetLabel(std::to_string(numColors) + " colors, max error " + std::to_string(maxError));
+}
+BENCHMARK(BM_SolveDynamicsColored)
+    ->Args({ 1, 1 })
+    ->Args({ 64, 1 })
+    ->Args({ 512, 1 })->Args({ 512, 2 })->Args({ 512, 4 })->Args({ 512, 8 })
+    ->Unit(BENCHMARK_MICROSECOND);
+
+// Steps ragdolls like the hellknight's one by one, each with its own solver. Arg: number of ragdolls.
+// Baseline for BM_SolveDynamicsBatch.
+static void BM_SolveDynamicsPerRagdoll(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numRagdolls = (int)state.Range(0);
+
+    RagdollCopies ragdoll;
+    InitRagdollCopies(&ragdoll, scene, 1, true);
+
+    int numParticles = (int)ragdoll.Positions.size();
+    std::vector<glm::vec3> newPositions(numParticles);
+    std::vector<glm::vec3> newVelocities(numParticles);
+
+    std::vector<DynamicsSolver> solvers(numRagdolls);
+    for (DynamicsSolver& solver : solvers)
+    {
+        InitDynamicsSolver(
+            &solver,
+            ragdoll.Masses.data(),
+            ragdoll.Hulls.data(),
+            numParticles,
+            ragdoll.Constraints.data(), (int)ragdoll.Constraints.size());
+    }
+
+    while (state.KeepRunning())
+    {
+        for (DynamicsSolver& solver : solvers)
+        {
+            SolveDynamics(
+                &solver,
+                1.0f / 60.0f,
+                (float*)ragdoll.Positions.data(),
+                (float*)ragdoll.Velocities.data(),
+                (float*)ragdoll.ExternalForces.data(),
+                DEFAULT_DYNAMICS_NUM_ITERATIONS,
+                scene->RagdollDampingK,
+                (float*)newPositions.data(),
+                (float*)newVelocities.data());
+        }
+        DoNotOptimize(newPositions.data());
+    }
+
+    state.SetItemsProcessed(state.Iterations() * numRagdolls);
+}
+BENCHMARK(BM_SolveDynamicsPerRagdoll)
+    ->Arg(8)->Arg(64)->Arg(512)->Arg(4096)
+    ->Unit(BENCHMARK_MICROSECOND);
+
+// Ragdolls like the hellknight's stepped together, one per SIMD lane. Args: number of ragdolls, max threads.
+// Every iteration steps the same initial state. Items are ragdolls, so ragdolls per millisecond are items per second / 1000.
+// Labels the largest difference to the single ragdoll solver (sequential projection) after one step.
+static void BM_SolveDynamicsBatch(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numRagdolls = (int)state.Range(0);
+
+    RagdollCopies ragdoll;
+    InitRagdollCopies(&ragdoll, scene, 1, true);
+
+    int numParticles = (int)ragdoll.Positions.size();
+
+    DynamicsBatchSolver solver;
+    InitDynamicsBatchSolver(
+        &solver,
+        ragdoll.Masses.data(),
+        ragdoll.Hulls.data(),
+        numParticles,
+        ragdoll.Constraints.data(), (int)ragdoll.Constraints.size(),
+        numRagdolls);
+    solver.NumThreads = (int)state.Range(1);
+    solver.Threads = GetThreadPool();
+
+    for (int ragdollIdx = 0; ragdollIdx < numRagdolls; ragdollIdx++)
+    {
+        SetDynamicsBatchSystem(&solver, ragdollIdx, (float*)ragdoll.Positions.data(), (float*)ragdoll.Velocities.data());
+    }
+
+    std::vector<float> initialPositions = solver.Positions;
+    std::vector<float> initialVelocities = solver.Velocities;
+
+    // Reference step of the first ragdoll
+    std::vector<glm::vec3> referencePositions(numParticles);
+    std::vector<glm::vec3> referenceVelocities(numParticles);
+    {
+        DynamicsSolver referenceSolver;
+        InitDynamicsSolver(
+            &referenceSolver,
+            ragdoll.Masses.data(),
+            ragdoll.Hulls.data(),
+            numParticles,
+            ragdoll.Constraints.data(), (int)ragdoll.Constraints.size());
+        referenceSolver.Projection = DYNAMICSPROJECTION_SEQUENTIAL;
+
+        SolveDynamics(
+            &referenceSolver,
+            1.0f / 60.0f,
+            (float*)ragdoll.Positions.data(),
+            (float*)ragdoll.Velocities.data(),
+            (float*)ragdoll.ExternalForces.data(),
+            DEFAULT_DYNAMICS_NUM_ITERATIONS,
+            scene->RagdollDampingK,
+            (float*)referencePositions.data(),
+            (float*)referenceVelocities.data());
+    }
+
+    SolveDynamicsBatch(&solver, 1.0f / 60.0f, (float*)ragdoll.ExternalForces.data(), DEFAULT_DYNAMICS_NUM_ITERATIONS, scene->RagdollDampingK);
+
+    std::vector<glm::vec3> positions(numParticles);
+    std::vector<glm::vec3> velocities(numParticles);
+    float maxError = 0.0f;
+    for (int ragdollIdx = 0; ragdollIdx < numRagdolls; ragdollIdx++)
+    {
+        GetDynamicsBatchSystem(&solver, ragdollIdx, (float*)positions.data(), (float*)velocities.data());
+        for (int i = 0; i < numParticles; i++)
+        {
+            glm::vec3 error = glm::abs(positions[i] - referencePositions[i]);
+            maxError = std::max(maxError, std::max(error.x, std::max(error.y, error.z)));
+        }
+    }
+
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        solver.Positions = initialPositions;
+        solver.Velocities = initialVelocities;
+        state.ResumeTiming();
+
+        SolveDynamicsBatch(&solver, 1.0f / 60.0f, (float*)ragdoll.ExternalForces.data(), DEFAULT_DYNAMICS_NUM_ITERATIONS, scene->RagdollDampingK);
+        DoNotOptimize(solver.Positions.data());
+    }
+
+    state.SetItemsProcessed(state.Iterations() * numRagdolls);
+    state.SetLabel(std::to_string(solver.NumLanes) + " lanes, max error " + std::to_string(maxError));
+}
+BENCHMARK(BM_SolveDynamicsBatch)
+    ->Args({ 8, 1 })->Args({ 64, 1 })->Args({ 512, 1 })
+    ->Args({ 4096, 1 })->Args({ 4096, 2 })->Args({ 4096, 4 })->Args({ 4096, 8 })
+    ->Unit(BENCHMARK_MICROSECOND);
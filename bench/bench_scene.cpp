@@ -0,0 +1,81 @@
+#include "microbench.h"
+#include "benchscene.h"
+
+#include "../renderer.h"
+#include "../scene.h"
+
+#include <glm/gtx/transform.hpp>
+
+// Appends copies of the scene graph, each one moved along X, so the update scales past the few nodes of the scene.
+// Returns the number of nodes before copying, to remove the copies with.
+static int AddSceneNodeCopies(Scene* scene, int numCopies)
+{
+    int numNodes = (int)scene->SceneNodes.size();
+    for (int copyIdx = 1; copyIdx < numCopies; copyIdx++)
+    {
+        for (int nodeID = 0; nodeID < numNodes; nodeID++)
+        {
+            SceneNode sceneNode = scene->SceneNodes[nodeID];
+            if (sceneNode.TransformParentNodeID == -1)
+            {
+                sceneNode.LocalTransform = translate(glm::vec3(copyIdx * 200.0f, 0.0f, 0.0f)) * sceneNode.LocalTransform;
+            }
+            else
+            {
+                sceneNode.TransformParentNodeID += copyIdx * numNodes;
+            }
+            scene->SceneNodes.push_back(sceneNode);
+        }
+    }
+    return numNodes;
+}
+
+// Arg: copies of the scene graph
+static void BM_UpdateWorldTransforms(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numNodes = AddSceneNodeCopies(scene, (int)state.Range(0));
+
+    while (state.KeepRunning())
+    {
+        UpdateWorldTransforms(scene);
+    }
+
+    state.SetItemsProcessed(state.Iterations() * scene->SceneNodes.size());
+    state.SetLabel(std::to_string(scene->SceneNodes.size()) + " nodes");
+
+    scene->SceneNodes.resize(numNodes);
+}
+BENCHMARK(BM_UpdateWorldTransforms)->Arg(1)->Arg(64)->Arg(1024)->Unit(BENCHMARK_MICROSECOND);
+
+// Builds and sorts the draw lists as PaintRenderer does, from the scene's camera and light.
+// Args: copies of the scene graph, hellknight crowd members (which add to the shadow caster bounds).
+static void BM_BuildDrawLists(BenchmarkState& state)
+{
+    Scene* scene = GetBenchScene();
+    int numNodes = AddSceneNodeCopies(scene, (int)state.Range(0));
+    UpdateWorldTransforms(scene);
+
+    int savedNumCrowdMembers = scene->Crowds[scene->HellknightCrowdID].NumMembers;
+    SetCrowdSize(scene, scene->HellknightCrowdID, (int)state.Range(1));
+
+    glm::mat4 worldView = glm::translate(glm::mat4(scene->CameraRotation), -scene->CameraPosition);
+    glm::mat4 worldLight = glm::lookAt(scene->LightPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    DrawLists drawLists;
+    while (state.KeepRunning())
+    {
+        BuildDrawLists(scene, worldView, worldLight, &drawLists);
+        DoNotOptimize(drawLists.Draws.data());
+    }
+
+    state.SetItemsProcessed(state.Iterations() * scene->SceneNodes.size());
+    state.SetLabel(std::to_string(drawLists.Draws.size()) + " draws");
+
+    SetCrowdSize(scene, scene->HellknightCrowdID, savedNumCrowdMembers);
+    scene->SceneNodes.resize(numNodes);
+    UpdateWorldTransforms(scene);
+}
+BENCHMARK(BM_BuildDrawLists)
+    ->Args({ 1, 0 })->Args({ 64, 0 })->Args({ 1024, 0 })->Args({ 1, 1000 })
+    ->Unit(BENCHMARK_MICROSECOND);
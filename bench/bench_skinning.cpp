@@ -0,0 +1,96 @@
+#include "microbench.h"
+#include "benchscene.h"
+
+#include "../cpuskinning.h"
+#include "../scene.h"
+
+#include <algorithm>
+
+// Hellknight's meshes and its current pose, in the form the CPU skinning kernels take
+struct SkinningInputs
+{
+    std::vector<const CPUSkinningMesh*> Meshes;
+    CPUSkinningPalette PaletteDLB;
+    CPUSkinningPalette PaletteLBS;
+    std::vector<PositionVertex> Positions;
+    std::vector<DifferentialVertex> Differentials;
+    int NumVertices;
+};
+
+static void InitSkinningInputs(SkinningInputs* inputs, Scene* scene)
+{
+    const AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[scene->Ragdolls[0].AnimatedSkeletonID];
+    BuildCPUSkinningPaletteDLB(&inputs->PaletteDLB, animSkeleton.BoneTransformDualQuats.data(), (int)animSkeleton.BoneTransformDualQuats.size());
+    BuildCPUSkinningPaletteLBS(&inputs->PaletteLBS, animSkeleton.BoneTransformMatrices.data(), (int)animSkeleton.BoneTransformMatrices.size());
+
+    inputs->Meshes.clear();
+    inputs->NumVertices = 0;
+    int maxNumVertices = 0;
+    for (const SkinnedMesh& skinnedMesh : scene->SkinnedMeshes)
+    {
+        const CPUSkinningMesh* mesh = &scene->BindPoseMeshes[skinnedMesh.BindPoseMeshID].CPUSkinning;
+        inputs->Meshes.push_back(mesh);
+        inputs->NumVertices += mesh->NumVertices;
+        maxNumVertices = std::max(maxNumVertices, mesh->NumVertices);
+    }
+
+    // Meshes are skinned one after the other into the same output, it's the throughput that's measured
+    inputs->Positions.resize(maxNumVertices);
+    inputs->Differentials.resize(maxNumVertices);
+}
+
+// Arg: 0 for DLB, 1 for LBS
+static void RunSkinningBenchmark(BenchmarkState& state, PFNSKINVERTICESPROC dlbKernel, PFNSKINVERTICESPROC lbsKernel)
+{
+    SkinningInputs inputs;
+    InitSkinningInputs(&inputs, GetBenchScene());
+
+    bool lbs = state.Range(0) != 0;
+    PFNSKINVERTICESPROC kernel = lbs ? lbsKernel : dlbKernel;
+    const CPUSkinningPalette* palette = lbs ? &inputs.PaletteLBS : &inputs.PaletteDLB;
+
+    while (state.KeepRunning())
+    {
+        for (const CPUSkinningMesh* mesh : inputs.Meshes)
+        {
+            kernel(mesh, palette, 0, mesh->NumVertices, inputs.Positions.data(), inputs.Differentials.data());
+        }
+        DoNotOptimize(inputs.Positions.data());
+    }
+
+    state.SetItemsProcessed(state.Iterations() * inputs.NumVertices);
+    state.SetLabel(lbs ? "LBS" : "DLB");
+}
+
+static void BM_SkinVerticesScalar(BenchmarkState& state)
+{
+    RunSkinningBenchmark(state, SkinVerticesDLBScalar, SkinVerticesLBSScalar);
+}
+BENCHMARK(BM_SkinVerticesScalar)->Arg(0)->Arg(1)->Unit(BENCHMARK_MICROSECOND);
+
+static void BM_SkinVerticesSIMD(BenchmarkState& state)
+{
+    RunSkinningBenchmark(state, SkinVerticesDLBSIMD, SkinVerticesLBSSIMD);
+}
+BENCHMARK(BM_SkinVerticesSIMD)->Arg(0)->Arg(1)->Unit(BENCHMARK_MICROSECOND);
+
+// DLB SIMD kernel split over threads, as the CPU skinning backend runs it. Arg: max threads, capped by the thread pool at one per core.
+static void BM_SkinVerticesParallel(BenchmarkState& state)
+{
+    SkinningInputs inputs;
+    InitSkinningInputs(&inputs, GetBenchScene());
+
+    int numThreads = (int)state.Range(0);
+
+    while (state.KeepRunning())
+    {
+        for (const CPUSkinningMesh* mesh : inputs.Meshes)
+        {
+            SkinVerticesParallel(SkinVerticesDLBSIMD, mesh, &inputs.PaletteDLB, inputs.Positions.data(), inputs.Differentials.data(), numThreads);
+        }
+        DoNotOptimize(inputs.Positions.data());
+    }
+
+    state.SetItemsProcessed(state.Iterations() * inputs.NumVertices);
+}
+BENCHMARK(BM_SkinVerticesParallel)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(BENCHMARK_MICROSECOND);
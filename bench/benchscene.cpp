@@ -0,0 +1,75 @@
+#include "benchscene.h"
+
+#include "../opengl.h"
+#include "../scene.h"
+
+#include <SDL.h>
+#include <qfpc.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+Scene* GetBenchScene()
+{
+    static Scene* scene = NULL;
+    if (scene)
+    {
+        return scene;
+    }
+
+#if defined(__linux__)
+    // Without a display server, SDL's offscreen driver renders to an EGL surfaceless context
+    if (!SDL_getenv("DISPLAY") && !SDL_getenv("WAYLAND_DISPLAY"))
+    {
+        SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+    }
+#endif
+
+    if (SDL_Init(SDL_INIT_VIDEO))
+    {
+        fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    // Same context as the program, so the same assets load
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    SDL_Window* window = SDL_CreateWindow(
+        "fictional-doodle-bench",
+        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+        64, 64,
+        SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if (!window)
+    {
+        fprintf(stderr, "SDL_CreateWindow: %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    SDL_GLContext glctx = SDL_GL_CreateContext(window);
+    if (!glctx)
+    {
+        fprintf(stderr, "SDL_GL_CreateContext: %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    InitGL();
+
+    // Assets are loaded from the working directory, like the program does
+    scene = new Scene();
+    InitScene(scene);
+
+    // Pose the skeletons, place the nodes and the camera, so benchmarks start from a frame's state
+    quatFirstPersonCamera(
+        glm::value_ptr(scene->CameraPosition),
+        glm::value_ptr(scene->CameraQuaternion),
+        glm::value_ptr(scene->CameraRotation),
+        0.0f, 0.0f, 0, 0, 0, 0, 0, 0, 0, 0);
+    UpdateAnimatedSkeletons(scene, 1000 / 60);
+    UpdateWorldTransforms(scene);
+
+    return scene;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+struct Scene;
+
+// The scene with its real assets (hellknight, floor), loaded the first time it's needed.
+// Loading creates GL objects, so a hidden window and GL context are created for it.
+// The benchmarks themselves don't make GL calls.
+Scene* GetBenchScene();
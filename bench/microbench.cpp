@@ -0,0 +1,586 @@
+#include "microbench.h"
+
+#include "../cpuskinning.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <regex>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static const int64_t kMaxIterations = 1000000000;
+
+static uint64_t GetRealTime_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Process CPU time, so kernels that run on several threads report the sum over their threads
+static uint64_t GetCPUTime_ns()
+{
+    return (uint64_t)((double)std::clock() * 1e9 / CLOCKS_PER_SEC);
+}
+
+BenchmarkState::BenchmarkState(const std::vector<int64_t>& ranges, int64_t maxIterations)
+    : MaxIterations(maxIterations)
+    , NumIterations(0)
+    , IsRunning(false)
+    , IsPaused(true)
+    , StartRealTime_ns(0)
+    , StartCPUTime_ns(0)
+    , RealTime_ns(0)
+    , CPUTime_ns(0)
+    , ItemsProcessed(0)
+    , Ranges(ranges)
+{ }
+
+bool BenchmarkState::KeepRunning()
+{
+    if (!IsRunning)
+    {
+        IsRunning = true;
+        ResumeTiming();
+    }
+    else
+    {
+        NumIterations++;
+    }
+
+    if (NumIterations < MaxIterations)
+    {
+        return true;
+    }
+
+    PauseTiming();
+    return false;
+}
+
+void BenchmarkState::PauseTiming()
+{
+    if (IsPaused)
+    {
+        return;
+    }
+
+    RealTime_ns += ::GetRealTime_ns() - StartRealTime_ns;
+    CPUTime_ns += ::GetCPUTime_ns() - StartCPUTime_ns;
+    IsPaused = true;
+}
+
+void BenchmarkState::ResumeTiming()
+{
+    if (!IsPaused)
+    {
+        return;
+    }
+
+    StartRealTime_ns = ::GetRealTime_ns();
+    StartCPUTime_ns = ::GetCPUTime_ns();
+    IsPaused = false;
+}
+
+BenchmarkFamily* BenchmarkFamily::Arg(int64_t arg)
+{
+    ArgsList.push_back({ arg });
+    return this;
+}
+
+BenchmarkFamily* BenchmarkFamily::Args(const std::vector<int64_t>& args)
+{
+    ArgsList.push_back(args);
+    return this;
+}
+
+BenchmarkFamily* BenchmarkFamily::Unit(BenchmarkTimeUnit timeUnit)
+{
+    TimeUnit = timeUnit;
+    return this;
+}
+
+// Registration happens during static initialization, so the list is created on first use
+static std::vector<std::unique_ptr<BenchmarkFamily>>& GetBenchmarkFamilies()
+{
+    static std::vector<std::unique_ptr<BenchmarkFamily>> families;
+    return families;
+}
+
+BenchmarkFamily* RegisterBenchmark(const char* name, PFNBENCHMARKPROC func)
+{
+    std::unique_ptr<BenchmarkFamily> family(new BenchmarkFamily());
+    family->Name = name;
+    family->Func = func;
+    family->TimeUnit = BENCHMARK_NANOSECOND;
+    GetBenchmarkFamilies().push_back(std::move(family));
+    return GetBenchmarkFamilies().back().get();
+}
+
+// One benchmark family with one of its argument lists
+struct BenchmarkInstance
+{
+    std::string Name;
+    const BenchmarkFamily* Family;
+    int FamilyIdx;
+    int InstanceIdx; // Index among the family's instances
+    std::vector<int64_t> Args;
+};
+
+struct BenchmarkResult
+{
+    std::string Name;
+    std::string RunName; // Name of the instance, without the aggregate's suffix
+    const char* AggregateName; // NULL for a single repetition
+    int FamilyIdx;
+    int InstanceIdx;
+    int RepetitionIdx;
+    int NumRepetitions;
+    int64_t Iterations;
+    double RealTime; // Per iteration, in the time unit
+    double CPUTime;
+    BenchmarkTimeUnit TimeUnit;
+    double ItemsPerSecond; // 0 when the benchmark doesn't count items
+    std::string Label;
+};
+
+static double GetTimeUnitMultiplier(BenchmarkTimeUnit timeUnit)
+{
+    switch (timeUnit)
+    {
+    case BENCHMARK_MICROSECOND: return 1e-3;
+    case BENCHMARK_MILLISECOND: return 1e-6;
+    default: return 1.0;
+    }
+}
+
+static const char* GetTimeUnitString(BenchmarkTimeUnit timeUnit)
+{
+    switch (timeUnit)
+    {
+    case BENCHMARK_MICROSECOND: return "us";
+    case BENCHMARK_MILLISECOND: return "ms";
+    default: return "ns";
+    }
+}
+
+static BenchmarkResult MakeResult(const BenchmarkInstance& instance, const BenchmarkState& state, int repetitionIdx, int numRepetitions)
+{
+    double multiplier = GetTimeUnitMultiplier(instance.Family->TimeUnit);
+
+    BenchmarkResult result;
+    result.Name = instance.Name;
+    result.RunName = instance.Name;
+    result.AggregateName = NULL;
+    result.FamilyIdx = instance.FamilyIdx;
+    result.InstanceIdx = instance.InstanceIdx;
+    result.RepetitionIdx = repetitionIdx;
+    result.NumRepetitions = numRepetitions;
+    result.Iterations = state.Iterations();
+    result.RealTime = state.GetRealTime_ns() * multiplier / std::max(state.Iterations(), (int64_t)1);
+    result.CPUTime = state.GetCPUTime_ns() * multiplier / std::max(state.Iterations(), (int64_t)1);
+    result.TimeUnit = instance.Family->TimeUnit;
+    result.ItemsPerSecond = state.GetRealTime_ns() > 0 ? state.GetItemsProcessed() * 1e9 / state.GetRealTime_ns() : 0.0;
+    result.Label = state.GetLabel();
+    return result;
+}
+
+// Mean, median and standard deviation of the repetitions, as Google Benchmark reports them
+static void AddAggregateResults(const std::vector<BenchmarkResult>& repetitions, std::vector<BenchmarkResult>& results)
+{
+    const char* aggregateNames[] = { "mean", "median", "stddev" };
+    for (const char* aggregateName : aggregateNames)
+    {
+        auto aggregate = [&](double BenchmarkResult::*field)
+        {
+            std::vector<double> values;
+            for (const BenchmarkResult& repetition : repetitions)
+            {
+                values.push_back(repetition.*field);
+            }
+
+            double mean = 0.0;
+            for (double value : values)
+            {
+                mean += value;
+            }
+            mean /= values.size();
+
+            if (strcmp(aggregateName, "mean") == 0)
+            {
+                return mean;
+            }
+            else if (strcmp(aggregateName, "median") == 0)
+            {
+                std::sort(begin(values), end(values));
+                size_t mid = values.size() / 2;
+                return values.size() % 2 ? values[mid] : 0.5 * (values[mid - 1] + values[mid]);
+            }
+            else
+            {
+                double sumSquares = 0.0;
+                for (double value : values)
+                {
+                    sumSquares += (value - mean) * (value - mean);
+                }
+                return values.size() > 1 ? std::sqrt(sumSquares / (values.size() - 1)) : 0.0;
+            }
+        };
+
+        BenchmarkResult result = repetitions[0];
+        result.Name = result.RunName + "_" + aggregateName;
+        result.AggregateName = aggregateName;
+        result.RepetitionIdx = -1;
+        result.RealTime = aggregate(&BenchmarkResult::RealTime);
+        result.CPUTime = aggregate(&BenchmarkResult::CPUTime);
+        result.ItemsPerSecond = aggregate(&BenchmarkResult::ItemsPerSecond);
+        results.push_back(result);
+    }
+}
+
+static void PrintConsoleHeader(int nameWidth)
+{
+    printf("%-*s %15s %15s %12s %s\n", nameWidth, "Benchmark", "Time", "CPU", "Iterations", "UserCounters...");
+    printf("%s\n", std::string(nameWidth + 60, '-').c_str());
+}
+
+// Three significant digits for small times, whole units otherwise
+static void PrintConsoleTime(double time, BenchmarkTimeUnit timeUnit)
+{
+    int precision = time < 10.0 ? 2 : time < 100.0 ? 1 : 0;
+    printf(" %12.*f %s", precision, time, GetTimeUnitString(timeUnit));
+}
+
+static void PrintConsoleResult(const BenchmarkResult& result, int nameWidth)
+{
+    printf("%-*s", nameWidth, result.Name.c_str());
+    PrintConsoleTime(result.RealTime, result.TimeUnit);
+    PrintConsoleTime(result.CPUTime, result.TimeUnit);
+    if (!result.AggregateName)
+    {
+        printf(" %12lld", (long long)result.Iterations);
+    }
+    else
+    {
+        printf(" %12s", "");
+    }
+    if (result.ItemsPerSecond > 0.0)
+    {
+        printf(" items_per_second=%.4g/s", result.ItemsPerSecond);
+    }
+    if (!result.Label.empty())
+    {
+        printf(" %s", result.Label.c_str());
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static std::string EscapeJSON(const std::string& s)
+{
+    std::string escaped;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            escaped += buf;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void WriteJSON(FILE* f, const std::vector<std::pair<std::string, std::string>>& context, const std::vector<BenchmarkResult>& results)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"context\": {\n");
+    for (size_t contextIdx = 0; contextIdx < context.size(); contextIdx++)
+    {
+        fprintf(f, "    \"%s\": \"%s\"%s\n",
+            EscapeJSON(context[contextIdx].first).c_str(), EscapeJSON(context[contextIdx].second).c_str(),
+            contextIdx + 1 < context.size() ? "," : "");
+    }
+    fprintf(f, "  },\n");
+
+    fprintf(f, "  \"benchmarks\": [\n");
+    for (size_t resultIdx = 0; resultIdx < results.size(); resultIdx++)
+    {
+        const BenchmarkResult& result = results[resultIdx];
+        fprintf(f, "    {\n");
+        fprintf(f, "      \"name\": \"%s\",\n", EscapeJSON(result.Name).c_str());
+        fprintf(f, "      \"family_index\": %d,\n", result.FamilyIdx);
+        fprintf(f, "      \"per_family_instance_index\": %d,\n", result.InstanceIdx);
+        fprintf(f, "      \"run_name\": \"%s\",\n", EscapeJSON(result.RunName).c_str());
+        if (result.AggregateName)
+        {
+            fprintf(f, "      \"run_type\": \"aggregate\",\n");
+            fprintf(f, "      \"repetitions\": %d,\n", result.NumRepetitions);
+            fprintf(f, "      \"threads\": 1,\n");
+            fprintf(f, "      \"aggregate_name\": \"%s\",\n", result.AggregateName);
+            fprintf(f, "      \"aggregate_unit\": \"time\",\n");
+        }
+        else
+        {
+            fprintf(f, "      \"run_type\": \"iteration\",\n");
+            fprintf(f, "      \"repetitions\": %d,\n", result.NumRepetitions);
+            fprintf(f, "      \"repetition_index\": %d,\n", result.RepetitionIdx);
+            fprintf(f, "      \"threads\": 1,\n");
+        }
+        fprintf(f, "      \"iterations\": %lld,\n", (long long)result.Iterations);
+        fprintf(f, "      \"real_time\": %.9g,\n", result.RealTime);
+        fprintf(f, "      \"cpu_time\": %.9g,\n", result.CPUTime);
+        fprintf(f, "      \"time_unit\": \"%s\"", GetTimeUnitString(result.TimeUnit));
+        if (result.ItemsPerSecond > 0.0)
+        {
+            fprintf(f, ",\n      \"items_per_second\": %.9g", result.ItemsPerSecond);
+        }
+        if (!result.Label.empty())
+        {
+            fprintf(f, ",\n      \"label\": \"%s\"", EscapeJSON(result.Label).c_str());
+        }
+        fprintf(f, "\n    }%s\n", resultIdx + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+}
+
+static bool ParseFlag(const char* arg, const char* flag, const char** value)
+{
+    size_t flagLength = strlen(flag);
+    if (strncmp(arg, flag, flagLength) != 0 || arg[flagLength] != '=')
+    {
+        return false;
+    }
+    *value = arg + flagLength + 1;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* filter = ".";
+    double minTime_s = 0.5;
+    int numRepetitions = 1;
+    bool jsonFormat = false;
+    const char* outFilename = NULL;
+    bool listTests = false;
+    std::vector<std::pair<std::string, std::string>> userContext;
+
+    for (int argIdx = 1; argIdx < argc; argIdx++)
+    {
+        const char* value;
+        if (ParseFlag(argv[argIdx], "--benchmark_filter", &value))
+        {
+            filter = value;
+        }
+        else if (ParseFlag(argv[argIdx], "--benchmark_min_time", &value))
+        {
+            // Also accepts the "0.5s" form of newer Google Benchmark versions
+            minTime_s = atof(value);
+        }
+        else if (ParseFlag(argv[argIdx], "--benchmark_repetitions", &value))
+        {
+            numRepetitions = std::max(atoi(value), 1);
+        }
+        else if (ParseFlag(argv[argIdx], "--benchmark_format", &value))
+        {
+            jsonFormat = strcmp(value, "json") == 0;
+        }
+        else if (ParseFlag(argv[argIdx], "--benchmark_out", &value))
+        {
+            outFilename = value;
+        }
+        else if (ParseFlag(argv[argIdx], "--benchmark_out_format", &value))
+        {
+            if (strcmp(value, "json") != 0)
+            {
+                fprintf(stderr, "Only JSON benchmark output files are supported\n");
+                exit(1);
+            }
+        }
+        else if (ParseFlag(argv[argIdx], "--benchmark_context", &value))
+        {
+            const char* separator = strchr(value, '=');
+            if (!separator)
+            {
+                fprintf(stderr, "Expected --benchmark_context=<key>=<value>, got %s\n", argv[argIdx]);
+                exit(1);
+            }
+            userContext.emplace_back(std::string(value, separator), std::string(separator + 1));
+        }
+        else if (strcmp(argv[argIdx], "--benchmark_list_tests") == 0 || strcmp(argv[argIdx], "--benchmark_list_tests=true") == 0)
+        {
+            listTests = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument %s\n", argv[argIdx]);
+            exit(1);
+        }
+    }
+
+    // Expand families into their instances and keep those matching the filter
+    std::regex filterRegex(filter);
+    std::vector<BenchmarkInstance> instances;
+    for (int familyIdx = 0; familyIdx < (int)GetBenchmarkFamilies().size(); familyIdx++)
+    {
+        const BenchmarkFamily* family = GetBenchmarkFamilies()[familyIdx].get();
+
+        std::vector<std::vector<int64_t>> argsList = family->ArgsList;
+        if (argsList.empty())
+        {
+            argsList.push_back({});
+        }
+
+        for (int instanceIdx = 0; instanceIdx < (int)argsList.size(); instanceIdx++)
+        {
+            BenchmarkInstance instance;
+            instance.Name = family->Name;
+            for (int64_t arg : argsList[instanceIdx])
+            {
+                instance.Name += "/" + std::to_string(arg);
+            }
+            instance.Family = family;
+            instance.FamilyIdx = familyIdx;
+            instance.InstanceIdx = instanceIdx;
+            instance.Args = argsList[instanceIdx];
+
+            if (std::regex_search(instance.Name, filterRegex))
+            {
+                instances.push_back(instance);
+            }
+        }
+    }
+
+    if (listTests)
+    {
+        for (const BenchmarkInstance& instance : instances)
+        {
+            printf("%s\n", instance.Name.c_str());
+        }
+        return 0;
+    }
+
+    // Context is written first in the report, but it's built before running so the date is the start of the run
+    std::vector<std::pair<std::string, std::string>> context;
+    {
+        char date[64];
+        time_t now = time(NULL);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+        context.emplace_back("date", date);
+
+        char hostName[256] = "";
+#ifdef _WIN32
+        if (const char* computerName = getenv("COMPUTERNAME"))
+        {
+            snprintf(hostName, sizeof(hostName), "%s", computerName);
+        }
+#else
+        gethostname(hostName, sizeof(hostName) - 1);
+#endif
+        context.emplace_back("host_name", hostName);
+        context.emplace_back("executable", argv[0]);
+        context.emplace_back("num_cpus", std::to_string(std::thread::hardware_concurrency()));
+#ifdef NDEBUG
+        context.emplace_back("library_build_type", "release");
+#else
+        context.emplace_back("library_build_type", "debug");
+#endif
+        context.emplace_back("cpu_skinning_isa", GetCPUSkinningISA());
+        context.insert(end(context), begin(userContext), end(userContext));
+    }
+
+    int nameWidth = 10;
+    for (const BenchmarkInstance& instance : instances)
+    {
+        nameWidth = std::max(nameWidth, (int)instance.Name.size() + (numRepetitions > 1 ? 7 : 0));
+    }
+
+    if (!jsonFormat)
+    {
+        PrintConsoleHeader(nameWidth);
+    }
+
+    std::vector<BenchmarkResult> results;
+    for (const BenchmarkInstance& instance : instances)
+    {
+        // Grow the iteration count until a run lasts the minimum time, as Google Benchmark does.
+        // The run that does is the first repetition, the others reuse its iteration count.
+        int64_t numIterations = 1;
+        std::vector<BenchmarkResult> repetitions;
+        for (;;)
+        {
+            BenchmarkState state(instance.Args, numIterations);
+            instance.Family->Func(state);
+
+            double seconds = state.GetRealTime_ns() * 1e-9;
+            if (seconds >= minTime_s || numIterations >= kMaxIterations)
+            {
+                repetitions.push_back(MakeResult(instance, state, 0, numRepetitions));
+                break;
+            }
+
+            double multiplier = minTime_s * 1.4 / std::max(seconds, 1e-9);
+            if (seconds / minTime_s <= 0.1)
+            {
+                multiplier = std::min(multiplier, 10.0);
+            }
+            numIterations = std::min(std::max((int64_t)(numIterations * multiplier), numIterations + 1), kMaxIterations);
+        }
+
+        for (int repetitionIdx = 1; repetitionIdx < numRepetitions; repetitionIdx++)
+        {
+            BenchmarkState state(instance.Args, numIterations);
+            instance.Family->Func(state);
+            repetitions.push_back(MakeResult(instance, state, repetitionIdx, numRepetitions));
+        }
+
+        results.insert(end(results), begin(repetitions), end(repetitions));
+        if (numRepetitions > 1)
+        {
+            AddAggregateResults(repetitions, results);
+        }
+
+        if (!jsonFormat)
+        {
+            for (size_t resultIdx = results.size() - repetitions.size() - (numRepetitions > 1 ? 3 : 0); resultIdx < results.size(); resultIdx++)
+            {
+                PrintConsoleResult(results[resultIdx], nameWidth);
+            }
+        }
+    }
+
+    if (jsonFormat)
+    {
+        WriteJSON(stdout, context, results);
+    }
+
+    if (outFilename)
+    {
+        FILE* f = fopen(outFilename, "w");
+        if (!f)
+        {
+            fprintf(stderr, "Couldn't open %s for writing\n", outFilename);
+            exit(1);
+        }
+        WriteJSON(f, context, results);
+        fclose(f);
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the engine's kernels, following Google Benchmark's interface and JSON output
+// so its results can be compared with the tools written for it.
+//
+//     static void BM_Kernel(BenchmarkState& state)
+//     {
+//         // Setup, not timed
+//         while (state.KeepRunning())
+//         {
+//             // Timed
+//         }
+//         state.SetItemsProcessed(state.Iterations() * numItems);
+//     }
+//     BENCHMARK(BM_Kernel)->Arg(8)->Arg(64);
+//
+// The program's main runs every registered benchmark. It takes Google Benchmark's flags:
+// --benchmark_filter=<regex> --benchmark_min_time=<seconds> --benchmark_repetitions=<n>
+// --benchmark_format=<console|json> --benchmark_out=<file> --benchmark_context=<key>=<value> --benchmark_list_tests
+
+enum BenchmarkTimeUnit
+{
+    BENCHMARK_NANOSECOND,
+    BENCHMARK_MICROSECOND,
+    BENCHMARK_MILLISECOND
+};
+
+class BenchmarkState
+{
+    int64_t MaxIterations;
+    int64_t NumIterations;
+    bool IsRunning;
+    bool IsPaused;
+    uint64_t StartRealTime_ns;
+    uint64_t StartCPUTime_ns;
+    uint64_t RealTime_ns; // Accumulated while running and not paused
+    uint64_t CPUTime_ns;
+    int64_t ItemsProcessed;
+    std::string Label;
+    std::vector<int64_t> Ranges;
+
+public:
+    BenchmarkState(const std::vector<int64_t>& ranges, int64_t maxIterations);
+
+    // Starts timing on the first call, returns false once all iterations ran
+    bool KeepRunning();
+
+    // Excludes per-iteration setup from the timings
+    void PauseTiming();
+    void ResumeTiming();
+
+    int64_t Range(int rangeIdx) const { return Ranges[rangeIdx]; }
+    int64_t Iterations() const { return NumIterations; }
+
+    // Reported as items_per_second, over the wall clock time
+    void SetItemsProcessed(int64_t itemsProcessed) { ItemsProcessed = itemsProcessed; }
+    void SetLabel(const std::string& label) { Label = label; }
+
+    // Results, read by the runner
+    uint64_t GetRealTime_ns() const { return RealTime_ns; }
+    uint64_t GetCPUTime_ns() const { return CPUTime_ns; }
+    int64_t GetItemsProcessed() const { return ItemsProcessed; }
+    const std::string& GetLabel() const { return Label; }
+};
+
+typedef void(*PFNBENCHMARKPROC)(BenchmarkState& state);
+
+// A benchmark function and the arguments it's run with, one instance per argument list
+class BenchmarkFamily
+{
+public:
+    std::string Name;
+    PFNBENCHMARKPROC Func;
+    std::vector<std::vector<int64_t>> ArgsList; // Empty to run once without arguments
+    BenchmarkTimeUnit TimeUnit;
+
+    BenchmarkFamily* Arg(int64_t arg);
+    BenchmarkFamily* Args(const std::vector<int64_t>& args);
+    BenchmarkFamily* Unit(BenchmarkTimeUnit timeUnit);
+};
+
+BenchmarkFamily* RegisterBenchmark(const char* name, PFNBENCHMARKPROC func);
+
+#define BENCHMARK_CONCAT2(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT2(a, b)
+#define BENCHMARK(func) static BenchmarkFamily* BENCHMARK_CONCAT(g_Benchmark, __LINE__) = RegisterBenchmark(#func, func)
+
+// Keeps the compiler from optimizing away a result that's otherwise unused
+template<class T>
+inline void DoNotOptimize(const T& value)
+{
+#ifdef _MSC_VER
+    const volatile char* bytes = (const volatile char*)&value;
+    (void)bytes[0];
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
@@ -0,0 +1,228 @@
+#include "benchmark.h"
+
+#include "scene.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef COUNT_ALLOCATIONS
+static std::atomic<uint64_t> gNumAllocations;
+static std::atomic<uint64_t> gNumAllocatedBytes;
+
+// Counting replacements of the global allocation functions, for the benchmark's allocation numbers.
+// Opt-in since every allocation of the program pays for the counters.
+static void* CountedAlloc(size_t size, size_t alignment)
+{
+    gNumAllocations.fetch_add(1, std::memory_order_relaxed);
+    gNumAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    size = size ? size : 1;
+
+    for (;;)
+    {
+#ifdef _MSC_VER
+        void* p = _aligned_malloc(size, alignment);
+#else
+        // aligned_alloc wants a multiple of the alignment
+        void* p = alignment <= alignof(std::max_align_t) ? malloc(size) : aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+        if (p)
+        {
+            return p;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void* CountedAllocNoThrow(size_t size, size_t alignment) noexcept
+{
+    try
+    {
+        return CountedAlloc(size, alignment);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+static void CountedFree(void* p) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static const size_t kDefaultAlignment = alignof(std::max_align_t);
+
+void* operator new(size_t size) { return CountedAlloc(size, kDefaultAlignment); }
+void* operator new[](size_t size) { return CountedAlloc(size, kDefaultAlignment); }
+void* operator new(size_t size, std::align_val_t al) { return CountedAlloc(size, (size_t)al); }
+void* operator new[](size_t size, std::align_val_t al) { return CountedAlloc(size, (size_t)al); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, kDefaultAlignment); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, kDefaultAlignment); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, (size_t)al); }
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, (size_t)al); }
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+
+uint64_t GetNumAllocations()
+{
+    return gNumAllocations.load(std::memory_order_relaxed);
+}
+
+uint64_t GetNumAllocatedBytes()
+{
+    return gNumAllocatedBytes.load(std::memory_order_relaxed);
+}
+#else
+uint64_t GetNumAllocations()
+{
+    return 0;
+}
+
+uint64_t GetNumAllocatedBytes()
+{
+    return 0;
+}
+#endif
+
+static uint64_t GetBenchmarkTimeNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ApplyBenchmarkCamera(Scene* scene, int frameIdx, int numFrames)
+{
+    const float kOrbitRadius = 170.0f;
+    const float kOrbitHeight = 200.0f;
+    const glm::vec3 kOrbitTarget = glm::vec3(0.0f, 50.0f, 0.0f);
+
+    float angle = 2.0f * glm::pi<float>() * frameIdx / std::max(numFrames, 1);
+    scene->CameraPosition = glm::vec3(kOrbitRadius * sin(angle), kOrbitHeight, kOrbitRadius * cos(angle));
+
+    // The camera quaternion rotates from camera to world space, the inverse of the view's rotation
+    glm::mat3 viewRotation = glm::mat3(glm::lookAt(scene->CameraPosition, kOrbitTarget, glm::vec3(0.0f, 1.0f, 0.0f)));
+    glm::quat cameraToWorld = glm::quat_cast(transpose(viewRotation));
+    scene->CameraQuaternion = glm::vec4(cameraToWorld.x, cameraToWorld.y, cameraToWorld.z, cameraToWorld.w);
+}
+
+void StartBenchmarkMeasurement(Scene* scene, BenchmarkRun* run)
+{
+    InitFrameStats(&scene->FrameStatistics, scene->FrameStatistics.Budget_ms);
+    run->StartTime_ns = GetBenchmarkTimeNanoseconds();
+    run->StartNumAllocations = GetNumAllocations();
+    run->StartNumAllocatedBytes = GetNumAllocatedBytes();
+}
+
+static void WriteJSONString(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            fputc('\\', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void WritePercentiles(FILE* f, const FrameStats* stats, const std::vector<float>& times_ms)
+{
+    FrameStatsPercentiles percentiles = ComputeFrameStatsPercentiles(stats, times_ms);
+    fprintf(f, "{ \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+        percentiles.Min_ms, percentiles.P50_ms, percentiles.P95_ms, percentiles.P99_ms, percentiles.Max_ms);
+}
+
+void WriteBenchmarkReport(Scene* scene, const BenchmarkSettings& settings, const BenchmarkRun& run)
+{
+    double wallTime_s = (GetBenchmarkTimeNanoseconds() - run.StartTime_ns) / 1e9;
+
+    FILE* f = fopen(settings.ReportFilename.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "Couldn't open %s for writing\n", settings.ReportFilename.c_str());
+        exit(1);
+    }
+
+    const FrameStats* stats = &scene->FrameStatistics;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"renderer\": ");
+    WriteJSONString(f, (const char*)glGetString(GL_RENDERER));
+    fprintf(f, ",\n");
+    fprintf(f, "  \"frames\": %d,\n", settings.NumFrames);
+    fprintf(f, "  \"warmupFrames\": %d,\n", settings.NumWarmupFrames);
+    fprintf(f, "  \"frameTimeStepMs\": %u,\n", settings.FrameTime_ms);
+    fprintf(f, "  \"profiledFrames\": %d,\n", stats->NumFrames);
+    fprintf(f, "  \"wallSeconds\": %.4f,\n", wallTime_s);
+    fprintf(f, "  \"framesPerSecond\": %.2f,\n", settings.NumFrames / wallTime_s);
+    fprintf(f, "  \"gpuTimestamps\": %s,\n", scene->Profiling.HasGPUTimestamps() ? "true" : "false");
+    const ProgramBinaryCacheStats& cacheStats = GetProgramBinaryCacheStats();
+    fprintf(f, "  \"shaderStartupMs\": %.3f,\n", scene->ShaderStartup_ms);
+    fprintf(f, "  \"programBinaryCache\": { \"loaded\": %d, \"compiled\": %d, \"rejected\": %d },\n",
+        cacheStats.NumLoaded, cacheStats.NumCompiled, cacheStats.NumRejected);
+#ifdef COUNT_ALLOCATIONS
+    uint64_t numAllocations = GetNumAllocations() - run.StartNumAllocations;
+    uint64_t numAllocatedBytes = GetNumAllocatedBytes() - run.StartNumAllocatedBytes;
+    fprintf(f, "  \"allocations\": { \"count\": %llu, \"bytes\": %llu, \"countPerFrame\": %.2f, \"bytesPerFrame\": %.2f },\n",
+        (unsigned long long)numAllocations, (unsigned long long)numAllocatedBytes,
+        (double)numAllocations / settings.NumFrames, (double)numAllocatedBytes / settings.NumFrames);
+#endif
+
+    fprintf(f, "  \"cpuFrameMs\": ");
+    WritePercentiles(f, stats, stats->CPUFrameTimes_ms);
+    fprintf(f, ",\n  \"gpuFrameMs\": ");
+    WritePercentiles(f, stats, stats->GPUFrameTimes_ms);
+
+    for (bool gpu : { false, true })
+    {
+        fprintf(f, ",\n  \"%s\": {", gpu ? "gpuScopesMs" : "cpuScopesMs");
+        bool first = true;
+        for (const FrameStatsScope& scope : stats->Scopes)
+        {
+            if (scope.IsGPU == gpu)
+            {
+                fprintf(f, "%s\n    ", first ? "" : ",");
+                WriteJSONString(f, scope.Name);
+                fprintf(f, ": ");
+                WritePercentiles(f, stats, scope.Times_ms);
+                first = false;
+            }
+        }
+        fprintf(f, "\n  }");
+    }
+
+    fprintf(f, "\n}\n");
+    fclose(f);
+
+    printf("Wrote benchmark report to %s\n", settings.ReportFilename.c_str());
+}
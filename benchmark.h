@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct Scene;
+
+// Runs the frame loop for a fixed number of frames with a fixed time step and a scripted camera,
+// so runs on different machines and builds can be compared.
+struct BenchmarkSettings
+{
+    int NumFrames; // Measured frames
+    int NumWarmupFrames; // Frames run before measuring, so loading and first use costs don't count
+    uint32_t FrameTime_ms; // Fixed time step instead of the wall clock
+    std::string ReportFilename;
+};
+
+// State captured when measurement starts
+struct BenchmarkRun
+{
+    uint64_t StartTime_ns;
+    uint64_t StartNumAllocations;
+    uint64_t StartNumAllocatedBytes;
+};
+
+// Allocations through operator new since the program started, only counted when built with COUNT_ALLOCATIONS (0 otherwise)
+uint64_t GetNumAllocations();
+uint64_t GetNumAllocatedBytes();
+
+// Moves the camera along its scripted path, an orbit around the scene over the measured frames
+void ApplyBenchmarkCamera(Scene* scene, int frameIdx, int numFrames);
+
+// Resets the frame statistics and starts counting time and allocations
+void StartBenchmarkMeasurement(Scene* scene, BenchmarkRun* run);
+
+// Writes a JSON report of the frame statistics, time and allocations since StartBenchmarkMeasurement
+void WriteBenchmarkReport(Scene* scene, const BenchmarkSettings& settings, const BenchmarkRun& run);
@@ -0,0 +1,490 @@
+#include "cpuskinning.h"
+
+#include "scene.h"
+#include "simd.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Don't bother waking up threads for less work than this
+static const int kMinVerticesPerThread = 1024;
+
+void InitCPUSkinningMesh(
+    CPUSkinningMesh* mesh,
+    const PositionVertex* positions,
+    const DifferentialVertex* differentials,
+    const BoneWeightVertex* boneWeights,
+    int numVertices)
+{
+    int numPaddedVertices = (numVertices + CPUSKINNING_VERTEX_PADDING - 1) / CPUSKINNING_VERTEX_PADDING * CPUSKINNING_VERTEX_PADDING;
+
+    mesh->NumVertices = numVertices;
+
+    // Padding vertices have zero weights and bone 0, so they're harmless to skin
+    for (int c = 0; c < CPUSKINNING_NUM_COMPONENTS; c++)
+    {
+        mesh->Components[c].assign(numPaddedVertices, 0.0f);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        mesh->BoneIDs[i].assign(numPaddedVertices, 0);
+        mesh->Weights[i].assign(numPaddedVertices, 0.0f);
+    }
+
+    for (int v = 0; v < numVertices; v++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            mesh->Components[CPUSKINNING_POSITION_X + i][v] = positions[v].Position[i];
+            mesh->Components[CPUSKINNING_NORMAL_X + i][v] = differentials[v].Normal[i];
+            mesh->Components[CPUSKINNING_TANGENT_X + i][v] = differentials[v].Tangent[i];
+            mesh->Components[CPUSKINNING_BITANGENT_X + i][v] = differentials[v].Bitangent[i];
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            mesh->BoneIDs[i][v] = boneWeights[v].BoneIDs[i];
+            mesh->Weights[i][v] = boneWeights[v].Weights[i];
+        }
+    }
+}
+
+void BuildCPUSkinningPaletteDLB(CPUSkinningPalette* palette, const glm::dualquat* boneTransforms, int numBones)
+{
+    palette->NumBones = numBones;
+    palette->Data.resize(8 * numBones);
+
+    for (int b = 0; b < numBones; b++)
+    {
+        const glm::dualquat& dq = boneTransforms[b];
+        float components[8] = {
+            dq.real.x, dq.real.y, dq.real.z, dq.real.w,
+            dq.dual.x, dq.dual.y, dq.dual.z, dq.dual.w
+        };
+
+        for (int c = 0; c < 8; c++)
+        {
+            palette->Data[c * numBones + b] = components[c];
+        }
+    }
+}
+
+void BuildCPUSkinningPaletteLBS(CPUSkinningPalette* palette, const glm::mat3x4* boneTransforms, int numBones)
+{
+    palette->NumBones = numBones;
+    palette->Data.resize(12 * numBones);
+
+    for (int b = 0; b < numBones; b++)
+    {
+        for (int c = 0; c < 12; c++)
+        {
+            palette->Data[c * numBones + b] = boneTransforms[b][c / 4][c % 4];
+        }
+    }
+}
+
+static glm::vec3 LoadVec3(const CPUSkinningMesh* mesh, int firstComponent, int v)
+{
+    return glm::vec3(
+        mesh->Components[firstComponent + 0][v],
+        mesh->Components[firstComponent + 1][v],
+        mesh->Components[firstComponent + 2][v]);
+}
+
+static glm::vec4 LoadPaletteVec4(const CPUSkinningPalette* palette, int firstComponent, int bone)
+{
+    return glm::vec4(
+        palette->Data[(firstComponent + 0) * palette->NumBones + bone],
+        palette->Data[(firstComponent + 1) * palette->NumBones + bone],
+        palette->Data[(firstComponent + 2) * palette->NumBones + bone],
+        palette->Data[(firstComponent + 3) * palette->NumBones + bone]);
+}
+
+static glm::vec3 QuatRotate(const glm::vec4& q, const glm::vec3& v)
+{
+    glm::vec3 qv = glm::vec3(q);
+    return v + 2.0f * glm::cross(qv, glm::cross(qv, v) + q.w * v);
+}
+
+void SkinVerticesDLBScalar(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials)
+{
+    for (int v = firstVertex; v < lastVertex; v++)
+    {
+        glm::vec4 reals[4];
+        glm::vec4 duals[4];
+
+        for (int i = 0; i < 4; i++)
+        {
+            reals[i] = LoadPaletteVec4(palette, 0, mesh->BoneIDs[i][v]);
+            duals[i] = LoadPaletteVec4(palette, 4, mesh->BoneIDs[i][v]);
+        }
+
+        // Reflect dual quaternions so that the dot products of the real components
+        // are positive to ensure consistent interpolation
+        for (int i = 1; i < 4; i++)
+        {
+            // Extract sign bit and map to -1 or 1 for reflection
+            float d = glm::dot(reals[0], reals[i]);
+            uint32_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            float s = float(1 - int((bits & 0x80000000u) >> 30));
+            reals[i] *= s;
+            duals[i] *= s;
+        }
+
+        glm::vec4 real(0.0f);
+        glm::vec4 dual(0.0f);
+
+        // Blend dual quaternions
+        for (int i = 0; i < 4; i++)
+        {
+            real += mesh->Weights[i][v] * reals[i];
+            dual += mesh->Weights[i][v] * duals[i];
+        }
+
+        // Normalize
+        float len = glm::length(real);
+        real /= len;
+        dual /= len;
+
+        glm::vec3 realXYZ = glm::vec3(real);
+        glm::vec3 dualXYZ = glm::vec3(dual);
+
+        // Rotate and translate
+        positions[v].Position = QuatRotate(real, LoadVec3(mesh, CPUSKINNING_POSITION_X, v));
+        positions[v].Position += 2.0f * (real.w * dualXYZ - dual.w * realXYZ + glm::cross(realXYZ, dualXYZ));
+        differentials[v].Normal = QuatRotate(real, LoadVec3(mesh, CPUSKINNING_NORMAL_X, v));
+        differentials[v].Tangent = QuatRotate(real, LoadVec3(mesh, CPUSKINNING_TANGENT_X, v));
+        differentials[v].Bitangent = QuatRotate(real, LoadVec3(mesh, CPUSKINNING_BITANGENT_X, v));
+    }
+}
+
+void SkinVerticesLBSScalar(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials)
+{
+    for (int v = firstVertex; v < lastVertex; v++)
+    {
+        // Transposed skinning matrix
+        glm::vec4 rows[3] = { glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f) };
+
+        // Blend matrices
+        for (int i = 0; i < 4; i++)
+        {
+            for (int r = 0; r < 3; r++)
+            {
+                rows[r] += mesh->Weights[i][v] * LoadPaletteVec4(palette, r * 4, mesh->BoneIDs[i][v]);
+            }
+        }
+
+        glm::vec4 position = glm::vec4(LoadVec3(mesh, CPUSKINNING_POSITION_X, v), 1.0f);
+        glm::vec3 normal = LoadVec3(mesh, CPUSKINNING_NORMAL_X, v);
+        glm::vec3 tangent = LoadVec3(mesh, CPUSKINNING_TANGENT_X, v);
+        glm::vec3 bitangent = LoadVec3(mesh, CPUSKINNING_BITANGENT_X, v);
+
+        for (int r = 0; r < 3; r++)
+        {
+            positions[v].Position[r] = glm::dot(position, rows[r]);
+            differentials[v].Normal[r] = glm::dot(normal, glm::vec3(rows[r]));
+            differentials[v].Tangent[r] = glm::dot(tangent, glm::vec3(rows[r]));
+            differentials[v].Bitangent[r] = glm::dot(bitangent, glm::vec3(rows[r]));
+        }
+    }
+}
+
+#ifdef SIMD_WIDTH
+
+static inline vvec3 VLoadVec3(const CPUSkinningMesh* mesh, int firstComponent, int v)
+{
+    return vvec3{
+        VLoad(&mesh->Components[firstComponent + 0][v]),
+        VLoad(&mesh->Components[firstComponent + 1][v]),
+        VLoad(&mesh->Components[firstComponent + 2][v]) };
+}
+
+static inline vvec3 VQuatRotate(const vvec3& qxyz, vfloat qw, const vvec3& v)
+{
+    vvec3 c = VCross(qxyz, v);
+    c = vvec3{ VMulAdd(qw, v.x, c.x), VMulAdd(qw, v.y, c.y), VMulAdd(qw, v.z, c.z) };
+    c = VCross(qxyz, c);
+    vfloat two = VSet1(2.0f);
+    return vvec3{ VMulAdd(two, c.x, v.x), VMulAdd(two, c.y, v.y), VMulAdd(two, c.z, v.z) };
+}
+
+// Transposes SoA registers back to the interleaved vertex layout, only writing vertices that exist
+static inline void VStoreVertices(
+    const vvec3& position, const vvec3& normal, const vvec3& tangent, const vvec3& bitangent,
+    int v, int numLanes,
+    PositionVertex* positions, DifferentialVertex* differentials)
+{
+    alignas(32) float lanes[12][SIMD_WIDTH];
+    const vvec3* vecs[4] = { &position, &normal, &tangent, &bitangent };
+    for (int i = 0; i < 4; i++)
+    {
+        VStore(lanes[i * 3 + 0], vecs[i]->x);
+        VStore(lanes[i * 3 + 1], vecs[i]->y);
+        VStore(lanes[i * 3 + 2], vecs[i]->z);
+    }
+
+    for (int lane = 0; lane < numLanes; lane++)
+    {
+        positions[v + lane].Position = glm::vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]);
+        differentials[v + lane].Normal = glm::vec3(lanes[3][lane], lanes[4][lane], lanes[5][lane]);
+        differentials[v + lane].Tangent = glm::vec3(lanes[6][lane], lanes[7][lane], lanes[8][lane]);
+        differentials[v + lane].Bitangent = glm::vec3(lanes[9][lane], lanes[10][lane], lanes[11][lane]);
+    }
+}
+
+void SkinVerticesDLBSIMD(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials)
+{
+    const vfloat signMask = VSet1(-0.0f);
+
+    for (int v = firstVertex; v < lastVertex; v += SIMD_WIDTH)
+    {
+        vint boneIDs[4];
+        vfloat weights[4];
+        for (int i = 0; i < 4; i++)
+        {
+            boneIDs[i] = VLoadInt(&mesh->BoneIDs[i][v]);
+            weights[i] = VLoad(&mesh->Weights[i][v]);
+        }
+
+        // Gather real and dual components of each influence
+        vfloat dqs[4][8];
+        for (int i = 0; i < 4; i++)
+        {
+            for (int c = 0; c < 8; c++)
+            {
+                dqs[i][c] = VGather(&palette->Data[c * palette->NumBones], boneIDs[i]);
+            }
+        }
+
+        // Reflect dual quaternions so that the dot products of the real components
+        // are positive, by flipping signs with the sign bit of the dot product
+        for (int i = 1; i < 4; i++)
+        {
+            vfloat d = VMul(dqs[0][0], dqs[i][0]);
+            d = VMulAdd(dqs[0][1], dqs[i][1], d);
+            d = VMulAdd(dqs[0][2], dqs[i][2], d);
+            d = VMulAdd(dqs[0][3], dqs[i][3], d);
+
+            vfloat sign = VAnd(d, signMask);
+            for (int c = 0; c < 8; c++)
+            {
+                dqs[i][c] = VXor(dqs[i][c], sign);
+            }
+        }
+
+        // Blend dual quaternions
+        vfloat dq[8];
+        for (int c = 0; c < 8; c++)
+        {
+            dq[c] = VMul(weights[0], dqs[0][c]);
+            for (int i = 1; i < 4; i++)
+            {
+                dq[c] = VMulAdd(weights[i], dqs[i][c], dq[c]);
+            }
+        }
+
+        // Normalize
+        vfloat lenSq = VMul(dq[0], dq[0]);
+        lenSq = VMulAdd(dq[1], dq[1], lenSq);
+        lenSq = VMulAdd(dq[2], dq[2], lenSq);
+        lenSq = VMulAdd(dq[3], dq[3], lenSq);
+        vfloat len = VSqrt(lenSq);
+        for (int c = 0; c < 8; c++)
+        {
+            dq[c] = VDiv(dq[c], len);
+        }
+
+        vvec3 realXYZ = { dq[0], dq[1], dq[2] };
+        vfloat realW = dq[3];
+        vvec3 dualXYZ = { dq[4], dq[5], dq[6] };
+        vfloat dualW = dq[7];
+
+        // Rotate
+        vvec3 position = VQuatRotate(realXYZ, realW, VLoadVec3(mesh, CPUSKINNING_POSITION_X, v));
+        vvec3 normal = VQuatRotate(realXYZ, realW, VLoadVec3(mesh, CPUSKINNING_NORMAL_X, v));
+        vvec3 tangent = VQuatRotate(realXYZ, realW, VLoadVec3(mesh, CPUSKINNING_TANGENT_X, v));
+        vvec3 bitangent = VQuatRotate(realXYZ, realW, VLoadVec3(mesh, CPUSKINNING_BITANGENT_X, v));
+
+        // Translate
+        vvec3 rd = VCross(realXYZ, dualXYZ);
+        vfloat two = VSet1(2.0f);
+        position.x = VMulAdd(two, VAdd(VSub(VMul(realW, dualXYZ.x), VMul(dualW, realXYZ.x)), rd.x), position.x);
+        position.y = VMulAdd(two, VAdd(VSub(VMul(realW, dualXYZ.y), VMul(dualW, realXYZ.y)), rd.y), position.y);
+        position.z = VMulAdd(two, VAdd(VSub(VMul(realW, dualXYZ.z), VMul(dualW, realXYZ.z)), rd.z), position.z);
+
+        int numLanes = std::min(SIMD_WIDTH, lastVertex - v);
+        VStoreVertices(position, normal, tangent, bitangent, v, numLanes, positions, differentials);
+    }
+}
+
+void SkinVerticesLBSSIMD(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials)
+{
+    for (int v = firstVertex; v < lastVertex; v += SIMD_WIDTH)
+    {
+        vint boneIDs[4];
+        vfloat weights[4];
+        for (int i = 0; i < 4; i++)
+        {
+            boneIDs[i] = VLoadInt(&mesh->BoneIDs[i][v]);
+            weights[i] = VLoad(&mesh->Weights[i][v]);
+        }
+
+        // Blend the 3 rows of the transposed skinning matrices
+        vfloat m[12];
+        for (int c = 0; c < 12; c++)
+        {
+            const float* paletteComponent = &palette->Data[c * palette->NumBones];
+            m[c] = VMul(weights[0], VGather(paletteComponent, boneIDs[0]));
+            for (int i = 1; i < 4; i++)
+            {
+                m[c] = VMulAdd(weights[i], VGather(paletteComponent, boneIDs[i]), m[c]);
+            }
+        }
+
+        vvec3 inputs[4] = {
+            VLoadVec3(mesh, CPUSKINNING_POSITION_X, v),
+            VLoadVec3(mesh, CPUSKINNING_NORMAL_X, v),
+            VLoadVec3(mesh, CPUSKINNING_TANGENT_X, v),
+            VLoadVec3(mesh, CPUSKINNING_BITANGENT_X, v)
+        };
+
+        vvec3 outputs[4];
+        for (int i = 0; i < 4; i++)
+        {
+            vfloat* out[3] = { &outputs[i].x, &outputs[i].y, &outputs[i].z };
+            for (int r = 0; r < 3; r++)
+            {
+                vfloat d = VMul(inputs[i].x, m[r * 4 + 0]);
+                d = VMulAdd(inputs[i].y, m[r * 4 + 1], d);
+                d = VMulAdd(inputs[i].z, m[r * 4 + 2], d);
+                *out[r] = d;
+            }
+        }
+
+        // Positions have an implicit w = 1
+        outputs[0].x = VAdd(outputs[0].x, m[3]);
+        outputs[0].y = VAdd(outputs[0].y, m[7]);
+        outputs[0].z = VAdd(outputs[0].z, m[11]);
+
+        int numLanes = std::min(SIMD_WIDTH, lastVertex - v);
+        VStoreVertices(outputs[0], outputs[1], outputs[2], outputs[3], v, numLanes, positions, differentials);
+    }
+}
+
+const char* GetCPUSkinningISA()
+{
+    return SIMD_WIDTH == 8 ? "AVX2" : "SSE2";
+}
+
+#else
+
+void SkinVerticesDLBSIMD(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials)
+{
+    SkinVerticesDLBScalar(mesh, palette, firstVertex, lastVertex, positions, differentials);
+}
+
+void SkinVerticesLBSSIMD(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials)
+{
+    SkinVerticesLBSScalar(mesh, palette, firstVertex, lastVertex, positions, differentials);
+}
+
+const char* GetCPUSkinningISA()
+{
+    return "Scalar";
+}
+
+#endif
+
+void SkinVerticesParallel(
+    PFNSKINVERTICESPROC kernel,
+    const CPUSkinningMesh* mesh,
+    const CPUSkinningPalette* palette,
+    PositionVertex* positions,
+    DifferentialVertex* differentials,
+    int numThreads)
+{
+    ThreadPool* pool = GetThreadPool();
+    if (numThreads <= 0 || numThreads > pool->GetMaxThreads())
+    {
+        numThreads = pool->GetMaxThreads();
+    }
+    numThreads = std::max(std::min(numThreads, mesh->NumVertices / kMinVerticesPerThread), 1);
+
+    // Ranges start on a padding boundary so SIMD kernels of neighboring threads never touch the same vertices
+    int verticesPerThread = (mesh->NumVertices + numThreads - 1) / numThreads;
+    verticesPerThread = (verticesPerThread + CPUSKINNING_VERTEX_PADDING - 1) / CPUSKINNING_VERTEX_PADDING * CPUSKINNING_VERTEX_PADDING;
+
+    pool->Run(numThreads, [&](int threadIdx, int)
+    {
+        int firstVertex = std::min(threadIdx * verticesPerThread, mesh->NumVertices);
+        int lastVertex = std::min(firstVertex + verticesPerThread, mesh->NumVertices);
+        if (firstVertex < lastVertex)
+        {
+            kernel(mesh, palette, firstVertex, lastVertex, positions, differentials);
+        }
+    });
+}
+
+static uint32_t PackSnorm2_10_10_10(const glm::vec4& v)
+{
+    glm::ivec4 i = glm::ivec4(glm::round(glm::clamp(v, -1.0f, 1.0f) * glm::vec4(511.0f, 511.0f, 511.0f, 1.0f)));
+    return (uint32_t(i.x) & 0x3FF) | ((uint32_t(i.y) & 0x3FF) << 10) | ((uint32_t(i.z) & 0x3FF) << 20) | (uint32_t(i.w) << 30);
+}
+
+void PackSkinnedDifferentials(const DifferentialVertex* differentials, int numVertices, PackedDifferentialVertex* packedDifferentials)
+{
+    for (int v = 0; v < numVertices; v++)
+    {
+        // Not normalized, same as the GPU packing (and a zero vector stays zero instead of becoming NaN)
+        glm::vec3 normal = differentials[v].Normal;
+        glm::vec3 tangent = differentials[v].Tangent;
+        float handedness = glm::dot(glm::cross(normal, tangent), differentials[v].Bitangent) < 0.0f ? -1.0f : 1.0f;
+
+        packedDifferentials[v].Normal = PackSnorm2_10_10_10(glm::vec4(normal, 0.0f));
+        packedDifferentials[v].Tangent = PackSnorm2_10_10_10(glm::vec4(tangent, handedness));
+    }
+}
+
+float ValidateCPUSkinning(
+    PFNSKINVERTICESPROC kernel,
+    PFNSKINVERTICESPROC referenceKernel,
+    const CPUSkinningMesh* mesh,
+    const CPUSkinningPalette* palette)
+{
+    std::vector<PositionVertex> positions(mesh->NumVertices);
+    std::vector<DifferentialVertex> differentials(mesh->NumVertices);
+    std::vector<PositionVertex> referencePositions(mesh->NumVertices);
+    std::vector<DifferentialVertex> referenceDifferentials(mesh->NumVertices);
+
+    SkinVerticesParallel(kernel, mesh, palette, positions.data(), differentials.data());
+    referenceKernel(mesh, palette, 0, mesh->NumVertices, referencePositions.data(), referenceDifferentials.data());
+
+    float maxError = 0.0f;
+    for (int v = 0; v < mesh->NumVertices; v++)
+    {
+        glm::vec3 errors[4] = {
+            positions[v].Position - referencePositions[v].Position,
+            differentials[v].Normal - referenceDifferentials[v].Normal,
+            differentials[v].Tangent - referenceDifferentials[v].Tangent,
+            differentials[v].Bitangent - referenceDifferentials[v].Bitangent
+        };
+
+        for (const glm::vec3& error : errors)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                // std::max would drop a NaN, and a kernel producing NaN or Inf must fail validation
+                if (!std::isfinite(error[c]))
+                {
+                    return INFINITY;
+                }
+                maxError = std::max(maxError, std::abs(error[c]));
+            }
+        }
+    }
+
+    return maxError;
+}
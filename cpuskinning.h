@@ -0,0 +1,91 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtx/dual_quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct PositionVertex;
+struct DifferentialVertex;
+struct PackedDifferentialVertex;
+struct BoneWeightVertex;
+
+// Bind pose arrays are padded to a multiple of this, so SIMD kernels can always load full registers
+#define CPUSKINNING_VERTEX_PADDING 8
+
+enum CPUSkinningComponent
+{
+    CPUSKINNING_POSITION_X, CPUSKINNING_POSITION_Y, CPUSKINNING_POSITION_Z,
+    CPUSKINNING_NORMAL_X, CPUSKINNING_NORMAL_Y, CPUSKINNING_NORMAL_Z,
+    CPUSKINNING_TANGENT_X, CPUSKINNING_TANGENT_Y, CPUSKINNING_TANGENT_Z,
+    CPUSKINNING_BITANGENT_X, CPUSKINNING_BITANGENT_Y, CPUSKINNING_BITANGENT_Z,
+    CPUSKINNING_NUM_COMPONENTS
+};
+
+// Bind pose of a mesh in structure-of-arrays form for the CPU skinning kernels.
+struct CPUSkinningMesh
+{
+    int NumVertices;
+    std::vector<float> Components[CPUSKINNING_NUM_COMPONENTS]; // One array per vertex component
+    std::vector<int32_t> BoneIDs[4]; // One array per influence
+    std::vector<float> Weights[4]; // One array per influence
+};
+
+// Skinning palette of one skeleton in structure-of-arrays form.
+// DLB palettes have 8 components per bone (real xyzw, dual xyzw), LBS palettes have 12 (3 rows xyzw).
+struct CPUSkinningPalette
+{
+    int NumBones;
+    std::vector<float> Data; // Component c of bone b is at Data[c * NumBones + b]
+};
+
+void InitCPUSkinningMesh(
+    CPUSkinningMesh* mesh,
+    const PositionVertex* positions,
+    const DifferentialVertex* differentials,
+    const BoneWeightVertex* boneWeights,
+    int numVertices);
+
+void BuildCPUSkinningPaletteDLB(CPUSkinningPalette* palette, const glm::dualquat* boneTransforms, int numBones);
+void BuildCPUSkinningPaletteLBS(CPUSkinningPalette* palette, const glm::mat3x4* boneTransforms, int numBones);
+
+// Skins vertices [firstVertex, lastVertex) and writes them at the same indices of positions and differentials.
+typedef void(*PFNSKINVERTICESPROC)(
+    const CPUSkinningMesh* mesh,
+    const CPUSkinningPalette* palette,
+    int firstVertex,
+    int lastVertex,
+    PositionVertex* positions,
+    DifferentialVertex* differentials);
+
+// Reference implementations, one vertex at a time. Same math as skinning_dlb.vert and skinning_lbs.vert.
+void SkinVerticesDLBScalar(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials);
+void SkinVerticesLBSScalar(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials);
+
+// SIMD kernels, using AVX2 when compiled with it and SSE2 otherwise. Fall back to the scalar kernels elsewhere.
+void SkinVerticesDLBSIMD(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials);
+void SkinVerticesLBSSIMD(const CPUSkinningMesh* mesh, const CPUSkinningPalette* palette, int firstVertex, int lastVertex, PositionVertex* positions, DifferentialVertex* differentials);
+
+// Name of the instruction set used by the SIMD kernels
+const char* GetCPUSkinningISA();
+
+// Splits the mesh's vertices into ranges and skins them on up to numThreads threads of the thread pool (0 = all of them)
+void SkinVerticesParallel(
+    PFNSKINVERTICESPROC kernel,
+    const CPUSkinningMesh* mesh,
+    const CPUSkinningPalette* palette,
+    PositionVertex* positions,
+    DifferentialVertex* differentials,
+    int numThreads = 0);
+
+// Packs skinned differentials into the layout the GPU skinning backends write, same math as PackSnorm2_10_10_10 in the shaders
+void PackSkinnedDifferentials(const DifferentialVertex* differentials, int numVertices, PackedDifferentialVertex* packedDifferentials);
+
+// Skins the mesh with both a kernel and its scalar reference, and returns the largest difference between any two outputs.
+// Returns INFINITY if any output differs by NaN or Inf.
+float ValidateCPUSkinning(
+    PFNSKINVERTICESPROC kernel,
+    PFNSKINVERTICESPROC referenceKernel,
+    const CPUSkinningMesh* mesh,
+    const CPUSkinningPalette* palette);
@@ -0,0 +1,84 @@
+// Draws every member of a crowd in one instanced draw.
+// Skinned vertices and member placement are fetched by instance, lighting happens in world space.
+
+#version 410
+
+layout(location = 1) in vec2 TexCoord;
+
+#ifdef INLINE_SKINNING
+// Bind pose vertices, skinned here with the member's palette instead of being fetched pre-skinned
+layout(location = 0) in vec3 Position;
+layout(location = 2) in vec3 Normal;
+layout(location = 3) in vec3 Tangent;
+layout(location = 4) in vec3 Bitangent;
+layout(location = 7) in uint PaletteID; // Per instance, selects the member's palette
+
+// Defined by skinning_inline_dlb.vert or skinning_inline_lbs.vert
+void SkinVertex(int paletteOffset, inout vec3 position, inout vec3 normal, inout vec3 tangent, inout vec3 bitangent);
+
+uniform samplerBuffer BoneTransforms;
+uniform int PaletteTableOffset; // Start of the table of palette offsets in texels
+#else
+uniform samplerBuffer SkinnedPositions; // 1 texel per vertex
+uniform isamplerBuffer SkinnedDifferentials; // 1 texel per vertex, normal and tangent packed as 2_10_10_10 snorm
+uniform int BaseVertex; // First skinned vertex of the first member
+uniform int NumVertices; // Number of skinned vertices per member
+#endif
+
+uniform samplerBuffer MemberTransforms; // 4 texels (columns) per member
+
+uniform mat4 WorldViewProjection;
+
+out vec3 fPosition;
+out vec2 fTexCoord;
+out vec3 fNormal;
+out vec3 fTangent;
+out vec3 fBitangent;
+
+#ifndef INLINE_SKINNING
+// Same conversion as a normalized GL_INT_2_10_10_10_REV attribute
+vec4 UnpackSnorm2_10_10_10(int p)
+{
+    ivec4 i = ivec4(p << 22, p << 12, p << 2, p) >> ivec4(22, 22, 22, 30);
+    return max(vec4(i) / vec4(511.0, 511.0, 511.0, 1.0), -1.0);
+}
+#endif
+
+void main()
+{
+#ifdef INLINE_SKINNING
+    int paletteOffset = int(texelFetch(BoneTransforms, PaletteTableOffset + int(PaletteID) / 4)[int(PaletteID) % 4]);
+
+    vec3 position = Position;
+    vec3 normal = Normal;
+    vec3 tangent = Tangent;
+    vec3 bitangent = Bitangent;
+    SkinVertex(paletteOffset, position, normal, tangent, bitangent);
+#else
+    // gl_VertexID is the index read from the element buffer
+    int vertexID = BaseVertex + gl_InstanceID * NumVertices + gl_VertexID;
+
+    vec3 position = texelFetch(SkinnedPositions, vertexID).xyz;
+    ivec2 packedDifferential = texelFetch(SkinnedDifferentials, vertexID).xy;
+    vec4 tangentHandedness = UnpackSnorm2_10_10_10(packedDifferential.y);
+    vec3 normal = UnpackSnorm2_10_10_10(packedDifferential.x).xyz;
+    vec3 tangent = tangentHandedness.xyz;
+    vec3 bitangent = cross(normal, tangent) * tangentHandedness.w;
+#endif
+
+    mat4 modelWorld = mat4(
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 0),
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 1),
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 2),
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 3));
+
+    vec4 worldPosition = modelWorld * vec4(position, 1.0);
+
+    fPosition = worldPosition.xyz;
+    fTexCoord = TexCoord;
+    fNormal = mat3(modelWorld) * normal;
+    fTangent = mat3(modelWorld) * tangent;
+    fBitangent = mat3(modelWorld) * bitangent;
+
+    gl_Position = WorldViewProjection * worldPosition;
+}
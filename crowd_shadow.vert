@@ -0,0 +1,49 @@
+#version 410
+
+#ifdef INLINE_SKINNING
+layout(location = 0) in vec3 Position;
+layout(location = 2) in vec3 Normal;
+layout(location = 3) in vec3 Tangent;
+layout(location = 4) in vec3 Bitangent;
+layout(location = 7) in uint PaletteID; // Per instance, selects the member's palette
+
+// Defined by skinning_inline_dlb.vert or skinning_inline_lbs.vert
+void SkinVertex(int paletteOffset, inout vec3 position, inout vec3 normal, inout vec3 tangent, inout vec3 bitangent);
+
+uniform samplerBuffer BoneTransforms;
+uniform int PaletteTableOffset; // Start of the table of palette offsets in texels
+#else
+uniform samplerBuffer SkinnedPositions; // 1 texel per vertex
+uniform int BaseVertex; // First skinned vertex of the first member
+uniform int NumVertices; // Number of skinned vertices per member
+#endif
+
+uniform samplerBuffer MemberTransforms; // 4 texels (columns) per member
+
+uniform mat4 WorldLightProjection;
+
+void main()
+{
+#ifdef INLINE_SKINNING
+    int paletteOffset = int(texelFetch(BoneTransforms, PaletteTableOffset + int(PaletteID) / 4)[int(PaletteID) % 4]);
+
+    vec3 position = Position;
+    vec3 normal = Normal;
+    vec3 tangent = Tangent;
+    vec3 bitangent = Bitangent;
+    SkinVertex(paletteOffset, position, normal, tangent, bitangent);
+#else
+    // gl_VertexID is the index read from the element buffer
+    int vertexID = BaseVertex + gl_InstanceID * NumVertices + gl_VertexID;
+
+    vec3 position = texelFetch(SkinnedPositions, vertexID).xyz;
+#endif
+
+    mat4 modelWorld = mat4(
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 0),
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 1),
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 2),
+        texelFetch(MemberTransforms, gl_InstanceID * 4 + 3));
+
+    gl_Position = WorldLightProjection * modelWorld * vec4(position, 1.0);
+}
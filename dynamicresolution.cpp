@@ -0,0 +1,105 @@
+#include "dynamicresolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// Frames to wait after a change before the next one
+static const int kSettleFrames = 15;
+
+// Fraction of the target frame time below which quality is raised again.
+// Kept well below 1 so the controller doesn't flip back and forth across the target.
+static const float kRaiseThreshold = 0.8f;
+
+void InitDynamicResolution(DynamicResolution* dynRes)
+{
+    *dynRes = DynamicResolution();
+    dynRes->Enabled = false;
+    dynRes->TargetFrameTime_ms = 1000.0f / 60.0f;
+    dynRes->MinScale = 0.5f;
+    dynRes->Scale = 1.0f;
+    dynRes->SampleShift = 0;
+    dynRes->MaxSampleShift = 2;
+    snprintf(dynRes->LastDecision, sizeof(dynRes->LastDecision), "None");
+}
+
+void UpdateDynamicResolution(DynamicResolution* dynRes, float gpuFrameTime_ms)
+{
+    float weight = 0.1f;
+    if (dynRes->GPUFrameTimeEMA_ms == 0.0f)
+    {
+        dynRes->GPUFrameTimeEMA_ms = gpuFrameTime_ms;
+    }
+    dynRes->GPUFrameTimeEMA_ms = weight * gpuFrameTime_ms + (1.0f - weight) * dynRes->GPUFrameTimeEMA_ms;
+
+    dynRes->ScaleHistory[dynRes->HistoryIndex] = dynRes->Scale;
+    dynRes->GPUFrameTimeHistory[dynRes->HistoryIndex] = gpuFrameTime_ms;
+    dynRes->HistoryIndex = (dynRes->HistoryIndex + 1) % DYNAMIC_RESOLUTION_HISTORY_SIZE;
+
+    dynRes->FramesSinceChange++;
+
+    if (!dynRes->Enabled)
+    {
+        if (dynRes->Scale != 1.0f || dynRes->SampleShift != 0)
+        {
+            dynRes->Scale = 1.0f;
+            dynRes->SampleShift = 0;
+            dynRes->FramesSinceChange = 0;
+            dynRes->NumDecisions++;
+            snprintf(dynRes->LastDecision, sizeof(dynRes->LastDecision), "Disabled: full quality");
+        }
+        return;
+    }
+
+    if (dynRes->FramesSinceChange < kSettleFrames)
+    {
+        return;
+    }
+
+    // Fill cost goes with the pixel count, which goes with the square of the scale
+    float load = dynRes->GPUFrameTimeEMA_ms / dynRes->TargetFrameTime_ms;
+    float scaleForTarget = dynRes->Scale / std::sqrt(std::max(load, 1e-3f));
+
+    float oldScale = dynRes->Scale;
+    int oldSampleShift = dynRes->SampleShift;
+    const char* reason = NULL;
+
+    if (load > 1.0f)
+    {
+        if (dynRes->Scale > dynRes->MinScale)
+        {
+            // Not all of the frame scales with pixels, so don't step down too far at once
+            dynRes->Scale = std::max(std::max(scaleForTarget, dynRes->Scale * 0.85f), dynRes->MinScale);
+            reason = "Over budget: lower resolution";
+        }
+        else if (dynRes->SampleShift < dynRes->MaxSampleShift)
+        {
+            dynRes->SampleShift++;
+            reason = "Over budget: fewer samples";
+        }
+    }
+    else if (load < kRaiseThreshold)
+    {
+        if (dynRes->SampleShift > 0)
+        {
+            dynRes->SampleShift--;
+            reason = "Under budget: more samples";
+        }
+        else if (dynRes->Scale < 1.0f)
+        {
+            // Raise slowly, a spike back over budget is worse than a few frames at lower resolution
+            dynRes->Scale = std::min(std::min(scaleForTarget, dynRes->Scale * 1.05f), 1.0f);
+            reason = "Under budget: higher resolution";
+        }
+    }
+
+    // The minimum scale can be raised from the GUI while rendering below it
+    dynRes->Scale = std::max(dynRes->Scale, dynRes->MinScale);
+
+    if (dynRes->Scale != oldScale || dynRes->SampleShift != oldSampleShift)
+    {
+        dynRes->FramesSinceChange = 0;
+        dynRes->NumDecisions++;
+        snprintf(dynRes->LastDecision, sizeof(dynRes->LastDecision), "%s (%.2f ms)", reason ? reason : "Clamped to minimum scale", dynRes->GPUFrameTimeEMA_ms);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// Number of frames of scale and GPU time kept for the profiling GUI
+#define DYNAMIC_RESOLUTION_HISTORY_SIZE 128
+
+// Controls the resolution and MSAA sample count the scene is rendered at, so the GPU holds a target frame time.
+// The resolution is lowered first. Only once it's at its minimum are samples dropped, and they come back first.
+struct DynamicResolution
+{
+    // Settings
+    bool Enabled;
+    float TargetFrameTime_ms; // GPU time per frame to hold
+    float MinScale; // Smallest fraction of the window's width and height to render at
+
+    // Current decision
+    float Scale; // Fraction of the window's width and height the scene is rendered at
+    int SampleShift; // The backbuffer has its full sample count shifted right by this many bits
+    int MaxSampleShift;
+    int NumSamples; // Sample count the renderer ended up with, for display
+
+    float GPUFrameTimeEMA_ms; // Smoothed GPU time of all profiled passes
+    int FramesSinceChange; // GPU times lag behind by the profiler's buffered frames, so changes are given time to show up
+
+    // History for the profiling GUI
+    float ScaleHistory[DYNAMIC_RESOLUTION_HISTORY_SIZE];
+    float GPUFrameTimeHistory[DYNAMIC_RESOLUTION_HISTORY_SIZE];
+    int HistoryIndex; // Next entry to write, the oldest entry
+    char LastDecision[64];
+    int NumDecisions;
+};
+
+void InitDynamicResolution(DynamicResolution* dynRes);
+
+// Feeds the GPU time of a frame and adjusts the scale and sample count
+void UpdateDynamicResolution(DynamicResolution* dynRes, float gpuFrameTime_ms);
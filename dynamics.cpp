@@ -1,12 +1,17 @@
 #include "dynamics.h"
+#include "simd.h"
+#include "threadpool.h"
 
 #include <glm/vec3.hpp>
 #include <glm/mat3x3.hpp>
+#include <glm/matrix.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/gtx/matrix_cross_product.hpp>
-#include <glm/gtx/rotate_vector.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <vector>
+#include <cmath>
 #include <cstdio>
 #include <cassert>
 
@@ -15,47 +20,90 @@ using glm::vec4;
 using glm::mat3;
 using glm::make_vec3;
 
-struct ParticleCollision
+// Don't bother waking up threads for colors smaller than this many constraints per thread
+static const int kMinConstraintsPerThread = 2048;
+
+// Don't bother waking up threads for fewer batched blocks of systems than this per thread
+static const int kMinBlocksPerThread = 4;
+
+#ifdef SIMD_WIDTH
+static const int kNumLanes = SIMD_WIDTH;
+#else
+static const int kNumLanes = 1;
+
+// Scalar stand-ins for the SIMD wrappers, so the batch solver steps one system per block. Masks are 1 or 0.
+typedef float vfloat;
+static inline vfloat VLoad(const float* p) { return *p; }
+static inline void VStore(float* p, vfloat a) { *p = a; }
+static inline vfloat VSet1(float f) { return f; }
+static inline vfloat VAdd(vfloat a, vfloat b) { return a + b; }
+static inline vfloat VSub(vfloat a, vfloat b) { return a - b; }
+static inline vfloat VMul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat VDiv(vfloat a, vfloat b) { return a / b; }
+static inline vfloat VSqrt(vfloat a) { return std::sqrt(a); }
+static inline vfloat VCmpGt(vfloat a, vfloat b) { return a > b ? 1.0f : 0.0f; }
+static inline vfloat VCmpGe(vfloat a, vfloat b) { return a >= b ? 1.0f : 0.0f; }
+static inline vfloat VCmpLt(vfloat a, vfloat b) { return a < b ? 1.0f : 0.0f; }
+static inline vfloat VSelect(vfloat mask, vfloat a, vfloat b) { return mask != 0.0f ? a : b; }
+static inline vfloat VMulAdd(vfloat a, vfloat b, vfloat c) { return a * b + c; }
+
+struct vvec3 { vfloat x, y, z; };
+
+static inline vvec3 VCross(const vvec3& a, const vvec3& b)
 {
-    int pidx;
-    vec3 normal;
-};
+    return vvec3{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+#endif
 
 // Velocities are dampened before used for prediction of new positions.
 // Damping method suggested in Muller 06
 static void dampVelocities(
     const vec3* xs,
     const float* ms,
+    float msum,
     float kdamping,
     int np,
     vec3* vs)
 {
+    if (kdamping == 0.0f)
+    {
+        return;
+    }
+
     vec3 xcm = vec3(0.0f);
     vec3 vcm = vec3(0.0f);
-    float msum = 0.0f;
     for (int i = 0; i < np; i++)
     {
         xcm += xs[i] * ms[i];
         vcm += vs[i] * ms[i];
-        msum += ms[i];
     }
     xcm /= msum;
     vcm /= msum;
 
+    // Inertia tensor accumulated as sum(m * (dot(r, r) * Identity - r * transpose(r))),
+    // which is what sum(matrixCross3(r) * transpose(matrixCross3(r)) * m) works out to.
     vec3 L = vec3(0.0f);
-    for (int i = 0; i < np; i++)
-    {
-        L += cross(xs[i] - xcm, ms[i] * vs[i]);
-    }
-
-    mat3 I = mat3(0.0f);
+    float Ixx = 0.0f, Iyy = 0.0f, Izz = 0.0f;
+    float Ixy = 0.0f, Ixz = 0.0f, Iyz = 0.0f;
     for (int i = 0; i < np; i++)
     {
         vec3 ri = xs[i] - xcm;
-        mat3 ricross = matrixCross3(ri);
-        I += ricross * transpose(ricross) * ms[i];
+        L += cross(ri, ms[i] * vs[i]);
+
+        vec3 mri = ms[i] * ri;
+        Ixx += mri.y * ri.y + mri.z * ri.z;
+        Iyy += mri.x * ri.x + mri.z * ri.z;
+        Izz += mri.x * ri.x + mri.y * ri.y;
+        Ixy -= mri.x * ri.y;
+        Ixz -= mri.x * ri.z;
+        Iyz -= mri.y * ri.z;
     }
 
+    mat3 I = mat3(
+        Ixx, Ixy, Ixz,
+        Ixy, Iyy, Iyz,
+        Ixz, Iyz, Izz);
+
     vec3 w = inverse(I) * L;
 
     for (int i = 0; i < np; i++)
@@ -81,10 +129,14 @@ static void dampVelocities(
 //       Therefore intersect a moving point with a moving triangle.
 static void generateCollisionConstraints(
     const vec3* xs, const vec3* ps, const Hull* hs, int np,
-    std::vector<ParticleCollision>& pcs,
-    std::vector<Constraint>& coll_cs)
+    PlaneConstraintBatch* coll_cs)
 {
-    auto sphereVSplane = [&pcs, &coll_cs](vec4 plane, int pidx, vec3 x, vec3 p, float r)
+    coll_cs->ParticleIDs.clear();
+    coll_cs->Points.clear();
+    coll_cs->Normals.clear();
+    coll_cs->Stiffnesses.clear();
+
+    auto sphereVSplane = [coll_cs](vec4 plane, int pidx, vec3 x, vec3 p, float r)
     {
         // offset plane in direction of radius
         plane.w -= r;
@@ -98,46 +150,20 @@ static void generateCollisionConstraints(
                 / dot(vec3(plane), (p - x));
             vec3 q = x + t * (p - x);
 
-            ParticleCollision pc;
-            pc.pidx = pidx;
-            pc.normal = vec3(plane);
-            pcs.push_back(pc);
-
-            Constraint c;
-            c.Func = CONSTRAINTFUNC_INTERSECTION;
-            c.NumParticles = 1;
-            // hack: vector gets resized, so I can't point to it
-            // instead use indices, then switch to pointers
-            // after all collision constraints are created
-            c.ParticleIDs = (int*)0 + (int)pcs.size() - 1;
-            c.Stiffness = 1.0f;
-            c.Type = CONSTRAINTTYPE_INEQUALITY;
-            *(vec3*)&c.Intersection.Qc = q;
-            *(vec3*)&c.Intersection.Nc = vec3(plane);
-            coll_cs.push_back(c);
+            coll_cs->ParticleIDs.push_back(pidx);
+            coll_cs->Points.push_back(q);
+            coll_cs->Normals.push_back(vec3(plane));
+            coll_cs->Stiffnesses.push_back(1.0f);
         }
         else if (p_in && x_in)
         {
             // find surface point closest to p
             vec3 qs = p - vec3(plane) * dot(plane, vec4(p, 1.0f));
 
-            ParticleCollision pc;
-            pc.pidx = pidx;
-            pc.normal = vec3(plane);
-            pcs.push_back(pc);
-
-            Constraint c;
-            c.Func = CONSTRAINTFUNC_PROJECTION;
-            c.NumParticles = 1;
-            // hack: vector gets resized, so I can't point to it
-            // instead use indices, then switch to pointers
-            // after all collision constraints are created
-            c.ParticleIDs = (int*)0 + (int)pcs.size() - 1;
-            c.Stiffness = 1.0f;
-            c.Type = CONSTRAINTTYPE_INEQUALITY;
-            *(vec3*)&c.Projection.Qs = qs;
-            *(vec3*)&c.Projection.Ns = vec3(plane);
-            coll_cs.push_back(c);
+            coll_cs->ParticleIDs.push_back(pidx);
+            coll_cs->Points.push_back(qs);
+            coll_cs->Normals.push_back(vec3(plane));
+            coll_cs->Stiffnesses.push_back(1.0f);
         }
     };
 
@@ -176,141 +202,236 @@ static void generateCollisionConstraints(
 // do a bunch of math and you end up with:
 //  dp[i] = -s * w[i] * dC/dp[i](p1,...,pn)
 // where s = C(p1,...,pn) / sum_j(w[j] * lengthSquared(dC/dp[j](p1,...,pn)))
-static void projectConstraint(
-    const Constraint* c,
-    const float* ws, int np,
+// For the distance constraint C(p0, p1) = length(p0 - p1) - d this is
+//  dp0 = -w0 / (w0 + w1) * (p0 - p1 - d * normalize(p0 - p1)), and dp1 the opposite scaled by w1
+static void projectDistanceConstraints(
+    const DistanceConstraintBatch& cs,
+    int first, int last,
     vec3* ps)
 {
-    if (c->Func == CONSTRAINTFUNC_DISTANCE)
+    const int* i0s = cs.ParticleIDs0.data();
+    const int* i1s = cs.ParticleIDs1.data();
+    const float* distances = cs.Distances.data();
+    const float* k0s = cs.Corrections0.data();
+    const float* k1s = cs.Corrections1.data();
+
+    for (int i = first; i < last; i++)
     {
-        assert(c->NumParticles == 2);
+        int i0 = i0s[i];
+        int i1 = i1s[i];
+        vec3 p1_to_p0 = ps[i0] - ps[i1];
+        float p1_to_p0_len = length(p1_to_p0);
+        vec3 p1_to_p0_dir = p1_to_p0_len > 0.0f ? p1_to_p0 / p1_to_p0_len : vec3(0.0f);
+        vec3 error = p1_to_p0 - distances[i] * p1_to_p0_dir;
+        ps[i0] -= k0s[i] * error;
+        ps[i1] += k1s[i] * error;
+    }
+}
 
-        float distance = c->Distance.Distance;
-        int i0 = c->ParticleIDs[0];
-        int i1 = c->ParticleIDs[1];
+#ifdef SIMD_WIDTH
 
-        if (c->Type == CONSTRAINTTYPE_EQUALITY)
-        {
-            // C(p1, p2) = length(p1 - p2) - d = 0
-            float w0 = ws[i0];
-            float w1 = ws[i1];
-            vec3 p1_to_p0 = ps[i0] - ps[i1];
-            float p1_to_p0_len = length(p1_to_p0);
-            vec3 p1_to_p0_dir = p1_to_p0_len > 0.0f ? p1_to_p0 / p1_to_p0_len : vec3(0.0f);
-            vec3 dp0 = -(w0 / (w0 + w1)) * (p1_to_p0 - distance * p1_to_p0_dir);
-            vec3 dp1 = +(w1 / (w0 + w1)) * (p1_to_p0 - distance * p1_to_p0_dir);
-            ps[i0] += dp0 * c->Stiffness;
-            ps[i1] += dp1 * c->Stiffness;
-        }
-        else
+// Same as above, one constraint per lane. The constraints of a range must not share particles.
+static void projectDistanceConstraintsSIMD(
+    const DistanceConstraintBatch& cs,
+    int first, int last,
+    vec3* ps)
+{
+    const float* pfs = &ps[0].x;
+    const vfloat zero = VSet1(0.0f);
+    const vfloat one = VSet1(1.0f);
+
+    int c = first;
+    for (; c + SIMD_WIDTH <= last; c += SIMD_WIDTH)
+    {
+        // Offsets of the particles' x in the interleaved positions
+        vint i0 = VLoadInt(&cs.ParticleIDs0[c]);
+        vint i1 = VLoadInt(&cs.ParticleIDs1[c]);
+        vint o0 = VAddInt(i0, VAddInt(i0, i0));
+        vint o1 = VAddInt(i1, VAddInt(i1, i1));
+
+        vvec3 p0 = { VGather(pfs + 0, o0), VGather(pfs + 1, o0), VGather(pfs + 2, o0) };
+        vvec3 p1 = { VGather(pfs + 0, o1), VGather(pfs + 1, o1), VGather(pfs + 2, o1) };
+
+        // error = (p0 - p1) * (1 - d / length(p0 - p1)), or 0 when the particles are on top of each other
+        vvec3 p1_to_p0 = { VSub(p0.x, p1.x), VSub(p0.y, p1.y), VSub(p0.z, p1.z) };
+        vfloat len = VSqrt(VMulAdd(p1_to_p0.x, p1_to_p0.x, VMulAdd(p1_to_p0.y, p1_to_p0.y, VMul(p1_to_p0.z, p1_to_p0.z))));
+        vfloat invLen = VAnd(VCmpGt(len, zero), VDiv(one, len));
+        vfloat s = VSub(one, VMul(VLoad(&cs.Distances[c]), invLen));
+        vfloat k0 = VMul(VLoad(&cs.Corrections0[c]), s);
+        vfloat k1 = VMul(VLoad(&cs.Corrections1[c]), s);
+
+        alignas(32) float lanes[6][SIMD_WIDTH];
+        VStore(lanes[0], VSub(p0.x, VMul(k0, p1_to_p0.x)));
+        VStore(lanes[1], VSub(p0.y, VMul(k0, p1_to_p0.y)));
+        VStore(lanes[2], VSub(p0.z, VMul(k0, p1_to_p0.z)));
+        VStore(lanes[3], VMulAdd(k1, p1_to_p0.x, p1.x));
+        VStore(lanes[4], VMulAdd(k1, p1_to_p0.y, p1.y));
+        VStore(lanes[5], VMulAdd(k1, p1_to_p0.z, p1.z));
+
+        // No scatter instruction, write lanes back one by one
+        for (int lane = 0; lane < SIMD_WIDTH; lane++)
         {
-            assert(false && "Unhandled constraint type");
+            ps[cs.ParticleIDs0[c + lane]] = vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]);
+            ps[cs.ParticleIDs1[c + lane]] = vec3(lanes[3][lane], lanes[4][lane], lanes[5][lane]);
         }
     }
-    else if (c->Func == CONSTRAINTFUNC_INTERSECTION)
-    {
-        assert(c->NumParticles == 1);
-        int i = c->ParticleIDs[0];
 
-        vec3 qc = make_vec3(c->Intersection.Qc);
-        vec3 nc = make_vec3(c->Intersection.Nc);
+    projectDistanceConstraints(cs, c, last, ps);
+}
+
+#endif
+
+// C(p) = (p - q) . n >= 0, moves p onto the plane when it's behind it
+static void projectPlaneConstraints(
+    const PlaneConstraintBatch& cs,
+    vec3* ps)
+{
+    const int* is = cs.ParticleIDs.data();
+    const vec3* qs = cs.Points.data();
+    const vec3* ns = cs.Normals.data();
+    const float* ks = cs.Stiffnesses.data();
+    int nc = (int)cs.ParticleIDs.size();
 
-        if (c->Type == CONSTRAINTTYPE_INEQUALITY)
+    for (int c = 0; c < nc; c++)
+    {
+        int i = is[c];
+        vec3 to_intersect = qs[c] - ps[i];
+        if (dot(ns[c], to_intersect) >= 0.0f)
         {
-            vec3 to_intersect = qc - ps[i];
-            if (dot(nc, to_intersect) >= 0.0f)
-            {
-                ps[i] += c->Stiffness * to_intersect;
-            }
+            ps[i] += ks[c] * to_intersect;
         }
-        else
+    }
+}
+
+// Greedily gives each constraint the lowest color not used by another constraint on its particles,
+// then sorts the batch by color. Constraints keep their relative order within a color.
+static void colorDistanceConstraints(
+    const DistanceConstraintBatch& cs, int np,
+    DistanceConstraintBatch* colored_cs,
+    std::vector<int>* colorOffsets)
+{
+    int nc = (int)cs.Distances.size();
+
+    std::vector<std::vector<int>> particleColors(np);
+    std::vector<int> colors(nc);
+    int numColors = 0;
+    for (int i = 0; i < nc; i++)
+    {
+        const std::vector<int>& colors0 = particleColors[cs.ParticleIDs0[i]];
+        const std::vector<int>& colors1 = particleColors[cs.ParticleIDs1[i]];
+
+        int color = 0;
+        while (std::find(colors0.begin(), colors0.end(), color) != colors0.end() ||
+               std::find(colors1.begin(), colors1.end(), color) != colors1.end())
         {
-            assert(false && "Unhandled constraint type");
+            color++;
         }
+
+        colors[i] = color;
+        particleColors[cs.ParticleIDs0[i]].push_back(color);
+        particleColors[cs.ParticleIDs1[i]].push_back(color);
+        numColors = std::max(numColors, color + 1);
     }
-    else if (c->Func == CONSTRAINTFUNC_PROJECTION)
+
+    colorOffsets->assign(numColors + 1, 0);
+    for (int i = 0; i < nc; i++)
     {
-        assert(c->NumParticles == 1);
-        int i = c->ParticleIDs[0];
+        (*colorOffsets)[colors[i] + 1]++;
+    }
+    for (int color = 0; color < numColors; color++)
+    {
+        (*colorOffsets)[color + 1] += (*colorOffsets)[color];
+    }
 
-        vec3 qs = make_vec3(c->Projection.Qs);
-        vec3 ns = make_vec3(c->Projection.Ns);
+    colored_cs->ParticleIDs0.resize(nc);
+    colored_cs->ParticleIDs1.resize(nc);
+    colored_cs->Distances.resize(nc);
+    colored_cs->Corrections0.resize(nc);
+    colored_cs->Corrections1.resize(nc);
 
-        if (c->Type == CONSTRAINTTYPE_INEQUALITY)
-        {
-            vec3 to_intersect = qs - ps[i];
-            if (dot(ns, to_intersect) >= 0.0f)
-            {
-                ps[i] += c->Stiffness * to_intersect;
-            }
-        }
-        else
+    std::vector<int> next(colorOffsets->begin(), colorOffsets->end() - 1);
+    for (int i = 0; i < nc; i++)
+    {
+        int j = next[colors[i]]++;
+        colored_cs->ParticleIDs0[j] = cs.ParticleIDs0[i];
+        colored_cs->ParticleIDs1[j] = cs.ParticleIDs1[i];
+        colored_cs->Distances[j] = cs.Distances[i];
+        colored_cs->Corrections0[j] = cs.Corrections0[i];
+        colored_cs->Corrections1[j] = cs.Corrections1[i];
+    }
+}
+
+// Threads wait here for each other between colors
+struct SpinBarrier
+{
+    int NumThreads;
+    std::atomic<int> NumWaiting;
+    std::atomic<int> Generation;
+};
+
+static void waitBarrier(SpinBarrier* barrier)
+{
+    int generation = barrier->Generation.load(std::memory_order_acquire);
+    if (barrier->NumWaiting.fetch_add(1, std::memory_order_acq_rel) == barrier->NumThreads - 1)
+    {
+        barrier->NumWaiting.store(0, std::memory_order_relaxed);
+        barrier->Generation.fetch_add(1, std::memory_order_release);
+    }
+    else
+    {
+        while (barrier->Generation.load(std::memory_order_acquire) == generation)
         {
-            assert(false && "Unhandled constraint type");
+            std::this_thread::yield();
         }
     }
-    else if (c->Func == CONSTRAINTFUNC_ANGULAR)
-    {
-        assert(c->NumParticles == 3);
-        
-        float angle = c->Angle.Angle;
-        int i0 = c->ParticleIDs[0];
-        int i1 = c->ParticleIDs[1];
-        int i2 = c->ParticleIDs[2];
+}
+
+// Runs all iterations of the colored projection on one of numThreads threads, which split every color between them.
+// The plane constraints are few and can share particles, so the first thread projects them alone.
+static void projectColoredConstraints(
+    const DynamicsSolver* solver,
+    int ni,
+    int threadIdx, int numThreads,
+    SpinBarrier* barrier,
+    vec3* ps)
+{
+    const DistanceConstraintBatch& cs = solver->ColoredDistanceConstraints;
+    const std::vector<int>& colorOffsets = solver->DistanceColorOffsets;
+    int numColors = (int)colorOffsets.size() - 1;
 
-        if (c->Type == CONSTRAINTTYPE_EQUALITY)
+    for (int iter = 0; iter < ni; iter++)
+    {
+        for (int color = 0; color < numColors; color++)
         {
-            assert(!isnan(angle));
-            
-            vec3 p0 = ps[i0];
-            vec3 p1 = ps[i1];
-            vec3 p2 = ps[i2];
-            
-            if (length(p1 - p0) > 0.0001f && length(p2 - p0) > 0.0001f)
+            // Ranges start on a lane boundary so only the last thread has a partial SIMD batch
+            int colorSize = colorOffsets[color + 1] - colorOffsets[color];
+            int constraintsPerThread = (colorSize + numThreads - 1) / numThreads;
+            constraintsPerThread = (constraintsPerThread + kNumLanes - 1) / kNumLanes * kNumLanes;
+            int first = std::min(colorOffsets[color] + threadIdx * constraintsPerThread, colorOffsets[color + 1]);
+            int last = std::min(first + constraintsPerThread, colorOffsets[color + 1]);
+
+#ifdef SIMD_WIDTH
+            projectDistanceConstraintsSIMD(cs, first, last, ps);
+#else
+            projectDistanceConstraints(cs, first, last, ps);
+#endif
+
+            if (numThreads > 1)
             {
-                float curr_angle = std::acos(dot(normalize(p1 - p0), normalize(p2 - p0)));
-                float delta_angle = (angle - curr_angle) * c->Stiffness;
-
-                vec3 rotationAxis = normalize(cross(p1 - p0, p2 - p0));
-
-                vec3 newP0P1 = rotate(normalize(p1 - p0), -delta_angle / 2.0f, rotationAxis);
-                vec3 newP0P2 = rotate(normalize(p2 - p0), delta_angle / 2.0f, rotationAxis);
-
-                // Probably more stable to move just p0 instead of p1 and p2
-                // ps[i1] = p0 + newP0P1 * length(p1 - p0);
-                // ps[i2] = p0 + newP0P2 * length(p2 - p0);
-
-                // float w0 = ws[i1];
-                // float w1 = ws[i2];
-                // ps[i0] = (-w0/(w0+w1)*(p0 + newP0P1 * length(p1 - p0)) + w1 / (w0 + w1)*(p0 + newP0P2 * length(p2 - p0))) / 2.0f;
-
-                float new_angle = std::acos(dot(normalize(ps[i1] - p0), normalize(ps[i2] - p0)));
-
-                //static int asdf = 0;
-                //if (asdf < 400)
-                //{
-                //    if (asdf == 0) printf("start asdf\n\n\n\n\n");
-                //    printf("curr_angle: %f\n", curr_angle);
-                //    printf("delta_angle: %f\n", delta_angle);
-                //    printf("new_angle: %f\n", new_angle);
-                //    printf("i0: %d, i1: %d, i2: %d\n", i0, i1, i2);
-                //    printf("rotationAxis: {%f,%f,%f}\n", rotationAxis.x, rotationAxis.y, rotationAxis.z);
-                //    // printf("p1: {%f,%f,%f}\n", p1.x, p1.y, p1.z);
-                //    printf("newP0P1: {%f,%f,%f}\n", newP0P1.x, newP0P1.y, newP0P1.z);
-                //    // printf("i0: %d, p0: {%f,%f,%f}\n", i0, p0.x, p0.y, p0.z);
-                //    // printf("p1 - p0: {%f,%f,%f}\n", (p1 - p0).x, (p1 - p0).y, (p1 - p0).z);
-                //    asdf++;
-                //}
+                waitBarrier(barrier);
             }
         }
-        else
+
+        if (threadIdx == 0)
         {
-            assert(false && "Unhandled constraint type");
+            projectPlaneConstraints(solver->PlaneConstraints, ps);
+            projectPlaneConstraints(solver->CollisionConstraints, ps);
+        }
+
+        if (numThreads > 1)
+        {
+            waitBarrier(barrier);
         }
-    }
-    else
-    {
-        assert(false && "Unhandled constraint function");
     }
 }
 
@@ -318,26 +439,28 @@ static void projectConstraint(
 // was generated is dampened perpendicular to the collision normal
 // and reflected in the direction of the collision normal
 static void velocityUpdate(
-    const ParticleCollision* pcs, int npcs,
+    const PlaneConstraintBatch& coll_cs,
     vec3* vs)
 {
+    int npcs = (int)coll_cs.ParticleIDs.size();
     int lastpidx = -1;
     for (int i = 0; i < npcs; i++)
     {
-        if (pcs[i].pidx == lastpidx)
+        if (coll_cs.ParticleIDs[i] == lastpidx)
         {
             continue;
         }
 
-        int pidx = pcs[i].pidx;
+        int pidx = coll_cs.ParticleIDs[i];
+        vec3 normal = coll_cs.Normals[i];
 
-        if (dot(vs[pidx], pcs[i].normal) < 0.0f)
+        if (dot(vs[pidx], normal) < 0.0f)
         {
-            vs[pidx] = reflect(vs[pidx], pcs[i].normal);
+            vs[pidx] = reflect(vs[pidx], normal);
         }
 
         // Dampen perpendicular to collision normal
-        vec3 normalpart = dot(vs[pidx], pcs[i].normal) * pcs[i].normal;
+        vec3 normalpart = dot(vs[pidx], normal) * normal;
         vec3 nonnormalpart = vs[pidx] - normalpart;
         vs[pidx] = normalpart + nonnormalpart * 0.5f;
 
@@ -345,17 +468,102 @@ static void velocityUpdate(
     }
 }
 
-void SimulateDynamics(
+void InitDynamicsSolver(
+    DynamicsSolver* solver,
+    const float* ms,
+    const Hull* hs,
+    int np,
+    const Constraint* cs, int nc)
+{
+    solver->NumParticles = np;
+    solver->Masses.assign(ms, ms + np);
+    solver->Hulls.assign(hs, hs + np);
+
+    solver->InverseMasses.resize(np);
+    solver->TotalMass = 0.0f;
+    for (int i = 0; i < np; i++)
+    {
+        solver->InverseMasses[i] = 1.0f / ms[i];
+        solver->TotalMass += ms[i];
+    }
+
+    solver->PredictedPositions.resize(np);
+
+    solver->Projection = DYNAMICSPROJECTION_COLORED;
+    solver->NumThreads = 0;
+    solver->Threads = NULL;
+
+    DistanceConstraintBatch& dist_cs = solver->DistanceConstraints;
+    dist_cs = DistanceConstraintBatch();
+
+    AngularConstraintBatch& ang_cs = solver->AngularConstraints;
+    ang_cs = AngularConstraintBatch();
+
+    PlaneConstraintBatch& plane_cs = solver->PlaneConstraints;
+    plane_cs = PlaneConstraintBatch();
+
+    for (int i = 0; i < nc; i++)
+    {
+        const Constraint& c = cs[i];
+
+        if (c.Func == CONSTRAINTFUNC_DISTANCE)
+        {
+            assert(c.NumParticles == 2);
+            assert(c.Type == CONSTRAINTTYPE_EQUALITY && "Unhandled constraint type");
+
+            int i0 = c.ParticleIDs[0];
+            int i1 = c.ParticleIDs[1];
+            float w0 = solver->InverseMasses[i0];
+            float w1 = solver->InverseMasses[i1];
+            dist_cs.ParticleIDs0.push_back(i0);
+            dist_cs.ParticleIDs1.push_back(i1);
+            dist_cs.Distances.push_back(c.Distance.Distance);
+            dist_cs.Corrections0.push_back(c.Stiffness * w0 / (w0 + w1));
+            dist_cs.Corrections1.push_back(c.Stiffness * w1 / (w0 + w1));
+        }
+        else if (c.Func == CONSTRAINTFUNC_INTERSECTION || c.Func == CONSTRAINTFUNC_PROJECTION)
+        {
+            assert(c.NumParticles == 1);
+            assert(c.Type == CONSTRAINTTYPE_INEQUALITY && "Unhandled constraint type");
+
+            const float* q = c.Func == CONSTRAINTFUNC_INTERSECTION ? c.Intersection.Qc : c.Projection.Qs;
+            const float* n = c.Func == CONSTRAINTFUNC_INTERSECTION ? c.Intersection.Nc : c.Projection.Ns;
+            plane_cs.ParticleIDs.push_back(c.ParticleIDs[0]);
+            plane_cs.Points.push_back(make_vec3(q));
+            plane_cs.Normals.push_back(make_vec3(n));
+            plane_cs.Stiffnesses.push_back(c.Stiffness);
+        }
+        else if (c.Func == CONSTRAINTFUNC_ANGULAR)
+        {
+            assert(c.NumParticles == 3);
+            assert(c.Type == CONSTRAINTTYPE_EQUALITY && "Unhandled constraint type");
+            assert(!isnan(c.Angle.Angle));
+
+            ang_cs.ParticleIDs0.push_back(c.ParticleIDs[0]);
+            ang_cs.ParticleIDs1.push_back(c.ParticleIDs[1]);
+            ang_cs.ParticleIDs2.push_back(c.ParticleIDs[2]);
+            ang_cs.Angles.push_back(c.Angle.Angle);
+            ang_cs.Stiffnesses.push_back(c.Stiffness);
+        }
+        else
+        {
+            assert(false && "Unhandled constraint function");
+        }
+    }
+
+    colorDistanceConstraints(dist_cs, np, &solver->ColoredDistanceConstraints, &solver->DistanceColorOffsets);
+}
+
+void SolveDynamics(
+    DynamicsSolver* solver,
     float dtsec,
     const float* x0s_f, const float* v0s_f,
-    const float* ms,
     const float* fexts_f,
-    const Hull* hs,
-    int np, int ni,
-    const Constraint* cs, int nc,
+    int ni,
     float kdamping,
     float* xs_f, float* vs_f)
 {
+    int np = solver->NumParticles;
     if (np == 0)
     {
         return;
@@ -367,71 +575,500 @@ void SimulateDynamics(
     vec3* xs = (vec3*)&xs_f[0];
     vec3* vs = (vec3*)&vs_f[0];
 
-    float* ws = new float[np];
+    const float* ws = solver->InverseMasses.data();
+    vec3* ps = solver->PredictedPositions.data();
+
+    for (int i = 0; i < np; i++)
+    {
+        xs[i] = x0s[i];
+        vs[i] = v0s[i] + dtsec * ws[i] * fexts[i];
+    }
+
+    dampVelocities(&xs[0], solver->Masses.data(), solver->TotalMass, kdamping, np, &vs[0]);
+
+    for (int i = 0; i < np; i++)
+    {
+        ps[i] = xs[i] + dtsec * vs[i];
+    }
+
+    generateCollisionConstraints(&xs[0], &ps[0], solver->Hulls.data(), np, &solver->CollisionConstraints);
+
+    // Angular constraints are batched but not projected: their correction of the particles
+    // was left commented out when they were written, so projecting them had no effect.
+    if (solver->Projection == DYNAMICSPROJECTION_SEQUENTIAL)
+    {
+        for (int iter = 0; iter < ni; iter++)
+        {
+            projectDistanceConstraints(solver->DistanceConstraints, 0, (int)solver->DistanceConstraints.Distances.size(), &ps[0]);
+            projectPlaneConstraints(solver->PlaneConstraints, &ps[0]);
+            projectPlaneConstraints(solver->CollisionConstraints, &ps[0]);
+        }
+    }
+    else
+    {
+        int maxColorSize = 0;
+        for (int color = 0; color + 1 < (int)solver->DistanceColorOffsets.size(); color++)
+        {
+            maxColorSize = std::max(maxColorSize, solver->DistanceColorOffsets[color + 1] - solver->DistanceColorOffsets[color]);
+        }
+
+        // Every thread waits at the barrier, so they must all run at the same time
+        int maxThreads = solver->Threads ? solver->Threads->GetMaxThreads() : 1;
+        int numThreads = solver->NumThreads > 0 ? std::min(solver->NumThreads, maxThreads) : maxThreads;
+        numThreads = std::max(std::min(numThreads, maxColorSize / kMinConstraintsPerThread), 1);
+
+        SpinBarrier barrier;
+        barrier.NumThreads = numThreads;
+        barrier.NumWaiting = 0;
+        barrier.Generation = 0;
+
+        if (numThreads == 1)
+        {
+            projectColoredConstraints(solver, ni, 0, 1, &barrier, &ps[0]);
+        }
+        else
+        {
+            solver->Threads->Run(numThreads, [&](int threadIdx, int)
+            {
+                projectColoredConstraints(solver, ni, threadIdx, numThreads, &barrier, &ps[0]);
+            });
+        }
+    }
+
     for (int i = 0; i < np; i++)
+    { 
+        vs[i] = (ps[i] - xs[i]) / dtsec;
+        xs[i] = ps[i];
+    }
+
+    velocityUpdate(solver->CollisionConstraints, &vs[0]);
+}
+
+void InitDynamicsBatchSolver(
+    DynamicsBatchSolver* solver,
+    const float* ms,
+    const Hull* hs,
+    int np,
+    const Constraint* cs, int nc,
+    int numSystems)
+{
+    // The constraints are batched the same way as for a single system
+    DynamicsSolver single;
+    InitDynamicsSolver(&single, ms, hs, np, cs, nc);
+
+    solver->NumParticles = np;
+    solver->NumSystems = numSystems;
+    solver->NumLanes = kNumLanes;
+    solver->NumBlocks = (numSystems + kNumLanes - 1) / kNumLanes;
+    solver->NumThreads = 0;
+    solver->Threads = NULL;
+
+    solver->Masses = std::move(single.Masses);
+    solver->InverseMasses = std::move(single.InverseMasses);
+    solver->TotalMass = single.TotalMass;
+    solver->DistanceConstraints = std::move(single.DistanceConstraints);
+    solver->PlaneConstraints = std::move(single.PlaneConstraints);
+
+    solver->CollisionParticleIDs.clear();
+    solver->CollisionRadiuses.clear();
+    solver->CollisionUsesOldPositions.clear();
+    for (int i = 0; i < np; i++)
+    {
+        if (hs[i].Type == HULLTYPE_SPHERE)
+        {
+            solver->CollisionParticleIDs.push_back(i);
+            solver->CollisionRadiuses.push_back(hs[i].Sphere.Radius);
+            solver->CollisionUsesOldPositions.push_back(0);
+        }
+        else if (hs[i].Type == HULLTYPE_CAPSULE)
+        {
+            solver->CollisionParticleIDs.push_back(i);
+            solver->CollisionRadiuses.push_back(hs[i].Capsule.Radius);
+            solver->CollisionUsesOldPositions.push_back(0);
+
+            solver->CollisionParticleIDs.push_back(hs[i].Capsule.OtherParticleID);
+            solver->CollisionRadiuses.push_back(hs[i].Capsule.Radius);
+            solver->CollisionUsesOldPositions.push_back(1);
+        }
+        else
+        {
+            assert(hs[i].Type == HULLTYPE_NULL && "Unhandled hull type");
+        }
+    }
+
+    int numStateFloats = solver->NumBlocks * np * 3 * kNumLanes;
+    solver->Positions.assign(numStateFloats, 0.0f);
+    solver->Velocities.assign(numStateFloats, 0.0f);
+    solver->PredictedPositions.assign(numStateFloats, 0.0f);
+
+    int nt = (int)solver->CollisionParticleIDs.size();
+    solver->CollisionPoints.assign(solver->NumBlocks * nt * 3 * kNumLanes, 0.0f);
+    solver->CollisionMasks.assign(solver->NumBlocks * nt * kNumLanes, 0.0f);
+}
+
+static void setDynamicsBatchLane(
+    DynamicsBatchSolver* solver,
+    int systemIdx,
+    const float* xs, const float* vs)
+{
+    int np = solver->NumParticles;
+    int b = systemIdx / kNumLanes;
+    int l = systemIdx % kNumLanes;
+    for (int i = 0; i < np * 3; i++)
     {
-        ws[i] = 1.0f / ms[i];
+        solver->Positions[(b * np * 3 + i) * kNumLanes + l] = xs[i];
+        solver->Velocities[(b * np * 3 + i) * kNumLanes + l] = vs[i];
     }
+}
 
-    float* ps_f = new float[np * 3];
-    vec3* ps = (vec3*)&ps_f[0];
+void SetDynamicsBatchSystem(
+    DynamicsBatchSolver* solver,
+    int systemIdx,
+    const float* xs, const float* vs)
+{
+    assert(systemIdx >= 0 && systemIdx < solver->NumSystems);
+    setDynamicsBatchLane(solver, systemIdx, xs, vs);
 
-    std::vector<ParticleCollision> pcs;
-    std::vector<Constraint> coll_cs;
+    // The unused lanes of the last block step a copy of the first system, so they don't fill up with NaNs
+    if (systemIdx == 0)
+    {
+        for (int padIdx = solver->NumSystems; padIdx < solver->NumBlocks * kNumLanes; padIdx++)
+        {
+            setDynamicsBatchLane(solver, padIdx, xs, vs);
+        }
+    }
+}
+
+void GetDynamicsBatchSystem(
+    const DynamicsBatchSolver* solver,
+    int systemIdx,
+    float* xs, float* vs)
+{
+    assert(systemIdx >= 0 && systemIdx < solver->NumSystems);
+
+    int np = solver->NumParticles;
+    int b = systemIdx / kNumLanes;
+    int l = systemIdx % kNumLanes;
+    for (int i = 0; i < np * 3; i++)
+    {
+        xs[i] = solver->Positions[(b * np * 3 + i) * kNumLanes + l];
+        vs[i] = solver->Velocities[(b * np * 3 + i) * kNumLanes + l];
+    }
+}
+
+// Particle i of a block, one system per lane
+static inline vvec3 VLoadParticle(const float* block, int i)
+{
+    return vvec3{
+        VLoad(block + (i * 3 + 0) * kNumLanes),
+        VLoad(block + (i * 3 + 1) * kNumLanes),
+        VLoad(block + (i * 3 + 2) * kNumLanes) };
+}
 
+static inline void VStoreParticle(float* block, int i, const vvec3& v)
+{
+    VStore(block + (i * 3 + 0) * kNumLanes, v.x);
+    VStore(block + (i * 3 + 1) * kNumLanes, v.y);
+    VStore(block + (i * 3 + 2) * kNumLanes, v.z);
+}
+
+// dampVelocities for every system of a block. The inertia tensor is inverted with its cofactors.
+static void dampVelocitiesBatch(
+    const float* xs,
+    const float* ms,
+    float msum,
+    float kdamping,
+    int np,
+    float* vs)
+{
+    if (kdamping == 0.0f)
+    {
+        return;
+    }
+
+    vfloat zero = VSet1(0.0f);
+
+    vvec3 xcm = { zero, zero, zero };
+    vvec3 vcm = { zero, zero, zero };
     for (int i = 0; i < np; i++)
     {
-        xs[i] = x0s[i];
-        vs[i] = v0s[i];
+        vfloat m = VSet1(ms[i]);
+        vvec3 x = VLoadParticle(xs, i);
+        vvec3 v = VLoadParticle(vs, i);
+        xcm = vvec3{ VMulAdd(x.x, m, xcm.x), VMulAdd(x.y, m, xcm.y), VMulAdd(x.z, m, xcm.z) };
+        vcm = vvec3{ VMulAdd(v.x, m, vcm.x), VMulAdd(v.y, m, vcm.y), VMulAdd(v.z, m, vcm.z) };
     }
+    vfloat vmsum = VSet1(msum);
+    xcm = vvec3{ VDiv(xcm.x, vmsum), VDiv(xcm.y, vmsum), VDiv(xcm.z, vmsum) };
+    vcm = vvec3{ VDiv(vcm.x, vmsum), VDiv(vcm.y, vmsum), VDiv(vcm.z, vmsum) };
 
+    vvec3 L = { zero, zero, zero };
+    vfloat Ixx = zero, Iyy = zero, Izz = zero;
+    vfloat Ixy = zero, Ixz = zero, Iyz = zero;
     for (int i = 0; i < np; i++)
     {
-        vs[i] = vs[i] + dtsec * ws[i] * fexts[i];
+        vfloat m = VSet1(ms[i]);
+        vvec3 x = VLoadParticle(xs, i);
+        vvec3 v = VLoadParticle(vs, i);
+        vvec3 ri = { VSub(x.x, xcm.x), VSub(x.y, xcm.y), VSub(x.z, xcm.z) };
+
+        vvec3 Li = VCross(ri, vvec3{ VMul(m, v.x), VMul(m, v.y), VMul(m, v.z) });
+        L = vvec3{ VAdd(L.x, Li.x), VAdd(L.y, Li.y), VAdd(L.z, Li.z) };
+
+        vvec3 mri = { VMul(m, ri.x), VMul(m, ri.y), VMul(m, ri.z) };
+        Ixx = VAdd(Ixx, VMulAdd(mri.y, ri.y, VMul(mri.z, ri.z)));
+        Iyy = VAdd(Iyy, VMulAdd(mri.x, ri.x, VMul(mri.z, ri.z)));
+        Izz = VAdd(Izz, VMulAdd(mri.x, ri.x, VMul(mri.y, ri.y)));
+        Ixy = VSub(Ixy, VMul(mri.x, ri.y));
+        Ixz = VSub(Ixz, VMul(mri.x, ri.z));
+        Iyz = VSub(Iyz, VMul(mri.y, ri.z));
     }
-     
-    dampVelocities(&xs[0], &ms[0], kdamping, np, &vs[0]);
 
+    // Cofactors of the symmetric inertia tensor, which are its inverse times the determinant
+    vfloat Cxx = VSub(VMul(Iyy, Izz), VMul(Iyz, Iyz));
+    vfloat Cxy = VSub(VMul(Ixz, Iyz), VMul(Ixy, Izz));
+    vfloat Cxz = VSub(VMul(Ixy, Iyz), VMul(Ixz, Iyy));
+    vfloat Cyy = VSub(VMul(Ixx, Izz), VMul(Ixz, Ixz));
+    vfloat Cyz = VSub(VMul(Ixy, Ixz), VMul(Ixx, Iyz));
+    vfloat Czz = VSub(VMul(Ixx, Iyy), VMul(Ixy, Ixy));
+    vfloat invDet = VDiv(VSet1(1.0f), VMulAdd(Ixx, Cxx, VMulAdd(Ixy, Cxy, VMul(Ixz, Cxz))));
+
+    vvec3 w = {
+        VMul(invDet, VMulAdd(Cxx, L.x, VMulAdd(Cxy, L.y, VMul(Cxz, L.z)))),
+        VMul(invDet, VMulAdd(Cxy, L.x, VMulAdd(Cyy, L.y, VMul(Cyz, L.z)))),
+        VMul(invDet, VMulAdd(Cxz, L.x, VMulAdd(Cyz, L.y, VMul(Czz, L.z)))) };
+
+    vfloat k = VSet1(kdamping);
     for (int i = 0; i < np; i++)
     {
-        ps[i] = xs[i] + dtsec * vs[i];
+        vvec3 x = VLoadParticle(xs, i);
+        vvec3 v = VLoadParticle(vs, i);
+        vvec3 wr = VCross(w, vvec3{ VSub(x.x, xcm.x), VSub(x.y, xcm.y), VSub(x.z, xcm.z) });
+        vvec3 dv = { VSub(VAdd(vcm.x, wr.x), v.x), VSub(VAdd(vcm.y, wr.y), v.y), VSub(VAdd(vcm.z, wr.z), v.z) };
+        VStoreParticle(vs, i, vvec3{ VMulAdd(k, dv.x, v.x), VMulAdd(k, dv.y, v.y), VMulAdd(k, dv.z, v.z) });
     }
+}
+
+// Steps the systems of one block, as SolveDynamics steps a single system
+static void stepDynamicsBatchBlock(
+    DynamicsBatchSolver* solver,
+    int b,
+    float dtsec,
+    const vec3* fexts,
+    int ni,
+    float kdamping)
+{
+    int np = solver->NumParticles;
+    int nt = (int)solver->CollisionParticleIDs.size();
+    float* xs = &solver->Positions[b * np * 3 * kNumLanes];
+    float* vs = &solver->Velocities[b * np * 3 * kNumLanes];
+    float* ps = &solver->PredictedPositions[b * np * 3 * kNumLanes];
+    float* qs = &solver->CollisionPoints[b * nt * 3 * kNumLanes];
+    float* masks = &solver->CollisionMasks[b * nt * kNumLanes];
+    const float* ws = solver->InverseMasses.data();
+
+    const vfloat zero = VSet1(0.0f);
+    const vfloat one = VSet1(1.0f);
+    const vfloat dt = VSet1(dtsec);
 
-    generateCollisionConstraints(&xs[0], &ps[0], &hs[0], np, pcs, coll_cs);
+    for (int i = 0; i < np; i++)
+    {
+        vec3 dv = dtsec * ws[i] * fexts[i];
+        vvec3 v = VLoadParticle(vs, i);
+        VStoreParticle(vs, i, vvec3{ VAdd(v.x, VSet1(dv.x)), VAdd(v.y, VSet1(dv.y)), VAdd(v.z, VSet1(dv.z)) });
+    }
 
-    // hack: since generateCollisionConstraints pushes onto vectors,
-    // we can't keep any pointers to inside it while building it.
-    // Instead, indices are stored, which are converted back to pointers here.
-    assert(coll_cs.size() == pcs.size());
-    for (int coll_i = 0; coll_i < (int)coll_cs.size(); coll_i++)
+    dampVelocitiesBatch(xs, solver->Masses.data(), solver->TotalMass, kdamping, np, vs);
+
+    for (int i = 0; i < np; i++)
     {
-        int collisionID = int(coll_cs[coll_i].ParticleIDs - (int*)0);
-        coll_cs[coll_i].ParticleIDs = &pcs[collisionID].pidx;
+        vvec3 x = VLoadParticle(xs, i);
+        vvec3 v = VLoadParticle(vs, i);
+        VStoreParticle(ps, i, vvec3{ VMulAdd(dt, v.x, x.x), VMulAdd(dt, v.y, x.y), VMulAdd(dt, v.z, x.z) });
     }
 
+    // Ground collisions like generateCollisionConstraints, the plane offset by the radius is y - r = 0.
+    // Every test is kept, with a mask of the systems where it generated a constraint.
+    for (int t = 0; t < nt; t++)
+    {
+        int i = solver->CollisionParticleIDs[t];
+        vfloat r = VSet1(solver->CollisionRadiuses[t]);
+        vvec3 x = VLoadParticle(xs, i);
+        vvec3 p = solver->CollisionUsesOldPositions[t] ? x : VLoadParticle(ps, i);
+
+        vfloat x_dist = VSub(x.y, r);
+        vfloat p_dist = VSub(p.y, r);
+        vfloat x_in = VCmpLt(x_dist, zero);
+        vfloat p_in = VCmpLt(p_dist, zero);
+
+        // Entering: intersection of x->p with the plane
+        vfloat s = VDiv(VSub(VSub(zero, r), x.y), VSub(p.y, x.y));
+        vvec3 q = { VMulAdd(s, VSub(p.x, x.x), x.x), VMulAdd(s, VSub(p.y, x.y), x.y), VMulAdd(s, VSub(p.z, x.z), x.z) };
+
+        // Already inside: surface point closest to p
+        q = vvec3{ VSelect(x_in, p.x, q.x), VSelect(x_in, VSub(p.y, p_dist), q.y), VSelect(x_in, p.z, q.z) };
+
+        VStoreParticle(qs, t, q);
+        VStore(masks + t * kNumLanes, p_in);
+    }
+
+    const DistanceConstraintBatch& dist_cs = solver->DistanceConstraints;
+    const PlaneConstraintBatch& plane_cs = solver->PlaneConstraints;
+    int ndc = (int)dist_cs.Distances.size();
+    int npc = (int)plane_cs.ParticleIDs.size();
+
     for (int iter = 0; iter < ni; iter++)
     {
-        for (int i = 0; i < nc; i++)
+        for (int c = 0; c < ndc; c++)
         {
-            projectConstraint(&cs[i], &ws[0], np, &ps[0]);
+            int i0 = dist_cs.ParticleIDs0[c];
+            int i1 = dist_cs.ParticleIDs1[c];
+            vvec3 p0 = VLoadParticle(ps, i0);
+            vvec3 p1 = VLoadParticle(ps, i1);
+
+            // error = (p0 - p1) * (1 - d / length(p0 - p1)), or 0 when the particles are on top of each other
+            vvec3 p1_to_p0 = { VSub(p0.x, p1.x), VSub(p0.y, p1.y), VSub(p0.z, p1.z) };
+            vfloat len = VSqrt(VMulAdd(p1_to_p0.x, p1_to_p0.x, VMulAdd(p1_to_p0.y, p1_to_p0.y, VMul(p1_to_p0.z, p1_to_p0.z))));
+            vfloat invLen = VSelect(VCmpGt(len, zero), VDiv(one, len), zero);
+            vfloat s = VSub(one, VMul(VSet1(dist_cs.Distances[c]), invLen));
+            vfloat k0 = VMul(VSet1(dist_cs.Corrections0[c]), s);
+            vfloat k1 = VMul(VSet1(dist_cs.Corrections1[c]), s);
+
+            VStoreParticle(ps, i0, vvec3{ VSub(p0.x, VMul(k0, p1_to_p0.x)), VSub(p0.y, VMul(k0, p1_to_p0.y)), VSub(p0.z, VMul(k0, p1_to_p0.z)) });
+            VStoreParticle(ps, i1, vvec3{ VMulAdd(k1, p1_to_p0.x, p1.x), VMulAdd(k1, p1_to_p0.y, p1.y), VMulAdd(k1, p1_to_p0.z, p1.z) });
         }
-        for (int i = 0; i < (int)coll_cs.size(); i++)
+
+        for (int c = 0; c < npc; c++)
+        {
+            int i = plane_cs.ParticleIDs[c];
+            vec3 q = plane_cs.Points[c];
+            vec3 n = plane_cs.Normals[c];
+            vfloat k = VSet1(plane_cs.Stiffnesses[c]);
+            vvec3 p = VLoadParticle(ps, i);
+            vvec3 to_intersect = { VSub(VSet1(q.x), p.x), VSub(VSet1(q.y), p.y), VSub(VSet1(q.z), p.z) };
+            vfloat d = VMulAdd(VSet1(n.x), to_intersect.x, VMulAdd(VSet1(n.y), to_intersect.y, VMul(VSet1(n.z), to_intersect.z)));
+            vfloat apply = VCmpGe(d, zero);
+            VStoreParticle(ps, i, vvec3{
+                VSelect(apply, VMulAdd(k, to_intersect.x, p.x), p.x),
+                VSelect(apply, VMulAdd(k, to_intersect.y, p.y), p.y),
+                VSelect(apply, VMulAdd(k, to_intersect.z, p.z), p.z) });
+        }
+
+        // The ground's normal is +y
+        for (int t = 0; t < nt; t++)
         {
-            projectConstraint(&coll_cs[i], &ws[0], np, &ps[0]);
+            int i = solver->CollisionParticleIDs[t];
+            vvec3 p = VLoadParticle(ps, i);
+            vvec3 q = VLoadParticle(qs, t);
+            vvec3 to_intersect = { VSub(q.x, p.x), VSub(q.y, p.y), VSub(q.z, p.z) };
+            vfloat apply = VSelect(VLoad(masks + t * kNumLanes), VCmpGe(to_intersect.y, zero), zero);
+            VStoreParticle(ps, i, vvec3{
+                VSelect(apply, VAdd(p.x, to_intersect.x), p.x),
+                VSelect(apply, VAdd(p.y, to_intersect.y), p.y),
+                VSelect(apply, VAdd(p.z, to_intersect.z), p.z) });
         }
     }
 
     for (int i = 0; i < np; i++)
-    { 
-        vs[i] = (ps[i] - xs[i]) / dtsec;
-        xs[i] = ps[i];
+    {
+        vvec3 x = VLoadParticle(xs, i);
+        vvec3 p = VLoadParticle(ps, i);
+        VStoreParticle(vs, i, vvec3{ VDiv(VSub(p.x, x.x), dt), VDiv(VSub(p.y, x.y), dt), VDiv(VSub(p.z, x.z), dt) });
+        VStoreParticle(xs, i, p);
+    }
+
+    // velocityUpdate, one system at a time since few particles collide
+    for (int l = 0; l < kNumLanes; l++)
+    {
+        int lastpidx = -1;
+        for (int t = 0; t < nt; t++)
+        {
+            int pidx = solver->CollisionParticleIDs[t];
+            if (masks[t * kNumLanes + l] == 0.0f || pidx == lastpidx)
+            {
+                continue;
+            }
+
+            float* v = &vs[pidx * 3 * kNumLanes + l];
+            float vx = v[0], vy = v[kNumLanes], vz = v[2 * kNumLanes];
+
+            // Reflect, then dampen perpendicular to the collision normal
+            if (vy < 0.0f)
+            {
+                vy = -vy;
+            }
+            v[0] = vx * 0.5f;
+            v[kNumLanes] = vy;
+            v[2 * kNumLanes] = vz * 0.5f;
+
+            lastpidx = pidx;
+        }
     }
+}
 
-    if (!pcs.empty())
+static void stepDynamicsBatchBlocks(
+    DynamicsBatchSolver* solver,
+    int firstBlock, int lastBlock,
+    float dtsec,
+    const vec3* fexts,
+    int ni,
+    float kdamping)
+{
+    for (int b = firstBlock; b < lastBlock; b++)
     {
-        velocityUpdate(&pcs[0], (int)pcs.size(), &vs[0]);
+        stepDynamicsBatchBlock(solver, b, dtsec, fexts, ni, kdamping);
     }
+}
 
-    delete[] ps_f;
-    delete[] ws;
-}
\ No newline at end of file
+void SolveDynamicsBatch(
+    DynamicsBatchSolver* solver,
+    float dtsec,
+    const float* fexts_f,
+    int ni,
+    float kdamping)
+{
+    if (solver->NumParticles == 0 || solver->NumBlocks == 0)
+    {
+        return;
+    }
+
+    const vec3* fexts = (const vec3*)&fexts_f[0];
+
+    int maxThreads = solver->Threads ? solver->Threads->GetMaxThreads() : 1;
+    int numThreads = solver->NumThreads > 0 ? std::min(solver->NumThreads, maxThreads) : maxThreads;
+    numThreads = std::max(std::min(numThreads, solver->NumBlocks / kMinBlocksPerThread), 1);
+
+    if (numThreads == 1)
+    {
+        stepDynamicsBatchBlocks(solver, 0, solver->NumBlocks, dtsec, fexts, ni, kdamping);
+        return;
+    }
+
+    // Blocks are independent, so threads don't need to wait for each other
+    solver->Threads->Run(numThreads, [&](int threadIdx, int numRunThreads)
+    {
+        int blocksPerThread = (solver->NumBlocks + numRunThreads - 1) / numRunThreads;
+        int firstBlock = threadIdx * blocksPerThread;
+        int lastBlock = std::min(firstBlock + blocksPerThread, solver->NumBlocks);
+        if (firstBlock < lastBlock)
+        {
+            stepDynamicsBatchBlocks(solver, firstBlock, lastBlock, dtsec, fexts, ni, kdamping);
+        }
+    });
+}
+
+void SimulateDynamics(
+    float dtsec,
+    const float* x0s_f, const float* v0s_f,
+    const float* ms,
+    const float* fexts_f,
+    const Hull* hs,
+    int np, int ni,
+    const Constraint* cs, int nc,
+    float kdamping,
+    float* xs_f, float* vs_f)
+{
+    DynamicsSolver solver;
+    InitDynamicsSolver(&solver, ms, hs, np, cs, nc);
+    SolveDynamics(&solver, dtsec, x0s_f, v0s_f, fexts_f, ni, kdamping, xs_f, vs_f);
+}
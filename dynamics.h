@@ -1,5 +1,11 @@
 #pragma once
 
+#include <glm/vec3.hpp>
+
+#include <vector>
+
+class ThreadPool;
+
 #define DEFAULT_DYNAMICS_NUM_ITERATIONS 10
 
 enum ConstraintFunc
@@ -109,9 +115,167 @@ struct Hull
 };
 
 #ifdef _MSC_VER
-extern "C"
-_declspec(dllexport)
+#define DYNAMICS_API extern "C" _declspec(dllexport)
+#else
+#define DYNAMICS_API
 #endif
+
+// Distance constraints of a solver, one entry per constraint
+struct DistanceConstraintBatch
+{
+    std::vector<int> ParticleIDs0;
+    std::vector<int> ParticleIDs1;
+    std::vector<float> Distances;
+    // Stiffness * w0 / (w0 + w1) and Stiffness * w1 / (w0 + w1), where w is the inverse mass
+    std::vector<float> Corrections0;
+    std::vector<float> Corrections1;
+};
+
+// Angular constraints of a solver, one entry per constraint
+struct AngularConstraintBatch
+{
+    std::vector<int> ParticleIDs0; // The joint
+    std::vector<int> ParticleIDs1;
+    std::vector<int> ParticleIDs2;
+    std::vector<float> Angles;
+    std::vector<float> Stiffnesses;
+};
+
+// Intersection and projection constraints of a solver, which both push a particle to the positive side of a plane
+struct PlaneConstraintBatch
+{
+    std::vector<int> ParticleIDs;
+    std::vector<glm::vec3> Points; // Qc or Qs
+    std::vector<glm::vec3> Normals; // Nc or Ns
+    std::vector<float> Stiffnesses;
+};
+
+enum DynamicsProjection
+{
+    // Projects the constraints one after the other, in the order they were given
+    DYNAMICSPROJECTION_SEQUENTIAL,
+    // Projects the distance constraints color by color. No two constraints of a color share a particle,
+    // so a color is projected with one SIMD lane per constraint, and split over threads when it's large.
+    // Visits the constraints in another order than the sequential projection, so results differ slightly.
+    DYNAMICSPROJECTION_COLORED
+};
+
+// Solver state of one particle system (eg. one ragdoll), kept between steps so they don't allocate.
+// The constraints are converted to batches by InitDynamicsSolver, which must be called again when they change.
+struct DynamicsSolver
+{
+    int NumParticles;
+    std::vector<float> Masses;
+    std::vector<float> InverseMasses;
+    float TotalMass;
+    std::vector<Hull> Hulls;
+
+    DynamicsProjection Projection; // DYNAMICSPROJECTION_COLORED after init
+    int NumThreads; // Upper bound for the colored projection, 0 (after init) for all of Threads'
+    // Runs the colored projection, NULL (after init) for the calling thread only. Set by the caller rather than by init,
+    // so a hot-reloaded solver DLL doesn't own threads that are running when it's unloaded.
+    ThreadPool* Threads;
+
+    DistanceConstraintBatch DistanceConstraints;
+    DistanceConstraintBatch ColoredDistanceConstraints; // The same constraints sorted by color
+    std::vector<int> DistanceColorOffsets; // Color i is [DistanceColorOffsets[i], DistanceColorOffsets[i + 1]) in the colored batch
+    AngularConstraintBatch AngularConstraints;
+    PlaneConstraintBatch PlaneConstraints; // Given to InitDynamicsSolver
+    PlaneConstraintBatch CollisionConstraints; // Generated every step, stiffness 1
+
+    std::vector<glm::vec3> PredictedPositions;
+};
+
+// Solver for many particle systems with the same masses, hulls and constraints (eg. ragdolls of the same skeleton),
+// stepped together with one system per SIMD lane. Only the positions and velocities differ between systems.
+// Systems are grouped in blocks of NumLanes, and the state of a block is stored as xxxx yyyy zzzz per particle:
+// component c of particle i of system s is at ((b * NumParticles + i) * 3 + c) * NumLanes + l, where b = s / NumLanes and l = s % NumLanes.
+struct DynamicsBatchSolver
+{
+    int NumParticles;
+    int NumSystems;
+    int NumLanes; // The SIMD width
+    int NumBlocks;
+    int NumThreads; // Upper bound, 0 (after init) for all of Threads'
+    ThreadPool* Threads; // Steps the blocks, NULL (after init) for the calling thread only. Set by the caller, see DynamicsSolver.
+
+    std::vector<float> Masses;
+    std::vector<float> InverseMasses;
+    float TotalMass;
+
+    DistanceConstraintBatch DistanceConstraints;
+    PlaneConstraintBatch PlaneConstraints;
+
+    // Ground collision tests, in the order the single system solver generates them
+    std::vector<int> CollisionParticleIDs;
+    std::vector<float> CollisionRadiuses;
+    std::vector<int> CollisionUsesOldPositions; // 1 for the other end of a capsule, tested at its old position
+
+    std::vector<float> Positions;
+    std::vector<float> Velocities;
+
+    // Scratch, laid out like the state
+    std::vector<float> PredictedPositions;
+    std::vector<float> CollisionPoints; // Per block, collision test, xyz and lane
+    std::vector<float> CollisionMasks; // Per block, collision test and lane. Non-zero where the test generated a constraint.
+};
+
+DYNAMICS_API
+void InitDynamicsSolver(
+    DynamicsSolver* solver,
+    const float* particleMasses,
+    const Hull* particleHulls,
+    int numParticles,
+    const Constraint* constraints, int numConstraints);
+
+DYNAMICS_API
+void SolveDynamics(
+    DynamicsSolver* solver,
+    float deltaTimeSeconds,
+    const float* particleOldPositionXYZs,
+    const float* particleOldVelocityXYZs,
+    const float* particleExternalForceXYZs,
+    int numIterations,
+    float kdamping,
+    float* particleNewPositionXYZs,
+    float* particleNewVelocityXYZs);
+
+// Angular constraints are ignored, like they are by SolveDynamics.
+// The state of the systems is zero until it's set.
+DYNAMICS_API
+void InitDynamicsBatchSolver(
+    DynamicsBatchSolver* solver,
+    const float* particleMasses,
+    const Hull* particleHulls,
+    int numParticles,
+    const Constraint* constraints, int numConstraints,
+    int numSystems);
+
+DYNAMICS_API
+void SetDynamicsBatchSystem(
+    DynamicsBatchSolver* solver,
+    int systemIdx,
+    const float* particlePositionXYZs,
+    const float* particleVelocityXYZs);
+
+DYNAMICS_API
+void GetDynamicsBatchSystem(
+    const DynamicsBatchSolver* solver,
+    int systemIdx,
+    float* particlePositionXYZs,
+    float* particleVelocityXYZs);
+
+// Steps every system in place. The external forces are per particle and the same for all systems.
+DYNAMICS_API
+void SolveDynamicsBatch(
+    DynamicsBatchSolver* solver,
+    float deltaTimeSeconds,
+    const float* particleExternalForceXYZs,
+    int numIterations,
+    float kdamping);
+
+// Stateless version of SolveDynamics, builds a solver for a single step
+DYNAMICS_API
 void SimulateDynamics(
     float deltaTimeSeconds,
     const float* particleOldPositionXYZs,
@@ -125,4 +289,10 @@ void SimulateDynamics(
     float* particleNewPositionXYZs,
     float* particleNewVelocityXYZs);
 
-using PFNSIMULATEDYNAMICSPROC = decltype(SimulateDynamics)*;
\ No newline at end of file
+using PFNINITDYNAMICSSOLVERPROC = decltype(InitDynamicsSolver)*;
+using PFNSOLVEDYNAMICSPROC = decltype(SolveDynamics)*;
+using PFNINITDYNAMICSBATCHSOLVERPROC = decltype(InitDynamicsBatchSolver)*;
+using PFNSETDYNAMICSBATCHSYSTEMPROC = decltype(SetDynamicsBatchSystem)*;
+using PFNGETDYNAMICSBATCHSYSTEMPROC = decltype(GetDynamicsBatchSystem)*;
+using PFNSOLVEDYNAMICSBATCHPROC = decltype(SolveDynamicsBatch)*;
+using PFNSIMULATEDYNAMICSPROC = decltype(SimulateDynamics)*;
@@ -0,0 +1,669 @@
+#include "filewatcher.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define UNICODE 1
+#define NOMINMAX 1
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+static bool FilenamesEqual(const char* a, const char* b)
+{
+#ifdef _WIN32
+    return _stricmp(a, b) == 0;
+#else
+    return strcmp(a, b) == 0;
+#endif
+}
+
+#ifdef _WIN32
+
+struct FileWatcher::Platform
+{
+    struct DirectoryWatch
+    {
+        HANDLE Handle;
+        OVERLAPPED Overlapped;
+        DWORD Buffer[4096]; // FILE_NOTIFY_INFORMATION must be DWORD aligned
+    };
+
+    bool OK;
+    std::atomic<bool> Stopping;
+    HANDLE WakeEvent;
+
+    // Indexed by directory ID. Allocated one by one, since the OVERLAPPED can't move while a read is pending.
+    std::vector<std::unique_ptr<DirectoryWatch>> DirectoryWatches;
+
+    Platform()
+        : Stopping(false)
+    {
+        WakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+        OK = WakeEvent != NULL;
+    }
+
+    ~Platform()
+    {
+        for (std::unique_ptr<DirectoryWatch>& watch : DirectoryWatches)
+        {
+            if (watch->Handle != INVALID_HANDLE_VALUE)
+            {
+                // The buffer can't be freed before the pending read is done with it
+                DWORD size;
+                CancelIoEx(watch->Handle, &watch->Overlapped);
+                GetOverlappedResult(watch->Handle, &watch->Overlapped, &size, TRUE);
+                CloseHandle(watch->Handle);
+                CloseHandle(watch->Overlapped.hEvent);
+            }
+        }
+
+        if (WakeEvent)
+        {
+            CloseHandle(WakeEvent);
+        }
+    }
+
+    static bool IssueRead(DirectoryWatch* watch)
+    {
+        return ReadDirectoryChangesW(
+            watch->Handle, watch->Buffer, sizeof(watch->Buffer), FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME,
+            NULL, &watch->Overlapped, NULL) != 0;
+    }
+
+    void WatchDirectory(const char* path)
+    {
+        std::unique_ptr<DirectoryWatch> watch(new DirectoryWatch());
+        watch->Handle = INVALID_HANDLE_VALUE;
+
+        int pathBufferSize = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path, -1, NULL, 0);
+        if (pathBufferSize != 0)
+        {
+            std::vector<WCHAR> wpath(pathBufferSize);
+            if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path, -1, wpath.data(), pathBufferSize))
+            {
+                watch->Handle = CreateFileW(
+                    wpath.data(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                    NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+            }
+        }
+
+        if (watch->Handle != INVALID_HANDLE_VALUE)
+        {
+            watch->Overlapped.hEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+            // Issued here rather than by the watcher thread so changes made right after WatchFile returns aren't missed
+            if (!watch->Overlapped.hEvent || !IssueRead(watch.get()))
+            {
+                CloseHandle(watch->Handle);
+                if (watch->Overlapped.hEvent) CloseHandle(watch->Overlapped.hEvent);
+                watch->Handle = INVALID_HANDLE_VALUE;
+            }
+        }
+
+        if (watch->Handle == INVALID_HANDLE_VALUE)
+        {
+            fprintf(stderr, "Couldn't watch directory %s for changes\n", path);
+        }
+
+        DirectoryWatches.push_back(std::move(watch));
+
+        // Have the watcher thread wait on the new directory too
+        SetEvent(WakeEvent);
+    }
+
+    void WatchFile(int, const char*) { }
+
+    void Wake()
+    {
+        SetEvent(WakeEvent);
+    }
+};
+
+void FileWatcher::Run()
+{
+    std::vector<HANDLE> handles;
+    std::vector<int> handleDirectoryIDs;
+
+    for (;;)
+    {
+        handles.assign(1, Impl->WakeEvent);
+        handleDirectoryIDs.assign(1, -1);
+        {
+            std::lock_guard<std::mutex> lock(TablesMutex);
+            for (int directoryID = 0; directoryID < (int)Impl->DirectoryWatches.size(); directoryID++)
+            {
+                const Platform::DirectoryWatch* watch = Impl->DirectoryWatches[directoryID].get();
+                if (watch->Handle != INVALID_HANDLE_VALUE && handles.size() < MAXIMUM_WAIT_OBJECTS)
+                {
+                    handles.push_back(watch->Overlapped.hEvent);
+                    handleDirectoryIDs.push_back(directoryID);
+                }
+            }
+        }
+
+        DWORD result = WaitForMultipleObjects((DWORD)handles.size(), handles.data(), FALSE, INFINITE);
+        if (Impl->Stopping)
+        {
+            return;
+        }
+
+        if (result == WAIT_FAILED)
+        {
+            fprintf(stderr, "Error waiting for file changes: %u\n", (unsigned)GetLastError());
+            return;
+        }
+
+        int handleIdx = (int)(result - WAIT_OBJECT_0);
+        if (handleIdx <= 0 || handleIdx >= (int)handles.size())
+        {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(TablesMutex);
+
+        int directoryID = handleDirectoryIDs[handleIdx];
+        Platform::DirectoryWatch* watch = Impl->DirectoryWatches[directoryID].get();
+
+        DWORD size;
+        if (GetOverlappedResult(watch->Handle, &watch->Overlapped, &size, FALSE))
+        {
+            if (size == 0)
+            {
+                // The system's buffer overflowed, so which files changed is unknown
+                QueueOverflowed.store(true, std::memory_order_release);
+            }
+
+            const char* entry = (const char*)watch->Buffer;
+            while (size != 0)
+            {
+                const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)entry;
+                if (info->Action == FILE_ACTION_MODIFIED ||
+                    info->Action == FILE_ACTION_ADDED ||
+                    info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+                {
+                    int nameLength = (int)(info->FileNameLength / sizeof(WCHAR));
+                    char name[MAX_PATH * 3 + 1];
+                    int nameSize = WideCharToMultiByte(CP_UTF8, 0, info->FileName, nameLength, name, sizeof(name) - 1, NULL, NULL);
+                    if (nameSize > 0)
+                    {
+                        name[nameSize] = '\0';
+                        PostChangesInDirectory(directoryID, name);
+                    }
+                }
+
+                if (info->NextEntryOffset == 0)
+                {
+                    break;
+                }
+                entry += info->NextEntryOffset;
+            }
+        }
+        else
+        {
+            QueueOverflowed.store(true, std::memory_order_release);
+        }
+
+        if (!Platform::IssueRead(watch))
+        {
+            fprintf(stderr, "Stopped watching directory %s for changes\n", Directories[directoryID].Path.c_str());
+            CloseHandle(watch->Handle);
+            CloseHandle(watch->Overlapped.hEvent);
+            watch->Handle = INVALID_HANDLE_VALUE;
+        }
+    }
+}
+
+#elif defined(__APPLE__)
+
+// kqueue only reports changes to open files, so each file is watched as well as its directory.
+// When the directory changes, files that were replaced by another are reopened.
+struct FileWatcher::Platform
+{
+    bool OK;
+    std::atomic<bool> Stopping;
+    int KQueue;
+
+    // Indexed by directory and file ID
+    std::vector<int> DirectoryFDs;
+    std::vector<int> FileFDs;
+    std::vector<ino_t> FileInodes;
+
+    // The event's udata is the ID, with the lowest bit set for directories
+    static void* EncodeUserData(int id, bool isDirectory)
+    {
+        return (void*)(((intptr_t)id << 1) | (isDirectory ? 1 : 0));
+    }
+
+    Platform()
+        : Stopping(false)
+    {
+        KQueue = kqueue();
+        OK = KQueue != -1;
+        if (!OK)
+        {
+            perror("kqueue");
+            return;
+        }
+
+        struct kevent wakeEvent;
+        EV_SET(&wakeEvent, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+        if (kevent(KQueue, &wakeEvent, 1, NULL, 0, NULL) == -1)
+        {
+            perror("kevent");
+            OK = false;
+        }
+    }
+
+    ~Platform()
+    {
+        for (int fd : DirectoryFDs) if (fd != -1) close(fd);
+        for (int fd : FileFDs) if (fd != -1) close(fd);
+        if (KQueue != -1) close(KQueue);
+    }
+
+    void WatchDirectory(const char* path)
+    {
+        int directoryID = (int)DirectoryFDs.size();
+        int fd = open(path, O_EVTONLY);
+        if (fd != -1)
+        {
+            struct kevent change;
+            EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, EncodeUserData(directoryID, true));
+            if (kevent(KQueue, &change, 1, NULL, 0, NULL) == -1)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        if (fd == -1)
+        {
+            perror(path);
+        }
+
+        DirectoryFDs.push_back(fd);
+    }
+
+    // Also used to reopen a file that was replaced
+    void WatchFile(int fileID, const char* path)
+    {
+        if (fileID >= (int)FileFDs.size())
+        {
+            FileFDs.resize(fileID + 1, -1);
+            FileInodes.resize(fileID + 1, 0);
+        }
+
+        // Closing the file also removes its events
+        if (FileFDs[fileID] != -1)
+        {
+            close(FileFDs[fileID]);
+            FileFDs[fileID] = -1;
+        }
+        FileInodes[fileID] = 0;
+
+        int fd = open(path, O_EVTONLY);
+        if (fd == -1)
+        {
+            // Might not exist yet, the directory's events will tell when it does
+            return;
+        }
+
+        struct stat buf;
+        struct kevent change;
+        EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB, 0, EncodeUserData(fileID, false));
+        if (fstat(fd, &buf) == -1 || kevent(KQueue, &change, 1, NULL, 0, NULL) == -1)
+        {
+            perror(path);
+            close(fd);
+            return;
+        }
+
+        FileFDs[fileID] = fd;
+        FileInodes[fileID] = buf.st_ino;
+    }
+
+    void Wake()
+    {
+        struct kevent wakeEvent;
+        EV_SET(&wakeEvent, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+        kevent(KQueue, &wakeEvent, 1, NULL, 0, NULL);
+    }
+};
+
+void FileWatcher::Run()
+{
+    struct kevent events[32];
+
+    for (;;)
+    {
+        int numEvents = kevent(Impl->KQueue, NULL, 0, events, sizeof(events) / sizeof(*events), NULL);
+        if (Impl->Stopping)
+        {
+            return;
+        }
+
+        if (numEvents == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("kevent");
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(TablesMutex);
+
+        for (int eventIdx = 0; eventIdx < numEvents; eventIdx++)
+        {
+            if (events[eventIdx].filter != EVFILT_VNODE)
+            {
+                continue;
+            }
+
+            intptr_t userData = (intptr_t)events[eventIdx].udata;
+            int id = (int)(userData >> 1);
+
+            if (userData & 1)
+            {
+                // A file of the directory was created, deleted or renamed, see which of the watched ones were replaced
+                for (int fileID = 0; fileID < (int)Files.size(); fileID++)
+                {
+                    if (Files[fileID].DirectoryID != id)
+                    {
+                        continue;
+                    }
+
+                    struct stat buf;
+                    if (stat(Files[fileID].Path.c_str(), &buf) == 0 && buf.st_ino != Impl->FileInodes[fileID])
+                    {
+                        Impl->WatchFile(fileID, Files[fileID].Path.c_str());
+                        PostChange(fileID);
+                    }
+                }
+            }
+            else
+            {
+                PostChange(id);
+            }
+        }
+    }
+}
+
+#elif defined(__linux__)
+
+struct FileWatcher::Platform
+{
+    bool OK;
+    std::atomic<bool> Stopping;
+    int InotifyFD;
+    int WakePipe[2];
+
+    // Watch descriptors, indexed by directory ID
+    std::vector<int> DirectoryWatches;
+
+    Platform()
+        : Stopping(false)
+    {
+        InotifyFD = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (InotifyFD == -1)
+        {
+            perror("inotify_init1");
+        }
+
+        if (pipe(WakePipe) == -1)
+        {
+            perror("pipe");
+            WakePipe[0] = WakePipe[1] = -1;
+        }
+
+        OK = InotifyFD != -1 && WakePipe[0] != -1;
+    }
+
+    ~Platform()
+    {
+        if (InotifyFD != -1) close(InotifyFD);
+        if (WakePipe[0] != -1) close(WakePipe[0]);
+        if (WakePipe[1] != -1) close(WakePipe[1]);
+    }
+
+    void WatchDirectory(const char* path)
+    {
+        // Editors either write the file in place or rename a new one over it
+        int wd = OK ? inotify_add_watch(InotifyFD, path, IN_CLOSE_WRITE | IN_MOVED_TO) : -1;
+        if (OK && wd == -1)
+        {
+            perror(path);
+        }
+        DirectoryWatches.push_back(wd);
+    }
+
+    void WatchFile(int, const char*) { }
+
+    void Wake()
+    {
+        char c = 0;
+        if (write(WakePipe[1], &c, 1) == -1)
+        {
+            perror("write");
+        }
+    }
+};
+
+void FileWatcher::Run()
+{
+    alignas(inotify_event) char buffer[4096];
+
+    for (;;)
+    {
+        pollfd fds[2] = {
+            { Impl->InotifyFD, POLLIN, 0 },
+            { Impl->WakePipe[0], POLLIN, 0 }
+        };
+
+        int numReady = poll(fds, 2, -1);
+        if (Impl->Stopping)
+        {
+            return;
+        }
+
+        if (numReady == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            return;
+        }
+
+        ssize_t size = read(Impl->InotifyFD, buffer, sizeof(buffer));
+        if (size <= 0)
+        {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(TablesMutex);
+
+        for (const char* entry = buffer; entry < buffer + size; )
+        {
+            const inotify_event* event = (const inotify_event*)entry;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                QueueOverflowed.store(true, std::memory_order_release);
+            }
+            else if (event->len > 0)
+            {
+                // The same directory can be watched through different paths, which share the watch descriptor
+                for (int directoryID = 0; directoryID < (int)Impl->DirectoryWatches.size(); directoryID++)
+                {
+                    if (Impl->DirectoryWatches[directoryID] == event->wd)
+                    {
+                        PostChangesInDirectory(directoryID, event->name);
+                    }
+                }
+            }
+            entry += sizeof(inotify_event) + event->len;
+        }
+    }
+}
+
+#else
+
+// No file watching for this platform, changes are never reported
+struct FileWatcher::Platform
+{
+    bool OK;
+    std::atomic<bool> Stopping;
+
+    Platform()
+        : OK(false), Stopping(false)
+    { }
+
+    void WatchDirectory(const char*) { }
+    void WatchFile(int, const char*) { }
+    void Wake() { }
+};
+
+void FileWatcher::Run()
+{ }
+
+#endif
+
+FileWatcher::FileWatcher()
+    : QueueHead(0)
+    , QueueTail(0)
+    , QueueOverflowed(false)
+    , Impl(new Platform())
+{
+    if (Impl->OK)
+    {
+        Thread = std::thread(&FileWatcher::Run, this);
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (Thread.joinable())
+    {
+        Impl->Stopping = true;
+        Impl->Wake();
+        Thread.join();
+    }
+}
+
+int FileWatcher::WatchFile(const char* path)
+{
+    std::lock_guard<std::mutex> lock(TablesMutex);
+
+    for (int fileID = 0; fileID < (int)Files.size(); fileID++)
+    {
+        if (Files[fileID].Path == path)
+        {
+            return fileID;
+        }
+    }
+
+    WatchedFile file;
+    file.Path = path;
+
+    size_t separator = file.Path.find_last_of("/\\");
+    std::string directoryPath;
+    if (separator == std::string::npos)
+    {
+        directoryPath = ".";
+        file.Name = file.Path;
+    }
+    else
+    {
+        directoryPath = separator == 0 ? "/" : file.Path.substr(0, separator);
+        file.Name = file.Path.substr(separator + 1);
+    }
+
+    file.DirectoryID = -1;
+    for (int directoryID = 0; directoryID < (int)Directories.size(); directoryID++)
+    {
+        if (FilenamesEqual(Directories[directoryID].Path.c_str(), directoryPath.c_str()))
+        {
+            file.DirectoryID = directoryID;
+            break;
+        }
+    }
+
+    if (file.DirectoryID == -1)
+    {
+        file.DirectoryID = (int)Directories.size();
+        Impl->WatchDirectory(directoryPath.c_str());
+
+        WatchedDirectory directory;
+        directory.Path = directoryPath;
+        Directories.push_back(directory);
+    }
+
+    int fileID = (int)Files.size();
+    Files.push_back(file);
+    Impl->WatchFile(fileID, path);
+
+    return fileID;
+}
+
+bool FileWatcher::PollChange(int* fileID)
+{
+    // Changes were dropped, so report them all and discard what's queued since it's covered
+    if (QueueOverflowed.load(std::memory_order_relaxed) && QueueOverflowed.exchange(false, std::memory_order_acquire))
+    {
+        QueueHead.store(QueueTail.load(std::memory_order_acquire), std::memory_order_release);
+        *fileID = -1;
+        return true;
+    }
+
+    uint32_t head = QueueHead.load(std::memory_order_relaxed);
+    if (head == QueueTail.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    *fileID = Queue[head % kQueueSize];
+    QueueHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+void FileWatcher::PostChange(int fileID)
+{
+    uint32_t tail = QueueTail.load(std::memory_order_relaxed);
+    if (tail - QueueHead.load(std::memory_order_acquire) == kQueueSize)
+    {
+        QueueOverflowed.store(true, std::memory_order_release);
+        return;
+    }
+
+    Queue[tail % kQueueSize] = fileID;
+    QueueTail.store(tail + 1, std::memory_order_release);
+}
+
+void FileWatcher::PostChangesInDirectory(int directoryID, const char* name)
+{
+    for (int fileID = 0; fileID < (int)Files.size(); fileID++)
+    {
+        if (Files[fileID].DirectoryID == directoryID && FilenamesEqual(Files[fileID].Name.c_str(), name))
+        {
+            PostChange(fileID);
+        }
+    }
+}
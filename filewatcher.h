@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Watches files for changes on a background thread, which posts the IDs of changed files to a lock-free queue.
+// Polling the queue makes no system calls, so it can be done every frame.
+// The directories of the files are watched, so files replaced by renaming over them (as many editors save) are seen too.
+// Backed by inotify on Linux, kqueue on OS X and ReadDirectoryChangesW on Windows. Other platforms see no changes.
+class FileWatcher
+{
+    static const int kQueueSize = 256; // Power of two
+
+    struct WatchedFile
+    {
+        std::string Path; // As given to WatchFile
+        std::string Name; // Filename within its directory
+        int DirectoryID;
+    };
+
+    struct WatchedDirectory
+    {
+        std::string Path;
+    };
+
+    // Handles of the platform's API
+    struct Platform;
+
+    // Tables shared with the watcher thread. Only WatchFile and the watcher thread lock this, never PollChange.
+    std::mutex TablesMutex;
+    std::vector<WatchedFile> Files;
+    std::vector<WatchedDirectory> Directories;
+
+    // Single producer (watcher thread), single consumer queue of changed file IDs
+    int Queue[kQueueSize];
+    std::atomic<uint32_t> QueueHead; // Next entry read by the consumer
+    std::atomic<uint32_t> QueueTail; // Next entry written by the producer
+    std::atomic<bool> QueueOverflowed; // Changes were dropped because the queue was full
+
+    std::unique_ptr<Platform> Impl;
+    std::thread Thread;
+
+    void PostChange(int fileID);
+    void PostChangesInDirectory(int directoryID, const char* name);
+    void Run();
+
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Starts watching a file and returns its ID. Watching the same path again returns the same ID.
+    // Only changes made after this returns are reported.
+    int WatchFile(const char* path);
+
+    // Pops the ID of a changed file, returns false when there are none left.
+    // A file that changed several times can be reported several times.
+    // The ID is -1 if changes were dropped, then every file should be considered changed.
+    bool PollChange(int* fileID);
+};
@@ -0,0 +1,159 @@
+#include "framestats.h"
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+void InitFrameStats(FrameStats* stats, float budget_ms)
+{
+    *stats = FrameStats();
+    stats->Budget_ms = budget_ms;
+    stats->CPUFrameTimes_ms.resize(FRAME_STATS_HISTORY_SIZE);
+    stats->GPUFrameTimes_ms.resize(FRAME_STATS_HISTORY_SIZE);
+}
+
+static int GetFrameStatsScope(FrameStats* stats, const char* name, bool isGPU, int depth)
+{
+    std::unordered_map<const char*, int>& scopeIDs = isGPU ? stats->GPUScopeIDs : stats->CPUScopeIDs;
+
+    auto found = scopeIDs.find(name);
+    if (found != scopeIDs.end())
+    {
+        return found->second;
+    }
+
+    FrameStatsScope scope;
+    scope.Name = name;
+    scope.IsGPU = isGPU;
+    scope.Depth = depth;
+    scope.Times_ms.resize(FRAME_STATS_HISTORY_SIZE);
+    scope.Mean_ms = 0.0f;
+
+    int scopeID = (int)stats->Scopes.size();
+    stats->Scopes.push_back(std::move(scope));
+    scopeIDs.emplace(name, scopeID);
+    return scopeID;
+}
+
+void RecordFrameStats(FrameStats* stats, const std::vector<GPUMarker>& gpuMarkers, const std::vector<CPUMarker>& cpuMarkers)
+{
+    if (cpuMarkers.empty())
+    {
+        return;
+    }
+
+    int index = stats->NextIndex;
+    int frame = cpuMarkers[0].Frame;
+
+    for (FrameStatsScope& scope : stats->Scopes)
+    {
+        scope.Times_ms[index] = 0.0f;
+    }
+
+    float cpuFrameTime_ms = 0.0f;
+    for (const CPUMarker& marker : cpuMarkers)
+    {
+        float time_ms = marker.TimeElapsed / 1e6f;
+        if (marker.ThreadIdx == 0 && marker.Depth == 0)
+        {
+            cpuFrameTime_ms += time_ms;
+        }
+        stats->Scopes[GetFrameStatsScope(stats, marker.Name, false, marker.Depth)].Times_ms[index] += time_ms;
+    }
+
+    float gpuFrameTime_ms = 0.0f;
+    for (const GPUMarker& marker : gpuMarkers)
+    {
+        float time_ms = marker.TimeElapsed / 1e6f;
+        if (marker.Depth == 0)
+        {
+            gpuFrameTime_ms += time_ms;
+        }
+        stats->Scopes[GetFrameStatsScope(stats, marker.Name, true, marker.Depth)].Times_ms[index] += time_ms;
+    }
+
+    stats->CPUFrameTimes_ms[index] = cpuFrameTime_ms;
+    stats->GPUFrameTimes_ms[index] = gpuFrameTime_ms;
+
+    bool cpuOverBudget = cpuFrameTime_ms > stats->Budget_ms;
+    bool gpuOverBudget = gpuFrameTime_ms > stats->Budget_ms;
+    if (cpuOverBudget || gpuOverBudget)
+    {
+        // Blame the scope furthest above its usual cost, on the side that went over budget.
+        // The CPU frame marker contains everything else, so it's never the culprit.
+        bool isGPU = !cpuOverBudget || (gpuOverBudget && gpuFrameTime_ms > cpuFrameTime_ms);
+
+        FrameStatsHitch& hitch = stats->Hitches[stats->NumHitches % FRAME_STATS_MAX_HITCHES];
+        hitch.Frame = frame;
+        hitch.FrameTime_ms = isGPU ? gpuFrameTime_ms : cpuFrameTime_ms;
+        hitch.IsGPU = isGPU;
+        hitch.ScopeID = -1;
+        hitch.ScopeExcess_ms = 0.0f;
+
+        for (int scopeID = 0; scopeID < (int)stats->Scopes.size(); scopeID++)
+        {
+            const FrameStatsScope& scope = stats->Scopes[scopeID];
+            if (scope.IsGPU != isGPU || (!isGPU && scope.Depth == 0))
+            {
+                continue;
+            }
+
+            float excess_ms = scope.Times_ms[index] - scope.Mean_ms;
+            if (excess_ms > hitch.ScopeExcess_ms)
+            {
+                hitch.ScopeID = scopeID;
+                hitch.ScopeExcess_ms = excess_ms;
+            }
+        }
+
+        stats->NumHitches++;
+    }
+
+    // Updated after looking for the culprit, so a spike doesn't raise its own baseline first
+    for (FrameStatsScope& scope : stats->Scopes)
+    {
+        float weight = 0.02f;
+        scope.Mean_ms = weight * scope.Times_ms[index] + (1.0f - weight) * scope.Mean_ms;
+    }
+
+    stats->NextIndex = (stats->NextIndex + 1) % FRAME_STATS_HISTORY_SIZE;
+    stats->NumFrames = std::min(stats->NumFrames + 1, FRAME_STATS_HISTORY_SIZE);
+}
+
+FrameStatsPercentiles ComputeFrameStatsPercentiles(const FrameStats* stats, const std::vector<float>& times_ms)
+{
+    FrameStatsPercentiles percentiles;
+    memset(&percentiles, 0, sizeof(percentiles));
+    if (stats->NumFrames == 0)
+    {
+        return percentiles;
+    }
+
+    // Recorded frames are the first NumFrames until the buffer wraps, and all of it after
+    std::vector<float> sorted(begin(times_ms), begin(times_ms) + stats->NumFrames);
+    std::sort(begin(sorted), end(sorted));
+
+    auto percentile = [&sorted](float p)
+    {
+        int idx = std::min((int)(p * sorted.size()), (int)sorted.size() - 1);
+        return sorted[idx];
+    };
+
+    percentiles.Min_ms = sorted.front();
+    percentiles.P50_ms = percentile(0.50f);
+    percentiles.P95_ms = percentile(0.95f);
+    percentiles.P99_ms = percentile(0.99f);
+    percentiles.Max_ms = sorted.back();
+    return percentiles;
+}
+
+void ComputeFrameStatsHistogram(const FrameStats* stats, const std::vector<float>& times_ms, float maxTime_ms, int numBins, float* bins)
+{
+    std::fill(bins, bins + numBins, 0.0f);
+    for (int frameIdx = 0; frameIdx < stats->NumFrames; frameIdx++)
+    {
+        int bin = (int)(times_ms[frameIdx] / maxTime_ms * numBins);
+        bins[std::min(std::max(bin, 0), numBins - 1)] += 1.0f;
+    }
+}
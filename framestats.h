@@ -0,0 +1,77 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+struct GPUMarker;
+struct CPUMarker;
+
+// Number of frames of history kept for each scope
+#define FRAME_STATS_HISTORY_SIZE 4096
+
+// Number of over budget frames kept for display
+#define FRAME_STATS_MAX_HITCHES 16
+
+// Elapsed time of one profiler scope over the last frames, summed over all its markers in each frame
+struct FrameStatsScope
+{
+    const char* Name; // Interned by the profiler
+    bool IsGPU;
+    int Depth; // Depth of its first marker
+    std::vector<float> Times_ms; // Cyclic buffer indexed like FrameStats::NextIndex
+    float Mean_ms; // Exponential moving average, used as the scope's usual cost
+};
+
+// A frame that went over budget, and the scope that was furthest above its usual cost
+struct FrameStatsHitch
+{
+    int Frame;
+    float FrameTime_ms;
+    bool IsGPU; // The GPU was over budget, rather than the CPU
+    int ScopeID; // -1 if no scope stood out
+    float ScopeExcess_ms;
+};
+
+struct FrameStatsPercentiles
+{
+    float Min_ms;
+    float P50_ms;
+    float P95_ms;
+    float P99_ms;
+    float Max_ms;
+};
+
+struct FrameStats
+{
+    float Budget_ms; // Frames taking longer on the CPU or GPU are hitches
+
+    int NumFrames; // Frames recorded, up to FRAME_STATS_HISTORY_SIZE
+    int NextIndex; // Where the next frame goes, also the oldest frame once full
+
+    std::vector<float> CPUFrameTimes_ms; // Time of the main thread's frame marker
+    std::vector<float> GPUFrameTimes_ms; // Sum of the top level GPU markers
+    std::vector<FrameStatsScope> Scopes;
+    std::unordered_map<const char*, int> CPUScopeIDs;
+    std::unordered_map<const char*, int> GPUScopeIDs;
+
+    FrameStatsHitch Hitches[FRAME_STATS_MAX_HITCHES]; // Cyclic buffer
+    int NumHitches; // Hitches since the start
+};
+
+void InitFrameStats(FrameStats* stats, float budget_ms);
+
+// Adds the markers of one frame read back from the profiler
+void RecordFrameStats(FrameStats* stats, const std::vector<GPUMarker>& gpuMarkers, const std::vector<CPUMarker>& cpuMarkers);
+
+// Percentiles of the recorded frames of a cyclic buffer of times
+FrameStatsPercentiles ComputeFrameStatsPercentiles(const FrameStats* stats, const std::vector<float>& times_ms);
+
+// Counts the recorded frames in numBins bins evenly covering [0, maxTime_ms], the last bin also counts longer frames
+void ComputeFrameStatsHistogram(const FrameStats* stats, const std::vector<float>& times_ms, float maxTime_ms, int numBins, float* bins);
+
+// Time of a recorded frame, 0 is the oldest
+inline float GetFrameStatsTime(const FrameStats* stats, const std::vector<float>& times_ms, int frameIdx)
+{
+    int oldest = stats->NumFrames < FRAME_STATS_HISTORY_SIZE ? 0 : stats->NextIndex;
+    return times_ms[(oldest + frameIdx) % FRAME_STATS_HISTORY_SIZE];
+}
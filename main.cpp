@@ -8,8 +8,12 @@
 #include "renderer.h"
 #include "scene.h"
 #include "mysdl_dpi.h"
+#include "benchmark.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 
 extern "C"
@@ -17,6 +21,65 @@ int main(int argc, char *argv[])
 {
     MySDL_SetDPIAwareness_MustBeFirstWSICallInProgram();
 
+    // --trace <frames> [--trace-file <file>] captures the first frames' profiling into a trace file.
+    // --benchmark <frames> [--benchmark-report <file>] [--software] runs a fixed number of frames in a hidden window and reports timings.
+    // --shader-cache <directory> sets where program binaries are cached, --no-shader-cache always compiles shaders from source.
+    int traceFrames = 0;
+    const char* traceFilename = "trace.json";
+    BenchmarkSettings benchmark;
+    benchmark.NumFrames = 0;
+    benchmark.NumWarmupFrames = 60;
+    benchmark.FrameTime_ms = 1000 / 60;
+    benchmark.ReportFilename = "benchmark.json";
+    bool softwareRendering = false;
+    for (int argIdx = 1; argIdx < argc; argIdx++)
+    {
+        if (strcmp(argv[argIdx], "--trace") == 0 && argIdx + 1 < argc)
+        {
+            traceFrames = atoi(argv[++argIdx]);
+        }
+        else if (strcmp(argv[argIdx], "--trace-file") == 0 && argIdx + 1 < argc)
+        {
+            traceFilename = argv[++argIdx];
+        }
+        else if (strcmp(argv[argIdx], "--benchmark") == 0 && argIdx + 1 < argc)
+        {
+            benchmark.NumFrames = atoi(argv[++argIdx]);
+        }
+        else if (strcmp(argv[argIdx], "--benchmark-report") == 0 && argIdx + 1 < argc)
+        {
+            benchmark.ReportFilename = argv[++argIdx];
+        }
+        else if (strcmp(argv[argIdx], "--software") == 0)
+        {
+            softwareRendering = true;
+        }
+        else if (strcmp(argv[argIdx], "--shader-cache") == 0 && argIdx + 1 < argc)
+        {
+            SetProgramBinaryCacheDirectory(argv[++argIdx]);
+        }
+        else if (strcmp(argv[argIdx], "--no-shader-cache") == 0)
+        {
+            SetProgramBinaryCacheDirectory(NULL);
+        }
+    }
+    bool isBenchmark = benchmark.NumFrames > 0;
+
+    // Mesa's llvmpipe, for machines without a GPU
+    if (softwareRendering)
+    {
+        SDL_setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+        SDL_setenv("GALLIUM_DRIVER", "llvmpipe", 1);
+    }
+
+#if defined(__linux__)
+    // Without a display server, SDL's offscreen driver renders to an EGL surfaceless context
+    if (isBenchmark && !SDL_getenv("DISPLAY") && !SDL_getenv("WAYLAND_DISPLAY"))
+    {
+        SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+    }
+#endif
+
     if (SDL_Init(SDL_INIT_EVERYTHING))
     {
         fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
@@ -31,9 +94,11 @@ int main(int argc, char *argv[])
 #endif
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
-    // Enable multisampling
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
+    // Multisampling is done in the renderer's backbuffer, which is resolved into the window.
+    // The window itself is single sampled, so the backbuffer can be resolved and upscaled into it at any sample count.
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 0);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 0);
+    const int kNumBackbufferSamples = 4;
 
     // Enable SRGB
     SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, 1);
@@ -54,6 +119,10 @@ int main(int argc, char *argv[])
     }
 
     Uint32 windowFlags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
+    if (isBenchmark)
+    {
+        windowFlags |= SDL_WINDOW_HIDDEN;
+    }
 #ifdef _WIN32
     // highdpi doesn't work on Mac yet because we have to set the NSHighResolutionCapable Info.plist property
     windowFlags |= SDL_WINDOW_ALLOW_HIGHDPI;
@@ -79,6 +148,12 @@ int main(int argc, char *argv[])
 
     InitGL();
 
+    if (isBenchmark)
+    {
+        // Measure the frames, not the display's refresh rate
+        SDL_GL_SetSwapInterval(0);
+    }
+
     Renderer renderer{};
     InitRenderer(&renderer);
 
@@ -92,15 +167,20 @@ int main(int argc, char *argv[])
         int windowWidth, windowHeight;
         SDL_GetWindowSize(window, &windowWidth, &windowHeight);
 
-        int numSamples;
-        SDL_GL_GetAttribute(SDL_GL_MULTISAMPLESAMPLES, &numSamples);
-
-        ResizeRenderer(&renderer,windowWidth, windowHeight, drawableWidth, drawableHeight, numSamples);
+        ResizeRenderer(&renderer,windowWidth, windowHeight, drawableWidth, drawableHeight, kNumBackbufferSamples);
     }
 
     Scene scene = Scene();
     InitScene(&scene);
 
+    if (traceFrames > 0)
+    {
+        StartTraceCapture(&scene.Trace, &scene.Profiling, traceFilename, traceFrames);
+    }
+
+    BenchmarkRun benchmarkRun;
+    int benchmarkFrameIdx = -benchmark.NumWarmupFrames;
+
     bool guiFocusEnabled = true;
     auto updateGuiFocus = [&] 
     {
@@ -153,10 +233,7 @@ int main(int argc, char *argv[])
                     int windowWidth, windowHeight;
                     SDL_GetWindowSize(window, &windowWidth, &windowHeight);
 
-                    int numSamples;
-                    SDL_GL_GetAttribute(SDL_GL_MULTISAMPLESAMPLES, &numSamples);
-
-                    ResizeRenderer(&renderer, windowWidth, windowHeight, drawableWidth, drawableHeight, numSamples);
+                    ResizeRenderer(&renderer, windowWidth, windowHeight, drawableWidth, drawableHeight, kNumBackbufferSamples);
                 }
             }
             else if (ev.type == SDL_KEYDOWN)
@@ -189,6 +266,29 @@ int main(int argc, char *argv[])
         Uint32 currTicks = SDL_GetTicks();
         Uint32 deltaTicks = currTicks - lastTicks;
 
+        if (isBenchmark)
+        {
+            if (benchmarkFrameIdx == benchmark.NumFrames)
+            {
+                WriteBenchmarkReport(&scene, benchmark, benchmarkRun);
+                goto endmainloop;
+            }
+
+            if (benchmarkFrameIdx == 0)
+            {
+                StartBenchmarkMeasurement(&scene, &benchmarkRun);
+            }
+
+            ApplyBenchmarkCamera(&scene, std::max(benchmarkFrameIdx, 0), benchmark.NumFrames);
+            deltaTicks = benchmark.FrameTime_ms;
+
+            // Shaders can take several frames to compile, the warmup only starts after
+            if (scene.ShaderStartup_ms >= 0.0f)
+            {
+                benchmarkFrameIdx++;
+            }
+        }
+
         UpdateScene(&scene, window, deltaTicks);
         PaintRenderer(&renderer, window, &scene);
 
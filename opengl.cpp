@@ -6,6 +6,7 @@
 
 #include <vector>
 #include <cstdio>
+#include <cstring>
 
 #ifdef _MSC_VER
 #define BREAKPOINT __debugbreak()
@@ -47,6 +48,22 @@ void CheckErrorGL(const char* description)
     }
 }
 
+bool HasExtensionGL(const char* name)
+{
+    GLint numExtensions;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+
+    for (int i = 0; i < numExtensions; i++)
+    {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 const char* FramebufferStatusToStringGL(GLenum err)
 {
     const char* errmsg = NULL;
@@ -140,6 +157,7 @@ void InitGL()
 {
     GetProcGL(glGetFloatv, "glGetFloatv");
     GetProcGL(glGetIntegerv, "glGetIntegerv");
+    GetProcGL(glGetInteger64v, "glGetInteger64v");
     GetProcGL(glGetStringi, "glGetStringi");
     GetProcGL(glGetString, "glGetString");
     GetProcGL(glClear, "glClear");
@@ -160,16 +178,20 @@ void InitGL()
     GetProcGL(glDeleteBuffers, "glDeleteBuffers");
     GetProcGL(glBindBuffer, "glBindBuffer");
     GetProcGL(glBindBufferBase, "glBindBufferBase");
+    GetProcGL(glBindBufferRange, "glBindBufferRange");
     GetProcGL(glBufferData, "glBufferData");
     GetProcGL(glBufferSubData, "glBufferSubData");
     GetProcGL(glMapBuffer, "glMapBuffer");
     GetProcGL(glUnmapBuffer, "glUnmapBuffer");
+    GetProcGL(glMapBufferRange, "glMapBufferRange");
+    GetProcGL(glFlushMappedBufferRange, "glFlushMappedBufferRange");
     GetProcGL(glGenVertexArrays, "glGenVertexArrays");
     GetProcGL(glDeleteVertexArrays, "glDeleteVertexArrays");
     GetProcGL(glBindVertexArray, "glBindVertexArray");
     GetProcGL(glEnableVertexAttribArray, "glEnableVertexAttribArray");
     GetProcGL(glVertexAttribPointer, "glVertexAttribPointer");
     GetProcGL(glVertexAttribIPointer, "glVertexAttribIPointer");
+    GetProcGL(glVertexAttribDivisor, "glVertexAttribDivisor");
     GetProcGL(glCreateShader, "glCreateShader");
     GetProcGL(glDeleteShader, "glDeleteShader");
     GetProcGL(glShaderSource, "glShaderSource");
@@ -183,10 +205,14 @@ void InitGL()
     GetProcGL(glDetachShader, "glDetachShader");
     GetProcGL(glGetProgramiv, "glGetProgramiv");
     GetProcGL(glGetProgramInfoLog, "glGetProgramInfoLog");
+    GetProcGL(glProgramParameteri, "glProgramParameteri");
+    GetProcGL(glGetProgramBinary, "glGetProgramBinary");
+    GetProcGL(glProgramBinary, "glProgramBinary");
     GetProcGL(glUseProgram, "glUseProgram");
     GetProcGL(glGetAttribLocation, "glGetAttribLocation");
     GetProcGL(glGetUniformLocation, "glGetUniformLocation");
     GetProcGL(glUniform1i, "glUniform1i");
+    GetProcGL(glUniform2i, "glUniform2i");
     GetProcGL(glUniform2f, "glUniform2f");
     GetProcGL(glUniform3fv, "glUniform3fv");
     GetProcGL(glUniformMatrix4fv, "glUniformMatrix4fv");
@@ -204,6 +230,8 @@ void InitGL()
     GetProcGL(glGenerateMipmap, "glGenerateMipmap");
     GetProcGL(glDrawElements, "glDrawElements");
     GetProcGL(glDrawArrays, "glDrawArrays");
+    GetProcGL(glDrawArraysInstanced, "glDrawArraysInstanced");
+    GetProcGL(glDrawElementsInstanced, "glDrawElementsInstanced");
     GetProcGL(glDrawElementsInstancedBaseVertex, "glDrawElementsInstancedBaseVertex");
     GetProcGL(glGenFramebuffers, "glGenFramebuffers");
     GetProcGL(glDeleteFramebuffers, "glDeleteFramebuffers");
@@ -225,11 +253,40 @@ void InitGL()
     GetProcGL(glEndQuery, "glEndQuery");
     GetProcGL(glGetQueryObjectiv, "glGetQueryObjectiv");
     GetProcGL(glGetQueryObjectuiv, "glGetQueryObjectuiv");
+    GetProcGL(glGetQueryObjectui64v, "glGetQueryObjectui64v");
+    GetProcGL(glGetQueryiv, "glGetQueryiv");
+    GetProcGL(glQueryCounter, "glQueryCounter");
+    GetProcGL(glFenceSync, "glFenceSync");
+    GetProcGL(glClientWaitSync, "glClientWaitSync");
+    GetProcGL(glDeleteSync, "glDeleteSync");
 
     GLint majorVersion, minorVersion;
     glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
     glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
 
+    // Optional entry points. These stay NULL when unsupported (eg. OS X is stuck on 4.1)
+    if (majorVersion > 4 || (majorVersion == 4 && minorVersion >= 4) || HasExtensionGL("GL_ARB_buffer_storage"))
+    {
+        GetProcGL(glBufferStorage, "glBufferStorage");
+    }
+
+    if (majorVersion > 4 || (majorVersion == 4 && minorVersion >= 3) ||
+        (HasExtensionGL("GL_ARB_compute_shader") && HasExtensionGL("GL_ARB_shader_storage_buffer_object")))
+    {
+        GetProcGL(glDispatchCompute, "glDispatchCompute");
+        GetProcGL(glMemoryBarrier, "glMemoryBarrier");
+    }
+
+    // The ARB version has the same enums and semantics
+    if (HasExtensionGL("GL_KHR_parallel_shader_compile"))
+    {
+        GetProcGL(glMaxShaderCompilerThreadsKHR, "glMaxShaderCompilerThreadsKHR");
+    }
+    else if (HasExtensionGL("GL_ARB_parallel_shader_compile"))
+    {
+        GetProcGL(glMaxShaderCompilerThreadsKHR, "glMaxShaderCompilerThreadsARB");
+    }
+
     int contextFlags;
     glGetIntegerv(GL_CONTEXT_FLAGS, &contextFlags);
 
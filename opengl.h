@@ -6,9 +6,15 @@
 #define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
 #define GL_TEXTURE_MAX_ANISOTROPY_EXT     0x84FE
 
+// KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR          0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) (GLuint count);
+
 void InitGL();
 void GetProcGL(void** proc, const char* name);
 void CheckErrorGL(const char* description);
+bool HasExtensionGL(const char* name);
 
 const char* FramebufferStatusToStringGL(GLenum err);
 const char* DebugSourceToStringGL(GLenum source);
@@ -57,6 +63,7 @@ public:
 #endif
 
 PROCGL(PFNGLGETINTEGERVPROC, glGetIntegerv);
+PROCGL(PFNGLGETINTEGER64VPROC, glGetInteger64v);
 PROCGL(PFNGLGETFLOATVPROC, glGetFloatv);
 PROCGL(PFNGLGETSTRINGIPROC, glGetStringi);
 PROCGL(PFNGLGETSTRINGPROC, glGetString);
@@ -78,16 +85,24 @@ PROCGL(PFNGLGENBUFFERSPROC, glGenBuffers);
 PROCGL(PFNGLDELETEBUFFERSPROC, glDeleteBuffers);
 PROCGL(PFNGLBINDBUFFERPROC, glBindBuffer);
 PROCGL(PFNGLBINDBUFFERBASEPROC, glBindBufferBase);
+PROCGL(PFNGLBINDBUFFERRANGEPROC, glBindBufferRange);
 PROCGL(PFNGLBUFFERDATAPROC, glBufferData);
 PROCGL(PFNGLBUFFERSUBDATAPROC, glBufferSubData);
 PROCGL(PFNGLMAPBUFFERPROC, glMapBuffer);
 PROCGL(PFNGLUNMAPBUFFERPROC, glUnmapBuffer);
+PROCGL(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange);
+PROCGL(PFNGLFLUSHMAPPEDBUFFERRANGEPROC, glFlushMappedBufferRange);
+PROCGL(PFNGLBUFFERSTORAGEPROC, glBufferStorage); // NULL unless GL 4.4 or ARB_buffer_storage
+PROCGL(PFNGLDISPATCHCOMPUTEPROC, glDispatchCompute); // NULL unless GL 4.3 or ARB_compute_shader
+PROCGL(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC, glMaxShaderCompilerThreadsKHR); // NULL unless KHR or ARB_parallel_shader_compile
+PROCGL(PFNGLMEMORYBARRIERPROC, glMemoryBarrier); // NULL unless GL 4.2 or ARB_shader_image_load_store
 PROCGL(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays);
 PROCGL(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays);
 PROCGL(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray);
 PROCGL(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray);
 PROCGL(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer);
 PROCGL(PFNGLVERTEXATTRIBIPOINTERPROC, glVertexAttribIPointer);
+PROCGL(PFNGLVERTEXATTRIBDIVISORPROC, glVertexAttribDivisor);
 PROCGL(PFNGLCREATESHADERPROC, glCreateShader);
 PROCGL(PFNGLDELETESHADERPROC, glDeleteShader);
 PROCGL(PFNGLSHADERSOURCEPROC, glShaderSource);
@@ -101,10 +116,14 @@ PROCGL(PFNGLATTACHSHADERPROC, glAttachShader);
 PROCGL(PFNGLDETACHSHADERPROC, glDetachShader);
 PROCGL(PFNGLGETPROGRAMIVPROC, glGetProgramiv);
 PROCGL(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog);
+PROCGL(PFNGLPROGRAMPARAMETERIPROC, glProgramParameteri);
+PROCGL(PFNGLGETPROGRAMBINARYPROC, glGetProgramBinary);
+PROCGL(PFNGLPROGRAMBINARYPROC, glProgramBinary);
 PROCGL(PFNGLUSEPROGRAMPROC, glUseProgram);
 PROCGL(PFNGLGETATTRIBLOCATIONPROC, glGetAttribLocation);
 PROCGL(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation);
 PROCGL(PFNGLUNIFORM1IPROC, glUniform1i);
+PROCGL(PFNGLUNIFORM2IPROC, glUniform2i);
 PROCGL(PFNGLUNIFORM2FPROC, glUniform2f);
 PROCGL(PFNGLUNIFORM3FVPROC, glUniform3fv);
 PROCGL(PFNGLUNIFORMMATRIX4FVPROC, glUniformMatrix4fv);
@@ -122,6 +141,8 @@ PROCGL(PFNGLTEXPARAMETERFVPROC, glTexParameterfv);
 PROCGL(PFNGLGENERATEMIPMAPPROC, glGenerateMipmap);
 PROCGL(PFNGLDRAWELEMENTSPROC, glDrawElements);
 PROCGL(PFNGLDRAWARRAYSPROC, glDrawArrays);
+PROCGL(PFNGLDRAWARRAYSINSTANCEDPROC, glDrawArraysInstanced);
+PROCGL(PFNGLDRAWELEMENTSINSTANCEDPROC, glDrawElementsInstanced);
 PROCGL(PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC, glDrawElementsInstancedBaseVertex);
 PROCGL(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers);
 PROCGL(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers);
@@ -143,6 +164,12 @@ PROCGL(PFNGLBEGINQUERYPROC, glBeginQuery);
 PROCGL(PFNGLENDQUERYPROC, glEndQuery);
 PROCGL(PFNGLGETQUERYOBJECTIVPROC, glGetQueryObjectiv);
 PROCGL(PFNGLGETQUERYOBJECTUIVPROC, glGetQueryObjectuiv);
+PROCGL(PFNGLGETQUERYOBJECTUI64VPROC, glGetQueryObjectui64v);
+PROCGL(PFNGLGETQUERYIVPROC, glGetQueryiv);
+PROCGL(PFNGLQUERYCOUNTERPROC, glQueryCounter);
+PROCGL(PFNGLFENCESYNCPROC, glFenceSync);
+PROCGL(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync);
+PROCGL(PFNGLDELETESYNCPROC, glDeleteSync);
 
 template<class ProcT>
 void GetProcGL(ProcGL<ProcT>& proc, const char* name)
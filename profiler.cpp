@@ -1,71 +1,302 @@
 #include "profiler.h"
 
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 
-void Increment(int& index, int cycle)
+// Marked on CPU markers until they're popped
+static const uint64_t kOpenMarker = UINT64_MAX;
+
+// Each thread's markers, looked up once per thread
+static thread_local const void* tlsCPUThreadOwner = NULL;
+static thread_local ProfilerCPUThread* tlsCPUThread = NULL;
+
+static uint64_t GetCPUTimeNanoseconds()
 {
-    index = (index + 1) % cycle;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-void Decrement(int& index, int cycle)
+Profiler::Profiler(int numBufferedFrames, int maxMarkersPerFrame)
+    : NumBufferedFrames(numBufferedFrames)
+    , MaxMarkersPerFrame(maxMarkersPerFrame)
+    , CPU(new CPUState())
 {
-    index = (cycle + index - 1) % cycle;
+    CPU->CurrFrame = 0;
+    CPU->NumDroppedMarkers = 0;
+
+#ifdef __APPLE__
+    // OS X doesn't support timestamps so we're limited to time elapsed without nesting
+    HasTimestamps = false;
+#else
+    GLint timestampBits = 0;
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &timestampBits);
+    HasTimestamps = timestampBits > 0;
+#endif
+
+    GPUFrames.resize(NumBufferedFrames);
+    for (int frameIdx = 0; frameIdx < NumBufferedFrames; frameIdx++)
+    {
+        GPUFrame& gpuFrame = GPUFrames[frameIdx];
+        gpuFrame.Frame = frameIdx == 0 ? 0 : -1;
+        gpuFrame.Markers.reserve(MaxMarkersPerFrame);
+        gpuFrame.QueryIDs.resize(MaxMarkersPerFrame * 2);
+        glGenQueries((GLsizei)gpuFrame.QueryIDs.size(), gpuFrame.QueryIDs.data());
+    }
+}
+
+ProfilerCPUThread* Profiler::GetCPUThread()
+{
+    if (tlsCPUThreadOwner == CPU.get())
+    {
+        return tlsCPUThread;
+    }
+
+    std::unique_ptr<ProfilerCPUThread> thread(new ProfilerCPUThread());
+    thread->Frames.resize(NumBufferedFrames);
+    for (ProfilerCPUFrame& cpuFrame : thread->Frames)
+    {
+        cpuFrame.Frame = -1;
+        cpuFrame.Markers.reserve(MaxMarkersPerFrame);
+    }
+
+    std::lock_guard<std::mutex> lock(CPU->ThreadsMutex);
+    thread->ThreadIdx = (int)CPU->Threads.size();
+    CPU->Threads.push_back(std::move(thread));
+
+    tlsCPUThreadOwner = CPU.get();
+    tlsCPUThread = CPU->Threads.back().get();
+    return tlsCPUThread;
 }
 
-Profiler::Profiler()
-    : CurrFrame(0)
-    , GPUReadIndex(0)
-    , GPUWriteIndex(0)
-    , NumPushedGPUMarkers(0)
+const char* Profiler::InternName(const char* name)
 {
-    glGenQueries(NUM_GPU_MARKERS, QueryIDs);
+    auto foundPointer = InternedNamesByPointer.find(name);
+    if (foundPointer != InternedNamesByPointer.end())
+    {
+        return foundPointer->second;
+    }
+
+    // First time this pointer is seen, the string is only looked up this once
+    const char* interned = InternedNamesByString.emplace(name, name).first->second;
+    InternedNamesByPointer.emplace(name, interned);
+    return interned;
 }
 
 void Profiler::RecordFrame()
 {
-    CurrFrame++;
+    // Frame marker pushed by the previous call
+    if (CPU->CurrFrame > 0)
+    {
+        PopCPUMarker();
+    }
+
+    int frame = ++CPU->CurrFrame;
 
-    // TODO: Record end time for previous frame and start time for current frame on CPU
+    assert(GPUStack.empty());
+    GPUFrame& gpuFrame = GPUFrames[frame % NumBufferedFrames];
+    gpuFrame.Frame = frame;
+    gpuFrame.Markers.clear();
+
+    PushCPUMarker("Frame");
 }
 
 void Profiler::PushGPUMarker(const char* name)
 {
-    // OS X doesn't support timestamps so we're limited to time elapsed with one marker
-    assert(NumPushedGPUMarkers++ == 0);
+    GPUFrame& gpuFrame = GPUFrames[CPU->CurrFrame % NumBufferedFrames];
+
+    int depth = (int)GPUStack.size();
+    if ((!HasTimestamps && depth > 0) || (int)gpuFrame.Markers.size() == MaxMarkersPerFrame)
+    {
+        if (HasTimestamps || depth == 0)
+        {
+            CPU->NumDroppedMarkers++;
+        }
+        GPUStack.push_back(-1);
+        return;
+    }
 
-    // Reinitialize marker
-    GPUMarker& marker = GPUMarkers[GPUWriteIndex];
-    marker.Frame = CurrFrame;
+    int markerIdx = (int)gpuFrame.Markers.size();
+
+    GPUMarker marker;
     marker.Name = name;
+    marker.Depth = depth;
+    marker.Frame = gpuFrame.Frame;
+    marker.Start = 0;
     marker.TimeElapsed = 0;
+    gpuFrame.Markers.push_back(marker);
 
-    glBeginQuery(GL_TIME_ELAPSED, QueryIDs[GPUWriteIndex]);
-    Increment(GPUWriteIndex, NUM_GPU_MARKERS);
+    if (HasTimestamps)
+    {
+        glQueryCounter(gpuFrame.QueryIDs[markerIdx * 2 + 0], GL_TIMESTAMP);
+    }
+    else
+    {
+        glBeginQuery(GL_TIME_ELAPSED, gpuFrame.QueryIDs[markerIdx * 2 + 0]);
+    }
+
+    GPUStack.push_back(markerIdx);
 }
 
 void Profiler::PopGPUMarker()
 {
-    assert(NumPushedGPUMarkers-- != 0);
-    glEndQuery(GL_TIME_ELAPSED);
+    assert(!GPUStack.empty());
+    int markerIdx = GPUStack.back();
+    GPUStack.pop_back();
+
+    if (markerIdx == -1)
+    {
+        return;
+    }
+
+    if (HasTimestamps)
+    {
+        GPUFrame& gpuFrame = GPUFrames[CPU->CurrFrame % NumBufferedFrames];
+        glQueryCounter(gpuFrame.QueryIDs[markerIdx * 2 + 1], GL_TIMESTAMP);
+    }
+    else
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+}
+
+void Profiler::PushCPUMarker(const char* name)
+{
+    ProfilerCPUThread* thread = GetCPUThread();
+
+    int frame = CPU->CurrFrame;
+    ProfilerCPUFrame& cpuFrame = thread->Frames[frame % NumBufferedFrames];
+    if (cpuFrame.Frame != frame)
+    {
+        cpuFrame.Frame = frame;
+        cpuFrame.Markers.clear();
+    }
+
+    if ((int)cpuFrame.Markers.size() == MaxMarkersPerFrame)
+    {
+        CPU->NumDroppedMarkers++;
+        thread->Stack.push_back(NULL);
+        return;
+    }
+
+    CPUMarker marker;
+    marker.Name = name;
+    marker.Depth = (int)thread->Stack.size();
+    marker.Frame = frame;
+    marker.ThreadIdx = thread->ThreadIdx;
+    marker.Start = GetCPUTimeNanoseconds();
+    marker.TimeElapsed = kOpenMarker;
+    cpuFrame.Markers.push_back(marker);
+
+    thread->Stack.push_back(&cpuFrame.Markers.back());
+}
+
+void Profiler::PopCPUMarker()
+{
+    uint64_t end = GetCPUTimeNanoseconds();
+
+    ProfilerCPUThread* thread = GetCPUThread();
+    assert(!thread->Stack.empty());
+    CPUMarker* marker = thread->Stack.back();
+    thread->Stack.pop_back();
+
+    if (marker)
+    {
+        marker->TimeElapsed = end - marker->Start;
+    }
 }
 
-void Profiler::ReadFrame(std::vector<GPUMarker>& frameMarkers)
+int64_t Profiler::CalibrateGPUClock()
 {
-    int frame = CurrFrame - (NUM_BUFFERED_FRAMES - 1);
+    if (!HasTimestamps)
+    {
+        return 0;
+    }
 
-    while (GPUMarkers[GPUReadIndex].Frame == frame)
+    // Reading GL_TIMESTAMP waits for the GL to get the time, so take the CPU time in the middle.
+    // A few tries and the one with the least waiting is the closest.
+    int64_t bestOffset = 0;
+    uint64_t bestRoundTrip = UINT64_MAX;
+    for (int attempt = 0; attempt < 5; attempt++)
     {
-        GLint resultAvailable = GL_FALSE;
-        glGetQueryObjectiv(QueryIDs[GPUReadIndex], GL_QUERY_RESULT_AVAILABLE, &resultAvailable);
+        uint64_t cpuBefore = GetCPUTimeNanoseconds();
+        GLint64 gpuTime;
+        glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+        uint64_t cpuAfter = GetCPUTimeNanoseconds();
 
-        if (resultAvailable == GL_TRUE)
+        if (cpuAfter - cpuBefore < bestRoundTrip)
         {
-            GPUMarker& marker = GPUMarkers[GPUReadIndex];
-            glGetQueryObjectuiv(QueryIDs[GPUReadIndex], GL_QUERY_RESULT, &marker.TimeElapsed);
-            frameMarkers.push_back(marker);
+            bestRoundTrip = cpuAfter - cpuBefore;
+            bestOffset = (int64_t)(cpuBefore + (cpuAfter - cpuBefore) / 2) - (int64_t)gpuTime;
         }
+    }
 
-        Increment(GPUReadIndex, NUM_GPU_MARKERS);
+    return bestOffset;
+}
+
+void Profiler::ReadFrame(std::vector<GPUMarker>& gpuMarkers, std::vector<CPUMarker>& cpuMarkers)
+{
+    int frame = CPU->CurrFrame - (NumBufferedFrames - 1);
+    if (frame < 0)
+    {
+        return;
+    }
+
+    GPUFrame& gpuFrame = GPUFrames[frame % NumBufferedFrames];
+    if (gpuFrame.Frame == frame)
+    {
+        for (int markerIdx = 0; markerIdx < (int)gpuFrame.Markers.size(); markerIdx++)
+        {
+            GLuint startQuery = gpuFrame.QueryIDs[markerIdx * 2 + 0];
+            GLuint endQuery = gpuFrame.QueryIDs[markerIdx * 2 + 1];
+
+            // Queries complete in order, so the last one says whether the results are in
+            GLint resultAvailable = GL_FALSE;
+            glGetQueryObjectiv(HasTimestamps ? endQuery : startQuery, GL_QUERY_RESULT_AVAILABLE, &resultAvailable);
+            if (resultAvailable != GL_TRUE)
+            {
+                continue;
+            }
+
+            GPUMarker marker = gpuFrame.Markers[markerIdx];
+            marker.Name = InternName(marker.Name);
+
+            if (HasTimestamps)
+            {
+                GLuint64 start, end;
+                glGetQueryObjectui64v(startQuery, GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(endQuery, GL_QUERY_RESULT, &end);
+                marker.Start = start;
+                marker.TimeElapsed = end - start;
+            }
+            else
+            {
+                GLuint64 timeElapsed;
+                glGetQueryObjectui64v(startQuery, GL_QUERY_RESULT, &timeElapsed);
+                marker.TimeElapsed = timeElapsed;
+            }
+
+            gpuMarkers.push_back(marker);
+        }
+
+        gpuFrame.Frame = -1;
+    }
+
+    std::lock_guard<std::mutex> lock(CPU->ThreadsMutex);
+    for (const std::unique_ptr<ProfilerCPUThread>& thread : CPU->Threads)
+    {
+        const ProfilerCPUFrame& cpuFrame = thread->Frames[frame % NumBufferedFrames];
+        if (cpuFrame.Frame != frame)
+        {
+            continue;
+        }
+
+        for (const CPUMarker& marker : cpuFrame.Markers)
+        {
+            if (marker.TimeElapsed != kOpenMarker)
+            {
+                cpuMarkers.push_back(marker);
+                cpuMarkers.back().Name = InternName(marker.Name);
+            }
+        }
     }
 }
@@ -2,44 +2,108 @@
 
 #include "opengl.h"
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
-#include <cstdint>
+
+// Marker names are kept by pointer, so they must be string literals (or outlive the profiler).
+// They're interned when read back: equal names get the same pointer, even if they came from different literals.
 
 struct GPUMarker
 {
-    uint32_t TimeElapsed; // Time elapsed in nanoseconds
+    const char* Name;
+    int Depth; // Number of GPU markers this one is nested in
+    int Frame; // Frame number at which this marker was pushed
+    uint64_t Start; // GPU timestamp in nanoseconds, 0 without timestamp queries
+    uint64_t TimeElapsed; // Time elapsed in nanoseconds
+};
+
+struct CPUMarker
+{
+    const char* Name;
+    int Depth; // Number of CPU markers this one is nested in, on the same thread
     int Frame; // Frame number at which this marker was pushed
-    std::string Name;
+    int ThreadIdx; // Threads are numbered in the order they first pushed a marker
+    uint64_t Start; // Steady clock time in nanoseconds
+    uint64_t TimeElapsed; // Time elapsed in nanoseconds
+};
 
-    GPUMarker() : Frame(0x80000000) { };
+// CPU markers one thread pushed during one frame
+struct ProfilerCPUFrame
+{
+    int Frame;
+    std::vector<CPUMarker> Markers;
+};
+
+struct ProfilerCPUThread
+{
+    int ThreadIdx;
+    std::vector<ProfilerCPUFrame> Frames; // Cyclic buffer, one per buffered frame
+    std::vector<CPUMarker*> Stack; // Pushed markers, NULL if dropped. Frames reserve all their markers up front, so these stay valid.
 };
 
 class Profiler
 {
-    static const size_t NUM_BUFFERED_FRAMES = 3; // Number of frames to buffer queries for before reading 
-    static const size_t NUM_GPU_MARKERS_PER_FRAME = 5; // Max number of GPU markers that can be pushed per frame
-    static const size_t NUM_GPU_MARKERS = NUM_BUFFERED_FRAMES * NUM_GPU_MARKERS_PER_FRAME; // GPU marker buffer size
+    // GPU markers pushed during one frame
+    struct GPUFrame
+    {
+        int Frame;
+        std::vector<GPUMarker> Markers;
+        std::vector<GLuint> QueryIDs; // Start and end timestamp queries of each marker, or one time elapsed query
+    };
+
+    // State shared with threads pushing CPU markers
+    struct CPUState
+    {
+        std::atomic<int> CurrFrame; // Current frame number used to associate markers
+        std::mutex ThreadsMutex;
+        std::vector<std::unique_ptr<ProfilerCPUThread>> Threads;
+        std::atomic<int> NumDroppedMarkers; // Markers that didn't fit in their frame
+    };
+
+    int NumBufferedFrames; // Number of frames to buffer queries for before reading
+    int MaxMarkersPerFrame; // Max number of GPU markers, and of CPU markers per thread, that can be pushed per frame
+    bool HasTimestamps; // Timestamp queries can be nested, time elapsed queries can't
+
+    std::vector<GPUFrame> GPUFrames; // Cyclic buffer, one per buffered frame
+    std::vector<int> GPUStack; // Indices of the pushed GPU markers in the current frame's markers, -1 if dropped
 
-    int CurrFrame; // Current frame number used to associate markers
-    int GPUReadIndex; // Index of GPU marker to read from
-    int GPUWriteIndex; // Index of GPU marker to write to
+    std::unique_ptr<CPUState> CPU;
 
-    GPUMarker GPUMarkers[NUM_GPU_MARKERS]; // Cyclic buffer for GPU markers
-    GLuint QueryIDs[NUM_GPU_MARKERS]; // Cyclic buffer for start time query objects
+    std::unordered_map<const char*, const char*> InternedNamesByPointer;
+    std::unordered_map<std::string, const char*> InternedNamesByString;
 
-    int NumPushedGPUMarkers; // Number of currently pushed GPU markers
+    ProfilerCPUThread* GetCPUThread();
+    const char* InternName(const char* name);
 
 public:
-    Profiler();
+    static const int DEFAULT_NUM_BUFFERED_FRAMES = 3;
+    static const int DEFAULT_MAX_MARKERS_PER_FRAME = 64;
 
-    // Invoke at the start of each frame
+    Profiler(int numBufferedFrames = DEFAULT_NUM_BUFFERED_FRAMES, int maxMarkersPerFrame = DEFAULT_MAX_MARKERS_PER_FRAME);
+
+    // Invoke at the start of each frame, from the thread that owns the GL context.
+    // Also times the frame itself with a "Frame" CPU marker on that thread.
     void RecordFrame();
 
-    // GPU profiling
+    // GPU profiling. Without timestamp queries (OS X), only the outermost markers are timed.
     void PushGPUMarker(const char* name);
     void PopGPUMarker();
 
-    // Retrieve profiling markers from the earliest available frame
-    void ReadFrame(std::vector<GPUMarker>& frameMarkers);
+    // CPU profiling, from any thread. A frame's markers are read a few frames later, so threads must be done with them by then.
+    void PushCPUMarker(const char* name);
+    void PopCPUMarker();
+
+    // Retrieve profiling markers from the earliest available frame, parents before their children
+    void ReadFrame(std::vector<GPUMarker>& gpuMarkers, std::vector<CPUMarker>& cpuMarkers);
+
+    // Offset in nanoseconds from the GPU's timestamps to the CPU markers' clock, 0 without timestamp queries
+    int64_t CalibrateGPUClock();
+
+    bool HasGPUTimestamps() const { return HasTimestamps; }
+    int GetNumDroppedMarkers() const { return CPU->NumDroppedMarkers; }
 };
@@ -14,13 +14,73 @@
 #include <cstdio>
 #include <algorithm>
 
-void InitRenderer(Renderer* renderer)
+// Binds diffuse, specular and normal map textures to units 0, 1 and 2
+static void BindMaterialTextures(Scene* scene, const Material& material)
 {
-    renderer->ShadowMapSize = 4096;
+    // Set diffuse texture
+    glActiveTexture(GL_TEXTURE0);
+    if (material.DiffuseTextureIDs.size() < 1 || material.DiffuseTextureIDs[0] == -1)
+    {
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, scene->DiffuseTextures[material.DiffuseTextureIDs[0]].TO);
+    }
 
-    glGenTextures(1, &renderer->ShadowMapTexture);
-    glBindTexture(GL_TEXTURE_2D, renderer->ShadowMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, renderer->ShadowMapSize, renderer->ShadowMapSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // Set specular texture
+    glActiveTexture(GL_TEXTURE1);
+    if (material.SpecularTextureIDs.size() < 1 || material.SpecularTextureIDs[0] == -1)
+    {
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, scene->SpecularTextures[material.SpecularTextureIDs[0]].TO);
+    }
+
+    // Set normal map texture
+    glActiveTexture(GL_TEXTURE2);
+    if (material.NormalTextureIDs.size() < 1 || material.NormalTextureIDs[0] == -1)
+    {
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, scene->NormalTextures[material.NormalTextureIDs[0]].TO);
+    }
+}
+
+// Returns the permutation of a scene program to draw with, or -1 if none has linked yet.
+// A permutation that isn't loaded starts loading, meanwhile draws use a linked permutation with a subset of its features.
+static int GetSceneProgramPermutation(ReloadableProgram* permutations, int permutation)
+{
+    if (permutations[permutation].Handle)
+    {
+        return permutation;
+    }
+
+    RequestProgram(&permutations[permutation]);
+
+    for (int fallback = (permutation - 1) & permutation; ; fallback = (fallback - 1) & permutation)
+    {
+        if (permutations[fallback].Handle)
+        {
+            return fallback;
+        }
+        if (fallback == 0)
+        {
+            return -1;
+        }
+    }
+}
+
+// Creates a depth texture for shadow mapping and a framebuffer rendering to it
+static void CreateShadowMap(int size, GLuint* texture, GLuint* fbo)
+{
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D, *texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
@@ -30,9 +90,9 @@ void InitRenderer(Renderer* renderer)
     glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, shadowBorderColor);
     glBindTexture(GL_TEXTURE_2D, 0);
 
-    glGenFramebuffers(1, &renderer->ShadowMapFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, renderer->ShadowMapFBO);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, renderer->ShadowMapTexture, 0);
+    glGenFramebuffers(1, fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, *texture, 0);
     GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if (fboStatus != GL_FRAMEBUFFER_COMPLETE)
     {
@@ -42,13 +102,68 @@ void InitRenderer(Renderer* renderer)
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void ResizeRenderer(
-    Renderer* renderer,
-    int windowWidth, 
-    int windowHeight, 
-    int drawableWidth, 
-    int drawableHeight, 
-    int numSamples)
+// Continues a 64-bit FNV-1a hash with more bytes
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Grows light space bounds by a model space box
+static void AddBoxToBounds(const glm::mat4& modelLight, const glm::vec3& boxMin, const glm::vec3& boxMax, glm::vec3* boundsMin, glm::vec3* boundsMax)
+{
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 modelCorner(
+            (corner & 1) ? boxMax.x : boxMin.x,
+            (corner & 2) ? boxMax.y : boxMin.y,
+            (corner & 4) ? boxMax.z : boxMin.z);
+        glm::vec3 lightCorner = glm::vec3(modelLight * glm::vec4(modelCorner, 1.0f));
+        *boundsMin = min(*boundsMin, lightCorner);
+        *boundsMax = max(*boundsMax, lightCorner);
+    }
+}
+
+// Grows light space bounds by the joints of an animated skeleton, each grown by a model space radius
+static void AddJointsToBounds(const glm::mat4& modelLight, const AnimatedSkeleton& animSkeleton, float radius, glm::vec3* boundsMin, glm::vec3* boundsMax)
+{
+    float scale = std::max(std::max(length(glm::vec3(modelLight[0])), length(glm::vec3(modelLight[1]))), length(glm::vec3(modelLight[2])));
+    glm::vec3 lightRadius = glm::vec3(radius * scale);
+
+    for (const glm::vec3& jointPosition : animSkeleton.JointPositions)
+    {
+        glm::vec3 lightJoint = glm::vec3(modelLight * glm::vec4(jointPosition, 1.0f));
+        *boundsMin = min(*boundsMin, lightJoint - lightRadius);
+        *boundsMax = max(*boundsMax, lightJoint + lightRadius);
+    }
+}
+
+void InitRenderer(Renderer* renderer)
+{
+    renderer->ShadowMapSize = 4096;
+
+    CreateShadowMap(renderer->ShadowMapSize, &renderer->ShadowMapTexture, &renderer->ShadowMapFBO);
+    CreateShadowMap(renderer->ShadowMapSize, &renderer->StaticShadowMapTexture, &renderer->StaticShadowMapFBO);
+    renderer->StaticShadowMapValid = false;
+}
+
+static void CheckFramebufferStatus()
+{
+    GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (fboStatus != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Framebuffer status error: %s\n", FramebufferStatusToStringGL(fboStatus));
+        exit(1);
+    }
+}
+
+// (Re)creates the multisampled backbuffer at the renderer's size with the given sample count
+static void AllocateBackbuffer(Renderer* renderer, int numSamples)
 {
     glFinish();
 
@@ -56,13 +171,13 @@ void ResizeRenderer(
     glDeleteTextures(1, &renderer->BackbufferColorTexture);
     glGenTextures(1, &renderer->BackbufferColorTexture);
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderer->BackbufferColorTexture);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, numSamples, GL_SRGB8_ALPHA8, drawableWidth, drawableHeight, GL_TRUE);
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, numSamples, GL_SRGB8_ALPHA8, renderer->BackbufferWidth, renderer->BackbufferHeight, GL_TRUE);
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
 
     glDeleteTextures(1, &renderer->BackbufferDepthTexture);
     glGenTextures(1, &renderer->BackbufferDepthTexture);
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderer->BackbufferDepthTexture);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, numSamples, GL_DEPTH_COMPONENT32F, drawableWidth, drawableHeight, GL_TRUE);
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, numSamples, GL_DEPTH_COMPONENT32F, renderer->BackbufferWidth, renderer->BackbufferHeight, GL_TRUE);
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
 
     // Init framebuffer
@@ -74,57 +189,62 @@ void ResizeRenderer(
     GLenum drawBufs[] = { GL_COLOR_ATTACHMENT0 };
     glDrawBuffers(sizeof(drawBufs) / sizeof(*drawBufs), &drawBufs[0]);
     glReadBuffer(GL_COLOR_ATTACHMENT0);
-    GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if (fboStatus != GL_FRAMEBUFFER_COMPLETE)
-    {
-        fprintf(stderr, "Framebuffer status error: %s\n", FramebufferStatusToStringGL(fboStatus));
-        exit(1);
-    }
+    CheckFramebufferStatus();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    renderer->BackbufferSamples = numSamples;
 }
 
-void PaintRenderer(
-    Renderer* renderer, 
-    SDL_Window* window, 
-    Scene* scene)
+void ResizeRenderer(
+    Renderer* renderer,
+    int windowWidth, 
+    int windowHeight, 
+    int drawableWidth, 
+    int drawableHeight, 
+    int numSamples)
 {
-    glm::mat4 worldView = glm::translate(glm::mat4(scene->CameraRotation), -scene->CameraPosition);
-
-    glm::mat4 worldLight = glm::lookAt(scene->LightPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::mat4 lightProjection = glm::ortho(-1000.0f, 1000.0f, -1000.0f, 1000.0f, -1000.0f, 1000.0f);
-    glm::mat4 worldLightProjection = lightProjection * worldLight;
-
-    struct DrawCmd
-    {
-        int HasTransparency;
-        float ViewDepth;
-        int MaterialID;
-        int NodeID;
-
-        bool operator<(const DrawCmd& other) const
-        {
-            if (HasTransparency < other.HasTransparency) return true;
-            if (other.HasTransparency < HasTransparency) return false;
-
-            // Nearer objects are drawn first, since they hide further objects
-            // Recall that GL view depth is along the negative Z direction,
-            // so nearer objects have a greater Z.
-            if (ViewDepth > other.ViewDepth) return true;
-            if (other.ViewDepth > ViewDepth) return false;
-
-            if (MaterialID < other.MaterialID) return true;
-            if (other.MaterialID < MaterialID) return false;
+    renderer->BackbufferWidth = drawableWidth;
+    renderer->BackbufferHeight = drawableHeight;
+    renderer->BackbufferMaxSamples = numSamples;
+
+    // Keep the sample count dynamic resolution chose, if any
+    int backbufferSamples = renderer->BackbufferSamples > 0 ? std::min(renderer->BackbufferSamples, numSamples) : numSamples;
+    AllocateBackbuffer(renderer, backbufferSamples);
+
+    glDeleteTextures(1, &renderer->ResolveColorTexture);
+    glGenTextures(1, &renderer->ResolveColorTexture);
+    glBindTexture(GL_TEXTURE_2D, renderer->ResolveColorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, drawableWidth, drawableHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-            if (NodeID < other.NodeID) return true;
-            if (other.NodeID < NodeID) return false;
+    glDeleteFramebuffers(1, &renderer->ResolveFBO);
+    glGenFramebuffers(1, &renderer->ResolveFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, renderer->ResolveFBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderer->ResolveColorTexture, 0);
+    CheckFramebufferStatus();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-            return false;
-        }
-    };
+void BuildDrawLists(
+    Scene* scene,
+    const glm::mat4& worldView,
+    const glm::mat4& worldLight,
+    DrawLists* drawLists)
+{
+    std::vector<DrawCmd>& draws = drawLists->Draws;
+    std::vector<DrawCmd>& staticShadowDraws = drawLists->StaticShadowDraws;
+    std::vector<DrawCmd>& dynamicShadowDraws = drawLists->DynamicShadowDraws;
+    glm::vec3& casterBoundsMin = drawLists->CasterBoundsMin;
+    glm::vec3& casterBoundsMax = drawLists->CasterBoundsMax;
+
+    draws.clear();
+    staticShadowDraws.clear();
+    dynamicShadowDraws.clear();
+    casterBoundsMin = glm::vec3(INFINITY);
+    casterBoundsMax = glm::vec3(-INFINITY);
 
-    // Produce list of draws to sort them in a good order
-    std::vector<DrawCmd> draws;
-    std::vector<DrawCmd> shadowDraws;
     for (int nodeID = 0; nodeID < (int)scene->SceneNodes.size(); nodeID++)
     {
         const SceneNode& sceneNode = scene->SceneNodes[nodeID];
@@ -156,15 +276,7 @@ void PaintRenderer(
             
             const Material& material = scene->Materials[materialID];
 
-            int hasTransparency = false;
-            for (int diffuseTextureIdx = 0; diffuseTextureIdx < (int)material.DiffuseTextureIDs.size(); diffuseTextureIdx++)
-            {
-                if (scene->DiffuseTextures[material.DiffuseTextureIDs[diffuseTextureIdx]].HasTransparency)
-                {
-                    hasTransparency = 1;
-                    break;
-                }
-            }
+            int hasTransparency = MaterialHasTransparency(scene, material);
 
             float viewDepth = (worldView * sceneNode.WorldTransform * glm::vec4(0, 0, 0, 1)).z;
 
@@ -184,7 +296,21 @@ void PaintRenderer(
                 shadowCmd.ViewDepth = lightDepth;
                 shadowCmd.MaterialID = materialID;
                 shadowCmd.NodeID = nodeID;
-                shadowDraws.push_back(shadowCmd);
+
+                glm::mat4 modelLight = worldLight * sceneNode.WorldTransform;
+                if (sceneNode.Type == SCENENODETYPE_STATICMESH)
+                {
+                    const StaticMesh& staticMesh = scene->StaticMeshes[sceneNode.AsStaticMesh.StaticMeshID];
+                    AddBoxToBounds(modelLight, staticMesh.BoundsMin, staticMesh.BoundsMax, &casterBoundsMin, &casterBoundsMax);
+                    staticShadowDraws.push_back(shadowCmd);
+                }
+                else
+                {
+                    const SkinnedMesh& skinnedMesh = scene->SkinnedMeshes[sceneNode.AsSkinnedMesh.SkinnedMeshID];
+                    const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[skinnedMesh.BindPoseMeshID];
+                    AddJointsToBounds(modelLight, scene->AnimatedSkeletons[skinnedMesh.AnimatedSkeletonID], bindPoseMesh.JointBoundsRadius, &casterBoundsMin, &casterBoundsMax);
+                    dynamicShadowDraws.push_back(shadowCmd);
+                }
             }
         }
         else
@@ -195,7 +321,99 @@ void PaintRenderer(
     }
 
     std::sort(begin(draws), end(draws));
-    std::sort(begin(shadowDraws), end(shadowDraws));
+    std::sort(begin(staticShadowDraws), end(staticShadowDraws));
+    std::sort(begin(dynamicShadowDraws), end(dynamicShadowDraws));
+
+    for (const Crowd& crowd : scene->Crowds)
+    {
+        float jointBoundsRadius = 0.0f;
+        for (int bindPoseMeshID : crowd.BindPoseMeshIDs)
+        {
+            jointBoundsRadius = std::max(jointBoundsRadius, scene->BindPoseMeshes[bindPoseMeshID].JointBoundsRadius);
+        }
+
+        for (int memberIdx = 0; memberIdx < crowd.NumMembers; memberIdx++)
+        {
+            const AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[crowd.AnimatedSkeletonIDs[memberIdx]];
+            AddJointsToBounds(worldLight * crowd.MemberTransforms[memberIdx], animSkeleton, jointBoundsRadius, &casterBoundsMin, &casterBoundsMax);
+        }
+    }
+}
+
+void PaintRenderer(
+    Renderer* renderer, 
+    SDL_Window* window, 
+    Scene* scene)
+{
+    glm::mat4 worldView = glm::translate(glm::mat4(scene->CameraRotation), -scene->CameraPosition);
+
+    glm::mat4 worldLight = glm::lookAt(scene->LightPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    scene->Profiling.PushCPUMarker("Draw Lists");
+
+    // Produce list of draws to sort them in a good order.
+    // Shadow casters are split into static ones, which can be cached, and skinned ones.
+    DrawLists drawLists;
+    BuildDrawLists(scene, worldView, worldLight, &drawLists);
+
+    const std::vector<DrawCmd>& draws = drawLists.Draws;
+    const std::vector<DrawCmd>& staticShadowDraws = drawLists.StaticShadowDraws;
+    const std::vector<DrawCmd>& dynamicShadowDraws = drawLists.DynamicShadowDraws;
+    glm::vec3 casterBoundsMin = drawLists.CasterBoundsMin;
+    glm::vec3 casterBoundsMax = drawLists.CasterBoundsMax;
+
+    // Fit the light's projection around the shadow casters, so the shadow map's texels aren't spent on empty space
+    glm::mat4 lightProjection = glm::ortho(-1000.0f, 1000.0f, -1000.0f, 1000.0f, -1000.0f, 1000.0f);
+    if (scene->FitShadowFrustum && casterBoundsMin.x <= casterBoundsMax.x)
+    {
+        glm::vec3 casterExtent = casterBoundsMax - casterBoundsMin;
+        glm::vec3 boundsExtent = renderer->ShadowBoundsMax - renderer->ShadowBoundsMin;
+
+        bool boundsHoldCasters =
+            renderer->ShadowBoundsWorldLight == worldLight &&
+            all(lessThanEqual(renderer->ShadowBoundsMin, casterBoundsMin)) &&
+            all(lessThanEqual(casterBoundsMax, renderer->ShadowBoundsMax));
+
+        bool boundsTooBig =
+            boundsExtent.x > 2.0f * casterExtent.x + 1.0f ||
+            boundsExtent.y > 2.0f * casterExtent.y + 1.0f;
+
+        if (!boundsHoldCasters || boundsTooBig)
+        {
+            // Leave room for the casters to move before the bounds have to be refit
+            glm::vec3 margin = 0.1f * casterExtent + glm::vec3(1.0f);
+            renderer->ShadowBoundsMin = casterBoundsMin - margin;
+            renderer->ShadowBoundsMax = casterBoundsMax + margin;
+            renderer->ShadowBoundsWorldLight = worldLight;
+        }
+
+        // Light space looks down -Z. Receivers that don't cast (transparent meshes) can be behind every caster,
+        // so the far plane is pushed back. Depth range doesn't cost anything, unlike the width and height.
+        const float kShadowFarExtension = 1000.0f;
+        lightProjection = glm::ortho(
+            renderer->ShadowBoundsMin.x, renderer->ShadowBoundsMax.x,
+            renderer->ShadowBoundsMin.y, renderer->ShadowBoundsMax.y,
+            -renderer->ShadowBoundsMax.z, -renderer->ShadowBoundsMin.z + kShadowFarExtension);
+    }
+
+    glm::mat4 worldLightProjection = lightProjection * worldLight;
+
+    // The static shadow map is redrawn when the light, the static casters or the shadow shader changed
+    uint64_t staticCastersHash = 14695981039346656037ull;
+    staticCastersHash = HashBytes(staticCastersHash, &scene->ShadowSP.Handle, sizeof(scene->ShadowSP.Handle));
+    for (const DrawCmd& cmd : staticShadowDraws)
+    {
+        const SceneNode& sceneNode = scene->SceneNodes[cmd.NodeID];
+        staticCastersHash = HashBytes(staticCastersHash, &cmd.NodeID, sizeof(cmd.NodeID));
+        staticCastersHash = HashBytes(staticCastersHash, &sceneNode.WorldTransform, sizeof(sceneNode.WorldTransform));
+    }
+
+    bool staticShadowMapStale =
+        !renderer->StaticShadowMapValid ||
+        renderer->StaticShadowMapWorldLightProjection != worldLightProjection ||
+        renderer->StaticShadowCastersHash != staticCastersHash;
+
+    scene->Profiling.PopCPUMarker();
 
     int drawableWidth, drawableHeight;
     SDL_GL_GetDrawableSize(window, &drawableWidth, &drawableHeight);
@@ -203,65 +421,186 @@ void PaintRenderer(
     int windowWidth, windowHeight;
     SDL_GetWindowSize(window, &windowWidth, &windowHeight);
 
+    // Dynamic resolution renders the scene into the bottom left corner of the backbuffer and upscales it to the window.
+    // Sub-viewports change size without reallocating, only a new sample count does.
+    DynamicResolution& dynRes = scene->DynamicRes;
+    int numSamples = std::max(renderer->BackbufferMaxSamples >> dynRes.SampleShift, 1);
+    if (numSamples != renderer->BackbufferSamples)
+    {
+        AllocateBackbuffer(renderer, numSamples);
+    }
+    dynRes.NumSamples = numSamples;
+
+    int renderWidth = std::max((int)(drawableWidth * dynRes.Scale + 0.5f), 1);
+    int renderHeight = std::max((int)(drawableHeight * dynRes.Scale + 0.5f), 1);
+
     // Shadow rendering
     if (scene->AllShadersOK)
     {
+        scene->Profiling.PushCPUMarker("Shadows");
         scene->Profiling.PushGPUMarker("Shadows");
 
-        glBindFramebuffer(GL_FRAMEBUFFER, renderer->ShadowMapFBO);
-        glViewport(0, 0, renderer->ShadowMapSize, renderer->ShadowMapSize);
-        glClear(GL_DEPTH_BUFFER_BIT);
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_POLYGON_OFFSET_FILL);
         glPolygonOffset(10.0f, 5.0f);
-        glUseProgram(scene->ShadowSP.Handle);
-
-        for (int drawIdx = 0; drawIdx < (int)shadowDraws.size(); drawIdx++)
-        {
-            const DrawCmd& cmd = shadowDraws[drawIdx];
+        glViewport(0, 0, renderer->ShadowMapSize, renderer->ShadowMapSize);
 
-            const SceneNode& sceneNode = scene->SceneNodes[cmd.NodeID];
+        // Palettes for inline skinning
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, scene->BonePaletteRing.TO);
 
-            // Draw node
-            if (sceneNode.Type == SCENENODETYPE_STATICMESH || sceneNode.Type == SCENENODETYPE_SKINNEDMESH)
+        auto drawShadowNodes = [&](const std::vector<DrawCmd>& shadowDraws)
+        {
+            for (int drawIdx = 0; drawIdx < (int)shadowDraws.size(); drawIdx++)
             {
-                GLuint vao;
-                int numIndices;
+                const DrawCmd& cmd = shadowDraws[drawIdx];
 
-                if (sceneNode.Type == SCENENODETYPE_STATICMESH)
-                {
-                    const StaticMesh& staticMesh = scene->StaticMeshes[sceneNode.AsStaticMesh.StaticMeshID];
-                    vao = staticMesh.MeshVAO;
-                    numIndices = staticMesh.NumIndices;
-                }
-                else if (sceneNode.Type == SCENENODETYPE_SKINNEDMESH)
-                {
-                    const SkinnedMeshSceneNode& skinnedMeshSceneNode = sceneNode.AsSkinnedMesh;
-                    const SkinnedMesh& skinnedMesh = scene->SkinnedMeshes[skinnedMeshSceneNode.SkinnedMeshID];
-                    const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[skinnedMesh.BindPoseMeshID];
-                    vao = skinnedMesh.SkinnedVAO;
-                    numIndices = bindPoseMesh.NumIndices;
-                }
-                else
+                const SceneNode& sceneNode = scene->SceneNodes[cmd.NodeID];
+
+                // Draw node
+                if (sceneNode.Type == SCENENODETYPE_STATICMESH || sceneNode.Type == SCENENODETYPE_SKINNEDMESH)
                 {
-                    fprintf(stderr, "Unhandled scene node type %d\n", sceneNode.Type);
-                    exit(1);
+                    GLuint vao;
+                    int numIndices;
+                    GLuint program = scene->ShadowSP.Handle;
+                    const ShadowUniformLocations* locs = &scene->ShadowSPLocs;
+                    int paletteOffset = 0;
+
+                    if (sceneNode.Type == SCENENODETYPE_STATICMESH)
+                    {
+                        const StaticMesh& staticMesh = scene->StaticMeshes[sceneNode.AsStaticMesh.StaticMeshID];
+                        vao = staticMesh.MeshVAO;
+                        numIndices = staticMesh.NumIndices;
+                    }
+                    else if (sceneNode.Type == SCENENODETYPE_SKINNEDMESH)
+                    {
+                        const SkinnedMeshSceneNode& skinnedMeshSceneNode = sceneNode.AsSkinnedMesh;
+                        const SkinnedMesh& skinnedMesh = scene->SkinnedMeshes[skinnedMeshSceneNode.SkinnedMeshID];
+                        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[skinnedMesh.BindPoseMeshID];
+                        const AnimatedSkeleton& animatedSkeleton = scene->AnimatedSkeletons[skinnedMesh.AnimatedSkeletonID];
+                        numIndices = bindPoseMesh.NumIndices;
+
+                        if (animatedSkeleton.InlineSkinning)
+                        {
+                            // Skin the bind pose while drawing it
+                            vao = bindPoseMesh.SkinningVAO;
+                            program = scene->ShadowSkinnedSPs[scene->MeshSkinningMethod].Handle;
+                            locs = &scene->ShadowSkinnedSPLocs[scene->MeshSkinningMethod];
+                            paletteOffset = skinnedMesh.PaletteTexelOffset;
+                        }
+                        else
+                        {
+                            vao = skinnedMesh.SkinnedVAO;
+                        }
+                    }
+                    else
+                    {
+                        fprintf(stderr, "Unhandled scene node type %d\n", sceneNode.Type);
+                        exit(1);
+                    }
+
+                    glUseProgram(program);
+                    glBindVertexArray(vao);
+
+                    glm::mat4 modelWorld = sceneNode.WorldTransform;
+                    glm::mat4 modelView = worldView * modelWorld;
+                    glm::mat4 modelViewProjection = worldLightProjection * modelWorld;
+
+                    glUniformMatrix4fv(locs->ModelLightProjectionLoc, 1, GL_FALSE, value_ptr(modelViewProjection));
+                    glUniform1i(locs->BoneTransformsLoc, 0);
+                    glUniform1i(locs->PaletteOffsetLoc, paletteOffset);
+
+                    glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
+
+                    glBindVertexArray(0);
                 }
+            }
+        };
 
-                glBindVertexArray(vao);
+        if (scene->CacheStaticShadows)
+        {
+            if (staticShadowMapStale)
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, renderer->StaticShadowMapFBO);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                drawShadowNodes(staticShadowDraws);
+
+                renderer->StaticShadowMapValid = true;
+                renderer->StaticShadowMapWorldLightProjection = worldLightProjection;
+                renderer->StaticShadowCastersHash = staticCastersHash;
+                scene->NumStaticShadowMapUpdates++;
+            }
 
-                glm::mat4 modelWorld = sceneNode.WorldTransform;
-                glm::mat4 modelView = worldView * modelWorld;
-                glm::mat4 modelViewProjection = worldLightProjection * modelWorld;
+            // Start from the static casters' depth and draw the moving ones over it
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer->StaticShadowMapFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer->ShadowMapFBO);
+            glBlitFramebuffer(
+                0, 0, renderer->ShadowMapSize, renderer->ShadowMapSize,
+                0, 0, renderer->ShadowMapSize, renderer->ShadowMapSize,
+                GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, renderer->ShadowMapFBO);
+        }
+        else
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, renderer->ShadowMapFBO);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            drawShadowNodes(staticShadowDraws);
+
+            // Drawn without the cache, so it has to be redrawn if the cache is turned back on
+            renderer->StaticShadowMapValid = false;
+        }
 
-                glUniformMatrix4fv(scene->ShadowSP_ModelLightProjectionLoc, 1, GL_FALSE, value_ptr(modelViewProjection));
+        drawShadowNodes(dynamicShadowDraws);
 
-                glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
+        // Crowds cast shadows with one instanced draw per bind pose mesh
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, scene->SkinnedPositionTO);
 
+        for (const Crowd& crowd : scene->Crowds)
+        {
+            if (crowd.NumMembers == 0)
+            {
+                continue;
+            }
+
+            // Members all skin the same way, see ChooseInlineSkinning
+            bool inlineSkinning = scene->AnimatedSkeletons[crowd.AnimatedSkeletonIDs[0]].InlineSkinning;
+            const ReloadableProgram& program = inlineSkinning ? scene->CrowdShadowSkinnedSPs[scene->MeshSkinningMethod] : scene->CrowdShadowSP;
+            const ShadowUniformLocations& locs = inlineSkinning ? scene->CrowdShadowSkinnedSPLocs[scene->MeshSkinningMethod] : scene->CrowdShadowSPLocs;
+
+            glUseProgram(program.Handle);
+            glUniformMatrix4fv(locs.WorldLightProjectionLoc, 1, GL_FALSE, value_ptr(worldLightProjection));
+            glUniform1i(locs.BoneTransformsLoc, 0);
+            glUniform1i(locs.PaletteTableOffsetLoc, scene->PaletteTableTexelOffset);
+            glUniform1i(locs.SkinnedPositionsLoc, 1);
+            glUniform1i(locs.MemberTransformsLoc, 2);
+
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_BUFFER, crowd.MemberTransformTO);
+
+            for (int crowdMeshIdx = 0; crowdMeshIdx < (int)crowd.BindPoseMeshIDs.size(); crowdMeshIdx++)
+            {
+                const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[crowd.BindPoseMeshIDs[crowdMeshIdx]];
+                if (MaterialHasTransparency(scene, scene->Materials[bindPoseMesh.MaterialID]))
+                {
+                    continue;
+                }
+
+                glUniform1i(locs.BaseVertexLoc, crowd.BaseVertices[crowdMeshIdx]);
+                glUniform1i(locs.NumVerticesLoc, bindPoseMesh.NumVertices);
+
+                glBindVertexArray(crowd.VAOs[crowdMeshIdx]);
+                glDrawElementsInstanced(GL_TRIANGLES, bindPoseMesh.NumIndices, GL_UNSIGNED_INT, NULL, crowd.NumMembers);
                 glBindVertexArray(0);
             }
         }
 
+        for (GLenum textureUnit : { GL_TEXTURE2, GL_TEXTURE1, GL_TEXTURE0 })
+        {
+            glActiveTexture(textureUnit);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+
         glUseProgram(0);
         glPolygonOffset(0.0f, 0.0f);
         glDisable(GL_POLYGON_OFFSET_FILL);
@@ -269,11 +608,13 @@ void PaintRenderer(
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
         scene->Profiling.PopGPUMarker();
+        scene->Profiling.PopCPUMarker();
     }
 
     // Scene rendering
     if (scene->AllShadersOK)
     {
+        scene->Profiling.PushCPUMarker("Rendering");
         scene->Profiling.PushGPUMarker("Rendering");
 
         glm::mat4 projection = glm::perspective(70.0f, (float)drawableWidth / drawableHeight, 0.01f, 1000.0f);
@@ -281,12 +622,16 @@ void PaintRenderer(
 
         glBindFramebuffer(GL_FRAMEBUFFER, renderer->BackbufferFBO);
 
-        glViewport(0, 0, drawableWidth, drawableHeight);
+        glViewport(0, 0, renderWidth, renderHeight);
 
         glEnable(GL_FRAMEBUFFER_SRGB);
         glClearColor(scene->BackgroundColor.r, scene->BackgroundColor.g, scene->BackgroundColor.b, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        // Palettes for inline skinning
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_BUFFER, scene->BonePaletteRing.TO);
+
         for (int drawIdx = 0; drawIdx < (int)draws.size(); drawIdx++)
         {
             const DrawCmd& cmd = draws[drawIdx];
@@ -295,15 +640,52 @@ void PaintRenderer(
             // Draw node
             if (sceneNode.Type == SCENENODETYPE_STATICMESH || sceneNode.Type == SCENENODETYPE_SKINNEDMESH)
             {
-                glUseProgram(scene->SceneSP.Handle);
-                glUniformMatrix4fv(scene->SceneSP_WorldViewLoc, 1, GL_FALSE, value_ptr(worldView));
-                glUniform1i(scene->SceneSP_DiffuseTextureLoc, 0);
-                glUniform1i(scene->SceneSP_SpecularTextureLoc, 1);
-                glUniform1i(scene->SceneSP_NormalTextureLoc, 2);
-                glUniform1i(scene->SceneSP_ShadowMapTextureLoc, 3);
-                glUniform3fv(scene->SceneSP_CameraPositionLoc, 1, value_ptr(scene->CameraPosition));
-                glUniform3fv(scene->SceneSP_LightPositionLoc, 1, value_ptr(scene->LightPosition));
-                glUniform3fv(scene->SceneSP_BackgroundColorLoc, 1, value_ptr(scene->BackgroundColor));
+                int materialID = cmd.MaterialID;
+                const Material& material = scene->Materials[materialID];
+                int permutation = GetScenePermutation(material, cmd.HasTransparency != 0);
+
+                ReloadableProgram* permutations = scene->SceneSPs;
+                const SceneUniformLocations* permutationLocs = scene->SceneSPLocs;
+                bool inlineSkinning = false;
+                int paletteOffset = 0;
+
+                if (sceneNode.Type == SCENENODETYPE_SKINNEDMESH)
+                {
+                    const SkinnedMesh& skinnedMesh = scene->SkinnedMeshes[sceneNode.AsSkinnedMesh.SkinnedMeshID];
+                    const AnimatedSkeleton& animatedSkeleton = scene->AnimatedSkeletons[skinnedMesh.AnimatedSkeletonID];
+                    if (animatedSkeleton.InlineSkinning)
+                    {
+                        permutations = scene->SceneSkinnedSPs[scene->MeshSkinningMethod];
+                        permutationLocs = scene->SceneSkinnedSPLocs[scene->MeshSkinningMethod];
+                        inlineSkinning = true;
+                        paletteOffset = skinnedMesh.PaletteTexelOffset;
+                    }
+                    else
+                    {
+                        // Skinned by the skinning pass, with packed normals and tangents
+                        permutations = scene->ScenePackedSPs;
+                        permutationLocs = scene->ScenePackedSPLocs;
+                    }
+                }
+
+                permutation = GetSceneProgramPermutation(permutations, permutation);
+                if (permutation == -1)
+                {
+                    continue;
+                }
+
+                const SceneUniformLocations* locs = &permutationLocs[permutation];
+                glUseProgram(permutations[permutation].Handle);
+                glUniformMatrix4fv(locs->WorldViewLoc, 1, GL_FALSE, value_ptr(worldView));
+                glUniform1i(locs->DiffuseTextureLoc, 0);
+                glUniform1i(locs->SpecularTextureLoc, 1);
+                glUniform1i(locs->NormalTextureLoc, 2);
+                glUniform1i(locs->ShadowMapTextureLoc, 3);
+                glUniform1i(locs->BoneTransformsLoc, 4);
+                glUniform1i(locs->PaletteOffsetLoc, paletteOffset);
+                glUniform3fv(locs->CameraPositionLoc, 1, value_ptr(scene->CameraPosition));
+                glUniform3fv(locs->LightPositionLoc, 1, value_ptr(scene->LightPosition));
+                glUniform3fv(locs->BackgroundColorLoc, 1, value_ptr(scene->BackgroundColor));
 
                 glEnable(GL_DEPTH_TEST);
 
@@ -313,7 +695,6 @@ void PaintRenderer(
                     glDepthFunc(GL_LESS);
                     glDisable(GL_BLEND);
                     glBlendFuncSeparate(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO);
-                    glUniform1i(scene->SceneSP_IlluminationModelLoc, 1);
                 }
                 else
                 {
@@ -321,46 +702,9 @@ void PaintRenderer(
                     glDepthFunc(GL_LEQUAL);
                     glEnable(GL_BLEND);
                     glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
-                    glUniform1i(scene->SceneSP_IlluminationModelLoc, 2);
                 }
 
-                int materialID = cmd.MaterialID;
-                const Material& material = scene->Materials[materialID];
-
-                // Set diffuse texture
-                glActiveTexture(GL_TEXTURE0);
-                if (material.DiffuseTextureIDs.size() < 1 || material.DiffuseTextureIDs[0] == -1)
-                {
-                    glBindTexture(GL_TEXTURE_2D, 0);
-                }
-                else
-                {
-                    glBindTexture(GL_TEXTURE_2D, scene->DiffuseTextures[material.DiffuseTextureIDs[0]].TO);
-                }
-
-                // Set specular texture
-                glActiveTexture(GL_TEXTURE1);
-                if (material.SpecularTextureIDs.size() < 1 || material.SpecularTextureIDs[0] == -1)
-                {
-                    glBindTexture(GL_TEXTURE_2D, 0);
-                }
-                else
-                {
-                    glBindTexture(GL_TEXTURE_2D, scene->SpecularTextures[material.SpecularTextureIDs[0]].TO);
-                }
-
-                // Set normal map texture
-                glActiveTexture(GL_TEXTURE2);
-                if (material.NormalTextureIDs.size() < 1 || material.NormalTextureIDs[0] == -1)
-                {
-                    glBindTexture(GL_TEXTURE_2D, 0);
-                    glUniform1i(scene->SceneSP_HasNormalMapLoc, 0);
-                }
-                else
-                {
-                    glBindTexture(GL_TEXTURE_2D, scene->NormalTextures[material.NormalTextureIDs[0]].TO);
-                    glUniform1i(scene->SceneSP_HasNormalMapLoc, 1);
-                }
+                BindMaterialTextures(scene, material);
 
                 // Set shadow map texture
                 glActiveTexture(GL_TEXTURE3);
@@ -380,7 +724,7 @@ void PaintRenderer(
                     const SkinnedMeshSceneNode& skinnedMeshSceneNode = sceneNode.AsSkinnedMesh;
                     const SkinnedMesh& skinnedMesh = scene->SkinnedMeshes[skinnedMeshSceneNode.SkinnedMeshID];
                     const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[skinnedMesh.BindPoseMeshID];
-                    vao = skinnedMesh.SkinnedVAO;
+                    vao = inlineSkinning ? bindPoseMesh.SkinningVAO : skinnedMesh.SkinnedVAO;
                     numIndices = bindPoseMesh.NumIndices;
                 }
                 else
@@ -395,11 +739,11 @@ void PaintRenderer(
                 glm::mat4 modelView = worldView * modelWorld;
                 glm::mat4 modelViewProjection = worldViewProjection * modelWorld;
 
-                glUniformMatrix4fv(scene->SceneSP_ModelWorldLoc, 1, GL_FALSE, value_ptr(modelWorld));
-                glUniformMatrix4fv(scene->SceneSP_WorldModelLoc, 1, GL_FALSE, value_ptr(glm::inverse(modelWorld)));
-                glUniformMatrix4fv(scene->SceneSP_ModelViewLoc, 1, GL_FALSE, value_ptr(modelView));
-                glUniformMatrix4fv(scene->SceneSP_ModelViewProjectionLoc, 1, GL_FALSE, value_ptr(modelViewProjection));
-                glUniformMatrix4fv(scene->SceneSP_WorldLightProjectionLoc, 1, GL_FALSE, value_ptr(worldLightProjection));
+                glUniformMatrix4fv(locs->ModelWorldLoc, 1, GL_FALSE, value_ptr(modelWorld));
+                glUniformMatrix4fv(locs->WorldModelLoc, 1, GL_FALSE, value_ptr(glm::inverse(modelWorld)));
+                glUniformMatrix4fv(locs->ModelViewLoc, 1, GL_FALSE, value_ptr(modelView));
+                glUniformMatrix4fv(locs->ModelViewProjectionLoc, 1, GL_FALSE, value_ptr(modelViewProjection));
+                glUniformMatrix4fv(locs->WorldLightProjectionLoc, 1, GL_FALSE, value_ptr(worldLightProjection));
 
                 glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
 
@@ -444,6 +788,119 @@ void PaintRenderer(
             }
         }
 
+        // Crowds are drawn with one instanced draw per bind pose mesh, opaque meshes first
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, renderer->ShadowMapTexture);
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_BUFFER, scene->SkinnedPositionTO);
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_BUFFER, scene->SkinnedDifferentialTO);
+
+        glEnable(GL_DEPTH_TEST);
+
+        for (int transparencyPass = 0; transparencyPass < 2; transparencyPass++)
+        {
+            if (!transparencyPass)
+            {
+                glDepthMask(GL_TRUE);
+                glDepthFunc(GL_LESS);
+                glDisable(GL_BLEND);
+            }
+            else
+            {
+                glDepthMask(GL_FALSE);
+                glDepthFunc(GL_LEQUAL);
+                glEnable(GL_BLEND);
+                glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+            }
+
+            for (const Crowd& crowd : scene->Crowds)
+            {
+                if (crowd.NumMembers == 0)
+                {
+                    continue;
+                }
+
+                // Members all skin the same way, see ChooseInlineSkinning
+                bool inlineSkinning = scene->AnimatedSkeletons[crowd.AnimatedSkeletonIDs[0]].InlineSkinning;
+                ReloadableProgram* permutations = inlineSkinning ? scene->CrowdSkinnedSPs[scene->MeshSkinningMethod] : scene->CrowdSPs;
+                const SceneUniformLocations* permutationLocs = inlineSkinning ? scene->CrowdSkinnedSPLocs[scene->MeshSkinningMethod] : scene->CrowdSPLocs;
+
+                glActiveTexture(GL_TEXTURE7);
+                glBindTexture(GL_TEXTURE_BUFFER, crowd.MemberTransformTO);
+
+                // Meshes are drawn with the permutation of their material, the uniforms are only set when it changes
+                const ReloadableProgram* boundProgram = NULL;
+
+                for (int crowdMeshIdx = 0; crowdMeshIdx < (int)crowd.BindPoseMeshIDs.size(); crowdMeshIdx++)
+                {
+                    const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[crowd.BindPoseMeshIDs[crowdMeshIdx]];
+                    const Material& material = scene->Materials[bindPoseMesh.MaterialID];
+                    if (MaterialHasTransparency(scene, material) != (transparencyPass != 0))
+                    {
+                        continue;
+                    }
+
+                    int permutation = GetSceneProgramPermutation(permutations, GetScenePermutation(material, transparencyPass != 0));
+                    if (permutation == -1)
+                    {
+                        continue;
+                    }
+
+                    const ReloadableProgram* program = &permutations[permutation];
+
+                    const SceneUniformLocations& locs = permutationLocs[permutation];
+                    if (program != boundProgram)
+                    {
+                        glUseProgram(program->Handle);
+                        glUniformMatrix4fv(locs.WorldViewProjectionLoc, 1, GL_FALSE, value_ptr(worldViewProjection));
+                        glUniform1i(locs.DiffuseTextureLoc, 0);
+                        glUniform1i(locs.SpecularTextureLoc, 1);
+                        glUniform1i(locs.NormalTextureLoc, 2);
+                        glUniform1i(locs.ShadowMapTextureLoc, 3);
+                        glUniform1i(locs.BoneTransformsLoc, 4);
+                        glUniform1i(locs.PaletteTableOffsetLoc, scene->PaletteTableTexelOffset);
+                        glUniform1i(locs.SkinnedPositionsLoc, 5);
+                        glUniform1i(locs.SkinnedDifferentialsLoc, 6);
+                        glUniform1i(locs.MemberTransformsLoc, 7);
+                        glUniform3fv(locs.CameraPositionLoc, 1, value_ptr(scene->CameraPosition));
+                        glUniform3fv(locs.LightPositionLoc, 1, value_ptr(scene->LightPosition));
+                        glUniform3fv(locs.BackgroundColorLoc, 1, value_ptr(scene->BackgroundColor));
+                        glUniformMatrix4fv(locs.WorldLightProjectionLoc, 1, GL_FALSE, value_ptr(worldLightProjection));
+
+                        // Vertices come out of the vertex shader in world space
+                        glUniformMatrix4fv(locs.ModelWorldLoc, 1, GL_FALSE, value_ptr(glm::mat4()));
+                        glUniformMatrix4fv(locs.WorldModelLoc, 1, GL_FALSE, value_ptr(glm::mat4()));
+
+                        boundProgram = program;
+                    }
+
+                    BindMaterialTextures(scene, material);
+                    glUniform1i(locs.BaseVertexLoc, crowd.BaseVertices[crowdMeshIdx]);
+                    glUniform1i(locs.NumVerticesLoc, bindPoseMesh.NumVertices);
+
+                    glBindVertexArray(crowd.VAOs[crowdMeshIdx]);
+                    glDrawElementsInstanced(GL_TRIANGLES, bindPoseMesh.NumIndices, GL_UNSIGNED_INT, NULL, crowd.NumMembers);
+                    glBindVertexArray(0);
+                }
+            }
+        }
+
+        // Restore default state
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glDisable(GL_BLEND);
+        glBlendFuncSeparate(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO);
+
+        for (GLenum textureUnit : { GL_TEXTURE4, GL_TEXTURE5, GL_TEXTURE6, GL_TEXTURE7 })
+        {
+            glActiveTexture(textureUnit);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        glUseProgram(0);
+
         glDisable(GL_FRAMEBUFFER_SRGB);
 
         glDisable(GL_DEPTH_TEST);
@@ -451,27 +908,50 @@ void PaintRenderer(
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
         scene->Profiling.PopGPUMarker();
+        scene->Profiling.PopCPUMarker();
+    }
+
+    // Draw to window's framebuffer.
+    // Multisampled framebuffers can only be resolved at the same size, so a scene rendered at a lower resolution
+    // is resolved at that size first and then upscaled.
+    if (renderWidth == drawableWidth && renderHeight == drawableHeight)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer->BackbufferFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // default FBO
+        glBlitFramebuffer(
+            0, 0, drawableWidth, drawableHeight,
+            0, 0, drawableWidth, drawableHeight,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
+    else
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer->BackbufferFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer->ResolveFBO);
+        glBlitFramebuffer(
+            0, 0, renderWidth, renderHeight,
+            0, 0, renderWidth, renderHeight,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer->ResolveFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // default FBO
+        glBlitFramebuffer(
+            0, 0, renderWidth, renderHeight,
+            0, 0, drawableWidth, drawableHeight,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR);
     }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // GUI rendering
+    // GUI rendering, always at the window's resolution
     {
+        scene->Profiling.PushCPUMarker("Interface");
         scene->Profiling.PushGPUMarker("Interface");
 
-        glBindFramebuffer(GL_FRAMEBUFFER, renderer->BackbufferFBO);
+        glViewport(0, 0, drawableWidth, drawableHeight);
         glEnable(GL_FRAMEBUFFER_SRGB);
         ImGui::Render();
         glDisable(GL_FRAMEBUFFER_SRGB);
-        glBindFramebuffer(GL_FRAMEBUFFER, renderer->BackbufferFBO);
 
         scene->Profiling.PopGPUMarker();
+        scene->Profiling.PopCPUMarker();
     }
-
-    // Draw to window's framebuffer
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer->BackbufferFBO);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // default FBO
-    glBlitFramebuffer(
-        0, 0, drawableWidth, drawableHeight,
-        0, 0, drawableWidth, drawableHeight,
-        GL_COLOR_BUFFER_BIT, GL_LINEAR);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
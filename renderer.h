@@ -4,6 +4,9 @@
 
 #include <glm/glm.hpp>
 
+#include <cstdint>
+#include <vector>
+
 struct SDL_Window;
 struct Scene;
 
@@ -13,14 +16,75 @@ struct Renderer
     GLuint BackbufferFBO;
     GLuint BackbufferColorTexture;
     GLuint BackbufferDepthTexture;
+    int BackbufferWidth;
+    int BackbufferHeight;
+    int BackbufferMaxSamples; // Sample count at full quality
+    int BackbufferSamples; // Sample count the backbuffer is allocated with, lowered by dynamic resolution
+
+    // Single sampled copy of the backbuffer. Multisampled framebuffers can only be resolved at the same size,
+    // so a backbuffer rendered at a lower resolution is resolved here before it's upscaled to the window.
+    GLuint ResolveFBO;
+    GLuint ResolveColorTexture;
 
     GLuint ShadowMapFBO;
     GLuint ShadowMapTexture;
     int ShadowMapSize;
 
+    // Depth of the static shadow casters, copied into the shadow map every frame
+    GLuint StaticShadowMapFBO;
+    GLuint StaticShadowMapTexture;
+    bool StaticShadowMapValid;
+    glm::mat4 StaticShadowMapWorldLightProjection; // Light transform the static shadow map was drawn with
+    uint64_t StaticShadowCastersHash; // Hash of the static casters the static shadow map was drawn with
+
+    // Light space box the shadow map covers. Kept while it holds the casters and isn't much too big,
+    // so the light projection (and with it the static shadow map) doesn't change every time something moves.
+    glm::mat4 ShadowBoundsWorldLight; // Light view the bounds are in
+    glm::vec3 ShadowBoundsMin;
+    glm::vec3 ShadowBoundsMax;
+
     bool GUIFocusEnabled;
 };
 
+// Draw of one scene node. Sorting puts opaque draws first, near to far, then by material.
+struct DrawCmd
+{
+    int HasTransparency;
+    float ViewDepth;
+    int MaterialID;
+    int NodeID;
+
+    bool operator<(const DrawCmd& other) const
+    {
+        if (HasTransparency < other.HasTransparency) return true;
+        if (other.HasTransparency < HasTransparency) return false;
+
+        // Nearer objects are drawn first, since they hide further objects
+        // Recall that GL view depth is along the negative Z direction,
+        // so nearer objects have a greater Z.
+        if (ViewDepth > other.ViewDepth) return true;
+        if (other.ViewDepth > ViewDepth) return false;
+
+        if (MaterialID < other.MaterialID) return true;
+        if (other.MaterialID < MaterialID) return false;
+
+        if (NodeID < other.NodeID) return true;
+        if (other.NodeID < NodeID) return false;
+
+        return false;
+    }
+};
+
+// Sorted draws of a frame. Shadow draws use light depth as their view depth.
+struct DrawLists
+{
+    std::vector<DrawCmd> Draws;
+    std::vector<DrawCmd> StaticShadowDraws; // Static mesh casters, which can be cached
+    std::vector<DrawCmd> DynamicShadowDraws; // Skinned mesh casters
+    glm::vec3 CasterBoundsMin; // Light space bounds of all shadow casters, crowds included
+    glm::vec3 CasterBoundsMax;
+};
+
 void InitRenderer(Renderer* renderer);
 
 void ResizeRenderer(
@@ -34,4 +98,11 @@ void ResizeRenderer(
 void PaintRenderer(
     Renderer* renderer,
     SDL_Window* window,
-    Scene* scene);
\ No newline at end of file
+    Scene* scene);
+
+// Builds and sorts the draw lists of the scene's nodes. Doesn't make any GL calls.
+void BuildDrawLists(
+    Scene* scene,
+    const glm::mat4& worldView,
+    const glm::mat4& worldLight,
+    DrawLists* drawLists);
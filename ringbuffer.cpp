@@ -0,0 +1,191 @@
+#include "ringbuffer.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+static void DeleteRegionFences(UploadRingBuffer* ring)
+{
+    for (int regionIdx = 0; regionIdx < UPLOAD_RING_NUM_REGIONS; regionIdx++)
+    {
+        if (ring->RegionFences[regionIdx])
+        {
+            glDeleteSync(ring->RegionFences[regionIdx]);
+            ring->RegionFences[regionIdx] = 0;
+        }
+    }
+}
+
+static void AllocateUploadRingStorage(UploadRingBuffer* ring, GLsizeiptr regionSize)
+{
+    // Deleting the old buffer is safe even if the GPU still uses it, GL keeps the storage alive until then.
+    if (ring->BO)
+    {
+        if (ring->IsPersistent)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, ring->BO);
+            glUnmapBuffer(GL_TEXTURE_BUFFER);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &ring->BO);
+    }
+
+    DeleteRegionFences(ring);
+
+    ring->RegionSize = regionSize;
+    ring->PersistentPtr = NULL;
+
+    GLsizeiptr totalSize = regionSize * UPLOAD_RING_NUM_REGIONS;
+
+    glGenBuffers(1, &ring->BO);
+    glBindBuffer(GL_TEXTURE_BUFFER, ring->BO);
+    if (ring->IsPersistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_TEXTURE_BUFFER, totalSize, NULL, flags);
+        ring->PersistentPtr = (uint8_t*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, totalSize, flags);
+        if (!ring->PersistentPtr)
+        {
+            fprintf(stderr, "Failed to persistently map upload ring buffer\n");
+            exit(1);
+        }
+    }
+    else
+    {
+        glBufferData(GL_TEXTURE_BUFFER, totalSize, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, ring->TO);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, ring->BO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void InitUploadRingBuffer(UploadRingBuffer* ring, GLsizeiptr regionSize)
+{
+    *ring = UploadRingBuffer();
+    ring->IsPersistent = glBufferStorage.fptr != NULL;
+    ring->CurrRegion = -1;
+
+    glGenTextures(1, &ring->TO);
+
+    AllocateUploadRingStorage(ring, regionSize);
+}
+
+void BeginUploadRingBufferFrame(UploadRingBuffer* ring, GLsizeiptr requiredSize)
+{
+    // Everything submitted since the last frame began may read from the previous region
+    if (ring->CurrRegion != -1)
+    {
+        ring->RegionFences[ring->CurrRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    ring->NumStalls = 0;
+    ring->BytesUploaded = 0;
+    ring->CurrOffset = 0;
+
+    if (requiredSize > ring->RegionSize)
+    {
+        GLsizeiptr newRegionSize = ring->RegionSize;
+        while (newRegionSize < requiredSize)
+        {
+            newRegionSize *= 2;
+        }
+        AllocateUploadRingStorage(ring, newRegionSize);
+    }
+
+    ring->CurrRegion = (ring->CurrRegion + 1) % UPLOAD_RING_NUM_REGIONS;
+
+    GLsync fence = ring->RegionFences[ring->CurrRegion];
+    if (fence)
+    {
+        bool orphaned = false;
+
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            ring->NumStalls++;
+            ring->TotalStalls++;
+
+            if (ring->IsPersistent)
+            {
+                // The mapping can't be swapped out, so wait for the GPU to finish reading.
+                while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+                    ;
+            }
+            else
+            {
+                // Orphan the buffer so the driver hands out fresh storage instead of synchronizing.
+                glBindBuffer(GL_TEXTURE_BUFFER, ring->BO);
+                glBufferData(GL_TEXTURE_BUFFER, ring->RegionSize * UPLOAD_RING_NUM_REGIONS, NULL, GL_STREAM_DRAW);
+                glBindBuffer(GL_TEXTURE_BUFFER, 0);
+                orphaned = true;
+            }
+        }
+
+        if (orphaned)
+        {
+            // The fresh storage isn't used by the GPU, so every other region's fence is stale too.
+            DeleteRegionFences(ring);
+        }
+        else
+        {
+            glDeleteSync(fence);
+            ring->RegionFences[ring->CurrRegion] = 0;
+        }
+    }
+
+    GLintptr regionOffset = ring->CurrRegion * ring->RegionSize;
+
+    if (ring->IsPersistent)
+    {
+        ring->CurrPtr = ring->PersistentPtr + regionOffset;
+    }
+    else
+    {
+        // The fence guarantees the GPU isn't reading this region, so no need for the driver to synchronize.
+        glBindBuffer(GL_TEXTURE_BUFFER, ring->BO);
+        ring->CurrPtr = (uint8_t*)glMapBufferRange(
+            GL_TEXTURE_BUFFER, regionOffset, ring->RegionSize,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        if (!ring->CurrPtr)
+        {
+            fprintf(stderr, "Failed to map upload ring buffer region\n");
+            exit(1);
+        }
+    }
+}
+
+GLintptr AllocateUploadRingBuffer(UploadRingBuffer* ring, GLsizeiptr size, GLsizeiptr alignment, void** mapped)
+{
+    GLsizeiptr offset = (ring->CurrOffset + alignment - 1) / alignment * alignment;
+    if (offset + size > ring->RegionSize)
+    {
+        fprintf(stderr, "Upload ring buffer region full (%d/%d bytes)\n", (int)(offset + size), (int)ring->RegionSize);
+        *mapped = NULL;
+        return -1;
+    }
+
+    ring->CurrOffset = offset + size;
+    ring->BytesUploaded += size;
+
+    *mapped = ring->CurrPtr + offset;
+    return ring->CurrRegion * ring->RegionSize + offset;
+}
+
+void EndUploadRingBufferFrame(UploadRingBuffer* ring)
+{
+    // Coherent persistent mappings are visible to the GPU without flushing
+    if (!ring->IsPersistent)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, ring->BO);
+        if (ring->CurrOffset > 0)
+        {
+            glFlushMappedBufferRange(GL_TEXTURE_BUFFER, 0, ring->CurrOffset);
+        }
+        glUnmapBuffer(GL_TEXTURE_BUFFER);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ring->CurrPtr = NULL;
+}
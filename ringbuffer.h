@@ -0,0 +1,42 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstdint>
+
+// Number of frames that can be in flight before the CPU has to wait for the GPU
+#define UPLOAD_RING_NUM_REGIONS 3
+
+// Ring of per-frame regions used to stream dynamic data (eg. skinning palettes) to the GPU.
+// Each frame writes into its own region, and fences make sure a region isn't overwritten while the GPU still reads it.
+// With ARB_buffer_storage the buffer is persistently mapped, otherwise (GL 4.1) each region is mapped unsynchronized
+// and the buffer is orphaned instead of waiting when the GPU falls behind.
+struct UploadRingBuffer
+{
+    GLuint BO; // Buffer object storing all regions
+    GLuint TO; // Texture buffer view of the whole buffer (RGBA32F texels)
+    GLsizeiptr RegionSize; // Size of each region in bytes
+    bool IsPersistent; // True if persistently mapped with ARB_buffer_storage
+    uint8_t* PersistentPtr; // Start of the persistent mapping
+    GLsync RegionFences[UPLOAD_RING_NUM_REGIONS]; // Signaled when the GPU is done with each region
+    int CurrRegion; // Region being written to this frame
+    GLsizeiptr CurrOffset; // Bytes allocated so far in the current region
+    uint8_t* CurrPtr; // CPU address of the current region
+
+    // Statistics
+    int NumStalls; // Times the GPU was still reading the region this frame (waited or orphaned)
+    int TotalStalls; // Stalls since the ring was created
+    GLsizeiptr BytesUploaded; // Bytes allocated this frame
+};
+
+void InitUploadRingBuffer(UploadRingBuffer* ring, GLsizeiptr regionSize);
+
+// Fences the previous frame's region and makes the next one writable. Grows the ring if requiredSize doesn't fit.
+void BeginUploadRingBufferFrame(UploadRingBuffer* ring, GLsizeiptr requiredSize);
+
+// Returns the offset in bytes from the start of the buffer, and the address to write the data to.
+// Returns -1 if the region is full.
+GLintptr AllocateUploadRingBuffer(UploadRingBuffer* ring, GLsizeiptr size, GLsizeiptr alignment, void** mapped);
+
+// Makes the data written this frame visible to the GPU
+void EndUploadRingBufferFrame(UploadRingBuffer* ring);
@@ -6,6 +6,7 @@
 #include "mysdl_dpi.h"
 
 #include "sceneloader.h"
+#include "threadpool.h"
 
 #define QFPC_IMPLEMENTATION
 #include <qfpc.h>
@@ -39,6 +40,25 @@
 // #define MULTIPLY_DYNAMICS_DELTAPOS_TRANSFORM_TO_MATRIX
 // --
 
+// Must match MAX_BONES in skinning_dlb.comp and skinning_lbs.comp, palettes are cached in shared memory
+static const int kMaxComputeSkinningBones = 256;
+
+// Workgroup size of the skinning compute shaders
+static const int kSkinningComputeWorkgroupSize = 64;
+
+// Crowd members are laid out on a grid this many members wide, this far apart
+static const int kCrowdGridWidth = 32;
+static const float kCrowdGridSpacing = 120.0f;
+static const int kMaxCrowdSize = 1000;
+
+// In auto mode, skeletons whose palette hasn't changed for this many updates go back to the skinning pass,
+// since lazy skinning then reuses their skinned vertices for free.
+static const int kInlineSkinningStaticFrames = 30;
+
+// Frames rendered before and while timing each step of the inline skinning benchmark
+static const int kInlineSkinningBenchmarkWarmupFrames = 10;
+static const int kInlineSkinningBenchmarkMeasuredFrames = 60;
+
 static int AddAnimatedSkeleton(
     Scene* scene,
     int initialAnimSequenceID)
@@ -48,18 +68,6 @@ static int AddAnimatedSkeleton(
     const AnimSequence& animSequence = scene->AnimSequences[initialAnimSequenceID];
     Skeleton& skeleton = scene->Skeletons[animSequence.SkeletonID];
 
-    // Skinning
-
-    glGenBuffers(1, &animatedSkeleton.BoneTransformTBO);
-    glBindBuffer(GL_TEXTURE_BUFFER, animatedSkeleton.BoneTransformTBO);
-    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat3x4) * skeleton.NumBones, NULL, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_TEXTURE_BUFFER, 0);
-
-    glGenTextures(1, &animatedSkeleton.BoneTransformTO);
-    glBindTexture(GL_TEXTURE_BUFFER, animatedSkeleton.BoneTransformTO);
-    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, animatedSkeleton.BoneTransformTBO);
-    glBindTexture(GL_TEXTURE_BUFFER, 0);
-
     // Skeleton
 
     glGenBuffers(1, &animatedSkeleton.SkeletonVBO);
@@ -87,6 +95,10 @@ static int AddAnimatedSkeleton(
     animatedSkeleton.BoneTransformDualQuats.resize(skeleton.NumBones);
     animatedSkeleton.BoneTransformMatrices.resize(skeleton.NumBones);
     animatedSkeleton.BoneControls.resize(skeleton.NumBones, BONECONTROL_ANIMATION);
+    animatedSkeleton.PaletteHash = 0;
+    animatedSkeleton.PaletteDirty = true;
+    animatedSkeleton.NumStaticPaletteFrames = 0;
+    animatedSkeleton.InlineSkinning = false;
     animatedSkeleton.JointPositions.resize(skeleton.NumBones);
     animatedSkeleton.JointVelocities.resize(skeleton.NumBones);
 
@@ -111,54 +123,252 @@ static int AddSkinnedMesh(
 
     skinnedMesh.BindPoseMeshID = bindPoseMeshID;
     skinnedMesh.AnimatedSkeletonID = animatedSkeletonID;
+    skinnedMesh.BaseVertex = 0;
+    skinnedMesh.PaletteID = 0;
+    skinnedMesh.PaletteTexelOffset = 0;
+
+    // Vertex attributes are set up once the mesh has a place in the skinned vertex buffers
+    glGenVertexArrays(1, &skinnedMesh.SkinnedVAO);
+    scene->SkinningBatchesDirty = true;
+
+    scene->SkinnedMeshes.push_back(std::move(skinnedMesh));
+    return (int)scene->SkinnedMeshes.size() - 1;
+}
+
+// Groups skinned meshes by bind pose mesh and lays out their skinned vertices batch after batch.
+static void RebuildSkinningBatches(Scene* scene)
+{
+    std::vector<std::vector<int>> bindPoseSkinnedMeshIDs(scene->BindPoseMeshes.size());
+    for (int skinnedMeshID = 0; skinnedMeshID < (int)scene->SkinnedMeshes.size(); skinnedMeshID++)
+    {
+        bindPoseSkinnedMeshIDs[scene->SkinnedMeshes[skinnedMeshID].BindPoseMeshID].push_back(skinnedMeshID);
+    }
+
+    scene->SkinningBatches.clear();
+
+    std::vector<int> instanceAnimatedSkeletonIDs;
+    int numVertices = 0;
+    for (int bindPoseMeshID = 0; bindPoseMeshID < (int)scene->BindPoseMeshes.size(); bindPoseMeshID++)
+    {
+        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[bindPoseMeshID];
+
+        SkinningBatch batch;
+        batch.BindPoseMeshID = bindPoseMeshID;
+        batch.FirstInstance = (int)instanceAnimatedSkeletonIDs.size();
+        batch.BaseVertex = numVertices;
+
+        // Transform feedback writes instances in order, one whole mesh after the other
+        for (int skinnedMeshID : bindPoseSkinnedMeshIDs[bindPoseMeshID])
+        {
+            SkinnedMesh& skinnedMesh = scene->SkinnedMeshes[skinnedMeshID];
+            skinnedMesh.BaseVertex = numVertices;
+            skinnedMesh.PaletteID = (int)instanceAnimatedSkeletonIDs.size();
+            numVertices += bindPoseMesh.NumVertices;
+            instanceAnimatedSkeletonIDs.push_back(skinnedMesh.AnimatedSkeletonID);
+        }
+
+        // Crowd members come after, so each crowd's members are contiguous for instanced drawing
+        for (Crowd& crowd : scene->Crowds)
+        {
+            for (int crowdMeshIdx = 0; crowdMeshIdx < (int)crowd.BindPoseMeshIDs.size(); crowdMeshIdx++)
+            {
+                if (crowd.BindPoseMeshIDs[crowdMeshIdx] != bindPoseMeshID)
+                {
+                    continue;
+                }
+
+                crowd.BaseVertices[crowdMeshIdx] = numVertices;
+                crowd.FirstInstances[crowdMeshIdx] = (int)instanceAnimatedSkeletonIDs.size();
+                for (int memberIdx = 0; memberIdx < crowd.NumMembers; memberIdx++)
+                {
+                    numVertices += bindPoseMesh.NumVertices;
+                    instanceAnimatedSkeletonIDs.push_back(crowd.AnimatedSkeletonIDs[memberIdx]);
+                }
+            }
+        }
+
+        batch.NumInstances = (int)instanceAnimatedSkeletonIDs.size() - batch.FirstInstance;
+        if (batch.NumInstances == 0)
+        {
+            continue;
+        }
+
+        scene->SkinningBatches.push_back(batch);
+
+        int numBones = (int)bindPoseMesh.PaletteBoneIDs.size();
+        if (scene->ComputeSkinningSupported && numBones > kMaxComputeSkinningBones)
+        {
+            fprintf(stderr, "Compute skinning supports up to %d bones, got %d. Using transform feedback.\n", kMaxComputeSkinningBones, numBones);
+            scene->ComputeSkinningSupported = false;
+            scene->MeshSkinningBackend = SKINNINGBACKEND_TRANSFORMFEEDBACK;
+        }
+    }
 
-    glGenBuffers(1, &skinnedMesh.PositionTFBO);
-    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, skinnedMesh.PositionTFBO);
-    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, bindPoseMesh.NumVertices * sizeof(PositionVertex), NULL, GL_DYNAMIC_DRAW);
+    scene->NumSkinnedVertices = numVertices;
+
+    // (Re)allocate skinned vertex buffers for all meshes
+    glDeleteBuffers(1, &scene->SkinnedPositionTFBO);
+    glGenBuffers(1, &scene->SkinnedPositionTFBO);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, scene->SkinnedPositionTFBO);
+    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, numVertices * sizeof(PositionVertex), NULL, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
 
-    glGenBuffers(1, &skinnedMesh.DifferentialTFBO);
-    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, skinnedMesh.DifferentialTFBO);
-    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, bindPoseMesh.NumVertices * sizeof(DifferentialVertex), NULL, GL_DYNAMIC_DRAW);
+    glDeleteBuffers(1, &scene->SkinnedDifferentialTFBO);
+    glGenBuffers(1, &scene->SkinnedDifferentialTFBO);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, scene->SkinnedDifferentialTFBO);
+    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, numVertices * sizeof(PackedDifferentialVertex), NULL, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
 
-    glGenTransformFeedbacks(1, &skinnedMesh.SkinningTFO);
-    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, skinnedMesh.SkinningTFO);
-    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, skinnedMesh.PositionTFBO);
-    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, skinnedMesh.DifferentialTFBO);
+    // Crowds fetch skinned vertices by instance, so they read the buffers as textures
+    GLint maxTextureBufferSize;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+    if (numVertices > maxTextureBufferSize)
+    {
+        fprintf(stderr, "Skinned vertices exceed texture buffer size (%d texels), crowds won't render correctly\n", maxTextureBufferSize);
+    }
+
+    glBindTexture(GL_TEXTURE_BUFFER, scene->SkinnedPositionTO);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, scene->SkinnedPositionTFBO);
+    glBindTexture(GL_TEXTURE_BUFFER, scene->SkinnedDifferentialTO);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32I, scene->SkinnedDifferentialTFBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, scene->SkinningTFO);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, scene->SkinnedPositionTFBO);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, scene->SkinnedDifferentialTFBO);
     glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
 
-    glGenVertexArrays(1, &skinnedMesh.SkinnedVAO);
-    glBindVertexArray(skinnedMesh.SkinnedVAO);
+    scene->SkinningInstanceAnimatedSkeletonIDs = instanceAnimatedSkeletonIDs;
+
+    // Every instance has its own palette, so palette IDs are instance indices.
+    // They're still read from a buffer since GL 4.1 has no base instance to offset gl_InstanceID with.
+    std::vector<GLuint> instancePaletteIDs(instanceAnimatedSkeletonIDs.size());
+    std::iota(begin(instancePaletteIDs), end(instancePaletteIDs), 0);
 
-    glBindBuffer(GL_ARRAY_BUFFER, skinnedMesh.PositionTFBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PositionVertex), (GLvoid*)offsetof(PositionVertex, Position));
+    glDeleteBuffers(1, &scene->SkinningInstanceVBO);
+    glGenBuffers(1, &scene->SkinningInstanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, scene->SkinningInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instancePaletteIDs.size() * sizeof(instancePaletteIDs[0]), instancePaletteIDs.data(), GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glEnableVertexAttribArray(0);
+    // Palette IDs are per instance. GL 4.1 has no base instance, so the attribute offset is set before each draw.
+    for (const SkinningBatch& batch : scene->SkinningBatches)
+    {
+        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[batch.BindPoseMeshID];
 
-    glBindBuffer(GL_ARRAY_BUFFER, bindPoseMesh.TexCoordVBO);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TexCoordVertex), (GLvoid*)offsetof(TexCoordVertex, TexCoord));
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(bindPoseMesh.SkinningVAO);
+        glVertexAttribDivisor(7, 1);
+        glEnableVertexAttribArray(7);
+        glBindVertexArray(0);
+    }
 
-    glEnableVertexAttribArray(1);
+    // Crowd members are consecutive instances, so each crowd mesh's palette IDs start at a fixed place
+    for (const Crowd& crowd : scene->Crowds)
+    {
+        for (int crowdMeshIdx = 0; crowdMeshIdx < (int)crowd.BindPoseMeshIDs.size(); crowdMeshIdx++)
+        {
+            glBindVertexArray(crowd.VAOs[crowdMeshIdx]);
 
-    glBindBuffer(GL_ARRAY_BUFFER, skinnedMesh.DifferentialTFBO);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(DifferentialVertex), (GLvoid*)offsetof(DifferentialVertex, Normal));
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(DifferentialVertex), (GLvoid*)offsetof(DifferentialVertex, Tangent));
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(DifferentialVertex), (GLvoid*)offsetof(DifferentialVertex, Bitangent));
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindBuffer(GL_ARRAY_BUFFER, scene->SkinningInstanceVBO);
+            glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)(crowd.FirstInstances[crowdMeshIdx] * sizeof(GLuint)));
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
+            glVertexAttribDivisor(7, 1);
+            glEnableVertexAttribArray(7);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bindPoseMesh.EBO);
+            glBindVertexArray(0);
+        }
+    }
 
-    glBindVertexArray(0);
+    // Point every skinned mesh's VAO at its range of the skinned vertex buffers
+    for (SkinnedMesh& skinnedMesh : scene->SkinnedMeshes)
+    {
+        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[skinnedMesh.BindPoseMeshID];
 
-    scene->SkinnedMeshes.push_back(std::move(skinnedMesh));
-    return (int)scene->SkinnedMeshes.size() - 1;
+        glBindVertexArray(skinnedMesh.SkinnedVAO);
+
+        GLintptr positionOffset = skinnedMesh.BaseVertex * sizeof(PositionVertex);
+        glBindBuffer(GL_ARRAY_BUFFER, scene->SkinnedPositionTFBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PositionVertex), (GLvoid*)(positionOffset + offsetof(PositionVertex, Position)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnableVertexAttribArray(0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, bindPoseMesh.TexCoordVBO);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TexCoordVertex), (GLvoid*)offsetof(TexCoordVertex, TexCoord));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnableVertexAttribArray(1);
+
+        // Normals and tangents are packed, the bitangent is rebuilt in the vertex shader
+        GLintptr differentialOffset = skinnedMesh.BaseVertex * sizeof(PackedDifferentialVertex);
+        glBindBuffer(GL_ARRAY_BUFFER, scene->SkinnedDifferentialTFBO);
+        glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedDifferentialVertex), (GLvoid*)(differentialOffset + offsetof(PackedDifferentialVertex, Normal)));
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedDifferentialVertex), (GLvoid*)(differentialOffset + offsetof(PackedDifferentialVertex, Tangent)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnableVertexAttribArray(2);
+        glEnableVertexAttribArray(3);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bindPoseMesh.EBO);
+
+        glBindVertexArray(0);
+    }
+
+    scene->SkinningBatchesDirty = false;
+
+    // The skinned vertex buffers were just reallocated
+    scene->AllPalettesDirty = true;
+}
+
+// Splits the skinning batches into runs of consecutive instances whose palettes changed.
+// Returns the number of instances left out because their previous skinning result is still valid.
+// Instances skinned inline by the passes drawing them are left out too, and counted in numInline.
+static int GetDirtySkinningRuns(Scene* scene, std::vector<SkinningBatch>& runs, int* numInline)
+{
+    runs.clear();
+
+    int numSkipped = 0;
+    *numInline = 0;
+    for (const SkinningBatch& batch : scene->SkinningBatches)
+    {
+        int numVertices = scene->BindPoseMeshes[batch.BindPoseMeshID].NumVertices;
+        bool inRun = false;
+
+        for (int instanceIdx = 0; instanceIdx < batch.NumInstances; instanceIdx++)
+        {
+            int animSkeletonID = scene->SkinningInstanceAnimatedSkeletonIDs[batch.FirstInstance + instanceIdx];
+            if (scene->AnimatedSkeletons[animSkeletonID].InlineSkinning)
+            {
+                (*numInline)++;
+                inRun = false;
+                continue;
+            }
+
+            if (!scene->AnimatedSkeletons[animSkeletonID].PaletteDirty)
+            {
+                numSkipped++;
+                inRun = false;
+                continue;
+            }
+
+            if (inRun)
+            {
+                runs.back().NumInstances++;
+                continue;
+            }
+
+            SkinningBatch run;
+            run.BindPoseMeshID = batch.BindPoseMeshID;
+            run.FirstInstance = batch.FirstInstance + instanceIdx;
+            run.NumInstances = 1;
+            run.BaseVertex = batch.BaseVertex + instanceIdx * numVertices;
+            runs.push_back(run);
+            inRun = true;
+        }
+    }
+
+    return numSkipped;
 }
 
 static void ReinitRagdollConstraintsToPose(
@@ -251,6 +461,8 @@ static void ReinitRagdollConstraintsToPose(
         int j = (int)ragdoll.JointConstraintParticleIDs.size() - numAngularJointsAdded + constraintToFix;
         ragdoll.BoneConstraints[i].ParticleIDs = &ragdoll.JointConstraintParticleIDs[j][0];
     }
+
+    ragdoll.SolverDirty = true;
 }
 
 static int AddRagdoll(
@@ -260,6 +472,7 @@ static int AddRagdoll(
 {
     Ragdoll ragdoll;
     ragdoll.AnimatedSkeletonID = animatedSkeletonID;
+    ragdoll.SolverDirty = true;
 
     const AnimatedSkeleton& animatedSkeleton = scene->AnimatedSkeletons[animatedSkeletonID];
     int animSequenceID = animatedSkeleton.CurrAnimSequenceID;
@@ -340,6 +553,111 @@ static int AddRagdoll(
     return (int)scene->Ragdolls.size() - 1;
 }
 
+static int AddCrowd(
+    Scene* scene,
+    const int* bindPoseMeshIDs, int numBindPoseMeshes,
+    const int* animSequenceIDs, int numAnimSequences)
+{
+    Crowd crowd;
+
+    crowd.BindPoseMeshIDs.assign(bindPoseMeshIDs, bindPoseMeshIDs + numBindPoseMeshes);
+    crowd.BaseVertices.resize(numBindPoseMeshes, 0);
+    crowd.FirstInstances.resize(numBindPoseMeshes, 0);
+    crowd.AnimSequenceIDs.assign(animSequenceIDs, animSequenceIDs + numAnimSequences);
+    crowd.NumMembers = 0;
+
+    // Pre-skinned positions and differentials are fetched from the skinned vertex buffers by instance.
+    // Inline skinning reads the bind pose instead, and palette IDs once the members have a place in the skinning instance buffer.
+    crowd.VAOs.resize(numBindPoseMeshes);
+    for (int crowdMeshIdx = 0; crowdMeshIdx < numBindPoseMeshes; crowdMeshIdx++)
+    {
+        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[bindPoseMeshIDs[crowdMeshIdx]];
+
+        glGenVertexArrays(1, &crowd.VAOs[crowdMeshIdx]);
+        glBindVertexArray(crowd.VAOs[crowdMeshIdx]);
+
+        glBindBuffer(GL_ARRAY_BUFFER, bindPoseMesh.PositionVBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PositionVertex), (GLvoid*)offsetof(PositionVertex, Position));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnableVertexAttribArray(0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, bindPoseMesh.TexCoordVBO);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TexCoordVertex), (GLvoid*)offsetof(TexCoordVertex, TexCoord));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnableVertexAttribArray(1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, bindPoseMesh.DifferentialVBO);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(DifferentialVertex), (GLvoid*)offsetof(DifferentialVertex, Normal));
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(DifferentialVertex), (GLvoid*)offsetof(DifferentialVertex, Tangent));
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(DifferentialVertex), (GLvoid*)offsetof(DifferentialVertex, Bitangent));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnableVertexAttribArray(2);
+        glEnableVertexAttribArray(3);
+        glEnableVertexAttribArray(4);
+
+        glBindBuffer(GL_ARRAY_BUFFER, bindPoseMesh.BoneVBO);
+        glVertexAttribIPointer(5, 4, GL_UNSIGNED_BYTE, sizeof(BoneWeightVertex), (GLvoid*)offsetof(BoneWeightVertex, BoneIDs));
+        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(BoneWeightVertex), (GLvoid*)offsetof(BoneWeightVertex, Weights));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnableVertexAttribArray(5);
+        glEnableVertexAttribArray(6);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bindPoseMesh.EBO);
+
+        glBindVertexArray(0);
+    }
+
+    glGenBuffers(1, &crowd.MemberTransformBO);
+    glGenTextures(1, &crowd.MemberTransformTO);
+
+    scene->Crowds.push_back(std::move(crowd));
+    return (int)scene->Crowds.size() - 1;
+}
+
+void SetCrowdSize(
+    Scene* scene,
+    int crowdID,
+    int numMembers)
+{
+    Crowd& crowd = scene->Crowds[crowdID];
+
+    // Members are never removed, so growing the crowd again is cheap
+    while ((int)crowd.AnimatedSkeletonIDs.size() < numMembers)
+    {
+        int memberIdx = (int)crowd.AnimatedSkeletonIDs.size();
+
+        int animSequenceID = crowd.AnimSequenceIDs[memberIdx % crowd.AnimSequenceIDs.size()];
+        int animatedSkeletonID = AddAnimatedSkeleton(scene, animSequenceID);
+
+        // Start members at different times so the crowd doesn't move in lockstep
+        scene->AnimatedSkeletons[animatedSkeletonID].CurrTimeMillisecond = (memberIdx * 7919) % 10000;
+
+        glm::vec3 position(
+            (memberIdx % kCrowdGridWidth - kCrowdGridWidth / 2) * kCrowdGridSpacing,
+            0.0f,
+            -(memberIdx / kCrowdGridWidth + 1) * kCrowdGridSpacing);
+
+        crowd.AnimatedSkeletonIDs.push_back(animatedSkeletonID);
+        crowd.MemberTransforms.push_back(translate(glm::mat4(), position));
+    }
+
+    crowd.NumMembers = numMembers;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, crowd.MemberTransformBO);
+    glBufferData(GL_TEXTURE_BUFFER, crowd.MemberTransforms.size() * sizeof(glm::mat4), crowd.MemberTransforms.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, crowd.MemberTransformTO);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, crowd.MemberTransformBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    scene->SkinningBatchesDirty = true;
+}
+
 static int AddTransformSceneNode(
     Scene* scene)
 {
@@ -377,14 +695,64 @@ static int AddSkinnedMeshSceneNode(
     return (int)scene->SceneNodes.size() - 1;
 }
 
+bool MaterialHasTransparency(const Scene* scene, const Material& material)
+{
+    for (int diffuseTextureIdx = 0; diffuseTextureIdx < (int)material.DiffuseTextureIDs.size(); diffuseTextureIdx++)
+    {
+        if (scene->DiffuseTextures[material.DiffuseTextureIDs[diffuseTextureIdx]].HasTransparency)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int GetScenePermutation(const Material& material, bool hasTransparency)
+{
+    if (hasTransparency)
+    {
+        return SCENEPERMUTATION_TRANSPARENT;
+    }
+
+    bool hasNormalMap = material.NormalTextureIDs.size() >= 1 && material.NormalTextureIDs[0] != -1;
+    return hasNormalMap ? SCENEPERMUTATION_NORMALMAP : 0;
+}
+
+// Starts loading the scene program permutations the loaded materials are drawn with, for both skinning methods and
+// both skinning paths, so the first frames and switching methods or inline skinning don't wait on them to compile.
+static void RequestScenePrograms(Scene* scene)
+{
+    for (const Material& material : scene->Materials)
+    {
+        int permutation = GetScenePermutation(material, MaterialHasTransparency(scene, material));
+        RequestProgram(&scene->SceneSPs[permutation]);
+        RequestProgram(&scene->ScenePackedSPs[permutation]);
+        RequestProgram(&scene->CrowdSPs[permutation]);
+        for (int method = 0; method < 2; method++)
+        {
+            RequestProgram(&scene->SceneSkinnedSPs[method][permutation]);
+            RequestProgram(&scene->CrowdSkinnedSPs[method][permutation]);
+        }
+    }
+}
+
 void InitScene(Scene* scene)
 {
     // Initial values
     scene->AllShadersOK = false;
+    scene->ShaderStartup_ms = -1.0f;
+    scene->ShaderStartupStartTicks = 0;
     scene->CameraPosition = glm::vec3(85.9077225f, 200.844162f, 140.049072f);
     scene->CameraQuaternion = glm::vec4(-0.351835f, 0.231701f, 0.090335f, 0.902411f);
     scene->EnableCamera = true;
     scene->MeshSkinningMethod = SKINNING_DLB;
+    scene->MeshSkinningBackend = SKINNINGBACKEND_TRANSFORMFEEDBACK;
+    scene->ComputeSkinningSupported = glDispatchCompute.fptr != NULL && glMemoryBarrier.fptr != NULL;
+    scene->CPUSkinningNeedsValidation = true;
+    scene->AllPalettesDirty = true;
+    scene->MeshInlineSkinningMode = INLINESKINNING_AUTO;
+    scene->InlineSkinningBench.IsRunning = false;
     scene->IsPlaying = true;
     scene->ShouldStep = false;
     // Cornflower blue
@@ -404,10 +772,46 @@ void InitScene(Scene* scene)
     scene->RagdollJointStiffness = 0.01f;
     scene->Gravity = -981.0f;
     scene->LightPosition = glm::vec3(0.0f, 300.0f, 100.0f);
+    scene->CacheStaticShadows = true;
+    scene->FitShadowFrustum = true;
+    InitDynamicResolution(&scene->DynamicRes);
+    scene->TraceCaptureFrames = 60;
+    InitFrameStats(&scene->FrameStatistics, 1000.0f / 60.0f);
 
-    scene->SkinningOutputs = { "oPosition", "gl_NextBuffer", "oNormal", "oTangent", "oBitangent" };
+    scene->SkinningOutputs = { "oPosition", "gl_NextBuffer", "oNormal", "oTangent" };
     scene->SkinningSPs[0] = ReloadableProgram(&scene->SkinningDLB).WithVaryings(scene->SkinningOutputs, GL_INTERLEAVED_ATTRIBS);
     scene->SkinningSPs[1] = ReloadableProgram(&scene->SkinningLBS).WithVaryings(scene->SkinningOutputs, GL_INTERLEAVED_ATTRIBS);
+    for (int influences = 0; influences < SKINNINGINFLUENCES_COUNT; influences++)
+    {
+        scene->SkinningComputeSPs[0][influences] = ReloadableProgram(&scene->SkinningDLBCompute[influences]);
+        scene->SkinningComputeSPs[1][influences] = ReloadableProgram(&scene->SkinningLBSCompute[influences]);
+    }
+    scene->SkinningInfluenceVariants = true;
+
+    ReloadableShader* skinningInlineLibraries[] = { &scene->SkinningInlineDLB, &scene->SkinningInlineLBS };
+    for (int permutation = 0; permutation < SCENEPERMUTATION_COUNT; permutation++)
+    {
+        ReloadableShader* fs = &scene->SceneFS[permutation];
+        scene->SceneSPs[permutation] = ReloadableProgram(&scene->SceneVS, fs);
+        scene->ScenePackedSPs[permutation] = ReloadableProgram(&scene->ScenePackedVS, fs);
+        scene->CrowdSPs[permutation] = ReloadableProgram(&scene->CrowdVS, fs);
+        for (int method = 0; method < 2; method++)
+        {
+            scene->SceneSkinnedSPs[method][permutation] = ReloadableProgram(&scene->SceneSkinnedVS, fs).WithLibrary(skinningInlineLibraries[method]);
+            scene->CrowdSkinnedSPs[method][permutation] = ReloadableProgram(&scene->CrowdSkinnedVS, fs).WithLibrary(skinningInlineLibraries[method]);
+        }
+    }
+    for (int method = 0; method < 2; method++)
+    {
+        scene->ShadowSkinnedSPs[method] = ReloadableProgram(&scene->ShadowSkinnedVS, &scene->ShadowFS).WithLibrary(skinningInlineLibraries[method]);
+        scene->CrowdShadowSkinnedSPs[method] = ReloadableProgram(&scene->CrowdShadowSkinnedVS, &scene->ShadowFS).WithLibrary(skinningInlineLibraries[method]);
+    }
+
+    InitUploadRingBuffer(&scene->BonePaletteRing, 64 * 1024);
+    glGenTransformFeedbacks(1, &scene->SkinningTFO);
+    glGenTextures(1, &scene->SkinnedPositionTO);
+    glGenTextures(1, &scene->SkinnedDifferentialTO);
+    scene->SkinningBatchesDirty = true;
 
     std::string assetFolder = "assets/";
 
@@ -465,6 +869,11 @@ void InitScene(Scene* scene)
         scene->SceneNodes[hellknightSceneNode].TransformParentNodeID = hellknightTransformNodeID;
     }
 
+    scene->HellknightCrowdID = AddCrowd(
+        scene,
+        hellknightBindPoseMeshIDs.data(), (int)hellknightBindPoseMeshIDs.size(),
+        hellknightAnimSequenceIDs.data(), (int)hellknightAnimSequenceIDs.size());
+
     int hellknightRagdollID = AddRagdoll(
         scene, 
         hellknightBindPoseMeshIDs.data(), 1,// (int)hellknightBindPoseMeshIDs.size(), 
@@ -479,26 +888,41 @@ void InitScene(Scene* scene)
         int floorSceneNode = AddStaticMeshSceneNode(scene, floorStaticMeshIDs[floorMeshIdx]);
         scene->SceneNodes[floorSceneNode].TransformParentNodeID = floorTransformNodeID;
     }
+
+    RequestScenePrograms(scene);
 }
 
+// Programs of both skinning methods are loaded, so switching methods doesn't wait on compiling them
 static void ReloadShaders(Scene* scene)
 {
     // Convenience functions to make things more concise
     GLuint sp;
-    bool anyProgramOutOfDate = false;
-    bool anyProgramRelinkFailed = false;
-    auto reload = [&sp, &anyProgramOutOfDate, &anyProgramRelinkFailed](ReloadableProgram* program)
+    bool allProgramsOK = true;
+    auto reload = [&sp, &allProgramsOK](ReloadableProgram* program)
     {
-        bool wasOutOfDate, newProgramLinked;
-        ReloadProgram(program, &wasOutOfDate, &newProgramLinked);
+        bool newProgramLinked;
+        ReloadProgram(program, NULL, &newProgramLinked);
         sp = program->Handle;
-        if (wasOutOfDate)
+
+        // A program that failed to reload keeps its previous version, but that's likely out of sync with the others
+        if (!program->Handle || program->ReloadFailed)
         {
-            anyProgramOutOfDate = true;
+            allProgramsOK = false;
         }
-        if (wasOutOfDate && !newProgramLinked)
+        return newProgramLinked;
+    };
+
+    // Programs loaded on demand are only needed once requested. Until the scene first draws, they're waited on like the
+    // others so the first frames have all of RequestScenePrograms' permutations. A draw asking for one later falls back
+    // to another permutation while it loads.
+    auto reloadOnDemand = [scene, &sp, &allProgramsOK](ReloadableProgram* program)
+    {
+        bool newProgramLinked;
+        ReloadProgram(program, NULL, &newProgramLinked);
+        sp = program->Handle;
+        if ((!program->Handle && !scene->AllShadersOK) || program->ReloadFailed)
         {
-            anyProgramRelinkFailed = true;
+            allProgramsOK = false;
         }
         return newProgramLinked;
     };
@@ -522,33 +946,115 @@ static void ReloadShaders(Scene* scene)
     };
 
     // Reload shaders & uniforms
-    if (reload(&scene->SkinningSPs[scene->MeshSkinningMethod]))
+    for (int method = 0; method < 2; method++)
     {
-        if (getU(&scene->SkinningSP_BoneTransformsLoc, "BoneTransforms"))
+        if (reload(&scene->SkinningSPs[method]))
         {
-            return;
+            // Palettes skinned by the previous program may be stale, so skin everything again
+            scene->AllPalettesDirty = true;
+            if (getU(&scene->SkinningSP_BoneTransformsLoc[method], "BoneTransforms") ||
+                getU(&scene->SkinningSP_PaletteTableOffsetLoc[method], "PaletteTableOffset") ||
+                getU(&scene->SkinningSP_InfluenceRangeEndsLoc[method], "InfluenceRangeEnds"))
+            {
+                return;
+            }
         }
     }
 
-    if (reload(&scene->SceneSP))
+    // Compute shaders don't compile below GL 4.3
+    if (glDispatchCompute.fptr)
     {
-        if (getUOpt(&scene->SceneSP_ModelWorldLoc, "ModelWorld") ||
-            getUOpt(&scene->SceneSP_WorldModelLoc, "WorldModel") ||
-            getUOpt(&scene->SceneSP_ModelViewLoc, "ModelView") ||
-            getUOpt(&scene->SceneSP_ModelViewProjectionLoc, "ModelViewProjection") ||
-            getUOpt(&scene->SceneSP_WorldViewLoc, "WorldView") ||
-            getUOpt(&scene->SceneSP_CameraPositionLoc, "CameraPosition") ||
-            getUOpt(&scene->SceneSP_LightPositionLoc, "LightPosition") ||
-            getUOpt(&scene->SceneSP_WorldLightProjectionLoc, "WorldLightProjection") ||
-            getUOpt(&scene->SceneSP_DiffuseTextureLoc, "DiffuseTexture") ||
-            getUOpt(&scene->SceneSP_SpecularTextureLoc, "SpecularTexture") ||
-            getUOpt(&scene->SceneSP_NormalTextureLoc, "NormalTexture") ||
-            getUOpt(&scene->SceneSP_ShadowMapTextureLoc, "ShadowMapTexture") ||
-            getUOpt(&scene->SceneSP_IlluminationModelLoc, "IlluminationModel") ||
-            getUOpt(&scene->SceneSP_HasNormalMapLoc, "HasNormalMap") ||
-            getUOpt(&scene->SceneSP_BackgroundColorLoc, "BackgroundColor"))
+        for (int method = 0; method < 2; method++)
         {
-            return;
+            for (int influences = 0; influences < SKINNINGINFLUENCES_COUNT; influences++)
+            {
+                if (reload(&scene->SkinningComputeSPs[method][influences]))
+                {
+                    scene->AllPalettesDirty = true;
+                    SkinningComputeUniformLocations* locs = &scene->SkinningComputeSPLocs[method][influences];
+                    if (getU(&locs->BoneTransformsLoc, "BoneTransforms") ||
+                        getU(&locs->PaletteTableOffsetLoc, "PaletteTableOffset") ||
+                        getU(&locs->FirstInstanceLoc, "FirstInstance") ||
+                        getU(&locs->BaseVertexLoc, "BaseVertex") ||
+                        getU(&locs->NumVerticesLoc, "NumVertices") ||
+                        getU(&locs->NumBonesLoc, "NumBones") ||
+                        getU(&locs->FirstVertexLoc, "FirstVertex") ||
+                        getU(&locs->EndVertexLoc, "EndVertex"))
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    // Scene shader permutations share their uniforms, those a permutation doesn't declare are left at -1
+    auto getSceneLocs = [&getUOpt](SceneUniformLocations* locs)
+    {
+        return getUOpt(&locs->ModelWorldLoc, "ModelWorld") ||
+            getUOpt(&locs->WorldModelLoc, "WorldModel") ||
+            getUOpt(&locs->ModelViewLoc, "ModelView") ||
+            getUOpt(&locs->ModelViewProjectionLoc, "ModelViewProjection") ||
+            getUOpt(&locs->WorldViewLoc, "WorldView") ||
+            getUOpt(&locs->WorldViewProjectionLoc, "WorldViewProjection") ||
+            getUOpt(&locs->CameraPositionLoc, "CameraPosition") ||
+            getUOpt(&locs->LightPositionLoc, "LightPosition") ||
+            getUOpt(&locs->WorldLightProjectionLoc, "WorldLightProjection") ||
+            getUOpt(&locs->DiffuseTextureLoc, "DiffuseTexture") ||
+            getUOpt(&locs->SpecularTextureLoc, "SpecularTexture") ||
+            getUOpt(&locs->NormalTextureLoc, "NormalTexture") ||
+            getUOpt(&locs->ShadowMapTextureLoc, "ShadowMapTexture") ||
+            getUOpt(&locs->BackgroundColorLoc, "BackgroundColor") ||
+            getUOpt(&locs->BoneTransformsLoc, "BoneTransforms") ||
+            getUOpt(&locs->PaletteOffsetLoc, "PaletteOffset") ||
+            getUOpt(&locs->PaletteTableOffsetLoc, "PaletteTableOffset") ||
+            getUOpt(&locs->SkinnedPositionsLoc, "SkinnedPositions") ||
+            getUOpt(&locs->SkinnedDifferentialsLoc, "SkinnedDifferentials") ||
+            getUOpt(&locs->MemberTransformsLoc, "MemberTransforms") ||
+            getUOpt(&locs->BaseVertexLoc, "BaseVertex") ||
+            getUOpt(&locs->NumVerticesLoc, "NumVertices");
+    };
+
+    auto getShadowLocs = [&getUOpt](ShadowUniformLocations* locs)
+    {
+        return getUOpt(&locs->ModelLightProjectionLoc, "ModelLightProjection") ||
+            getUOpt(&locs->WorldLightProjectionLoc, "WorldLightProjection") ||
+            getUOpt(&locs->BoneTransformsLoc, "BoneTransforms") ||
+            getUOpt(&locs->PaletteOffsetLoc, "PaletteOffset") ||
+            getUOpt(&locs->PaletteTableOffsetLoc, "PaletteTableOffset") ||
+            getUOpt(&locs->SkinnedPositionsLoc, "SkinnedPositions") ||
+            getUOpt(&locs->MemberTransformsLoc, "MemberTransforms") ||
+            getUOpt(&locs->BaseVertexLoc, "BaseVertex") ||
+            getUOpt(&locs->NumVerticesLoc, "NumVertices");
+    };
+
+    // Scene permutations are only loaded once requested, see RequestScenePrograms
+    for (int permutation = 0; permutation < SCENEPERMUTATION_COUNT; permutation++)
+    {
+        struct { ReloadableProgram* SP; SceneUniformLocations* Locs; } scenePrograms[] = {
+            { &scene->SceneSPs[permutation], &scene->SceneSPLocs[permutation] },
+            { &scene->ScenePackedSPs[permutation], &scene->ScenePackedSPLocs[permutation] },
+            { &scene->SceneSkinnedSPs[SKINNING_DLB][permutation], &scene->SceneSkinnedSPLocs[SKINNING_DLB][permutation] },
+            { &scene->SceneSkinnedSPs[SKINNING_LBS][permutation], &scene->SceneSkinnedSPLocs[SKINNING_LBS][permutation] },
+            { &scene->CrowdSPs[permutation], &scene->CrowdSPLocs[permutation] },
+            { &scene->CrowdSkinnedSPs[SKINNING_DLB][permutation], &scene->CrowdSkinnedSPLocs[SKINNING_DLB][permutation] },
+            { &scene->CrowdSkinnedSPs[SKINNING_LBS][permutation], &scene->CrowdSkinnedSPLocs[SKINNING_LBS][permutation] }
+        };
+
+        for (const auto& sceneProgram : scenePrograms)
+        {
+            if (!IsProgramRequested(sceneProgram.SP))
+            {
+                continue;
+            }
+
+            if (reloadOnDemand(sceneProgram.SP))
+            {
+                if (getSceneLocs(sceneProgram.Locs))
+                {
+                    return;
+                }
+            }
         }
     }
 
@@ -563,22 +1069,49 @@ static void ReloadShaders(Scene* scene)
 
     if (reload(&scene->ShadowSP))
     {
-        if (getUOpt(&scene->ShadowSP_ModelLightProjectionLoc, "ModelLightProjection"))
+        if (getShadowLocs(&scene->ShadowSPLocs))
+        {
+            return;
+        }
+    }
+
+    for (int method = 0; method < 2; method++)
+    {
+        if (reload(&scene->ShadowSkinnedSPs[method]))
+        {
+            if (getShadowLocs(&scene->ShadowSkinnedSPLocs[method]))
+            {
+                return;
+            }
+        }
+    }
+
+    if (reload(&scene->CrowdShadowSP))
+    {
+        if (getShadowLocs(&scene->CrowdShadowSPLocs))
         {
             return;
         }
     }
 
-    if (anyProgramOutOfDate)
+    for (int method = 0; method < 2; method++)
     {
-        scene->AllShadersOK = !anyProgramRelinkFailed;
+        if (reload(&scene->CrowdShadowSkinnedSPs[method]))
+        {
+            if (getShadowLocs(&scene->CrowdShadowSkinnedSPLocs[method]))
+            {
+                return;
+            }
+        }
     }
+
+    scene->AllShadersOK = allProgramsOK;
 }
 
-static void ShowGPUProfilingGUI(Scene* scene)
+static void ShowGPUProfilingGUI(Scene* scene, const std::vector<GPUMarker>& markers)
 {
     int windowWidth = 300;
-    int windowHeight = 150;
+    int windowHeight = 420;
 
     ImGui::SetNextWindowSize(ImVec2((float)windowWidth, (float)windowHeight), ImGuiSetCond_Always);
     ImGui::SetNextWindowPos(ImVec2(0, 120), ImGuiSetCond_Always);
@@ -596,9 +1129,6 @@ static void ShowGPUProfilingGUI(Scene* scene)
     float textHeight = ImGui::GetTextLineHeightWithSpacing();
     float height = textHeight + 2 * spacing;
 
-    std::vector<GPUMarker> markers;
-    scene->Profiling.ReadFrame(markers);
-
     for (const GPUMarker& marker : markers)
     {
         // Convert elapsed time from nanoseconds to milliseconds
@@ -614,38 +1144,411 @@ static void ShowGPUProfilingGUI(Scene* scene)
         float width = windowWidth * heat;
         ImU32 color = ImColor(0.3f * heat, 0.3f * (1.0f - heat), 0.0f);
 
-        // Draw bar
+        // Draw bar, indented under the marker it's nested in
         ImVec2 p0 = ImGui::GetCursorScreenPos();
-        ImVec2 p1 = ImVec2(p0.x + width, p0.y + height);
-        drawList->AddRectFilled(p0, p1, color, 0.0f);
+        float indent = marker.Depth * 2 * spacing;
+        ImVec2 p1 = ImVec2(p0.x + indent + width, p0.y + height);
+        drawList->AddRectFilled(ImVec2(p0.x + indent, p0.y), p1, color, 0.0f);
 
         // Draw text inside bar and move cursor to start of next bar
-        ImGui::SetCursorScreenPos(ImVec2(p0.x + spacing, p0.y + spacing));
-        ImGui::Text("%s (%.2f ms)", marker.Name.c_str(), emaTime);
+        ImGui::SetCursorScreenPos(ImVec2(p0.x + indent + spacing, p0.y + spacing));
+        ImGui::Text("%s (%.2f ms)", marker.Name, emaTime);
         ImGui::SetCursorScreenPos(ImVec2(p0.x, p0.y + height));
     }
 
-    ImGui::End();
-}
+    ImGui::Text("GPU timers: %s, %d markers dropped",
+        scene->Profiling.HasGPUTimestamps() ? "timestamps" : "time elapsed, outermost only",
+        scene->Profiling.GetNumDroppedMarkers());
 
-static void ShowSystemInfoGUI(Scene* scene)
-{
-    ImGui::SetNextWindowPos(ImVec2(0, 0), ImGuiSetCond_Always);
-    if (ImGui::Begin("Info", NULL, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize))
+    // Each backend keeps its own moving average, so switching between them gives a side by side comparison
+    auto tfSkinningEMA = scene->ProfilingEMAs.find("Skinning (TF)");
+    auto computeSkinningEMA = scene->ProfilingEMAs.find("Skinning (Compute)");
+    if (tfSkinningEMA != scene->ProfilingEMAs.end() && computeSkinningEMA != scene->ProfilingEMAs.end())
     {
-        char cpuBrandString[0x40];
-        memset(cpuBrandString, 0, sizeof(cpuBrandString));
+        ImGui::Text("Skinning TF vs Compute: %.2f / %.2f ms", tfSkinningEMA->second, computeSkinningEMA->second);
+    }
 
-        // Get CPU brand string.
-#ifdef _WIN32
-        int cpuInfo[4] = { -1 };
-        __cpuid(cpuInfo, 0x80000002);
-        memcpy(cpuBrandString, cpuInfo, sizeof(cpuInfo));
-        __cpuid(cpuInfo, 0x80000003);
-        memcpy(cpuBrandString + 16, cpuInfo, sizeof(cpuInfo));
-        __cpuid(cpuInfo, 0x80000004);
-        memcpy(cpuBrandString + 32, cpuInfo, sizeof(cpuInfo));
-#elif __APPLE__
+    // Palette reads and blends the influence count variants skip, compared to blending 4 influences for every vertex
+    if (scene->MeshSkinningBackend != SKINNINGBACKEND_CPU)
+    {
+        const int kInfluenceCounts[SKINNINGINFLUENCES_COUNT] = { 1, 2, 4 };
+        int texelsPerBone = scene->MeshSkinningMethod == SKINNING_DLB ? 2 : 3;
+
+        int64_t numVertices = 0;
+        int64_t numBlendsSaved = 0;
+        for (int influences = 0; influences < SKINNINGINFLUENCES_COUNT; influences++)
+        {
+            numVertices += scene->SkinnedVerticesByInfluences[influences];
+            numBlendsSaved += scene->SkinnedVerticesByInfluences[influences] * (4 - kInfluenceCounts[influences]);
+        }
+
+        if (!scene->SkinningInfluenceVariants)
+        {
+            numBlendsSaved = 0;
+        }
+
+        ImGui::Text("Influences 1/2/4: %lld/%lld/%lld verts",
+            (long long)scene->SkinnedVerticesByInfluences[SKINNINGINFLUENCES_1],
+            (long long)scene->SkinnedVerticesByInfluences[SKINNINGINFLUENCES_2],
+            (long long)scene->SkinnedVerticesByInfluences[SKINNINGINFLUENCES_4]);
+        ImGui::Text("Saved: %lld palette reads, %lld blends (%.0f%%)",
+            (long long)(numBlendsSaved * texelsPerBone), (long long)numBlendsSaved,
+            numVertices > 0 ? 100.0f * numBlendsSaved / (numVertices * 4) : 0.0f);
+
+        const char* markerNames[2][2] = {
+            { "Skinning (TF)", "Skinning (TF, 4 influences)" },
+            { "Skinning (Compute)", "Skinning (Compute, 4 influences)" }
+        };
+        const char* const* backendMarkerNames = markerNames[scene->MeshSkinningBackend];
+        auto variantsEMA = scene->ProfilingEMAs.find(backendMarkerNames[0]);
+        auto fourInfluencesEMA = scene->ProfilingEMAs.find(backendMarkerNames[1]);
+        if (variantsEMA != scene->ProfilingEMAs.end() && fourInfluencesEMA != scene->ProfilingEMAs.end())
+        {
+            ImGui::Text("Variants vs 4 influences: %.2f / %.2f ms", variantsEMA->second, fourInfluencesEMA->second);
+        }
+    }
+
+    if (scene->MeshSkinningBackend == SKINNINGBACKEND_CPU)
+    {
+        ImGui::Text("CPU skinning: %.1f Mverts/s (%s, error %.1e)",
+            scene->CPUSkinningVerticesPerSecond / 1e6f, GetCPUSkinningISA(), scene->CPUSkinningMaxError);
+    }
+
+    ImGui::Text("Static shadow map updates: %d", scene->NumStaticShadowMapUpdates);
+
+    const DynamicResolution& dynRes = scene->DynamicRes;
+    ImGui::Text("Resolution: %.0f%%, %dx MSAA (GPU %.2f / %.2f ms)",
+        dynRes.Scale * 100.0f, dynRes.NumSamples, dynRes.GPUFrameTimeEMA_ms, dynRes.TargetFrameTime_ms);
+    ImGui::PlotLines("##scalehistory", dynRes.ScaleHistory, DYNAMIC_RESOLUTION_HISTORY_SIZE, dynRes.HistoryIndex,
+        "Scale", 0.0f, 1.0f, ImVec2((float)windowWidth - 20.0f, 30.0f));
+    ImGui::PlotLines("##gputimehistory", dynRes.GPUFrameTimeHistory, DYNAMIC_RESOLUTION_HISTORY_SIZE, dynRes.HistoryIndex,
+        "GPU ms", 0.0f, 2.0f * dynRes.TargetFrameTime_ms, ImVec2((float)windowWidth - 20.0f, 30.0f));
+    ImGui::Text("Change %d: %s", dynRes.NumDecisions, dynRes.LastDecision);
+
+    ImGui::Text("Meshes: %d skinned, %d skipped, %d inline", scene->NumMeshesSkinned, scene->NumMeshesSkipped, scene->NumMeshesInlineSkinned);
+
+    const UploadRingBuffer& paletteRing = scene->BonePaletteRing;
+    ImGui::Text("Palette upload: %d bytes/frame (%d bones)", (int)paletteRing.BytesUploaded, scene->NumPaletteBonesUploaded);
+    ImGui::Text("Palette stalls: %d (%d total, %s)", paletteRing.NumStalls, paletteRing.TotalStalls,
+        paletteRing.IsPersistent ? "persistent" : "orphaning");
+
+    ImGui::End();
+}
+
+static void ShowCPUProfilingGUI(Scene* scene, const std::vector<CPUMarker>& markers)
+{
+    int windowWidth = 300;
+    int windowHeight = 180;
+
+    ImGui::SetNextWindowSize(ImVec2((float)windowWidth, (float)windowHeight), ImGuiSetCond_Always);
+    ImGui::SetNextWindowPos(ImVec2(0, 540), ImGuiSetCond_Always);
+
+    if (!ImGui::Begin("CPU Profiling", NULL, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize))
+    {
+        ImGui::End();
+        return;
+    }
+
+    // Sum markers with the same name, so work split across threads or calls shows up once
+    std::vector<const CPUMarker*> firstMarkers;
+    std::unordered_map<const char*, float> frameTimes;
+    int numThreads = 0;
+    for (const CPUMarker& marker : markers)
+    {
+        auto found = frameTimes.find(marker.Name);
+        if (found == frameTimes.end())
+        {
+            firstMarkers.push_back(&marker);
+            found = frameTimes.emplace(marker.Name, 0.0f).first;
+        }
+        found->second += marker.TimeElapsed / 1e6f;
+        numThreads = std::max(numThreads, marker.ThreadIdx + 1);
+    }
+
+    for (const CPUMarker* marker : firstMarkers)
+    {
+        float weight = 0.05f;
+        float emaTime = weight * frameTimes[marker->Name] + (1.0f - weight) * scene->CPUProfilingEMAs[marker->Name];
+        scene->CPUProfilingEMAs[marker->Name] = emaTime;
+
+        ImGui::SetCursorPosX(ImGui::GetCursorPosX() + marker->Depth * 12.0f);
+        ImGui::Text("%s (%.2f ms)", marker->Name, emaTime);
+    }
+
+    ImGui::Text("Threads: %d", numThreads);
+
+    ImGui::End();
+}
+
+static ImU32 GetFrameStatsScopeColor(int scopeID)
+{
+    float r, g, b;
+    ImGui::ColorConvertHSVtoRGB(fmodf(scopeID * 0.17f, 1.0f), 0.6f, 0.8f, r, g, b);
+    return ImColor(r, g, b);
+}
+
+static void ShowFrameStatsGUI(Scene* scene)
+{
+    FrameStats& stats = scene->FrameStatistics;
+
+    // Between the profiling windows on the left and the toolbox on the right, collapsed at first to keep the view clear
+    ImGuiIO& io = ImGui::GetIO();
+    float windowWidth = std::max(io.DisplaySize.x - 600.0f, 300.0f);
+    float windowHeight = 300.0f;
+    ImGui::SetNextWindowSize(ImVec2(windowWidth, windowHeight), ImGuiSetCond_Always);
+    ImGui::SetNextWindowPos(ImVec2(300.0f, io.DisplaySize.y - windowHeight), ImGuiSetCond_Always);
+    ImGui::SetNextWindowCollapsed(true, ImGuiSetCond_FirstUseEver);
+
+    if (!ImGui::Begin("Frame Times", NULL, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize))
+    {
+        ImGui::End();
+        return;
+    }
+
+    ImGui::SliderFloat("Budget (ms)", &stats.Budget_ms, 1.0f, 50.0f);
+    ImGui::Text("%d frames, %d over budget", stats.NumFrames, stats.NumHitches);
+
+    // Distribution of each scope
+    ImGui::Columns(6, "framestatspercentiles");
+    for (const char* header : { "Scope", "Min", "P50", "P95", "P99", "Max" })
+    {
+        ImGui::Text("%s", header);
+        ImGui::NextColumn();
+    }
+
+    auto showPercentiles = [&](const char* name, const char* side, const std::vector<float>& times_ms)
+    {
+        FrameStatsPercentiles percentiles = ComputeFrameStatsPercentiles(&stats, times_ms);
+        ImGui::Text("%s (%s)", name, side); ImGui::NextColumn();
+        for (float time_ms : { percentiles.Min_ms, percentiles.P50_ms, percentiles.P95_ms, percentiles.P99_ms, percentiles.Max_ms })
+        {
+            if (time_ms > stats.Budget_ms)
+            {
+                ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%.2f", time_ms);
+            }
+            else
+            {
+                ImGui::Text("%.2f", time_ms);
+            }
+            ImGui::NextColumn();
+        }
+    };
+
+    showPercentiles("Frame", "CPU", stats.CPUFrameTimes_ms);
+    showPercentiles("Frame", "GPU", stats.GPUFrameTimes_ms);
+    for (const FrameStatsScope& scope : stats.Scopes)
+    {
+        if (scope.IsGPU || scope.Depth > 0)
+        {
+            showPercentiles(scope.Name, scope.IsGPU ? "GPU" : "CPU", scope.Times_ms);
+        }
+    }
+    ImGui::Columns(1);
+
+    // Frame time graph and histogram, up to twice the budget
+    float graphMax_ms = 2.0f * stats.Budget_ms;
+    int numGraphFrames = stats.NumFrames;
+    int graphOffset = stats.NumFrames < FRAME_STATS_HISTORY_SIZE ? 0 : stats.NextIndex;
+    ImGui::PlotLines("##cpuframetimes", stats.CPUFrameTimes_ms.data(), numGraphFrames, graphOffset,
+        "CPU frame (ms)", 0.0f, graphMax_ms, ImVec2(windowWidth - 20.0f, 40.0f));
+    ImGui::PlotLines("##gpuframetimes", stats.GPUFrameTimes_ms.data(), numGraphFrames, graphOffset,
+        "GPU frame (ms)", 0.0f, graphMax_ms, ImVec2(windowWidth - 20.0f, 40.0f));
+
+    const int kNumHistogramBins = 40;
+    float histogram[kNumHistogramBins];
+    ComputeFrameStatsHistogram(&stats, stats.CPUFrameTimes_ms, graphMax_ms, kNumHistogramBins, histogram);
+    ImGui::PlotHistogram("##cpuframehistogram", histogram, kNumHistogramBins, 0,
+        "CPU frame histogram, 0 to 2x budget", 0.0f, FLT_MAX, ImVec2(windowWidth - 20.0f, 40.0f));
+
+    // Stacked timeline of the last frames, split into the scopes directly under the frame
+    if (ImGui::RadioButton("CPU timeline", !scene->FrameStatsTimelineGPU))
+    {
+        scene->FrameStatsTimelineGPU = false;
+    }
+    ImGui::SameLine();
+    if (ImGui::RadioButton("GPU timeline", scene->FrameStatsTimelineGPU))
+    {
+        scene->FrameStatsTimelineGPU = true;
+    }
+
+    bool timelineGPU = scene->FrameStatsTimelineGPU;
+    int timelineDepth = timelineGPU ? 0 : 1;
+    const int kNumTimelineFrames = 240;
+    int numTimelineFrames = std::min(stats.NumFrames, kNumTimelineFrames);
+    float timelineWidth = windowWidth - 20.0f;
+    float timelineHeight = 80.0f;
+    float columnWidth = timelineWidth / kNumTimelineFrames;
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    drawList->AddRectFilled(origin, ImVec2(origin.x + timelineWidth, origin.y + timelineHeight), ImColor(0.1f, 0.1f, 0.1f));
+
+    for (int column = 0; column < numTimelineFrames; column++)
+    {
+        int frameIdx = stats.NumFrames - numTimelineFrames + column;
+        float x0 = origin.x + column * columnWidth;
+        float y = origin.y + timelineHeight;
+
+        for (int scopeID = 0; scopeID < (int)stats.Scopes.size(); scopeID++)
+        {
+            const FrameStatsScope& scope = stats.Scopes[scopeID];
+            if (scope.IsGPU != timelineGPU || scope.Depth != timelineDepth)
+            {
+                continue;
+            }
+
+            float height = GetFrameStatsTime(&stats, scope.Times_ms, frameIdx) / graphMax_ms * timelineHeight;
+            float y1 = std::max(y - height, origin.y);
+            drawList->AddRectFilled(ImVec2(x0, y1), ImVec2(x0 + std::max(columnWidth - 1.0f, 1.0f), y), GetFrameStatsScopeColor(scopeID));
+            y = y1;
+        }
+    }
+
+    float budgetY = origin.y + timelineHeight * 0.5f;
+    drawList->AddLine(ImVec2(origin.x, budgetY), ImVec2(origin.x + timelineWidth, budgetY), ImColor(1.0f, 0.3f, 0.3f));
+    ImGui::Dummy(ImVec2(timelineWidth, timelineHeight));
+
+    // Legend
+    bool firstInLegend = true;
+    for (int scopeID = 0; scopeID < (int)stats.Scopes.size(); scopeID++)
+    {
+        const FrameStatsScope& scope = stats.Scopes[scopeID];
+        if (scope.IsGPU != timelineGPU || scope.Depth != timelineDepth)
+        {
+            continue;
+        }
+
+        if (!firstInLegend)
+        {
+            ImGui::SameLine();
+        }
+        ImGui::TextColored(ImGui::ColorConvertU32ToFloat4(GetFrameStatsScopeColor(scopeID)), "%s", scope.Name);
+        firstInLegend = false;
+    }
+
+    // Most recent hitches first
+    ImGui::Text("Over budget:");
+    int numShownHitches = std::min(stats.NumHitches, FRAME_STATS_MAX_HITCHES);
+    for (int hitchIdx = 0; hitchIdx < numShownHitches; hitchIdx++)
+    {
+        const FrameStatsHitch& hitch = stats.Hitches[(stats.NumHitches - 1 - hitchIdx) % FRAME_STATS_MAX_HITCHES];
+        if (hitch.ScopeID != -1)
+        {
+            ImGui::Text("Frame %d: %.2f ms %s, %s +%.2f ms", hitch.Frame, hitch.FrameTime_ms, hitch.IsGPU ? "GPU" : "CPU",
+                stats.Scopes[hitch.ScopeID].Name, hitch.ScopeExcess_ms);
+        }
+        else
+        {
+            ImGui::Text("Frame %d: %.2f ms %s", hitch.Frame, hitch.FrameTime_ms, hitch.IsGPU ? "GPU" : "CPU");
+        }
+    }
+
+    ImGui::End();
+}
+
+static void ApplyInlineSkinningBenchmarkStep(Scene* scene)
+{
+    InlineSkinningBenchmark& bench = scene->InlineSkinningBench;
+
+    SetCrowdSize(scene, scene->HellknightCrowdID, bench.CrowdSizes[bench.StepIdx / 2]);
+    scene->MeshInlineSkinningMode = bench.StepIdx % 2 == 0 ? INLINESKINNING_OFF : INLINESKINNING_ON;
+
+    bench.FrameIdx = 0;
+    bench.GPUMilliseconds = 0.0;
+    bench.NumMeasuredFrames = 0;
+}
+
+static void StartInlineSkinningBenchmark(Scene* scene)
+{
+    InlineSkinningBenchmark& bench = scene->InlineSkinningBench;
+
+    bench.IsRunning = true;
+    bench.SavedMode = scene->MeshInlineSkinningMode;
+    bench.SavedCrowdSize = scene->Crowds[scene->HellknightCrowdID].NumMembers;
+    bench.CrowdSizes = { 0, 10, 50, 100, 250, 500, kMaxCrowdSize };
+    bench.Results.clear();
+    bench.StepIdx = 0;
+
+    // Paused animations would let lazy skinning skip all the work being measured
+    scene->IsPlaying = true;
+
+    ApplyInlineSkinningBenchmarkStep(scene);
+}
+
+// Times the GPU work of each step, excluding the interface, and prints a table when done
+static void UpdateInlineSkinningBenchmark(Scene* scene, const std::vector<GPUMarker>& markers)
+{
+    InlineSkinningBenchmark& bench = scene->InlineSkinningBench;
+
+    if (!bench.IsRunning)
+    {
+        return;
+    }
+
+    // Markers are read a few frames late, warming up also flushes those of the previous step
+    bench.FrameIdx++;
+    if (bench.FrameIdx <= kInlineSkinningBenchmarkWarmupFrames || markers.empty())
+    {
+        return;
+    }
+
+    double frameMilliseconds = 0.0;
+    for (const GPUMarker& marker : markers)
+    {
+        if (marker.Depth == 0 && strcmp(marker.Name, "Interface") != 0)
+        {
+            frameMilliseconds += marker.TimeElapsed / 1e6;
+        }
+    }
+
+    bench.GPUMilliseconds += frameMilliseconds;
+    bench.NumMeasuredFrames++;
+
+    if (bench.NumMeasuredFrames < kInlineSkinningBenchmarkMeasuredFrames)
+    {
+        return;
+    }
+
+    bench.Results.push_back(float(bench.GPUMilliseconds / bench.NumMeasuredFrames));
+    bench.StepIdx++;
+
+    if (bench.StepIdx < (int)bench.CrowdSizes.size() * 2)
+    {
+        ApplyInlineSkinningBenchmarkStep(scene);
+        return;
+    }
+
+    printf("Inline skinning benchmark (%s, GPU ms per frame)\n", scene->MeshSkinningMethod == SKINNING_DLB ? "DLB" : "LBS");
+    printf("%10s %14s %14s\n", "Characters", "Skinning pass", "Inline");
+    for (int sizeIdx = 0; sizeIdx < (int)bench.CrowdSizes.size(); sizeIdx++)
+    {
+        // The hellknight outside the crowd is always there
+        printf("%10d %14.3f %14.3f\n", bench.CrowdSizes[sizeIdx] + 1, bench.Results[sizeIdx * 2 + 0], bench.Results[sizeIdx * 2 + 1]);
+    }
+
+    bench.IsRunning = false;
+    scene->MeshInlineSkinningMode = bench.SavedMode;
+    SetCrowdSize(scene, scene->HellknightCrowdID, bench.SavedCrowdSize);
+}
+
+static void ShowSystemInfoGUI(Scene* scene)
+{
+    ImGui::SetNextWindowPos(ImVec2(0, 0), ImGuiSetCond_Always);
+    if (ImGui::Begin("Info", NULL, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize))
+    {
+        char cpuBrandString[0x40];
+        memset(cpuBrandString, 0, sizeof(cpuBrandString));
+
+        // Get CPU brand string.
+#ifdef _WIN32
+        int cpuInfo[4] = { -1 };
+        __cpuid(cpuInfo, 0x80000002);
+        memcpy(cpuBrandString, cpuInfo, sizeof(cpuInfo));
+        __cpuid(cpuInfo, 0x80000003);
+        memcpy(cpuBrandString + 16, cpuInfo, sizeof(cpuInfo));
+        __cpuid(cpuInfo, 0x80000004);
+        memcpy(cpuBrandString + 32, cpuInfo, sizeof(cpuInfo));
+#elif __APPLE__
         size_t len = sizeof(cpuBrandString);
         sysctlbyname("machdep.cpu.brand_string", &cpuBrandString, &len, NULL, 0);
 #endif
@@ -666,7 +1569,7 @@ static void ShowToolboxGUI(Scene* scene, SDL_Window* window)
     int w = int(io.DisplaySize.x / io.DisplayFramebufferScale.x);
     int h = int(io.DisplaySize.y / io.DisplayFramebufferScale.y);
 
-    int toolboxW = 300, toolboxH = 600;
+    int toolboxW = 300, toolboxH = 720;
 
     ImGui::SetNextWindowSize(ImVec2((float)toolboxW, (float)toolboxH), ImGuiSetCond_Always);
     ImGui::SetNextWindowPos(ImVec2((float)w - toolboxW, 0), ImGuiSetCond_Always);
@@ -743,16 +1646,119 @@ static void ShowToolboxGUI(Scene* scene, SDL_Window* window)
                     scene->SceneNodes[scene->HellknightTransformNodeID].LocalTransform = translate(glm::mat4(), scene->HellknightPosition);
                 }
 
+                Crowd& hellknightCrowd = scene->Crowds[scene->HellknightCrowdID];
+                int hellknightCrowdSize = hellknightCrowd.NumMembers;
+                ImGui::Text("Hellknight Crowd (%d instanced draws)", hellknightCrowdSize > 0 ? (int)hellknightCrowd.BindPoseMeshIDs.size() : 0);
+                if (ImGui::SliderInt("##crowdsize", &hellknightCrowdSize, 0, kMaxCrowdSize))
+                {
+                    SetCrowdSize(scene, scene->HellknightCrowdID, hellknightCrowdSize);
+                }
+
+                ImGui::Text("Inline Skinning");
+                if (ImGui::RadioButton("Off", scene->MeshInlineSkinningMode == INLINESKINNING_OFF))
+                {
+                    scene->MeshInlineSkinningMode = INLINESKINNING_OFF;
+                }
+                ImGui::SameLine();
+                if (ImGui::RadioButton("Auto", scene->MeshInlineSkinningMode == INLINESKINNING_AUTO))
+                {
+                    scene->MeshInlineSkinningMode = INLINESKINNING_AUTO;
+                }
+                ImGui::SameLine();
+                if (ImGui::RadioButton("On", scene->MeshInlineSkinningMode == INLINESKINNING_ON))
+                {
+                    scene->MeshInlineSkinningMode = INLINESKINNING_ON;
+                }
+
+                const InlineSkinningBenchmark& inlineSkinningBench = scene->InlineSkinningBench;
+                if (inlineSkinningBench.IsRunning)
+                {
+                    ImGui::Text("Benchmarking... %d/%d", inlineSkinningBench.StepIdx + 1, (int)inlineSkinningBench.CrowdSizes.size() * 2);
+                }
+                else
+                {
+                    if (ImGui::Button("Benchmark Inline Skinning"))
+                    {
+                        StartInlineSkinningBenchmark(scene);
+                    }
+
+                    for (int sizeIdx = 0; sizeIdx < (int)inlineSkinningBench.Results.size() / 2; sizeIdx++)
+                    {
+                        ImGui::Text("%4d characters: %.2f vs %.2f ms inline",
+                            inlineSkinningBench.CrowdSizes[sizeIdx] + 1,
+                            inlineSkinningBench.Results[sizeIdx * 2 + 0],
+                            inlineSkinningBench.Results[sizeIdx * 2 + 1]);
+                    }
+                }
+
                 ImGui::Text("Skinning Method");
                 if (ImGui::RadioButton("Dual Quaternion Linear Blending", scene->MeshSkinningMethod == SKINNING_DLB))
                 {
                     scene->MeshSkinningMethod = SKINNING_DLB;
-                    ReloadShaders(scene);
+                    scene->AllPalettesDirty = true;
+                    scene->CPUSkinningNeedsValidation = true;
                 }
                 if (ImGui::RadioButton("Linear Blend Skinning", scene->MeshSkinningMethod == SKINNING_LBS))
                 {
                     scene->MeshSkinningMethod = SKINNING_LBS;
-                    ReloadShaders(scene);
+                    scene->AllPalettesDirty = true;
+                    scene->CPUSkinningNeedsValidation = true;
+                }
+
+                ImGui::Text("Skinning Backend");
+                if (ImGui::RadioButton("Transform Feedback", scene->MeshSkinningBackend == SKINNINGBACKEND_TRANSFORMFEEDBACK))
+                {
+                    scene->MeshSkinningBackend = SKINNINGBACKEND_TRANSFORMFEEDBACK;
+                    scene->AllPalettesDirty = true;
+                }
+                if (scene->ComputeSkinningSupported)
+                {
+                    if (ImGui::RadioButton("Compute Shader", scene->MeshSkinningBackend == SKINNINGBACKEND_COMPUTE))
+                    {
+                        scene->MeshSkinningBackend = SKINNINGBACKEND_COMPUTE;
+                        scene->AllPalettesDirty = true;
+                    }
+                }
+                else
+                {
+                    ImGui::TextDisabled("Compute Shader (requires GL 4.3)");
+                }
+                if (ImGui::RadioButton("CPU", scene->MeshSkinningBackend == SKINNINGBACKEND_CPU))
+                {
+                    scene->MeshSkinningBackend = SKINNINGBACKEND_CPU;
+                    scene->AllPalettesDirty = true;
+                    scene->CPUSkinningNeedsValidation = true;
+                }
+                if (ImGui::Checkbox("Skin by influence count", &scene->SkinningInfluenceVariants))
+                {
+                    scene->AllPalettesDirty = true;
+                }
+
+                ImGui::Text("Shadows");
+                ImGui::Checkbox("Cache Static Shadows", &scene->CacheStaticShadows);
+                ImGui::Checkbox("Fit Shadow Frustum", &scene->FitShadowFrustum);
+
+                ImGui::Text("Dynamic Resolution");
+                ImGui::Checkbox("Hold GPU Frame Time", &scene->DynamicRes.Enabled);
+                ImGui::SliderFloat("Target (ms)", &scene->DynamicRes.TargetFrameTime_ms, 4.0f, 50.0f);
+                ImGui::SliderFloat("Min Scale", &scene->DynamicRes.MinScale, 0.25f, 1.0f);
+
+                ImGui::Text("Profiling");
+                if (scene->Trace.IsCapturing)
+                {
+                    ImGui::Text("Capturing... %d/%d", scene->Trace.NumFramesCaptured, scene->Trace.NumFramesRequested);
+                }
+                else
+                {
+                    ImGui::SliderInt("Frames", &scene->TraceCaptureFrames, 1, 600);
+                    if (ImGui::Button("Capture Trace"))
+                    {
+                        StartTraceCapture(&scene->Trace, &scene->Profiling, "trace.json", scene->TraceCaptureFrames);
+                    }
+                    if (!scene->Trace.LastWrittenFilename.empty())
+                    {
+                        ImGui::Text("Wrote %s", scene->Trace.LastWrittenFilename.c_str());
+                    }
                 }
 
                 ImGui::Text("Ragdoll Damping (1.0 = rigid)");
@@ -770,6 +1776,7 @@ static void ShowToolboxGUI(Scene* scene, SDL_Window* window)
                                 c.Stiffness = scene->RagdollBoneStiffness;
                             }
                         }
+                        scene->Ragdolls[ragdollIdx].SolverDirty = true;
                     }
                 }
 
@@ -785,6 +1792,7 @@ static void ShowToolboxGUI(Scene* scene, SDL_Window* window)
                                 c.Stiffness = scene->RagdollBoneStiffness;
                             }
                         }
+                        scene->Ragdolls[ragdollIdx].SolverDirty = true;
                     }
                 }
 
@@ -844,7 +1852,7 @@ static void ShowToolboxGUI(Scene* scene, SDL_Window* window)
     ImGui::End();
 }
 
-static void UpdateAnimatedSkeletons(Scene* scene, uint32_t dt_ms)
+void UpdateAnimatedSkeletons(Scene* scene, uint32_t dt_ms)
 {
     // Storage for animation frame
     std::vector<SQT> frame;
@@ -928,36 +1936,212 @@ static void UpdateAnimatedSkeletons(Scene* scene, uint32_t dt_ms)
     }
 }
 
-static void UpdateTransformations(Scene* scene, uint32_t dt_ms)
+// Returns the palette of an animated skeleton for the current skinning method
+static void GetSkinningPalette(Scene* scene, const AnimatedSkeleton& animSkeleton, const GLvoid** data, GLsizeiptr* size)
 {
-    for (AnimatedSkeleton& animSkeleton : scene->AnimatedSkeletons)
+    switch (scene->MeshSkinningMethod)
     {
-        // Upload joint transformations for skinning
+    case SKINNING_DLB:
+        *data = animSkeleton.BoneTransformDualQuats.data();
+        *size = animSkeleton.BoneTransformDualQuats.size() * sizeof(animSkeleton.BoneTransformDualQuats[0]);
+        break;
+    case SKINNING_LBS:
+        *data = animSkeleton.BoneTransformMatrices.data();
+        *size = animSkeleton.BoneTransformMatrices.size() * sizeof(animSkeleton.BoneTransformMatrices[0]);
+        break;
+    default:
+        *data = NULL;
+        *size = 0;
+    }
+}
 
-        GLsizeiptr jointTransformsSize;
-        GLvoid*    jointTransformsData;
+// Size of one bone of a skinning palette for the current skinning method
+static GLsizeiptr GetSkinningPaletteBoneSize(Scene* scene)
+{
+    return scene->MeshSkinningMethod == SKINNING_DLB ? sizeof(glm::dualquat) : sizeof(glm::mat3x4);
+}
 
-        switch(scene->MeshSkinningMethod)
+// Copies the bones of an animated skeleton's palette that a mesh references, in the order of the mesh's palette
+static void GatherSkinningPalette(Scene* scene, const AnimatedSkeleton& animSkeleton, const std::vector<int>& paletteBoneIDs, GLvoid* palette)
+{
+    switch (scene->MeshSkinningMethod)
+    {
+    case SKINNING_DLB:
+        for (int paletteBoneIdx = 0; paletteBoneIdx < (int)paletteBoneIDs.size(); paletteBoneIdx++)
         {
-        case SKINNING_DLB:
-            jointTransformsData = animSkeleton.BoneTransformDualQuats.data();
-            jointTransformsSize = animSkeleton.BoneTransformDualQuats.size() * sizeof(animSkeleton.BoneTransformDualQuats[0]);
+            ((glm::dualquat*)palette)[paletteBoneIdx] = animSkeleton.BoneTransformDualQuats[paletteBoneIDs[paletteBoneIdx]];
+        }
+        break;
+    case SKINNING_LBS:
+        for (int paletteBoneIdx = 0; paletteBoneIdx < (int)paletteBoneIDs.size(); paletteBoneIdx++)
+        {
+            ((glm::mat3x4*)palette)[paletteBoneIdx] = animSkeleton.BoneTransformMatrices[paletteBoneIDs[paletteBoneIdx]];
+        }
+        break;
+    }
+}
+
+// 64-bit FNV-1a
+static uint64_t HashPalette(const GLvoid* data, GLsizeiptr size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t hash = 14695981039346656037ull;
+    for (GLsizeiptr i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Inline skinning skins a vertex in each pass that draws it (shadows and scene), the skinning pass skins it once but
+// writes 20 bytes per vertex that both passes read back. Skinning twice wins while the palette changes every frame,
+// but a palette that stopped changing costs nothing in the skinning pass thanks to lazy skinning.
+static void ChooseInlineSkinning(Scene* scene)
+{
+    std::vector<bool> wasInline(scene->AnimatedSkeletons.size());
+
+    for (int animSkeletonIdx = 0; animSkeletonIdx < (int)scene->AnimatedSkeletons.size(); animSkeletonIdx++)
+    {
+        AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[animSkeletonIdx];
+        wasInline[animSkeletonIdx] = animSkeleton.InlineSkinning;
+
+        switch (scene->MeshInlineSkinningMode)
+        {
+        case INLINESKINNING_OFF:
+            animSkeleton.InlineSkinning = false;
             break;
-        case SKINNING_LBS:
-            jointTransformsData = animSkeleton.BoneTransformMatrices.data();
-            jointTransformsSize = animSkeleton.BoneTransformMatrices.size() * sizeof(animSkeleton.BoneTransformMatrices[0]);
+        case INLINESKINNING_AUTO:
+            animSkeleton.InlineSkinning = animSkeleton.NumStaticPaletteFrames < kInlineSkinningStaticFrames;
+            break;
+        case INLINESKINNING_ON:
+            animSkeleton.InlineSkinning = true;
             break;
-        default:
-            jointTransformsData = NULL;
-            jointTransformsSize = 0;
         }
+    }
+
+    // A crowd is drawn with one shader for all members, so they all go the same way
+    for (const Crowd& crowd : scene->Crowds)
+    {
+        bool anyInline = false;
+        for (int memberIdx = 0; memberIdx < crowd.NumMembers; memberIdx++)
+        {
+            anyInline = anyInline || scene->AnimatedSkeletons[crowd.AnimatedSkeletonIDs[memberIdx]].InlineSkinning;
+        }
+
+        for (int animSkeletonID : crowd.AnimatedSkeletonIDs)
+        {
+            scene->AnimatedSkeletons[animSkeletonID].InlineSkinning = anyInline;
+        }
+    }
+
+    // Skinned vertex buffers weren't written while skinning inline
+    for (int animSkeletonIdx = 0; animSkeletonIdx < (int)scene->AnimatedSkeletons.size(); animSkeletonIdx++)
+    {
+        AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[animSkeletonIdx];
+        if (wasInline[animSkeletonIdx] && !animSkeleton.InlineSkinning)
+        {
+            animSkeleton.PaletteDirty = true;
+        }
+    }
+}
+
+static void UpdateTransformations(Scene* scene, uint32_t dt_ms)
+{
+    // Skinned vertex buffers must exist before deciding which of them can be kept
+    if (scene->SkinningBatchesDirty)
+    {
+        RebuildSkinningBatches(scene);
+    }
+
+    // Palettes are fetched as RGBA32F texels, so each one must start on a texel boundary
+    const GLsizeiptr kTexelSize = sizeof(glm::vec4);
 
-        glBindBuffer(GL_TEXTURE_BUFFER, animSkeleton.BoneTransformTBO);
-        glBufferSubData(GL_TEXTURE_BUFFER, 0, jointTransformsSize, jointTransformsData);
-        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    // Palette table entries are texel offsets stored as floats, which are exact up to 2^24 texels.
+    GLsizeiptr paletteTableSize = scene->SkinningInstanceAnimatedSkeletonIDs.size() * sizeof(float);
+
+    // Palettes identical to the last uploaded ones (paused animation, ragdoll at rest, etc.) are neither uploaded nor skinned
+    for (AnimatedSkeleton& animSkeleton : scene->AnimatedSkeletons)
+    {
+        const GLvoid* jointTransformsData;
+        GLsizeiptr jointTransformsSize;
+        GetSkinningPalette(scene, animSkeleton, &jointTransformsData, &jointTransformsSize);
+
+        uint64_t paletteHash = HashPalette(jointTransformsData, jointTransformsSize);
+        animSkeleton.NumStaticPaletteFrames = paletteHash == animSkeleton.PaletteHash ? animSkeleton.NumStaticPaletteFrames + 1 : 0;
+        animSkeleton.PaletteDirty = scene->AllPalettesDirty || paletteHash != animSkeleton.PaletteHash;
+        animSkeleton.PaletteHash = paletteHash;
+    }
+
+    scene->AllPalettesDirty = false;
+
+    ChooseInlineSkinning(scene);
+
+    // Inline skinned meshes are skinned every time they're drawn, so their palettes are needed every frame.
+    // Other instances only need a palette when they're skinned.
+    GLsizeiptr paletteBoneSize = GetSkinningPaletteBoneSize(scene);
+    GLsizeiptr totalPaletteSize = (paletteTableSize + kTexelSize - 1) / kTexelSize * kTexelSize;
+    for (const SkinningBatch& batch : scene->SkinningBatches)
+    {
+        GLsizeiptr paletteSize = scene->BindPoseMeshes[batch.BindPoseMeshID].PaletteBoneIDs.size() * paletteBoneSize;
+        for (int instanceIdx = 0; instanceIdx < batch.NumInstances; instanceIdx++)
+        {
+            const AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[scene->SkinningInstanceAnimatedSkeletonIDs[batch.FirstInstance + instanceIdx]];
+            if (animSkeleton.PaletteDirty || animSkeleton.InlineSkinning)
+            {
+                totalPaletteSize += (paletteSize + kTexelSize - 1) / kTexelSize * kTexelSize;
+            }
+        }
+    }
+
+    // Write all palettes contiguously into this frame's region of the ring
+    BeginUploadRingBufferFrame(&scene->BonePaletteRing, totalPaletteSize);
+
+    float* paletteTable;
+    GLintptr paletteTableOffset = AllocateUploadRingBuffer(&scene->BonePaletteRing, paletteTableSize, kTexelSize, (void**)&paletteTable);
+    scene->PaletteTableTexelOffset = int(paletteTableOffset / kTexelSize);
+
+    // Gather each instance's palette from its skeleton's pose, next to the palettes of the other instances of its mesh
+    // Offsets are also kept on the CPU, since reading back the mapped table can be slow
+    std::vector<int> paletteTexelOffsets(scene->SkinningInstanceAnimatedSkeletonIDs.size(), 0);
+    scene->NumPaletteBonesUploaded = 0;
+    for (const SkinningBatch& batch : scene->SkinningBatches)
+    {
+        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[batch.BindPoseMeshID];
+        GLsizeiptr paletteSize = bindPoseMesh.PaletteBoneIDs.size() * paletteBoneSize;
+
+        for (int paletteID = batch.FirstInstance; paletteID < batch.FirstInstance + batch.NumInstances; paletteID++)
+        {
+            const AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[scene->SkinningInstanceAnimatedSkeletonIDs[paletteID]];
+
+            paletteTable[paletteID] = 0.0f;
+
+            if (!animSkeleton.PaletteDirty && !animSkeleton.InlineSkinning)
+            {
+                continue;
+            }
+
+            void* mapped;
+            GLintptr offset = AllocateUploadRingBuffer(&scene->BonePaletteRing, paletteSize, kTexelSize, &mapped);
+            if (offset != -1)
+            {
+                GatherSkinningPalette(scene, animSkeleton, bindPoseMesh.PaletteBoneIDs, mapped);
+                paletteTable[paletteID] = float(offset / kTexelSize);
+                paletteTexelOffsets[paletteID] = int(offset / kTexelSize);
+                scene->NumPaletteBonesUploaded += (int)bindPoseMesh.PaletteBoneIDs.size();
+            }
+        }
+    }
 
-        // Upload joint positions for rendering skeletons
+    // Skinned meshes drawn with inline skinning pass their palette to the shaders directly
+    for (SkinnedMesh& skinnedMesh : scene->SkinnedMeshes)
+    {
+        skinnedMesh.PaletteTexelOffset = paletteTexelOffsets[skinnedMesh.PaletteID];
+    }
 
+    // Upload joint positions for rendering skeletons
+    for (AnimatedSkeleton& animSkeleton : scene->AnimatedSkeletons)
+    {
         GLsizeiptr jointPositionsSize = animSkeleton.JointPositions.size() * sizeof(animSkeleton.JointPositions[0]);
         GLvoid*    jointPositionsData = animSkeleton.JointPositions.data();
 
@@ -965,37 +2149,83 @@ static void UpdateTransformations(Scene* scene, uint32_t dt_ms)
         glBufferSubData(GL_ARRAY_BUFFER, 0, jointPositionsSize, jointPositionsData);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
+
+    EndUploadRingBufferFrame(&scene->BonePaletteRing);
 }
 
-static void UpdateSkinnedGeometry(Scene* scene, uint32_t dt_ms)
+static void SkinWithTransformFeedback(Scene* scene, const std::vector<SkinningBatch>& runs, bool skinAll)
 {
-    scene->Profiling.PushGPUMarker("Skinning");
+    scene->Profiling.PushGPUMarker(scene->SkinningInfluenceVariants ? "Skinning (TF)" : "Skinning (TF, 4 influences)");
 
     // Skin vertices using the matrix palette and store them with transform feedback
     glUseProgram(scene->SkinningSPs[scene->MeshSkinningMethod].Handle);
-    glUniform1i(scene->SkinningSP_BoneTransformsLoc, 0);
+    glUniform1i(scene->SkinningSP_BoneTransformsLoc[scene->MeshSkinningMethod], 0);
+    glUniform1i(scene->SkinningSP_PaletteTableOffsetLoc[scene->MeshSkinningMethod], scene->PaletteTableTexelOffset);
     glEnable(GL_RASTERIZER_DISCARD);
-    for (int skinnedMeshIdx = 0; skinnedMeshIdx < (int)scene->SkinnedMeshes.size(); skinnedMeshIdx++)
+
+    // All palettes live in the same ring buffer, each instance finds its own through the palette table
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, scene->BonePaletteRing.TO);
+
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, scene->SkinningTFO);
+
+    // When every mesh is skinned, all runs append to the skinned vertex buffers in one transform feedback pass.
+    // Otherwise each run has to be captured into its own range, leaving the skipped meshes' vertices untouched.
+    if (skinAll)
     {
-        const SkinnedMesh& skinnedMesh = scene->SkinnedMeshes[skinnedMeshIdx];
-        int bindPoseMeshID = skinnedMesh.BindPoseMeshID;
-        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[bindPoseMeshID];
-        int animatedSkeletonID = skinnedMesh.AnimatedSkeletonID;
-        const AnimatedSkeleton& animatedSkeleton = scene->AnimatedSkeletons[animatedSkeletonID];
+        glBeginTransformFeedback(GL_POINTS); // capture points so triangles aren't unfolded
+    }
+
+    for (const SkinningBatch& run : runs)
+    {
+        const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[run.BindPoseMeshID];
 
         glBindVertexArray(bindPoseMesh.SkinningVAO);
 
-        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, skinnedMesh.SkinningTFO);
-        glBeginTransformFeedback(GL_POINTS); // capture points so triangles aren't unfolded
+        glBindBuffer(GL_ARRAY_BUFFER, scene->SkinningInstanceVBO);
+        glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)(run.FirstInstance * sizeof(GLuint)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        // Empty 1 and 2 influence ranges make every vertex blend 4 influences
+        if (scene->SkinningInfluenceVariants)
+        {
+            glUniform2i(scene->SkinningSP_InfluenceRangeEndsLoc[scene->MeshSkinningMethod], bindPoseMesh.InfluenceRangeEnds[SKINNINGINFLUENCES_1], bindPoseMesh.InfluenceRangeEnds[SKINNINGINFLUENCES_2]);
+        }
+        else
+        {
+            glUniform2i(scene->SkinningSP_InfluenceRangeEndsLoc[scene->MeshSkinningMethod], 0, 0);
+        }
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_BUFFER, animatedSkeleton.BoneTransformTO);
+        if (!skinAll)
+        {
+            GLsizeiptr numVertices = (GLsizeiptr)run.NumInstances * bindPoseMesh.NumVertices;
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, scene->SkinnedPositionTFBO,
+                run.BaseVertex * sizeof(PositionVertex), numVertices * sizeof(PositionVertex));
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 1, scene->SkinnedDifferentialTFBO,
+                run.BaseVertex * sizeof(PackedDifferentialVertex), numVertices * sizeof(PackedDifferentialVertex));
+            glBeginTransformFeedback(GL_POINTS);
+        }
 
-        glDrawArrays(GL_POINTS, 0, bindPoseMesh.NumVertices);
+        glDrawArraysInstanced(GL_POINTS, 0, bindPoseMesh.NumVertices, run.NumInstances);
 
+        if (!skinAll)
+        {
+            glEndTransformFeedback();
+        }
+    }
+
+    if (skinAll)
+    {
         glEndTransformFeedback();
     }
+    else
+    {
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, scene->SkinnedPositionTFBO);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, scene->SkinnedDifferentialTFBO);
+    }
+
     glDisable(GL_RASTERIZER_DISCARD);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
     glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
     glBindVertexArray(0);
     glUseProgram(0);
@@ -1003,20 +2233,260 @@ static void UpdateSkinnedGeometry(Scene* scene, uint32_t dt_ms)
     scene->Profiling.PopGPUMarker();
 }
 
+static void SkinWithCompute(Scene* scene, const std::vector<SkinningBatch>& runs)
+{
+    scene->Profiling.PushGPUMarker(scene->SkinningInfluenceVariants ? "Skinning (Compute)" : "Skinning (Compute, 4 influences)");
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, scene->BonePaletteRing.TO);
+
+    // Outputs are the same buffers transform feedback writes to, so the renderer doesn't care which backend ran
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, scene->SkinningInstanceVBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, scene->SkinnedPositionTFBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, scene->SkinnedDifferentialTFBO);
+
+    // Each influence count variant is dispatched over its range of every mesh.
+    // Without variants, the 4 influence variant is dispatched over all vertices.
+    for (int influences = 0; influences < SKINNINGINFLUENCES_COUNT; influences++)
+    {
+        if (!scene->SkinningInfluenceVariants && influences != SKINNINGINFLUENCES_4)
+        {
+            continue;
+        }
+
+        const SkinningComputeUniformLocations& locs = scene->SkinningComputeSPLocs[scene->MeshSkinningMethod][influences];
+
+        glUseProgram(scene->SkinningComputeSPs[scene->MeshSkinningMethod][influences].Handle);
+        glUniform1i(locs.BoneTransformsLoc, 0);
+        glUniform1i(locs.PaletteTableOffsetLoc, scene->PaletteTableTexelOffset);
+
+        // One workgroup row per instance, so every workgroup skins with a single palette
+        for (const SkinningBatch& run : runs)
+        {
+            const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[run.BindPoseMeshID];
+
+            int firstVertex = 0;
+            if (scene->SkinningInfluenceVariants && influences > 0)
+            {
+                firstVertex = bindPoseMesh.InfluenceRangeEnds[influences - 1];
+            }
+            int endVertex = bindPoseMesh.InfluenceRangeEnds[influences];
+            if (firstVertex == endVertex)
+            {
+                continue;
+            }
+
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bindPoseMesh.PositionVBO);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bindPoseMesh.DifferentialVBO);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bindPoseMesh.BoneVBO);
+
+            glUniform1i(locs.FirstInstanceLoc, run.FirstInstance);
+            glUniform1i(locs.BaseVertexLoc, run.BaseVertex);
+            glUniform1i(locs.NumVerticesLoc, bindPoseMesh.NumVertices);
+            glUniform1i(locs.NumBonesLoc, (int)bindPoseMesh.PaletteBoneIDs.size());
+            glUniform1i(locs.FirstVertexLoc, firstVertex);
+            glUniform1i(locs.EndVertexLoc, endVertex);
+
+            GLuint numWorkgroups = (endVertex - firstVertex + kSkinningComputeWorkgroupSize - 1) / kSkinningComputeWorkgroupSize;
+            glDispatchCompute(numWorkgroups, run.NumInstances, 1);
+        }
+    }
+
+    // Skinned vertices are read as vertex attributes when rendering
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+    for (GLuint binding = 0; binding < 6; binding++)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glUseProgram(0);
+
+    scene->Profiling.PopGPUMarker();
+}
+
+static void SkinWithCPU(Scene* scene, const std::vector<SkinningBatch>& runs)
+{
+    uint64_t startTicks = SDL_GetPerformanceCounter();
+
+    // Palettes are shared by all meshes of an animated skeleton, so convert them to SoA once.
+    // Only those skinned this frame are needed: runs only hold the instances of dirty palettes, and switching the
+    // skinning method (which changes the palette layout) dirties all palettes.
+    scene->CPUSkinningPalettes.resize(scene->AnimatedSkeletons.size());
+    for (int animSkeletonIdx = 0; animSkeletonIdx < (int)scene->AnimatedSkeletons.size(); animSkeletonIdx++)
+    {
+        const AnimatedSkeleton& animSkeleton = scene->AnimatedSkeletons[animSkeletonIdx];
+        if (!animSkeleton.PaletteDirty || animSkeleton.InlineSkinning)
+        {
+            continue;
+        }
+
+        CPUSkinningPalette* palette = &scene->CPUSkinningPalettes[animSkeletonIdx];
+
+        switch (scene->MeshSkinningMethod)
+        {
+        case SKINNING_DLB:
+            BuildCPUSkinningPaletteDLB(palette, animSkeleton.BoneTransformDualQuats.data(), (int)animSkeleton.BoneTransformDualQuats.size());
+            break;
+        case SKINNING_LBS:
+            BuildCPUSkinningPaletteLBS(palette, animSkeleton.BoneTransformMatrices.data(), (int)animSkeleton.BoneTransformMatrices.size());
+            break;
+        }
+    }
+
+    PFNSKINVERTICESPROC kernel = scene->MeshSkinningMethod == SKINNING_DLB ? SkinVerticesDLBSIMD : SkinVerticesLBSSIMD;
+    PFNSKINVERTICESPROC referenceKernel = scene->MeshSkinningMethod == SKINNING_DLB ? SkinVerticesDLBScalar : SkinVerticesLBSScalar;
+
+    scene->CPUSkinnedPositions.resize(scene->NumSkinnedVertices);
+    scene->CPUSkinnedDifferentials.resize(scene->NumSkinnedVertices);
+    scene->CPUSkinnedPackedDifferentials.resize(scene->NumSkinnedVertices);
+
+    int numVerticesSkinned = 0;
+    for (const SkinningBatch& run : runs)
+    {
+        const CPUSkinningMesh* mesh = &scene->BindPoseMeshes[run.BindPoseMeshID].CPUSkinning;
+
+        for (int instanceIdx = 0; instanceIdx < run.NumInstances; instanceIdx++)
+        {
+            const CPUSkinningPalette* palette = &scene->CPUSkinningPalettes[scene->SkinningInstanceAnimatedSkeletonIDs[run.FirstInstance + instanceIdx]];
+            int baseVertex = run.BaseVertex + instanceIdx * mesh->NumVertices;
+
+            SkinVerticesParallel(
+                kernel, mesh, palette,
+                &scene->CPUSkinnedPositions[baseVertex],
+                &scene->CPUSkinnedDifferentials[baseVertex]);
+
+            PackSkinnedDifferentials(
+                &scene->CPUSkinnedDifferentials[baseVertex], mesh->NumVertices,
+                &scene->CPUSkinnedPackedDifferentials[baseVertex]);
+        }
+
+        numVerticesSkinned += run.NumInstances * mesh->NumVertices;
+    }
+
+    uint64_t endTicks = SDL_GetPerformanceCounter();
+
+    if (numVerticesSkinned > 0 && endTicks > startTicks)
+    {
+        float verticesPerSecond = numVerticesSkinned * (float)SDL_GetPerformanceFrequency() / (endTicks - startTicks);
+        float weight = 0.05f;
+        scene->CPUSkinningVerticesPerSecond = weight * verticesPerSecond + (1.0f - weight) * scene->CPUSkinningVerticesPerSecond;
+    }
+
+    // Validation runs the scalar reference, so only do it when the kernels or their inputs change
+    if (scene->CPUSkinningNeedsValidation)
+    {
+        const float kTolerance = 1e-3f;
+
+        scene->CPUSkinningMaxError = 0.0f;
+        for (const SkinningBatch& run : runs)
+        {
+            float error = ValidateCPUSkinning(
+                kernel, referenceKernel,
+                &scene->BindPoseMeshes[run.BindPoseMeshID].CPUSkinning,
+                &scene->CPUSkinningPalettes[scene->SkinningInstanceAnimatedSkeletonIDs[run.FirstInstance]]);
+            scene->CPUSkinningMaxError = std::max(scene->CPUSkinningMaxError, error);
+        }
+
+        if (scene->CPUSkinningMaxError > kTolerance)
+        {
+            fprintf(stderr, "CPU skinning (%s) differs from the scalar reference by %g\n", GetCPUSkinningISA(), scene->CPUSkinningMaxError);
+        }
+
+        scene->CPUSkinningNeedsValidation = false;
+    }
+
+    // Only upload the meshes that were skinned
+    for (const SkinningBatch& run : runs)
+    {
+        int numVertices = run.NumInstances * scene->BindPoseMeshes[run.BindPoseMeshID].NumVertices;
+
+        glBindBuffer(GL_ARRAY_BUFFER, scene->SkinnedPositionTFBO);
+        glBufferSubData(GL_ARRAY_BUFFER,
+            run.BaseVertex * sizeof(PositionVertex), numVertices * sizeof(PositionVertex),
+            &scene->CPUSkinnedPositions[run.BaseVertex]);
+        glBindBuffer(GL_ARRAY_BUFFER, scene->SkinnedDifferentialTFBO);
+        glBufferSubData(GL_ARRAY_BUFFER,
+            run.BaseVertex * sizeof(PackedDifferentialVertex), numVertices * sizeof(PackedDifferentialVertex),
+            &scene->CPUSkinnedPackedDifferentials[run.BaseVertex]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void UpdateSkinnedGeometry(Scene* scene, uint32_t dt_ms)
+{
+    std::vector<SkinningBatch> runs;
+    int numInline;
+    int numSkipped = GetDirtySkinningRuns(scene, runs, &numInline);
+
+    scene->NumMeshesSkinned = (int)scene->SkinningInstanceAnimatedSkeletonIDs.size() - numSkipped - numInline;
+    scene->NumMeshesSkipped = numSkipped;
+    scene->NumMeshesInlineSkinned = numInline;
+
+    // The GPU backends blend only the influences each vertex range has, count how many vertices took each path
+    for (int influences = 0; influences < SKINNINGINFLUENCES_COUNT; influences++)
+    {
+        scene->SkinnedVerticesByInfluences[influences] = 0;
+    }
+
+    if (scene->MeshSkinningBackend != SKINNINGBACKEND_CPU)
+    {
+        for (const SkinningBatch& run : runs)
+        {
+            const BindPoseMesh& bindPoseMesh = scene->BindPoseMeshes[run.BindPoseMeshID];
+
+            int firstVertex = 0;
+            for (int influences = 0; influences < SKINNINGINFLUENCES_COUNT; influences++)
+            {
+                int64_t numVertices = bindPoseMesh.InfluenceRangeEnds[influences] - firstVertex;
+                scene->SkinnedVerticesByInfluences[influences] += numVertices * run.NumInstances;
+                firstVertex = bindPoseMesh.InfluenceRangeEnds[influences];
+            }
+        }
+    }
+
+    if (runs.empty())
+    {
+        return;
+    }
+
+    switch (scene->MeshSkinningBackend)
+    {
+    case SKINNINGBACKEND_TRANSFORMFEEDBACK:
+        SkinWithTransformFeedback(scene, runs, numSkipped == 0 && numInline == 0);
+        break;
+    case SKINNINGBACKEND_COMPUTE:
+        SkinWithCompute(scene, runs);
+        break;
+    case SKINNINGBACKEND_CPU:
+        SkinWithCPU(scene, runs);
+        break;
+    }
+}
+
 static void UpdateDynamics(Scene* scene, uint32_t dt_ms)
 {
-    static PFNSIMULATEDYNAMICSPROC pfnSimulateDynamics = NULL;
+    static PFNINITDYNAMICSSOLVERPROC pfnInitDynamicsSolver = NULL;
+    static PFNSOLVEDYNAMICSPROC pfnSolveDynamics = NULL;
 
 #ifdef _MSC_VER
-    static RuntimeCpp runtimeSimulateDynamics(L"SimulateDynamics.dll", { "SimulateDynamics" });
+    static RuntimeCpp runtimeSimulateDynamics(L"SimulateDynamics.dll", { "InitDynamicsSolver", "SolveDynamics" });
     if (PollDLLs(&runtimeSimulateDynamics)) {
-        runtimeSimulateDynamics.GetProc(pfnSimulateDynamics, "SimulateDynamics");
+        runtimeSimulateDynamics.GetProc(pfnInitDynamicsSolver, "InitDynamicsSolver");
+        runtimeSimulateDynamics.GetProc(pfnSolveDynamics, "SolveDynamics");
+
+        // The new code might batch the constraints differently
+        for (Ragdoll& ragdoll : scene->Ragdolls)
+        {
+            ragdoll.SolverDirty = true;
+        }
     }
 #else
-    pfnSimulateDynamics = SimulateDynamics;
+    pfnInitDynamicsSolver = InitDynamicsSolver;
+    pfnSolveDynamics = SolveDynamics;
 #endif
 
-    if (!pfnSimulateDynamics)
+    if (!pfnInitDynamicsSolver || !pfnSolveDynamics)
     {
         return;
     }
@@ -1030,34 +2500,48 @@ static void UpdateDynamics(Scene* scene, uint32_t dt_ms)
         AnimSequence& animSequence = scene->AnimSequences[animatedSkeleton.CurrAnimSequenceID];
         Skeleton& skeleton = scene->Skeletons[animSequence.SkeletonID];
 
+        if (ragdoll.SolverDirty)
+        {
+            // all unit masses for now
+            std::vector<float> masses(skeleton.NumBones, 1.0f);
+
+            pfnInitDynamicsSolver(
+                &ragdoll.Solver,
+                masses.data(),
+                ragdoll.JointHulls.data(),
+                skeleton.NumBones,
+                ragdoll.BoneConstraints.data(), (int)ragdoll.BoneConstraints.size());
+            ragdoll.Solver.Threads = GetThreadPool();
+
+            ragdoll.ExternalForces.resize(skeleton.NumBones);
+            ragdoll.NewPositions.resize(skeleton.NumBones);
+            ragdoll.NewVelocities.resize(skeleton.NumBones);
+            ragdoll.SolverDirty = false;
+        }
+
         // Read from old buffer
         const std::vector<glm::vec3>& oldPositions = animatedSkeleton.JointPositions;
         const std::vector<glm::vec3>& oldVelocities = animatedSkeleton.JointVelocities;
 
         // Write to new buffer
-        std::vector<glm::vec3> newPositions(skeleton.NumBones);
-        std::vector<glm::vec3> newVelocities(skeleton.NumBones);
-
-        // all unit masses for now
-        std::vector<float> masses(skeleton.NumBones, 1.0f);
+        std::vector<glm::vec3>& newPositions = ragdoll.NewPositions;
+        std::vector<glm::vec3>& newVelocities = ragdoll.NewVelocities;
 
         // just gravity for now
-        std::vector<glm::vec3> externalForces(skeleton.NumBones);
+        std::vector<glm::vec3>& externalForces = ragdoll.ExternalForces;
         for (int i = 0; i < skeleton.NumBones; i++)
         {
-            externalForces[i] = glm::vec3(0.0f, scene->Gravity, 0.0f) * masses[i];
+            externalForces[i] = glm::vec3(0.0f, scene->Gravity, 0.0f) * ragdoll.Solver.Masses[i];
         }
 
         // do the dynamics dance
-        pfnSimulateDynamics(
+        pfnSolveDynamics(
+            &ragdoll.Solver,
             dt_s,
             (float*)oldPositions.data(),
             (float*)oldVelocities.data(),
-            (float*)masses.data(),
             (float*)externalForces.data(),
-            ragdoll.JointHulls.data(),
-            skeleton.NumBones, DEFAULT_DYNAMICS_NUM_ITERATIONS,
-            ragdoll.BoneConstraints.data(), (int)ragdoll.BoneConstraints.size(),
+            DEFAULT_DYNAMICS_NUM_ITERATIONS,
             scene->RagdollDampingK,
             (float*)newPositions.data(),
             (float*)newVelocities.data());
@@ -1091,13 +2575,85 @@ static void UpdateDynamics(Scene* scene, uint32_t dt_ms)
     }
 }
 
+void UpdateWorldTransforms(Scene* scene)
+{
+    // Partial sort nodes according to parent relationship
+    std::vector<int> parentSortedNodes(scene->SceneNodes.size());
+    std::iota(begin(parentSortedNodes), end(parentSortedNodes), 0);
+    std::make_heap(begin(parentSortedNodes), end(parentSortedNodes),
+        [&scene](int n0, int n1) {
+        return scene->SceneNodes[n0].TransformParentNodeID > scene->SceneNodes[n1].TransformParentNodeID;
+    });
+
+    for (int nodeID : parentSortedNodes)
+    {
+        if (scene->SceneNodes[nodeID].TransformParentNodeID == -1)
+        {
+            scene->SceneNodes[nodeID].WorldTransform = scene->SceneNodes[nodeID].LocalTransform;
+        }
+        else
+        {
+            int parentNodeID = scene->SceneNodes[nodeID].TransformParentNodeID;
+            glm::mat4 parentWorldTransform = scene->SceneNodes[parentNodeID].WorldTransform;
+            scene->SceneNodes[nodeID].WorldTransform = scene->SceneNodes[nodeID].LocalTransform * parentWorldTransform;
+        }
+    }
+}
+
 void UpdateScene(Scene* scene, SDL_Window* window, uint32_t dt_ms)
 {
-    ReloadShaders(scene);
+    // Only look at the programs when a shader file changed, while they compile, or to retry the first load
+    if (PollShaderFileChanges() || AnyProgramReloadsPending() || !scene->AllShadersOK)
+    {
+        if (scene->ShaderStartup_ms < 0.0f && scene->ShaderStartupStartTicks == 0)
+        {
+            scene->ShaderStartupStartTicks = SDL_GetPerformanceCounter();
+        }
+
+        ReloadShaders(scene);
+
+        // Compiles can take several frames to finish. The scene permutations requested by InitScene are pending until they
+        // link too, so they're part of the startup time and of the binary cache numbers.
+        if (scene->ShaderStartup_ms < 0.0f && !AnyProgramReloadsPending())
+        {
+            uint64_t endTicks = SDL_GetPerformanceCounter();
+            scene->ShaderStartup_ms = (endTicks - scene->ShaderStartupStartTicks) * 1000.0f / SDL_GetPerformanceFrequency();
+
+            const ProgramBinaryCacheStats& cacheStats = GetProgramBinaryCacheStats();
+            printf("Loaded shaders in %.1f ms (%d programs from the binary cache, %d compiled, %d cached binaries rejected)\n",
+                scene->ShaderStartup_ms, cacheStats.NumLoaded, cacheStats.NumCompiled, cacheStats.NumRejected);
+        }
+    }
+
+    std::vector<GPUMarker> gpuMarkers;
+    std::vector<CPUMarker> cpuMarkers;
+    scene->Profiling.ReadFrame(gpuMarkers, cpuMarkers);
+
+    AddTraceCaptureFrame(&scene->Trace, &scene->Profiling, gpuMarkers, cpuMarkers);
+    RecordFrameStats(&scene->FrameStatistics, gpuMarkers, cpuMarkers);
+
+    if (!gpuMarkers.empty())
+    {
+        float gpuFrameTime_ms = 0.0f;
+        for (const GPUMarker& marker : gpuMarkers)
+        {
+            if (marker.Depth == 0)
+            {
+                gpuFrameTime_ms += marker.TimeElapsed / 1e6f;
+            }
+        }
+        UpdateDynamicResolution(&scene->DynamicRes, gpuFrameTime_ms);
+    }
+
+    UpdateInlineSkinningBenchmark(scene, gpuMarkers);
 
+    scene->Profiling.PushCPUMarker("GUI");
     ShowSystemInfoGUI(scene);
     ShowToolboxGUI(scene, window);
-    ShowGPUProfilingGUI(scene);
+    ShowGPUProfilingGUI(scene, gpuMarkers);
+    ShowCPUProfilingGUI(scene, cpuMarkers);
+    ShowFrameStatsGUI(scene);
+    scene->Profiling.PopCPUMarker();
 
     if (!scene->AllShadersOK)
     {
@@ -1134,42 +2690,31 @@ void UpdateScene(Scene* scene, SDL_Window* window, uint32_t dt_ms)
 
     if (scene->IsPlaying || scene->ShouldStep)
     {
+        scene->Profiling.PushCPUMarker("Animation");
         UpdateAnimatedSkeletons(scene, dt_ms);
+        scene->Profiling.PopCPUMarker();
 
         // TODO: Remove this bind pose ugliness from everywhere
         if (!scene->ShowBindPoses)
         {
+            scene->Profiling.PushCPUMarker("Dynamics");
             UpdateDynamics(scene, 1000 / 60);
+            scene->Profiling.PopCPUMarker();
         }
 
+        scene->Profiling.PushCPUMarker("Transformations");
         UpdateTransformations(scene, dt_ms);
+        scene->Profiling.PopCPUMarker();
+
+        scene->Profiling.PushCPUMarker("Skinning");
         UpdateSkinnedGeometry(scene, dt_ms);
+        scene->Profiling.PopCPUMarker();
 
         scene->ShouldStep = false;
     }
 
     // Update world transforms from local transforms
-    {
-        // Partial sort nodes according to parent relationship
-        std::vector<int> parentSortedNodes(scene->SceneNodes.size());
-        std::iota(begin(parentSortedNodes), end(parentSortedNodes), 0);
-        std::make_heap(begin(parentSortedNodes), end(parentSortedNodes),
-            [&scene](int n0, int n1) {
-            return scene->SceneNodes[n0].TransformParentNodeID > scene->SceneNodes[n1].TransformParentNodeID;
-        });
-
-        for (int nodeID : parentSortedNodes)
-        {
-            if (scene->SceneNodes[nodeID].TransformParentNodeID == -1)
-            {
-                scene->SceneNodes[nodeID].WorldTransform = scene->SceneNodes[nodeID].LocalTransform;
-            }
-            else
-            {
-                int parentNodeID = scene->SceneNodes[nodeID].TransformParentNodeID;
-                glm::mat4 parentWorldTransform = scene->SceneNodes[parentNodeID].WorldTransform;
-                scene->SceneNodes[nodeID].WorldTransform = scene->SceneNodes[nodeID].LocalTransform * parentWorldTransform;
-            }
-        }
-    }
+    scene->Profiling.PushCPUMarker("World Transforms");
+    UpdateWorldTransforms(scene);
+    scene->Profiling.PopCPUMarker();
 }
@@ -19,8 +19,8 @@ uniform vec3 CameraPosition;
 uniform vec3 LightPosition;
 uniform mat4 WorldLightProjection;
 uniform vec3 BackgroundColor;
-uniform int IlluminationModel;
-uniform int HasNormalMap;
+
+// Permutations are compiled with TRANSPARENT and NORMAL_MAP defined or not, see SCENEPERMUTATION_*
 
 void main()
 {
@@ -39,29 +39,26 @@ void main()
     shadowMapCoord.xyz += shadowMapCoord.w * vec3(0.5, 0.5, 0.5); // w will divide up to 0.5 instead of 1.0
     float shadowPass = textureProj(ShadowMapTexture, shadowMapCoord);
 
-    if (IlluminationModel == 1) // standard opaque material
+#ifndef TRANSPARENT
+    // standard opaque material
     {
         vec4 diffuseMap = texture(DiffuseTexture, fTexCoord);
         vec4 specularMap = texture(SpecularTexture, fTexCoord);
 
-        vec3 modelNormal;
-        if (HasNormalMap != 0)
-        {
-            vec3 normalMap = normalize(texture(NormalTexture, fTexCoord).rgb);
-            vec3 tangent = normalize(fTangent);
-            vec3 bitangent = normalize(fBitangent);
-            vec3 normal = normalize(fNormal);
-            if (dot(cross(normal, tangent), bitangent) < 0)
-            {
-                tangent = -tangent;
-            }
-            mat3 tangentModelMatrix = mat3(tangent, bitangent, normal);
-            modelNormal = tangentModelMatrix * normalMap;
-        }
-        else
+#ifdef NORMAL_MAP
+        vec3 normalMap = normalize(texture(NormalTexture, fTexCoord).rgb);
+        vec3 tangent = normalize(fTangent);
+        vec3 bitangent = normalize(fBitangent);
+        vec3 normal = normalize(fNormal);
+        if (dot(cross(normal, tangent), bitangent) < 0)
         {
-            modelNormal = normalize(fNormal);
+            tangent = -tangent;
         }
+        mat3 tangentModelMatrix = mat3(tangent, bitangent, normal);
+        vec3 modelNormal = tangentModelMatrix * normalMap;
+#else
+        vec3 modelNormal = normalize(fNormal);
+#endif
 
         float a = 50;
         float kA = 0.03;
@@ -79,7 +76,8 @@ void main()
 
         FragColor = vec4(ambient + diffuse + specular, 1.0);
     }
-    else if (IlluminationModel == 2) // Transparent objects
+#else
+    // Transparent objects
     {
         // note: lots of hacks here specific to hellknight...
         float kA = 0.03;
@@ -95,6 +93,7 @@ void main()
 
         FragColor = vec4(ambient + diffuse + specular, diffuseMap.a) * fTexCoord.x * fTexCoord.y;
     }
+#endif
 
     float kSceneViewRadius = 400.0;
     float kCameraViewRadius = 600.0;
@@ -4,6 +4,11 @@
 #include "shaderreloader.h"
 #include "dynamics.h"
 #include "profiler.h"
+#include "ringbuffer.h"
+#include "cpuskinning.h"
+#include "dynamicresolution.h"
+#include "tracecapture.h"
+#include "framestats.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_precision.hpp>
@@ -32,6 +37,14 @@ struct DifferentialVertex
     glm::vec3 Bitangent;
 };
 
+// Skinned normal and tangent as GL_INT_2_10_10_10_REV. The tangent's w is the handedness of the bitangent,
+// which is rebuilt from the normal and tangent when drawing.
+struct PackedDifferentialVertex
+{
+    uint32_t Normal;
+    uint32_t Tangent;
+};
+
 struct BoneWeightVertex
 {
     glm::u8vec4 BoneIDs;
@@ -67,6 +80,40 @@ enum SkinningMethod
     SKINNING_LBS  // Linear blend skinning
 };
 
+// Used for array indices, don't change!
+enum SkinningBackend
+{
+    SKINNINGBACKEND_TRANSFORMFEEDBACK, // Vertex shader with rasterization disabled, GL 4.1
+    SKINNINGBACKEND_COMPUTE,           // Compute shader reading and writing storage buffers, GL 4.3
+    SKINNINGBACKEND_CPU                // Multithreaded SIMD kernels, uploaded to the skinned vertex buffers
+};
+
+// Number of bone influences a skinning shader variant blends. Used for array indices, don't change!
+enum SkinningInfluences
+{
+    SKINNINGINFLUENCES_1, // Vertices bound to a single bone
+    SKINNINGINFLUENCES_2, // Vertices blending two bones
+    SKINNINGINFLUENCES_4, // Everything else, up to the 4 influences a vertex can store
+    SKINNINGINFLUENCES_COUNT
+};
+
+// Material features the scene shaders are compiled for, instead of branching on them at runtime.
+// A permutation is indexed by the bits of its features. Used for array indices, don't change!
+enum ScenePermutation
+{
+    SCENEPERMUTATION_TRANSPARENT = 1, // Blended, lit without normals
+    SCENEPERMUTATION_NORMALMAP = 2, // Opaque only, transparent materials ignore their normal map
+    SCENEPERMUTATION_COUNT = 4
+};
+
+// Where skinned meshes are skinned. Used for array indices, don't change!
+enum InlineSkinningMode
+{
+    INLINESKINNING_OFF,  // Always skin in the skinning pass, and draw from the skinned vertex buffers
+    INLINESKINNING_AUTO, // Choose per animated skeleton
+    INLINESKINNING_ON    // Always skin in the vertex shaders of the passes that draw the meshes
+};
+
 // Bitsets to say which components of the animation changes every frame
 // For example if an object does not rotate then the Q (Quaternion) channels are turned off, which saves space.
 // When a channel is not set in an animation sequence, then the baseFrame setting is used instead.
@@ -93,6 +140,8 @@ struct StaticMesh
     int NumIndices; // Number of indices in the static mesh
     int NumVertices; // Number of vertices in the static mesh
     int MaterialID; // The material this mesh was designed for
+    glm::vec3 BoundsMin; // Model space bounding box, for fitting the shadow map to its casters
+    glm::vec3 BoundsMax;
 };
 
 // Skeleton Table
@@ -125,6 +174,10 @@ struct BindPoseMesh
     int NumVertices; // Number of vertices in the bind pose
     int SkeletonID; // Skeleton used to skin this mesh
     int MaterialID; // The material this mesh was designed for
+    int InfluenceRangeEnds[SKINNINGINFLUENCES_COUNT]; // Vertices are sorted by influence count, each range ends where the next starts
+    std::vector<int> PaletteBoneIDs; // Skeleton bone of each bone in the mesh's palette. The vertices' BoneIDs index this list.
+    float JointBoundsRadius; // Whatever the pose, vertices are within this distance of one of the palette bones' joints
+    CPUSkinningMesh CPUSkinning; // Bind pose in SoA form for the CPU skinning backend
 };
 
 // AnimSequence Table
@@ -147,8 +200,6 @@ struct AnimSequence
 // Each animated skeleton instance is associated to an animation sequence, which is associated to one skeleton.
 struct AnimatedSkeleton
 {
-    GLuint BoneTransformTBO; // The matrices used to transform the bones
-    GLuint BoneTransformTO; // Texture descriptor for the palette
     GLuint SkeletonVAO; // Vertex array for rendering animated skeletons
     GLuint SkeletonVBO; // Vertex buffer object for the skeleton vertices
     int CurrAnimSequenceID; // The currently playing animation sequence for each skinned mesh
@@ -158,6 +209,10 @@ struct AnimatedSkeleton
     std::vector<glm::dualquat> BoneTransformDualQuats; // Skinning palette for DLB
     std::vector<glm::mat3x4> BoneTransformMatrices; // Skinning palette for LBS
     std::vector<BoneControlMode> BoneControls; // How each bone is animated
+    uint64_t PaletteHash; // Hash of the skinning palette uploaded last
+    bool PaletteDirty; // Palette differs from the one the skinned meshes were last skinned with
+    int NumStaticPaletteFrames; // Number of updates in a row the palette didn't change
+    bool InlineSkinning; // Meshes are skinned by the vertex shaders drawing them, not by the skinning pass
 
     // Joint physical properties
     std::vector<glm::vec3> JointPositions;
@@ -170,12 +225,110 @@ struct AnimatedSkeleton
 // The skeleton of the bind pose and the skeleton of the animated skeleton must be the same one.
 struct SkinnedMesh
 {
-    GLuint SkinningTFO; // Transform feedback for skinning
-    GLuint SkinnedVAO; // Vertex array for rendering skinned meshes.
-    GLuint PositionTFBO; // Positions created from transform feedback
-    GLuint DifferentialTFBO; // Differential geometry from transform feedback
+    GLuint SkinnedVAO; // Vertex array for rendering skinned meshes. Reads this mesh's range of the scene's skinned vertex buffers.
+    int BaseVertex; // First vertex of this mesh in the scene's skinned vertex buffers
     int BindPoseMeshID; // The ID of the bind pose of this skinned mesh
     int AnimatedSkeletonID; // The animated skeleton used to transform this mesh
+    int PaletteID; // Entry of this mesh in the skinning instance buffer and the palette table
+    int PaletteTexelOffset; // Where this frame's palette is in the palette ring buffer, for inline skinning
+};
+
+// SkinningBatch Table
+// All skinned meshes sharing a bind pose mesh are skinned together with one instanced transform feedback draw.
+// Instances write their skinned vertices one after the other, starting at the batch's base vertex.
+struct SkinningBatch
+{
+    int BindPoseMeshID; // The bind pose skinned by this batch
+    int FirstInstance; // First entry of this batch in the skinning instance buffer
+    int NumInstances; // Number of skinned meshes in the batch
+    int BaseVertex; // First vertex written by this batch in the scene's skinned vertex buffers
+};
+
+// Crowd Table
+// Groups of identical skinned characters, each member with its own animated skeleton and placement.
+// Members are skinned along with the other skinned meshes, but drawn with one instanced draw per bind pose mesh,
+// so the number of draws doesn't depend on the number of members.
+struct Crowd
+{
+    std::vector<int> BindPoseMeshIDs; // The bind pose meshes making up one member
+    std::vector<int> BaseVertices; // For each bind pose mesh, first skinned vertex of the first member. Members follow each other.
+    std::vector<int> FirstInstances; // For each bind pose mesh, first member's entry in the skinning instance buffer
+    std::vector<GLuint> VAOs; // For each bind pose mesh, bind pose vertices, palette IDs and indices
+    std::vector<int> AnimSequenceIDs; // Animation sequences given to new members in turn
+    std::vector<int> AnimatedSkeletonIDs; // Animated skeleton of each member
+    std::vector<glm::mat4> MemberTransforms; // Model to world transform of each member
+    GLuint MemberTransformBO; // MemberTransforms as 4 RGBA32F texels per member
+    GLuint MemberTransformTO;
+    int NumMembers; // The first NumMembers members are skinned and drawn, the rest are kept for later
+};
+
+// Uniform locations of the scene shader and its permutations (crowds, inline skinning).
+// Uniforms a permutation doesn't use are -1, which glUniform* ignores.
+struct SceneUniformLocations
+{
+    GLint ModelWorldLoc;
+    GLint WorldModelLoc;
+    GLint ModelViewLoc;
+    GLint ModelViewProjectionLoc;
+    GLint WorldViewLoc;
+    GLint WorldViewProjectionLoc;
+    GLint CameraPositionLoc;
+    GLint LightPositionLoc;
+    GLint WorldLightProjectionLoc;
+    GLint DiffuseTextureLoc;
+    GLint SpecularTextureLoc;
+    GLint NormalTextureLoc;
+    GLint ShadowMapTextureLoc;
+    GLint BackgroundColorLoc;
+    GLint BoneTransformsLoc;
+    GLint PaletteOffsetLoc;
+    GLint PaletteTableOffsetLoc;
+    GLint SkinnedPositionsLoc;
+    GLint SkinnedDifferentialsLoc;
+    GLint MemberTransformsLoc;
+    GLint BaseVertexLoc;
+    GLint NumVerticesLoc;
+};
+
+// Uniform locations of the shadow shader and its permutations (crowds, inline skinning).
+struct ShadowUniformLocations
+{
+    GLint ModelLightProjectionLoc;
+    GLint WorldLightProjectionLoc;
+    GLint BoneTransformsLoc;
+    GLint PaletteOffsetLoc;
+    GLint PaletteTableOffsetLoc;
+    GLint SkinnedPositionsLoc;
+    GLint MemberTransformsLoc;
+    GLint BaseVertexLoc;
+    GLint NumVerticesLoc;
+};
+
+// Uniform locations of the skinning compute shader, one set per influence count variant.
+struct SkinningComputeUniformLocations
+{
+    GLint BoneTransformsLoc;
+    GLint PaletteTableOffsetLoc;
+    GLint FirstInstanceLoc;
+    GLint BaseVertexLoc;
+    GLint NumVerticesLoc;
+    GLint NumBonesLoc;
+    GLint FirstVertexLoc;
+    GLint EndVertexLoc;
+};
+
+// Steps through crowd sizes, timing the GPU with and without inline skinning at each.
+struct InlineSkinningBenchmark
+{
+    bool IsRunning;
+    int StepIdx; // Current crowd size and mode, mode changes fastest
+    int FrameIdx; // Frames rendered in the current step, the first ones are warmup
+    double GPUMilliseconds; // Sum of GPU marker times over the measured frames of the current step
+    int NumMeasuredFrames;
+    InlineSkinningMode SavedMode; // Restored when the benchmark ends
+    int SavedCrowdSize;
+    std::vector<int> CrowdSizes;
+    std::vector<float> Results; // Average GPU frame time of each step, in milliseconds
 };
 
 // Ragdoll Table
@@ -188,6 +341,11 @@ struct Ragdoll
     std::vector<glm::ivec2> BoneConstraintParticleIDs; // particle IDs used in the bone distance constraints 
     std::vector<glm::ivec3> JointConstraintParticleIDs; // particles IDs used in the joint angular constraints
     std::vector<Hull> JointHulls; // the collision hulls associated to every joint
+    DynamicsSolver Solver; // Batched constraints and scratch memory of the simulation
+    bool SolverDirty; // The constraints or hulls changed since the solver was initialized
+    std::vector<glm::vec3> ExternalForces; // Per joint, reused every step
+    std::vector<glm::vec3> NewPositions; // Written by the solver, reused every step
+    std::vector<glm::vec3> NewVelocities;
 };
 
 // DiffuseTexture Table
@@ -266,8 +424,13 @@ struct Scene
 
     std::vector<SkinnedMesh> SkinnedMeshes;
 
+    std::vector<SkinningBatch> SkinningBatches;
+    bool SkinningBatchesDirty; // Rebuild batches and skinned vertex buffers before the next skinning pass
+
     std::vector<Ragdoll> Ragdolls;
 
+    std::vector<Crowd> Crowds;
+
     std::vector<DiffuseTexture> DiffuseTextures;
     std::unordered_map<std::string, int> DiffuseTextureNameToID;
 
@@ -285,27 +448,102 @@ struct Scene
     ReloadableShader SkinningDLB{ "skinning_dlb.vert" };
     ReloadableShader SkinningLBS{ "skinning_lbs.vert" };
     ReloadableProgram SkinningSPs[2];
-    GLint SkinningSP_BoneTransformsLoc;
+    GLint SkinningSP_BoneTransformsLoc[2];
+    GLint SkinningSP_PaletteTableOffsetLoc[2];
+    GLint SkinningSP_InfluenceRangeEndsLoc[2];
+
+    // Skinning compute shader programs that write the same skinned vertices as transform feedback.
+    // One variant per influence count, each dispatched over its range of the bind pose vertices.
+    ReloadableShader SkinningDLBCompute[SKINNINGINFLUENCES_COUNT]{
+        ReloadableShader{ "skinning_dlb.comp", "#define NUM_INFLUENCES 1" },
+        ReloadableShader{ "skinning_dlb.comp", "#define NUM_INFLUENCES 2" },
+        ReloadableShader{ "skinning_dlb.comp", "#define NUM_INFLUENCES 4" } };
+    ReloadableShader SkinningLBSCompute[SKINNINGINFLUENCES_COUNT]{
+        ReloadableShader{ "skinning_lbs.comp", "#define NUM_INFLUENCES 1" },
+        ReloadableShader{ "skinning_lbs.comp", "#define NUM_INFLUENCES 2" },
+        ReloadableShader{ "skinning_lbs.comp", "#define NUM_INFLUENCES 4" } };
+    ReloadableProgram SkinningComputeSPs[2][SKINNINGINFLUENCES_COUNT];
+    SkinningComputeUniformLocations SkinningComputeSPLocs[2][SKINNINGINFLUENCES_COUNT];
+
+    // Skin each bind pose vertex range with only as many influences as its vertices have.
+    // When disabled, every vertex blends 4 influences, for comparing GPU times.
+    bool SkinningInfluenceVariants;
+    int64_t SkinnedVerticesByInfluences[SKINNINGINFLUENCES_COUNT]; // Vertices skinned on the GPU in the last skinning pass
+
+    // CPU skinning backend. Skinned vertices are written here first, then uploaded to the skinned vertex buffers.
+    std::vector<CPUSkinningPalette> CPUSkinningPalettes; // Indexed by AnimatedSkeletonID
+    std::vector<PositionVertex> CPUSkinnedPositions;
+    std::vector<DifferentialVertex> CPUSkinnedDifferentials;
+    std::vector<PackedDifferentialVertex> CPUSkinnedPackedDifferentials;
+    bool CPUSkinningNeedsValidation; // Compare the SIMD kernels against the scalar reference on the next CPU skinning pass
+    float CPUSkinningMaxError; // Largest difference to the scalar reference seen in the last validation
+    float CPUSkinningVerticesPerSecond; // Moving average of CPU skinning throughput
+
+    // Meshes are only skinned when their skeleton's palette changed since they were last skinned
+    bool AllPalettesDirty; // Reskin everything, eg. after the skinning method changed or skinned vertex buffers were reallocated
+    int NumMeshesSkinned; // Meshes skinned in the last skinning pass
+    int NumMeshesSkipped; // Meshes whose previous skinning result was reused in the last skinning pass
+    int NumMeshesInlineSkinned; // Meshes skinned by the vertex shaders drawing them instead
+
+    // Skinning in the vertex shaders of the shadow and scene passes saves writing and reading back the skinned vertex buffers
+    InlineSkinningMode MeshInlineSkinningMode;
+    InlineSkinningBenchmark InlineSkinningBench;
+
+    // Skinning palettes of all skinning instances, written contiguously every frame.
+    // Each instance has its own palette of only the bones its bind pose mesh references, gathered from its skeleton's pose.
+    // Each frame's region starts with a table of where every instance's palette is, indexed by palette ID.
+    UploadRingBuffer BonePaletteRing;
+    int PaletteTableTexelOffset;
+    int NumPaletteBonesUploaded; // Bones written to the palette ring this frame
+
+    // Skinned vertices of every skinned mesh, written by the batched skinning pass.
+    // Positions are PositionVertex, differentials are PackedDifferentialVertex.
+    GLuint SkinningTFO;
+    GLuint SkinnedPositionTFBO;
+    GLuint SkinnedDifferentialTFBO;
+    GLuint SkinningInstanceVBO; // Palette ID of every skinned mesh, grouped by batch. Instances are their own palette ID.
+    std::vector<int> SkinningInstanceAnimatedSkeletonIDs; // Animated skeleton posing each instance
+    int NumSkinnedVertices;
+    GLuint SkinnedPositionTO; // Texture buffer views of the skinned vertex buffers (RGB32F and RG32I), for instanced crowd rendering
+    GLuint SkinnedDifferentialTO;
+
+    // Skinning functions linked into the permutations of the scene and shadow shaders that skin inline.
+    // Indexed by SkinningMethod like the other skinning programs.
+    ReloadableShader SkinningInlineDLB{ "skinning_inline_dlb.vert" };
+    ReloadableShader SkinningInlineLBS{ "skinning_inline_lbs.vert" };
+
+    // Scene fragment shader permutations, indexed by SCENEPERMUTATION_* bits.
+    // Each scene program below has one permutation per entry, only loaded once a draw needs it.
+    ReloadableShader SceneFS[SCENEPERMUTATION_COUNT]{
+        ReloadableShader{ "scene.frag" },
+        ReloadableShader{ "scene.frag", "#define TRANSPARENT" },
+        ReloadableShader{ "scene.frag", "#define NORMAL_MAP" },
+        ReloadableShader{ "scene.frag", "#define TRANSPARENT\n#define NORMAL_MAP" } };
 
     // Scene shader. Used to render objects in the scene which have their geometry defined in world space.
     ReloadableShader SceneVS{ "scene.vert" };
-    ReloadableShader SceneFS{ "scene.frag" };
-    ReloadableProgram SceneSP{ &SceneVS, &SceneFS };
-    GLint SceneSP_ModelWorldLoc;
-    GLint SceneSP_WorldModelLoc;
-    GLint SceneSP_ModelViewLoc;
-    GLint SceneSP_ModelViewProjectionLoc;
-    GLint SceneSP_WorldViewLoc;
-    GLint SceneSP_CameraPositionLoc;
-    GLint SceneSP_LightPositionLoc;
-    GLint SceneSP_WorldLightProjectionLoc;
-    GLint SceneSP_DiffuseTextureLoc;
-    GLint SceneSP_SpecularTextureLoc;
-    GLint SceneSP_NormalTextureLoc;
-    GLint SceneSP_ShadowMapTextureLoc;
-    GLint SceneSP_IlluminationModelLoc;
-    GLint SceneSP_HasNormalMapLoc;
-    GLint SceneSP_BackgroundColorLoc;
+    ReloadableProgram SceneSPs[SCENEPERMUTATION_COUNT];
+    SceneUniformLocations SceneSPLocs[SCENEPERMUTATION_COUNT];
+
+    // Scene shader drawing meshes skinned by the skinning pass, which have packed differentials.
+    ReloadableShader ScenePackedVS{ "scene.vert", "#define PACKED_DIFFERENTIALS" };
+    ReloadableProgram ScenePackedSPs[SCENEPERMUTATION_COUNT];
+    SceneUniformLocations ScenePackedSPLocs[SCENEPERMUTATION_COUNT];
+
+    // Scene shader skinning bind pose vertices with the palette of the mesh's animated skeleton.
+    ReloadableShader SceneSkinnedVS{ "scene.vert", "#define INLINE_SKINNING" };
+    ReloadableProgram SceneSkinnedSPs[2][SCENEPERMUTATION_COUNT];
+    SceneUniformLocations SceneSkinnedSPLocs[2][SCENEPERMUTATION_COUNT];
+
+    // Crowd shader. Same as the scene shader, but fetches skinned vertices and placement by instance.
+    ReloadableShader CrowdVS{ "crowd.vert" };
+    ReloadableProgram CrowdSPs[SCENEPERMUTATION_COUNT];
+    SceneUniformLocations CrowdSPLocs[SCENEPERMUTATION_COUNT];
+
+    // Crowd shader skinning bind pose vertices with the palette of each member.
+    ReloadableShader CrowdSkinnedVS{ "crowd.vert", "#define INLINE_SKINNING" };
+    ReloadableProgram CrowdSkinnedSPs[2][SCENEPERMUTATION_COUNT];
+    SceneUniformLocations CrowdSkinnedSPLocs[2][SCENEPERMUTATION_COUNT];
 
     // Skeleton shader program used to render bones.
     ReloadableShader SkeletonVS{ "skeleton.vert" };
@@ -318,11 +556,26 @@ struct Scene
     ReloadableShader ShadowVS{ "shadow.vert" };
     ReloadableShader ShadowFS{ "shadow.frag" };
     ReloadableProgram ShadowSP{ &ShadowVS, &ShadowFS };
-    GLint ShadowSP_ModelLightProjectionLoc;
+    ShadowUniformLocations ShadowSPLocs;
+
+    ReloadableShader ShadowSkinnedVS{ "shadow.vert", "#define INLINE_SKINNING" };
+    ReloadableProgram ShadowSkinnedSPs[2];
+    ShadowUniformLocations ShadowSkinnedSPLocs[2];
+
+    // Crowd shadow shader. Same as the shadow shader, but fetches skinned vertices and placement by instance.
+    ReloadableShader CrowdShadowVS{ "crowd_shadow.vert" };
+    ReloadableProgram CrowdShadowSP{ &CrowdShadowVS, &ShadowFS };
+    ShadowUniformLocations CrowdShadowSPLocs;
+
+    ReloadableShader CrowdShadowSkinnedVS{ "crowd_shadow.vert", "#define INLINE_SKINNING" };
+    ReloadableProgram CrowdShadowSkinnedSPs[2];
+    ShadowUniformLocations CrowdShadowSkinnedSPLocs[2];
 
     // true if all shaders in the scene are compiling/linking successfully.
     // Scene updates will stop if not all shaders are working, since it will likely crash.
     bool AllShadersOK;
+    float ShaderStartup_ms; // Time taken by the first load of the shaders, scene permutations included, -1 until then
+    uint64_t ShaderStartupStartTicks;
 
     // Camera placement, updated each frame.
     glm::vec3 CameraPosition;
@@ -338,6 +591,10 @@ struct Scene
     // The current skinning method used to skin all meshes in the scene
     SkinningMethod MeshSkinningMethod;
 
+    // The current way skinning is executed on the GPU, and whether the compute shader path can be used
+    SkinningBackend MeshSkinningBackend;
+    bool ComputeSkinningSupported;
+
     // For debugging skeletal animations
     bool ShowBindPoses;
     bool ShowSkeletons;
@@ -346,6 +603,9 @@ struct Scene
     int HellknightTransformNodeID;
     glm::vec3 HellknightPosition;
 
+    // Crowd of hellknights (for testing instancing)
+    int HellknightCrowdID;
+
     bool IsPlaying;
     bool ShouldStep;
 
@@ -359,12 +619,43 @@ struct Scene
 
     glm::vec3 LightPosition;
 
+    // Static shadow casters are drawn into a cached shadow map, redrawn only when they or the light change.
+    // Each frame it's copied into the shadow map and the skinned casters are drawn on top.
+    bool CacheStaticShadows;
+    bool FitShadowFrustum; // Fit the light's projection to the shadow casters instead of a fixed box
+    int NumStaticShadowMapUpdates; // Times the cached static shadow map was redrawn
+
+    // Resolution and sample count of the scene, driven by the profiled GPU time
+    DynamicResolution DynamicRes;
+
     Profiler Profiling;
 
     // Exponential weighted moving averages for profiling statistics
     std::unordered_map<std::string,float> ProfilingEMAs;
+    std::unordered_map<std::string,float> CPUProfilingEMAs; // Summed over all markers and threads with the same name
+
+    // Distribution of frame and scope times over the last frames
+    FrameStats FrameStatistics;
+    bool FrameStatsTimelineGPU; // Stack GPU scopes in the timeline instead of CPU ones
+
+    // Profiler capture to a trace file
+    TraceCapture Trace;
+    int TraceCaptureFrames; // Number of frames captured from the toolbox
 };
 
 void InitScene(Scene* scene);
 
 void UpdateScene(Scene* scene, SDL_Window* window, uint32_t deltaMilliseconds);
+
+// Steps of UpdateScene that don't touch GL, exposed to benchmark them on their own
+void UpdateAnimatedSkeletons(Scene* scene, uint32_t dt_ms); // Poses skeletons and computes their skinning palettes
+void UpdateWorldTransforms(Scene* scene); // Scene graph world transforms from local transforms
+
+// Skins and draws the first numMembers members of a crowd, adding members as needed
+void SetCrowdSize(Scene* scene, int crowdID, int numMembers);
+
+// Materials with a transparent diffuse texture are blended, in a pass after opaque ones
+bool MaterialHasTransparency(const Scene* scene, const Material& material);
+
+// SCENEPERMUTATION_* bits of the scene shader drawing a material
+int GetScenePermutation(const Material& material, bool hasTransparency);
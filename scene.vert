@@ -2,15 +2,28 @@
 
 layout(location = 0) in  vec4 Position;
 layout(location = 1) in  vec2 TexCoord;
+#ifdef PACKED_DIFFERENTIALS
+// Written by the skinning pass as 2_10_10_10 snorm. The tangent's w is the handedness of the bitangent.
+layout(location = 2) in  vec4 Normal;
+layout(location = 3) in  vec4 Tangent;
+#else
 layout(location = 2) in  vec3 Normal;
 layout(location = 3) in  vec3 Tangent;
 layout(location = 4) in  vec3 Bitangent;
+#endif
 
 uniform mat4 ModelWorld;
 //uniform mat4 ModelView;
 uniform mat4 ModelViewProjection;
 //uniform mat4 WorldView;
 
+#ifdef INLINE_SKINNING
+// Defined by skinning_inline_dlb.vert or skinning_inline_lbs.vert
+void SkinVertex(int paletteOffset, inout vec3 position, inout vec3 normal, inout vec3 tangent, inout vec3 bitangent);
+
+uniform int PaletteOffset; // Start of the mesh's palette in texels
+#endif
+
 out vec3 fPosition;
 out vec2 fTexCoord;
 out vec3 fNormal;
@@ -21,9 +34,19 @@ void main()
 {
     fPosition = Position.xyz;
     fTexCoord = TexCoord;
+#ifdef PACKED_DIFFERENTIALS
+    fNormal = Normal.xyz;
+    fTangent = Tangent.xyz;
+    fBitangent = cross(Normal.xyz, Tangent.xyz) * (Tangent.w < 0.0 ? -1.0 : 1.0);
+#else
     fNormal = Normal;
     fTangent = Tangent;
     fBitangent = Bitangent;
+#endif
+
+#ifdef INLINE_SKINNING
+    SkinVertex(PaletteOffset, fPosition, fNormal, fTangent, fBitangent);
+#endif
 
-    gl_Position = ModelViewProjection * Position;
+    gl_Position = ModelViewProjection * vec4(fPosition, 1.0);
 }
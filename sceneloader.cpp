@@ -18,6 +18,8 @@
 #include <string>
 #include <functional>
 #include <array>
+#include <algorithm>
+#include <numeric>
 
 static void LoadMD5Materials(
     Scene* scene,
@@ -546,11 +548,50 @@ static void LoadMD5Meshes(
             }
         }
 
+        // Sort vertices by influence count, so skinning can blend only as many bones as each range of vertices has.
+        // The sort is stable to keep the vertex cache order of each range.
+        std::vector<int> vertexInfluences(vertexCount);
+        int influenceRangeSizes[SKINNINGINFLUENCES_COUNT] = {};
+        for (int vertexIdx = 0; vertexIdx < vertexCount; vertexIdx++)
+        {
+            int numBones = vertexNumBones[vertexIdx];
+            vertexInfluences[vertexIdx] = numBones <= 1 ? SKINNINGINFLUENCES_1 : numBones == 2 ? SKINNINGINFLUENCES_2 : SKINNINGINFLUENCES_4;
+            influenceRangeSizes[vertexInfluences[vertexIdx]]++;
+        }
+
+        std::vector<int> sortedVertices(vertexCount);
+        std::iota(begin(sortedVertices), end(sortedVertices), 0);
+        std::stable_sort(begin(sortedVertices), end(sortedVertices),
+            [&vertexInfluences](int v0, int v1) { return vertexInfluences[v0] < vertexInfluences[v1]; });
+
+        std::vector<int> vertexSortedIndices(vertexCount);
+        for (int sortedIdx = 0; sortedIdx < vertexCount; sortedIdx++)
+        {
+            vertexSortedIndices[sortedVertices[sortedIdx]] = sortedIdx;
+        }
+
+        auto sortVertices = [&sortedVertices](auto& vertices)
+        {
+            auto unsortedVertices = vertices;
+            for (int sortedIdx = 0; sortedIdx < (int)sortedVertices.size(); sortedIdx++)
+            {
+                vertices[sortedIdx] = unsortedVertices[sortedVertices[sortedIdx]];
+            }
+        };
+
+        sortVertices(positions);
+        sortVertices(texCoords);
+        sortVertices(differentials);
+        sortVertices(boneWeights);
+
         int faceCount = (int)mesh->mNumFaces;
         std::vector<glm::uvec3> indices(faceCount);
         for (int faceIdx = 0; faceIdx < faceCount; faceIdx++)
         {
-            indices[faceIdx] = glm::make_vec3(&mesh->mFaces[faceIdx].mIndices[0]);
+            for (int i = 0; i < 3; i++)
+            {
+                indices[faceIdx][i] = vertexSortedIndices[mesh->mFaces[faceIdx].mIndices[i]];
+            }
         }
 
         BindPoseMesh bindPoseMesh;
@@ -559,6 +600,58 @@ static void LoadMD5Meshes(
         bindPoseMesh.SkeletonID = skeletonID;
         bindPoseMesh.MaterialID = materialIDMapping[mesh->mMaterialIndex];
 
+        int influenceRangeEnd = 0;
+        for (int influences = 0; influences < SKINNINGINFLUENCES_COUNT; influences++)
+        {
+            influenceRangeEnd += influenceRangeSizes[influences];
+            bindPoseMesh.InfluenceRangeEnds[influences] = influenceRangeEnd;
+        }
+
+        // The CPU kernels skin straight from the skeleton's palette, so they keep the skeleton's bone IDs
+        InitCPUSkinningMesh(&bindPoseMesh.CPUSkinning, positions.data(), differentials.data(), boneWeights.data(), vertexCount);
+
+        // The GPU skins with a palette of only the bones this mesh references, in skeleton order.
+        // Unused influences have zero weight and any bone will do, so they're pointed at the first one.
+        std::vector<bool> isBoneReferenced(skeleton.NumBones);
+        for (int vertexIdx = 0; vertexIdx < vertexCount; vertexIdx++)
+        {
+            for (int i = 0; i < std::min(vertexNumBones[sortedVertices[vertexIdx]], 4); i++)
+            {
+                isBoneReferenced[boneWeights[vertexIdx].BoneIDs[i]] = true;
+            }
+        }
+
+        std::vector<int> skeletonToPaletteBoneIDs(skeleton.NumBones, 0);
+        for (int boneID = 0; boneID < skeleton.NumBones; boneID++)
+        {
+            if (isBoneReferenced[boneID])
+            {
+                skeletonToPaletteBoneIDs[boneID] = (int)bindPoseMesh.PaletteBoneIDs.size();
+                bindPoseMesh.PaletteBoneIDs.push_back(boneID);
+            }
+        }
+
+        // A skinned vertex is a blend of the vertex moved rigidly with each of its bones, which stay within the
+        // bind pose distance of their joints. So bounds around the joints grown by the largest such distance hold the mesh.
+        bindPoseMesh.JointBoundsRadius = 0.0f;
+        for (int vertexIdx = 0; vertexIdx < vertexCount; vertexIdx++)
+        {
+            for (int i = 0; i < std::min(vertexNumBones[sortedVertices[vertexIdx]], 4); i++)
+            {
+                glm::mat4 bindPose = inverse(skeleton.BoneInverseBindPoseTransforms[boneWeights[vertexIdx].BoneIDs[i]]);
+                float jointDistance = length(positions[vertexIdx].Position - glm::vec3(bindPose[3]));
+                bindPoseMesh.JointBoundsRadius = std::max(bindPoseMesh.JointBoundsRadius, jointDistance);
+            }
+        }
+
+        for (int vertexIdx = 0; vertexIdx < vertexCount; vertexIdx++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                boneWeights[vertexIdx].BoneIDs[i] = skeletonToPaletteBoneIDs[boneWeights[vertexIdx].BoneIDs[i]];
+            }
+        }
+
         glGenBuffers(1, &bindPoseMesh.PositionVBO);
         glBindBuffer(GL_ARRAY_BUFFER, bindPoseMesh.PositionVBO);
         glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(positions[0]), positions.data(), GL_STATIC_DRAW);
@@ -904,6 +997,14 @@ static void LoadOBJMeshes(
         staticMesh.NumIndices = faceCount * 3;
         staticMesh.MaterialID = materialIDMapping[mesh->mMaterialIndex];
 
+        staticMesh.BoundsMin = glm::vec3(INFINITY);
+        staticMesh.BoundsMax = glm::vec3(-INFINITY);
+        for (int vertexIdx = 0; vertexIdx < vertexCount; vertexIdx++)
+        {
+            staticMesh.BoundsMin = min(staticMesh.BoundsMin, positions[vertexIdx].Position);
+            staticMesh.BoundsMax = max(staticMesh.BoundsMax, positions[vertexIdx].Position);
+        }
+
         glGenBuffers(1, &staticMesh.PositionVBO);
         glBindBuffer(GL_ARRAY_BUFFER, staticMesh.PositionVBO);
         glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(positions[0]), positions.data(), GL_STATIC_DRAW);
@@ -1,74 +1,410 @@
 #include "shaderreloader.h"
 
+#include "filewatcher.h"
+
 #include <string>
 #include <fstream>
 #include <cassert>
+#include <cstdio>
 
-#if defined(__APPLE__)
+#ifdef _WIN32
+#include <direct.h>
+#else
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <stdio.h>
 #endif
 
-static uint64_t GetShaderFileTimestamp(const char* filename)
+// Versions of the watched shader files, indexed by file ID. Bumped on every change, starting from 1.
+static std::vector<uint64_t> g_ShaderFileVersions;
+
+static FileWatcher& GetShaderFileWatcher()
 {
-    uint64_t timestamp = 0;
+    // Created on first use, so the watcher thread only runs when shaders are
+    static FileWatcher watcher;
+    return watcher;
+}
 
-#ifdef _WIN32
-    int filenameBufferSize = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, filename, -1, NULL, 0);
-    if (filenameBufferSize == 0)
+bool PollShaderFileChanges()
+{
+    bool anyChanged = false;
+
+    int fileID;
+    while (GetShaderFileWatcher().PollChange(&fileID))
     {
-        return 0;
+        if (fileID == -1)
+        {
+            // Changes were dropped, so which files changed is unknown
+            for (uint64_t& version : g_ShaderFileVersions)
+            {
+                version++;
+            }
+        }
+        else if (fileID < (int)g_ShaderFileVersions.size())
+        {
+            g_ShaderFileVersions[fileID]++;
+        }
+        anyChanged = true;
     }
-    
-    WCHAR* wfilename = new WCHAR[filenameBufferSize];
-    if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, filename, -1, wfilename, filenameBufferSize))
+
+    return anyChanged;
+}
+
+static std::string ShaderStringFromFile(const char* filename)
+{
+    std::ifstream fs(filename);
+    if (!fs)
     {
-        HANDLE hFile = CreateFileW(wfilename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (hFile != INVALID_HANDLE_VALUE)
+        return "";
+    }
+
+    std::string s(
+        std::istreambuf_iterator<char>{fs},
+        std::istreambuf_iterator<char>{});
+
+    return s;
+}
+
+// Inserts defines after the #version line, which must stay first, and resets line numbers for error messages
+static void InsertShaderDefines(std::string& src, const char* defines)
+{
+    size_t insertPos = 0;
+    int versionLine = 0;
+
+    size_t lineStart = 0;
+    for (int line = 1; lineStart < src.size(); line++)
+    {
+        size_t lineEnd = src.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
         {
-            FILETIME lastWriteTime;
-            if (GetFileTime(hFile, NULL, NULL, &lastWriteTime))
+            lineEnd = src.size();
+        }
+
+        size_t directive = src.find_first_not_of(" \t", lineStart);
+        if (directive < lineEnd && src[directive] == '#')
+        {
+            size_t keyword = src.find_first_not_of(" \t", directive + 1);
+            if (keyword < lineEnd && src.compare(keyword, 7, "version") == 0)
             {
-                LARGE_INTEGER largeWriteTime;
-                largeWriteTime.HighPart = lastWriteTime.dwHighDateTime;
-                largeWriteTime.LowPart = lastWriteTime.dwLowDateTime;
-                timestamp = largeWriteTime.QuadPart;
+                insertPos = lineEnd < src.size() ? lineEnd + 1 : lineEnd;
+                versionLine = line;
+                break;
             }
-            CloseHandle(hFile);
         }
+
+        lineStart = lineEnd + 1;
+    }
+
+    std::string preamble = defines;
+    if (!preamble.empty() && preamble.back() != '\n')
+    {
+        preamble += '\n';
+    }
+    preamble += "#line " + std::to_string(versionLine + 1) + "\n";
+
+    if (insertPos == src.size() && !src.empty() && src.back() != '\n')
+    {
+        preamble = "\n" + preamble;
+    }
+
+    src.insert(insertPos, preamble);
+}
+
+static const char* GetShaderStageName(GLenum type)
+{
+    switch (type)
+    {
+    case GL_VERTEX_SHADER: return "vertex";
+    case GL_FRAGMENT_SHADER: return "fragment";
+    case GL_GEOMETRY_SHADER: return "geometry";
+    case GL_TESS_CONTROL_SHADER: return "tessellation control";
+    case GL_TESS_EVALUATION_SHADER: return "tessellation evaluation";
+    case GL_COMPUTE_SHADER: return "compute";
+    default: return "unknown";
+    }
+}
+
+// Directory of the program binary cache, empty if disabled
+static std::string g_ProgramBinaryCacheDirectory = "shadercache";
+static ProgramBinaryCacheStats g_ProgramBinaryCacheStats;
+
+static const uint32_t kProgramBinaryMagic = 0x42505046; // "FPPB"
+
+struct ProgramBinaryHeader
+{
+    uint32_t Magic;
+    uint32_t Format;
+    uint64_t Key; // Checked in case two keys end up with the same filename
+    uint32_t Length;
+};
+
+void SetProgramBinaryCacheDirectory(const char* directory)
+{
+    g_ProgramBinaryCacheDirectory = directory ? directory : "";
+}
+
+const ProgramBinaryCacheStats& GetProgramBinaryCacheStats()
+{
+    return g_ProgramBinaryCacheStats;
+}
+
+// FNV-1a
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static uint64_t HashString(uint64_t hash, const char* s)
+{
+    // Includes the terminator, so consecutive strings can't run into each other
+    return HashBytes(hash, s ? s : "", strlen(s ? s : "") + 1);
+}
+
+static const uint64_t kHashSeed = 0xCBF29CE484222325ULL;
+
+static bool IsProgramBinaryCacheEnabled()
+{
+    if (g_ProgramBinaryCacheDirectory.empty())
+    {
+        return false;
+    }
+
+    // Some drivers (eg. OS X's) support the API but no binary formats
+    static GLint numFormats = -1;
+    if (numFormats == -1)
+    {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    }
+    return numFormats > 0;
+}
+
+// Binaries are only valid for the driver that produced them, so it's part of the key with everything that goes into linking
+static uint64_t GetProgramBinaryKey(const ReloadableProgram* program, const std::vector<ReloadableShader*>& shaders)
+{
+    uint64_t key = kHashSeed;
+    key = HashString(key, (const char*)glGetString(GL_VENDOR));
+    key = HashString(key, (const char*)glGetString(GL_RENDERER));
+    key = HashString(key, (const char*)glGetString(GL_VERSION));
+
+    for (const ReloadableShader* shader : shaders)
+    {
+        GLenum type = shader ? shader->Type : 0;
+        uint64_t sourceHash = shader ? shader->SourceHash : 0;
+        key = HashBytes(key, &type, sizeof(type));
+        key = HashBytes(key, &sourceHash, sizeof(sourceHash));
     }
-    delete[] wfilename;
-#elif defined(__APPLE__)
-    struct stat buf;
 
-    if (stat(filename, &buf) == -1)
+    for (const char* varying : program->TransformFeedbackVaryings)
+    {
+        key = HashString(key, varying);
+    }
+    if (!program->TransformFeedbackVaryings.empty())
+    {
+        key = HashBytes(key, &program->TransformFeedbackBufferMode, sizeof(program->TransformFeedbackBufferMode));
+    }
+
+    return key;
+}
+
+static std::string GetProgramBinaryFilename(uint64_t key)
+{
+    char filename[32];
+    snprintf(filename, sizeof(filename), "/%016llx.bin", (unsigned long long)key);
+    return g_ProgramBinaryCacheDirectory + filename;
+}
+
+// Returns the program, or 0 if it isn't cached or the driver rejected the binary
+static GLuint LoadProgramBinary(uint64_t key)
+{
+    std::string filename = GetProgramBinaryFilename(key);
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f)
     {
-        perror(filename);
         return 0;
     }
 
-    timestamp = buf.st_mtimespec.tv_sec;
+    ProgramBinaryHeader header;
+    std::vector<char> binary;
+    bool readOK = fread(&header, sizeof(header), 1, f) == 1 &&
+        header.Magic == kProgramBinaryMagic && header.Key == key;
+    if (readOK)
+    {
+        binary.resize(header.Length);
+        readOK = fread(binary.data(), 1, binary.size(), f) == binary.size();
+    }
+    fclose(f);
+
+    GLuint program = 0;
+    if (readOK)
+    {
+        program = glCreateProgram();
+        glProgramBinary(program, header.Format, binary.data(), (GLsizei)binary.size());
+
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!status)
+        {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    if (!program)
+    {
+        // Replaced once the program is compiled from source
+        fprintf(stderr, "Rejected cached program binary %s\n", filename.c_str());
+        g_ProgramBinaryCacheStats.NumRejected++;
+    }
+
+    return program;
+}
+
+static void SaveProgramBinary(GLuint program, uint64_t key)
+{
+    GLint length;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        return;
+    }
+
+    ProgramBinaryHeader header;
+    header.Magic = kProgramBinaryMagic;
+    header.Key = key;
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    header.Format = format;
+    header.Length = (uint32_t)length;
+
+#ifdef _WIN32
+    _mkdir(g_ProgramBinaryCacheDirectory.c_str());
 #else
-    static_assert(false, "no GetShaderFileTimestamp for this platform");
+    mkdir(g_ProgramBinaryCacheDirectory.c_str(), 0755);
 #endif
 
-    return timestamp;
+    std::string filename = GetProgramBinaryFilename(key);
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f)
+    {
+        perror(filename.c_str());
+        return;
+    }
+
+    // A partially written file is caught by the length check or rejected by the driver when loaded
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(binary.data(), 1, header.Length, f);
+    fclose(f);
 }
 
-static std::string ShaderStringFromFile(const char* filename)
+// Number of programs waiting on their shaders to compile or link
+static int g_NumPendingReloads;
+
+bool AnyProgramReloadsPending()
 {
-    std::ifstream fs(filename);
-    if (!fs)
+    return g_NumPendingReloads > 0;
+}
+
+// With KHR_parallel_shader_compile, compiles and links run on the driver's threads and their status can be polled without blocking.
+// Without it, the first status query waits for the work to finish, so reloads complete in the call that starts them.
+static bool IsParallelShaderCompileEnabled()
+{
+    static bool initialized = false;
+    if (!initialized)
     {
-        return "";
+        // Let the driver pick the number of threads
+        if (glMaxShaderCompilerThreadsKHR.fptr)
+        {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+        initialized = true;
     }
+    return glMaxShaderCompilerThreadsKHR.fptr != NULL;
+}
 
-    std::string s(
-        std::istreambuf_iterator<char>{fs},
-        std::istreambuf_iterator<char>{});
+// Starts compiling the shader, unless it's already compiled, being compiled, or failed to compile
+static void StartCompilingShader(ReloadableShader* shader)
+{
+    if (shader->Handle || shader->CompileFailed)
+    {
+        return;
+    }
 
-    return s;
+    shader->Handle = glCreateShader(shader->Type);
+
+    const char* csrc = shader->Source.c_str();
+    glShaderSource(shader->Handle, 1, &csrc, NULL);
+    glCompileShader(shader->Handle);
+    shader->CompilePending = true;
+
+    // Not needed anymore, it's only kept until a program misses the cache
+    shader->Source = std::string();
+}
+
+// Returns false while the shader is still compiling. Compile errors are reported once it's done.
+static bool IsShaderCompileDone(ReloadableShader* shader)
+{
+    if (!shader->CompilePending)
+    {
+        return true;
+    }
+
+    GLint status;
+    if (IsParallelShaderCompileEnabled())
+    {
+        glGetShaderiv(shader->Handle, GL_COMPLETION_STATUS_KHR, &status);
+        if (!status)
+        {
+            return false;
+        }
+    }
+
+    shader->CompilePending = false;
+
+    glGetShaderiv(shader->Handle, GL_COMPILE_STATUS, &status);
+    if (!status)
+    {
+        GLint logLength;
+        glGetShaderiv(shader->Handle, GL_INFO_LOG_LENGTH, &logLength);
+        std::vector<GLchar> log(logLength + 1);
+        glGetShaderInfoLog(shader->Handle, (GLsizei)log.size(), NULL, log.data());
+        fprintf(stderr, "Error compiling %s shader %s: %s\n", GetShaderStageName(shader->Type), shader->Filename, log.data());
+
+        glDeleteShader(shader->Handle);
+        shader->Handle = 0;
+        shader->CompileFailed = true;
+    }
+
+    return true;
+}
+
+static void SetReloadPending(ReloadableProgram* program, bool pending)
+{
+    if (program->ReloadPending != pending)
+    {
+        g_NumPendingReloads += pending ? 1 : -1;
+        program->ReloadPending = pending;
+    }
+}
+
+void RequestProgram(ReloadableProgram* program)
+{
+    if (!IsProgramRequested(program))
+    {
+        SetReloadPending(program, true);
+    }
+}
+
+bool IsProgramRequested(const ReloadableProgram* program)
+{
+    // Any program ReloadProgram was called on
+    return program->ReloadPending || !program->LinkedVersions.empty();
 }
 
 void ReloadProgram(
@@ -76,7 +412,7 @@ void ReloadProgram(
     bool* wasOutOfDate,
     bool* newProgramLinked)
 {
-    ReloadableShader* shaders[] = {
+    std::vector<ReloadableShader*> shaders = {
         program->VS,
         program->FS,
         program->GS,
@@ -84,69 +420,142 @@ void ReloadProgram(
         program->TES,
         program->CS
     };
+    shaders.insert(shaders.end(), program->Libraries.begin(), program->Libraries.end());
 
-    const char* shaderStageNames[] = {
-        "vertex",
-        "fragment",
-        "geometry",
-        "tessellation control",
-        "tessellation evaluation",
-        "compute"
-    };
+    program->LinkedVersions.resize(shaders.size(), 0);
 
     bool anyChanged = false;
-    bool anyErrors = false;
 
-    for (int i = 0; i < sizeof(shaders) / sizeof(*shaders); i++)
+    for (int i = 0; i < (int)shaders.size(); i++)
     {
         if (!shaders[i])
         {
             continue;
         }
 
-        uint64_t timestamp = GetShaderFileTimestamp(shaders[i]->Filename);
-        if (shaders[i]->Timestamp < timestamp)
+        if (shaders[i]->FileID == -1)
         {
-            anyChanged = true;
-            shaders[i]->Timestamp = timestamp;
+            shaders[i]->FileID = GetShaderFileWatcher().WatchFile(shaders[i]->Filename);
+            if (shaders[i]->FileID >= (int)g_ShaderFileVersions.size())
+            {
+                g_ShaderFileVersions.resize(shaders[i]->FileID + 1, 1);
+            }
+        }
+
+        // Only read for now, compiling waits until a program using it isn't in the binary cache
+        uint64_t version = g_ShaderFileVersions[shaders[i]->FileID];
+        if (shaders[i]->Version != version)
+        {
+            shaders[i]->Version = version;
+
+            shaders[i]->Source = ShaderStringFromFile(shaders[i]->Filename);
+            if (shaders[i]->Defines)
+            {
+                InsertShaderDefines(shaders[i]->Source, shaders[i]->Defines);
+            }
+            shaders[i]->SourceHash = HashString(kHashSeed, shaders[i]->Source.c_str());
 
+            // Programs already linked with it keep working after the shader object is deleted
             glDeleteShader(shaders[i]->Handle);
-            shaders[i]->Handle = glCreateShader(shaders[i]->Type);
+            shaders[i]->Handle = 0;
+            shaders[i]->CompilePending = false;
+            shaders[i]->CompileFailed = false;
+        }
+
+        // Also relink if another program sharing this shader reread it
+        if (shaders[i]->Version != program->LinkedVersions[i])
+        {
+            anyChanged = true;
+        }
+    }
+
+    // Failures are only reported once, until one of the shaders changes again
+    for (int i = 0; i < (int)shaders.size(); i++)
+    {
+        program->LinkedVersions[i] = shaders[i] ? shaders[i]->Version : 0;
+    }
+
+    if (newProgramLinked) *newProgramLinked = false;
+    if (wasOutOfDate) *wasOutOfDate = false;
+
+    bool useCache = IsProgramBinaryCacheEnabled();
+
+    if (anyChanged)
+    {
+        // Restart a reload that was still going with the new sources
+        if (program->PendingHandle)
+        {
+            glDeleteProgram(program->PendingHandle);
+            program->PendingHandle = 0;
+        }
+        SetReloadPending(program, false);
+
+        program->PendingBinaryKey = useCache ? GetProgramBinaryKey(program, shaders) : 0;
+
+        GLuint cachedProgram = useCache ? LoadProgramBinary(program->PendingBinaryKey) : 0;
+        if (cachedProgram)
+        {
+            g_ProgramBinaryCacheStats.NumLoaded++;
 
-            std::string src = ShaderStringFromFile(shaders[i]->Filename);
-            const char* csrc = src.c_str();
-            glShaderSource(shaders[i]->Handle, 1, &csrc, NULL);
-            glCompileShader(shaders[i]->Handle);
+            glDeleteProgram(program->Handle);
+            program->Handle = cachedProgram;
+            program->ReloadFailed = false;
+            if (wasOutOfDate) *wasOutOfDate = true;
+            if (newProgramLinked) *newProgramLinked = true;
+            return;
+        }
 
-            GLint status;
-            glGetShaderiv(shaders[i]->Handle, GL_COMPILE_STATUS, &status);
-            if (!status)
+        for (int i = 0; i < (int)shaders.size(); i++)
+        {
+            if (shaders[i])
             {
-                GLint logLength;
-                glGetShaderiv(shaders[i]->Handle, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<GLchar> log(logLength + 1);
-                glGetShaderInfoLog(shaders[i]->Handle, (GLsizei)log.size(), NULL, log.data());
-                fprintf(stderr, "Error compiling %s shader %s: %s\n", shaderStageNames[i], shaders[i]->Filename, log.data());
-
-                glDeleteShader(shaders[i]->Handle);
-                shaders[i]->Handle = 0;
-                anyErrors = true;
+                StartCompilingShader(shaders[i]);
             }
         }
+        SetReloadPending(program, true);
     }
 
-    bool programOK = !anyErrors;
-    if (newProgramLinked) *newProgramLinked = false;
-    if (wasOutOfDate) *wasOutOfDate = anyChanged;
+    if (!program->ReloadPending)
+    {
+        return;
+    }
 
-    if (anyChanged && !anyErrors)
+    // The previous program stays in use until the new one is linked
+    if (!program->PendingHandle)
     {
-        GLuint newProgram;
-        newProgram = glCreateProgram();
+        bool anyErrors = false;
+        for (int i = 0; i < (int)shaders.size(); i++)
+        {
+            if (!shaders[i])
+            {
+                continue;
+            }
+
+            if (!IsShaderCompileDone(shaders[i]))
+            {
+                return;
+            }
+
+            // Don't link without a stage that failed to compile
+            if (shaders[i]->CompileFailed)
+            {
+                anyErrors = true;
+            }
+        }
 
-        for (int i = 0; i < sizeof(shaders) / sizeof(*shaders); i++)
+        if (anyErrors)
         {
-            if (!shaders[i] || !shaders[i]->Handle)
+            SetReloadPending(program, false);
+            program->ReloadFailed = true;
+            if (wasOutOfDate) *wasOutOfDate = true;
+            return;
+        }
+
+        GLuint newProgram = glCreateProgram();
+
+        for (int i = 0; i < (int)shaders.size(); i++)
+        {
+            if (!shaders[i])
             {
                 continue;
             }
@@ -163,45 +572,71 @@ void ReloadProgram(
                 program->TransformFeedbackBufferMode);
         }
 
+        if (useCache)
+        {
+            glProgramParameteri(newProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+
         glLinkProgram(newProgram);
+        program->PendingHandle = newProgram;
+    }
 
-        GLint status;
-        glGetProgramiv(newProgram, GL_LINK_STATUS, &status);
+    GLint status;
+    if (IsParallelShaderCompileEnabled())
+    {
+        glGetProgramiv(program->PendingHandle, GL_COMPLETION_STATUS_KHR, &status);
         if (!status)
         {
-            GLint logLength;
-            glGetProgramiv(newProgram, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<GLchar> log(logLength + 1);
-            glGetProgramInfoLog(newProgram, (GLsizei)log.size(), NULL, log.data());
-            fprintf(stderr, "Error linking program (");
-            bool first = false;
-            for (int i = 0; i < sizeof(shaders) / sizeof(*shaders); i++)
-            {
-                if (!shaders[i])
-                {
-                    continue;
-                }
-
-                if (!first)
-                {
-                    fprintf(stderr, ", ");
-                }
-                else
-                {
-                    first = true;
-                }
-
-                fprintf(stderr, "%s", shaders[i]->Filename);
-            }
-            fprintf(stderr, "): %s\n", log.data());
-            glDeleteProgram(newProgram);
-            programOK = false;
+            return;
         }
-        else
+    }
+
+    GLuint newProgram = program->PendingHandle;
+    program->PendingHandle = 0;
+    SetReloadPending(program, false);
+    if (wasOutOfDate) *wasOutOfDate = true;
+
+    glGetProgramiv(newProgram, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        GLint logLength;
+        glGetProgramiv(newProgram, GL_INFO_LOG_LENGTH, &logLength);
+        std::vector<GLchar> log(logLength + 1);
+        glGetProgramInfoLog(newProgram, (GLsizei)log.size(), NULL, log.data());
+        fprintf(stderr, "Error linking program (");
+        bool first = false;
+        for (int i = 0; i < (int)shaders.size(); i++)
         {
-            glDeleteProgram(program->Handle);
-            program->Handle = newProgram;
-            if (newProgramLinked) *newProgramLinked = true;
+            if (!shaders[i])
+            {
+                continue;
+            }
+
+            if (!first)
+            {
+                fprintf(stderr, ", ");
+            }
+            else
+            {
+                first = true;
+            }
+
+            fprintf(stderr, "%s", shaders[i]->Filename);
         }
+        fprintf(stderr, "): %s\n", log.data());
+        glDeleteProgram(newProgram);
+        program->ReloadFailed = true;
+        return;
     }
+
+    g_ProgramBinaryCacheStats.NumCompiled++;
+    if (useCache)
+    {
+        SaveProgramBinary(newProgram, program->PendingBinaryKey);
+    }
+
+    glDeleteProgram(program->Handle);
+    program->Handle = newProgram;
+    program->ReloadFailed = false;
+    if (newProgramLinked) *newProgramLinked = true;
 }
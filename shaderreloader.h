@@ -4,6 +4,7 @@
 
 #include <cstring>
 #include <cstdlib>
+#include <string>
 #include <vector>
 
 struct ReloadableShader
@@ -12,16 +13,27 @@ struct ReloadableShader
         : Handle(0)
         , Type(type)
         , Filename(filename)
-        , Timestamp(0)
+        , Defines(NULL)
+        , FileID(-1)
+        , Version(0)
+        , SourceHash(0)
+        , CompilePending(false)
+        , CompileFailed(false)
     { }
 
-    explicit ReloadableShader(const char* filename)
+    // defines are inserted after the #version line, to compile permutations of the same file
+    explicit ReloadableShader(const char* filename, const char* defines = NULL)
         : Handle(0)
         , Filename(filename)
-        , Timestamp(0)
+        , Defines(defines)
+        , FileID(-1)
+        , Version(0)
+        , SourceHash(0)
+        , CompilePending(false)
+        , CompileFailed(false)
     {
         const char* exts[] = {
-            ".vert", ".frag", ".geom", ".tesc", ".tese", "comp"
+            ".vert", ".frag", ".geom", ".tesc", ".tese", ".comp"
         };
         GLenum types[] = {
             GL_VERTEX_SHADER,
@@ -57,7 +69,17 @@ struct ReloadableShader
     GLuint Handle;
     GLenum Type;
     const char* Filename;
-    uint64_t Timestamp;
+    const char* Defines;
+
+    // ID of the file in the shader file watcher, and the version of the file last read
+    int FileID;
+    uint64_t Version;
+
+    // Source of the current version, with the defines inserted. Compiled only when a program using it isn't in the binary cache.
+    std::string Source;
+    uint64_t SourceHash;
+    bool CompilePending; // Handle is still compiling, its status wasn't checked yet
+    bool CompileFailed; // Until the file changes again
 };
 
 struct ReloadableProgram
@@ -71,11 +93,13 @@ struct ReloadableProgram
         ReloadableShader* tcs = NULL,
         ReloadableShader* tes = NULL)
         : Handle(0), VS(vs), FS(fs), GS(gs), TCS(tcs), TES(tes), CS(NULL)
+        , ReloadPending(false), ReloadFailed(false), PendingHandle(0), PendingBinaryKey(0)
     { }
 
     explicit ReloadableProgram(
         ReloadableShader* onestage)
         : Handle(0), VS(NULL), FS(NULL), GS(NULL), TCS(NULL), TES(NULL), CS(NULL)
+        , ReloadPending(false), ReloadFailed(false), PendingHandle(0), PendingBinaryKey(0)
     {
         switch (onestage->Type)
         {
@@ -99,6 +123,13 @@ struct ReloadableProgram
         return *this;
     }
 
+    // Links in another shader object of one of the program's stages, eg. to provide functions declared but not defined by it
+    ReloadableProgram& WithLibrary(ReloadableShader* library)
+    {
+        Libraries.push_back(library);
+        return *this;
+    }
+
     GLuint Handle;
     ReloadableShader* VS;
     ReloadableShader* FS;
@@ -110,8 +141,48 @@ struct ReloadableProgram
     // Transform feedback outputs to capture.
     std::vector<const char*> TransformFeedbackVaryings;
     GLenum TransformFeedbackBufferMode;
+
+    // Extra shader objects linked with the stages above
+    std::vector<ReloadableShader*> Libraries;
+
+    // Versions of the shaders when the program was last linked (or failed to).
+    // Shaders can be shared by programs, so one program recompiling a shader doesn't mean the others were relinked.
+    std::vector<uint64_t> LinkedVersions;
+
+    // Reloads are asynchronous: the shaders compile, then PendingHandle links, while Handle keeps the last program that linked.
+    bool ReloadPending;
+    bool ReloadFailed; // The last reload failed to compile or link
+    GLuint PendingHandle;
+    uint64_t PendingBinaryKey; // Where the binary goes in the cache once linked
+};
+
+// Applies the changes reported by the shader file watcher since the last call, so the next ReloadProgram sees them.
+// Returns true if any shader file changed. Makes no system calls when nothing changed.
+bool PollShaderFileChanges();
+
+struct ProgramBinaryCacheStats
+{
+    int NumLoaded; // Programs loaded from a cached binary
+    int NumCompiled; // Programs compiled from source, then added to the cache
+    int NumRejected; // Cached binaries the driver refused, eg. after a driver update
 };
 
+// Linked programs are cached on disk as binaries, keyed by their sources and the driver, so they don't need compiling on the next run.
+// NULL disables the cache. The directory is created if needed.
+void SetProgramBinaryCacheDirectory(const char* directory);
+const ProgramBinaryCacheStats& GetProgramBinaryCacheStats();
+
+// True while programs wait on their shaders to compile or link
+bool AnyProgramReloadsPending();
+
+// For programs only loaded once they're needed, eg. rarely used permutations.
+// Requesting a program marks it pending so it's loaded by the next ReloadProgram, and requested programs are reloaded from then on.
+void RequestProgram(ReloadableProgram* program);
+bool IsProgramRequested(const ReloadableProgram* program);
+
+// Starts recompiling the shaders whose files changed and relinking the program if any of its shaders did, or continues a reload started earlier.
+// Doesn't wait on the driver when it supports KHR_parallel_shader_compile, so it should be called again while AnyProgramReloadsPending.
+// wasOutOfDate is set when a reload finishes, and newProgramLinked if it succeeded and replaced Handle.
 void ReloadProgram(
     ReloadableProgram* program,
     bool* wasOutOfDate = NULL,
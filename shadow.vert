@@ -4,7 +4,28 @@ layout(location = 0) in vec3 Position;
 
 uniform mat4 ModelLightProjection;
 
+#ifdef INLINE_SKINNING
+layout(location = 2) in vec3 Normal;
+layout(location = 3) in vec3 Tangent;
+layout(location = 4) in vec3 Bitangent;
+
+// Defined by skinning_inline_dlb.vert or skinning_inline_lbs.vert
+void SkinVertex(int paletteOffset, inout vec3 position, inout vec3 normal, inout vec3 tangent, inout vec3 bitangent);
+
+uniform int PaletteOffset; // Start of the mesh's palette in texels
+#endif
+
 void main()
 {
-    gl_Position = ModelLightProjection * vec4(Position, 1.0);
-}
\ No newline at end of file
+    vec3 position = Position;
+
+#ifdef INLINE_SKINNING
+    // Differentials are skinned too, but the linker can drop that work since they are never used
+    vec3 normal = Normal;
+    vec3 tangent = Tangent;
+    vec3 bitangent = Bitangent;
+    SkinVertex(PaletteOffset, position, normal, tangent, bitangent);
+#endif
+
+    gl_Position = ModelLightProjection * vec4(position, 1.0);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+// SIMD_WIDTH is the number of float lanes of the instruction set the wrappers below use: AVX2 when compiled with it, SSE2 otherwise.
+// It's not defined on other targets, where code should fall back to scalar loops.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+#endif
+
+#ifdef SIMD_WIDTH
+
+// Thin wrappers so kernels are written once for both instruction sets
+#if SIMD_WIDTH == 8
+typedef __m256 vfloat;
+typedef __m256i vint;
+static inline vfloat VLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline vint VLoadInt(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+static inline void VStore(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+static inline vfloat VSet1(float f) { return _mm256_set1_ps(f); }
+static inline vfloat VAdd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat VSub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat VMul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat VDiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+static inline vfloat VSqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+static inline vfloat VAnd(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+static inline vfloat VXor(vfloat a, vfloat b) { return _mm256_xor_ps(a, b); }
+static inline vfloat VCmpGt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vfloat VCmpGe(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline vfloat VCmpLt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vfloat VSelect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+static inline vint VAddInt(vint a, vint b) { return _mm256_add_epi32(a, b); }
+static inline vfloat VGather(const float* base, vint indices) { return _mm256_i32gather_ps(base, indices, 4); }
+#else
+typedef __m128 vfloat;
+typedef __m128i vint;
+static inline vfloat VLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline vint VLoadInt(const int32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void VStore(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+static inline vfloat VSet1(float f) { return _mm_set1_ps(f); }
+static inline vfloat VAdd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat VSub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat VMul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat VDiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+static inline vfloat VSqrt(vfloat a) { return _mm_sqrt_ps(a); }
+static inline vfloat VAnd(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+static inline vfloat VXor(vfloat a, vfloat b) { return _mm_xor_ps(a, b); }
+static inline vfloat VCmpGt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+static inline vfloat VCmpGe(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+static inline vfloat VCmpLt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vfloat VSelect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline vint VAddInt(vint a, vint b) { return _mm_add_epi32(a, b); }
+static inline vfloat VGather(const float* base, vint indices)
+{
+    // SSE has no gather, so load lanes one by one
+    alignas(16) int32_t i[4];
+    _mm_store_si128((__m128i*)i, indices);
+    return _mm_set_ps(base[i[3]], base[i[2]], base[i[1]], base[i[0]]);
+}
+#endif
+
+static inline vfloat VMulAdd(vfloat a, vfloat b, vfloat c) { return VAdd(VMul(a, b), c); }
+
+struct vvec3 { vfloat x, y, z; };
+
+static inline vvec3 VCross(const vvec3& a, const vvec3& b)
+{
+    return vvec3{
+        VSub(VMul(a.y, b.z), VMul(a.z, b.y)),
+        VSub(VMul(a.z, b.x), VMul(a.x, b.z)),
+        VSub(VMul(a.x, b.y), VMul(a.y, b.x)) };
+}
+
+#endif // SIMD_WIDTH
@@ -8,34 +8,50 @@ layout(location = 3) in  vec3 Tangent;
 layout(location = 4) in  vec3 Bitangent;
 layout(location = 5) in uvec4 BoneIDs;
 layout(location = 6) in  vec4 Weights;
+layout(location = 7) in  uint PaletteID; // Per instance, selects the instance's palette
 
 uniform samplerBuffer BoneTransforms;
+uniform int PaletteTableOffset; // Start of the table of palette offsets in texels
+uniform ivec2 InfluenceRangeEnds; // Ends of the bind pose vertex ranges with 1 and 2 influences
 
 out vec3 oPosition;
-out vec3 oNormal;
-out vec3 oTangent;
-out vec3 oBitangent;
+flat out int oNormal; // 2_10_10_10 snorm
+flat out int oTangent; // 2_10_10_10 snorm, w is the handedness of the bitangent
 
 vec3 QuatRotate(in vec4 q, in vec3 v)
 {
     return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
 }
 
+// Packs a vector with components in [-1,1] for a normalized GL_INT_2_10_10_10_REV attribute
+int PackSnorm2_10_10_10(vec4 v)
+{
+    ivec4 i = ivec4(round(clamp(v, -1.0, 1.0) * vec4(511.0, 511.0, 511.0, 1.0)));
+    return (i.x & 0x3FF) | ((i.y & 0x3FF) << 10) | ((i.z & 0x3FF) << 20) | (i.w << 30);
+}
+
 void main()
 {
+    // Find where this instance's palette starts
+    int paletteOffset = int(texelFetch(BoneTransforms, PaletteTableOffset + int(PaletteID) / 4)[int(PaletteID) % 4]);
+
+    // Vertices are sorted by influence count, so neighbouring vertices take the same branch.
+    // Transform feedback writes each draw contiguously, so the ranges are skinned in one draw instead of one per variant.
+    int numInfluences = gl_VertexID < InfluenceRangeEnds[0] ? 1 : gl_VertexID < InfluenceRangeEnds[1] ? 2 : 4;
+
     vec4 reals[4];
     vec4 duals[4];
 
     // Read dual quaternion real and dual components from texture buffer
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < numInfluences; i++)
     {
-        reals[i] = texelFetch(BoneTransforms, int(BoneIDs[i]) * 2 + 0);
-        duals[i] = texelFetch(BoneTransforms, int(BoneIDs[i]) * 2 + 1);
+        reals[i] = texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 2 + 0);
+        duals[i] = texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 2 + 1);
     }
 
     // Reflect dual quaternions so that the dot products of the real components
     // are positive to ensure consistent interpolation
-    for (int i = 1; i < 4; i++)
+    for (int i = 1; i < numInfluences; i++)
     {
         // Extract sign bit and map to -1 or 1 for reflection
         uint bits = floatBitsToUint(dot(reals[0], reals[i]));
@@ -48,7 +64,7 @@ void main()
     vec4 dual = vec4(0.0);
 
     // Blend dual quaternions
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < numInfluences; i++)
     {
         real += Weights[i] * reals[i];
         dual += Weights[i] * duals[i];
@@ -60,11 +76,15 @@ void main()
     dual /= len;
 
     // Rotate
-    oPosition  = QuatRotate(real, Position);
-    oNormal    = QuatRotate(real, Normal);
-    oTangent   = QuatRotate(real, Tangent);
-    oBitangent = QuatRotate(real, Bitangent);
+    oPosition = QuatRotate(real, Position);
+    vec3 normal = QuatRotate(real, Normal);
+    vec3 tangent = QuatRotate(real, Tangent);
 
     // Translate
     oPosition += 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+
+    // Rotation keeps handedness, so it can be taken from the bind pose and the bitangent rebuilt when drawing
+    float handedness = dot(cross(Normal, Tangent), Bitangent) < 0.0 ? -1.0 : 1.0;
+    oNormal = PackSnorm2_10_10_10(vec4(normal, 0.0));
+    oTangent = PackSnorm2_10_10_10(vec4(tangent, handedness));
 }
@@ -0,0 +1,28 @@
+// Linear Blend Skinning, linked into vertex shaders that skin bind pose vertices themselves
+
+#version 410
+
+layout(location = 5) in uvec4 BoneIDs;
+layout(location = 6) in  vec4 Weights;
+
+uniform samplerBuffer BoneTransforms;
+
+void SkinVertex(int paletteOffset, inout vec3 position, inout vec3 normal, inout vec3 tangent, inout vec3 bitangent)
+{
+    // Transposed skinning matrix
+    mat3x4 skinningTransform = mat3x4(0.0);
+
+    // Blend matrices
+    for (int i = 0; i < 4; i++)
+    {
+        skinningTransform[0] += Weights[i] * texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 3 + 0);
+        skinningTransform[1] += Weights[i] * texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 3 + 1);
+        skinningTransform[2] += Weights[i] * texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 3 + 2);
+    }
+
+    // Left multiply vectors with transposed matrix to undo transposition
+    position  = vec4(position, 1.0) * skinningTransform;
+    normal    = normal    * mat3(skinningTransform);
+    tangent   = tangent   * mat3(skinningTransform);
+    bitangent = bitangent * mat3(skinningTransform);
+}
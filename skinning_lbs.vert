@@ -8,30 +8,51 @@ layout(location = 3) in  vec3 Tangent;
 layout(location = 4) in  vec3 Bitangent;
 layout(location = 5) in uvec4 BoneIDs;
 layout(location = 6) in  vec4 Weights;
+layout(location = 7) in  uint PaletteID; // Per instance, selects the instance's palette
 
 uniform samplerBuffer BoneTransforms;
+uniform int PaletteTableOffset; // Start of the table of palette offsets in texels
+uniform ivec2 InfluenceRangeEnds; // Ends of the bind pose vertex ranges with 1 and 2 influences
 
 out vec3 oPosition;
-out vec3 oNormal;
-out vec3 oTangent;
-out vec3 oBitangent;
+flat out int oNormal; // 2_10_10_10 snorm
+flat out int oTangent; // 2_10_10_10 snorm, w is the handedness of the bitangent
+
+// Packs a vector with components in [-1,1] for a normalized GL_INT_2_10_10_10_REV attribute
+int PackSnorm2_10_10_10(vec4 v)
+{
+    ivec4 i = ivec4(round(clamp(v, -1.0, 1.0) * vec4(511.0, 511.0, 511.0, 1.0)));
+    return (i.x & 0x3FF) | ((i.y & 0x3FF) << 10) | ((i.z & 0x3FF) << 20) | (i.w << 30);
+}
 
 void main()
 {
+    // Find where this instance's palette starts
+    int paletteOffset = int(texelFetch(BoneTransforms, PaletteTableOffset + int(PaletteID) / 4)[int(PaletteID) % 4]);
+
+    // Vertices are sorted by influence count, so neighbouring vertices take the same branch.
+    // Transform feedback writes each draw contiguously, so the ranges are skinned in one draw instead of one per variant.
+    int numInfluences = gl_VertexID < InfluenceRangeEnds[0] ? 1 : gl_VertexID < InfluenceRangeEnds[1] ? 2 : 4;
+
     // Transposed skinning matrix
     mat3x4 skinningTransform = mat3x4(0.0);
 
     // Blend matrices
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < numInfluences; i++)
     {
-        skinningTransform[0] += Weights[i] * texelFetch(BoneTransforms, int(BoneIDs[i]) * 3 + 0);
-        skinningTransform[1] += Weights[i] * texelFetch(BoneTransforms, int(BoneIDs[i]) * 3 + 1);
-        skinningTransform[2] += Weights[i] * texelFetch(BoneTransforms, int(BoneIDs[i]) * 3 + 2);
+        skinningTransform[0] += Weights[i] * texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 3 + 0);
+        skinningTransform[1] += Weights[i] * texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 3 + 1);
+        skinningTransform[2] += Weights[i] * texelFetch(BoneTransforms, paletteOffset + int(BoneIDs[i]) * 3 + 2);
     }
 
     // Left multiply vectors with transposed matrix to undo transposition
-    oPosition  = Position  * skinningTransform;
-    oNormal    = Normal    * mat3(skinningTransform);
-    oTangent   = Tangent   * mat3(skinningTransform);
-    oBitangent = Bitangent * mat3(skinningTransform);
+    oPosition = Position * skinningTransform;
+    vec3 normal = normalize(Normal * mat3(skinningTransform));
+    vec3 tangent = normalize(Tangent * mat3(skinningTransform));
+    vec3 bitangent = Bitangent * mat3(skinningTransform);
+
+    // Blended matrices can scale, so the vectors are normalized to fit the packed range
+    float handedness = dot(cross(normal, tangent), bitangent) < 0.0 ? -1.0 : 1.0;
+    oNormal = PackSnorm2_10_10_10(vec4(normal, 0.0));
+    oTangent = PackSnorm2_10_10_10(vec4(tangent, handedness));
 }
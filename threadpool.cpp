@@ -0,0 +1,104 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int numWorkers)
+    : Generation(0)
+    , Stopping(false)
+    , Task(NULL)
+    , NumTaskThreads(0)
+    , NumWorkersRunning(0)
+{
+    for (int workerIdx = 0; workerIdx < numWorkers; workerIdx++)
+    {
+        Workers.emplace_back(&ThreadPool::Work, this, workerIdx);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(WorkMutex);
+        Stopping = true;
+    }
+    WorkAvailable.notify_all();
+
+    for (std::thread& worker : Workers)
+    {
+        worker.join();
+    }
+}
+
+int ThreadPool::GetMaxThreads() const
+{
+    return (int)Workers.size() + 1;
+}
+
+void ThreadPool::Work(int workerIdx)
+{
+    // The calling thread of a run is thread 0
+    int threadIdx = workerIdx + 1;
+
+    uint64_t lastGeneration = 0;
+    std::unique_lock<std::mutex> lock(WorkMutex);
+    for (;;)
+    {
+        WorkAvailable.wait(lock, [&] { return Stopping || Generation != lastGeneration; });
+        if (Stopping)
+        {
+            return;
+        }
+
+        lastGeneration = Generation;
+        if (threadIdx >= NumTaskThreads)
+        {
+            continue;
+        }
+
+        const std::function<void(int, int)>* task = Task;
+        int numThreads = NumTaskThreads;
+        lock.unlock();
+        (*task)(threadIdx, numThreads);
+        lock.lock();
+
+        NumWorkersRunning--;
+        if (NumWorkersRunning == 0)
+        {
+            WorkDone.notify_one();
+        }
+    }
+}
+
+void ThreadPool::Run(int numThreads, const std::function<void(int threadIdx, int numThreads)>& task)
+{
+    std::lock_guard<std::mutex> runLock(RunMutex);
+
+    numThreads = std::max(std::min(numThreads, GetMaxThreads()), 1);
+
+    if (numThreads > 1)
+    {
+        {
+            std::lock_guard<std::mutex> lock(WorkMutex);
+            Task = &task;
+            NumTaskThreads = numThreads;
+            NumWorkersRunning = numThreads - 1;
+            Generation++;
+        }
+        WorkAvailable.notify_all();
+    }
+
+    task(0, numThreads);
+
+    if (numThreads > 1)
+    {
+        std::unique_lock<std::mutex> lock(WorkMutex);
+        WorkDone.wait(lock, [&] { return NumWorkersRunning == 0; });
+        Task = NULL;
+    }
+}
+
+ThreadPool* GetThreadPool()
+{
+    static ThreadPool pool(std::max((int)std::thread::hardware_concurrency(), 1) - 1);
+    return &pool;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads kept alive between parallel loops, so splitting work over cores every frame doesn't create threads.
+// The calling thread takes part in every run as thread 0.
+// All threads of a run execute at the same time, so they can wait for each other (eg. with a barrier).
+class ThreadPool
+{
+    std::vector<std::thread> Workers;
+
+    // Guards everything below. Workers sleep on WorkAvailable until the generation changes or the pool stops.
+    std::mutex WorkMutex;
+    std::condition_variable WorkAvailable;
+    std::condition_variable WorkDone;
+    uint64_t Generation;
+    bool Stopping;
+    const std::function<void(int, int)>* Task;
+    int NumTaskThreads;
+    int NumWorkersRunning; // Workers that haven't finished the current run
+
+    // Runs from several threads are done one after the other
+    std::mutex RunMutex;
+
+    void Work(int workerIdx);
+
+public:
+    explicit ThreadPool(int numWorkers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads a run can use, counting the calling thread
+    int GetMaxThreads() const;
+
+    // Calls task(threadIdx, numThreads) on numThreads threads (at most GetMaxThreads) and returns once all calls have returned.
+    // A task must not start a run itself.
+    void Run(int numThreads, const std::function<void(int threadIdx, int numThreads)>& task);
+};
+
+// Pool with one thread per core, counting the calling thread. Created on first use.
+ThreadPool* GetThreadPool();
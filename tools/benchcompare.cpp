@@ -0,0 +1,751 @@
+// Compares two sets of benchmark results and fails on significant regressions.
+//
+//     $ ./fictional-doodle-benchcompare.out baseline.json contender.json
+//     $ ./fictional-doodle-benchcompare.out baseline1.json baseline2.json -- contender1.json contender2.json
+//
+// Reads both the microbenchmarks' JSON (fictional-doodle-bench.out --benchmark_out, or any Google Benchmark output)
+// and the program's --benchmark reports. Each repetition of a microbenchmark, and each report file, is one sample.
+// Metrics are compared by their median, and a change counts when it's over the metric's threshold and,
+// when there are enough samples for it, the Mann-Whitney U test finds the samples differ.
+//
+// Flags:
+// --alpha=<p>                          Significance level, 0.05 by default
+// --threshold=<regex>=<percent>        Overrides the threshold of matching metrics, the last matching flag wins
+// --filter=<regex>                     Only compares matching metrics
+// --all                                Also prints metrics that didn't change
+// --fail-unconfirmed                   Also fails on regressions over the threshold that had too few samples for the test
+//
+// Returns 0 without significant regressions, 1 with significant regressions, 2 on bad arguments or input files.
+// Regressions with too few samples to be significant are only reported, unless --fail-unconfirmed is given.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum JSONType
+{
+    JSONTYPE_NULL,
+    JSONTYPE_BOOL,
+    JSONTYPE_NUMBER,
+    JSONTYPE_STRING,
+    JSONTYPE_ARRAY,
+    JSONTYPE_OBJECT
+};
+
+struct JSONValue
+{
+    JSONType Type;
+    bool Bool;
+    double Number;
+    std::string String;
+    std::vector<JSONValue> Array;
+    std::vector<std::pair<std::string, JSONValue>> Object; // In file order
+
+    const JSONValue* Find(const char* key) const
+    {
+        for (const auto& member : Object)
+        {
+            if (member.first == key)
+            {
+                return &member.second;
+            }
+        }
+        return NULL;
+    }
+};
+
+struct JSONParser
+{
+    const char* Filename;
+    const char* Text;
+    const char* Curr;
+};
+
+static void JSONError(const JSONParser* parser, const char* message)
+{
+    int line = 1;
+    for (const char* c = parser->Text; c < parser->Curr; c++)
+    {
+        line += *c == '\n';
+    }
+    fprintf(stderr, "%s:%d: %s\n", parser->Filename, line, message);
+    exit(2);
+}
+
+static void SkipWhitespace(JSONParser* parser)
+{
+    while (isspace((unsigned char)*parser->Curr))
+    {
+        parser->Curr++;
+    }
+}
+
+static void ExpectChar(JSONParser* parser, char c)
+{
+    SkipWhitespace(parser);
+    if (*parser->Curr != c)
+    {
+        char message[64];
+        snprintf(message, sizeof(message), "Expected '%c'", c);
+        JSONError(parser, message);
+    }
+    parser->Curr++;
+}
+
+static std::string ParseJSONString(JSONParser* parser)
+{
+    ExpectChar(parser, '"');
+
+    std::string s;
+    while (*parser->Curr != '"')
+    {
+        if (*parser->Curr == '\0')
+        {
+            JSONError(parser, "Unterminated string");
+        }
+
+        if (*parser->Curr != '\\')
+        {
+            s += *parser->Curr++;
+            continue;
+        }
+
+        parser->Curr++;
+        switch (*parser->Curr++)
+        {
+        case '"': s += '"'; break;
+        case '\\': s += '\\'; break;
+        case '/': s += '/'; break;
+        case 'b': s += '\b'; break;
+        case 'f': s += '\f'; break;
+        case 'n': s += '\n'; break;
+        case 'r': s += '\r'; break;
+        case 't': s += '\t'; break;
+        case 'u':
+        {
+            // Names and labels are ASCII, so other code points are only kept as a placeholder
+            unsigned int codePoint = 0;
+            for (int digitIdx = 0; digitIdx < 4; digitIdx++)
+            {
+                if (!isxdigit((unsigned char)*parser->Curr))
+                {
+                    JSONError(parser, "Bad \\u escape");
+                }
+                char digit = (char)tolower(*parser->Curr++);
+                codePoint = codePoint * 16 + (isdigit((unsigned char)digit) ? digit - '0' : digit - 'a' + 10);
+            }
+            s += codePoint < 0x80 ? (char)codePoint : '?';
+            break;
+        }
+        default:
+            JSONError(parser, "Bad escape");
+        }
+    }
+    parser->Curr++;
+
+    return s;
+}
+
+static void ParseJSONValue(JSONParser* parser, JSONValue* value)
+{
+    SkipWhitespace(parser);
+
+    value->Type = JSONTYPE_NULL;
+    value->Bool = false;
+    value->Number = 0.0;
+
+    char c = *parser->Curr;
+    if (c == '{')
+    {
+        value->Type = JSONTYPE_OBJECT;
+        parser->Curr++;
+        SkipWhitespace(parser);
+        if (*parser->Curr == '}')
+        {
+            parser->Curr++;
+            return;
+        }
+        for (;;)
+        {
+            std::string key = ParseJSONString(parser);
+            ExpectChar(parser, ':');
+            value->Object.emplace_back(key, JSONValue());
+            ParseJSONValue(parser, &value->Object.back().second);
+
+            SkipWhitespace(parser);
+            if (*parser->Curr == ',')
+            {
+                parser->Curr++;
+                continue;
+            }
+            ExpectChar(parser, '}');
+            return;
+        }
+    }
+    else if (c == '[')
+    {
+        value->Type = JSONTYPE_ARRAY;
+        parser->Curr++;
+        SkipWhitespace(parser);
+        if (*parser->Curr == ']')
+        {
+            parser->Curr++;
+            return;
+        }
+        for (;;)
+        {
+            value->Array.emplace_back();
+            ParseJSONValue(parser, &value->Array.back());
+
+            SkipWhitespace(parser);
+            if (*parser->Curr == ',')
+            {
+                parser->Curr++;
+                continue;
+            }
+            ExpectChar(parser, ']');
+            return;
+        }
+    }
+    else if (c == '"')
+    {
+        value->Type = JSONTYPE_STRING;
+        value->String = ParseJSONString(parser);
+    }
+    else if (strncmp(parser->Curr, "true", 4) == 0 || strncmp(parser->Curr, "false", 5) == 0)
+    {
+        value->Type = JSONTYPE_BOOL;
+        value->Bool = c == 't';
+        parser->Curr += value->Bool ? 4 : 5;
+    }
+    else if (strncmp(parser->Curr, "null", 4) == 0)
+    {
+        parser->Curr += 4;
+    }
+    else
+    {
+        // Also takes the NaN and Infinity Google Benchmark can write
+        char* end;
+        value->Type = JSONTYPE_NUMBER;
+        value->Number = strtod(parser->Curr, &end);
+        if (end == parser->Curr)
+        {
+            JSONError(parser, "Expected a value");
+        }
+        parser->Curr = end;
+    }
+}
+
+static void LoadJSON(const char* filename, JSONValue* root)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "Couldn't open %s\n", filename);
+        exit(2);
+    }
+
+    std::string text;
+    char buf[4096];
+    size_t numRead;
+    while ((numRead = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        text.append(buf, numRead);
+    }
+    fclose(f);
+
+    JSONParser parser;
+    parser.Filename = filename;
+    parser.Text = text.c_str();
+    parser.Curr = parser.Text;
+    ParseJSONValue(&parser, root);
+}
+
+// A compared number, with the samples of both sides
+struct Metric
+{
+    std::string Name;
+    const char* Unit;
+    bool HigherIsBetter;
+    double Threshold; // Smallest relative change of the median that counts
+    double MinDelta; // Smallest absolute change of the median that counts, for times too short to matter
+    std::vector<double> Samples[2]; // Baseline, contender
+};
+
+struct MetricTable
+{
+    std::vector<Metric> Metrics; // In the order they were first seen
+    std::map<std::string, int> MetricIDs;
+};
+
+static void AddSample(MetricTable* table, int side, const std::string& name, const char* unit, bool higherIsBetter, double threshold, double minDelta, double sample)
+{
+    auto found = table->MetricIDs.find(name);
+    if (found == end(table->MetricIDs))
+    {
+        Metric metric;
+        metric.Name = name;
+        metric.Unit = unit;
+        metric.HigherIsBetter = higherIsBetter;
+        metric.Threshold = threshold;
+        metric.MinDelta = minDelta;
+        found = table->MetricIDs.emplace(name, (int)table->Metrics.size()).first;
+        table->Metrics.push_back(metric);
+    }
+    table->Metrics[found->second].Samples[side].push_back(sample);
+}
+
+static double GetNumber(const JSONValue& object, const char* key, double defaultValue)
+{
+    const JSONValue* value = object.Find(key);
+    return value && value->Type == JSONTYPE_NUMBER ? value->Number : defaultValue;
+}
+
+// Google Benchmark output: one sample per repetition, in nanoseconds
+static void AddMicrobenchmarkSamples(MetricTable* table, int side, const JSONValue& root)
+{
+    const JSONValue* benchmarks = root.Find("benchmarks");
+    for (const JSONValue& benchmark : benchmarks->Array)
+    {
+        const JSONValue* name = benchmark.Find("name");
+        const JSONValue* runType = benchmark.Find("run_type");
+        const JSONValue* errorOccurred = benchmark.Find("error_occurred");
+        if (!name || name->Type != JSONTYPE_STRING ||
+            (runType && runType->String == "aggregate") ||
+            (errorOccurred && errorOccurred->Bool))
+        {
+            continue;
+        }
+
+        double multiplier = 1.0;
+        const JSONValue* timeUnit = benchmark.Find("time_unit");
+        if (timeUnit && timeUnit->String == "us") multiplier = 1e3;
+        if (timeUnit && timeUnit->String == "ms") multiplier = 1e6;
+        if (timeUnit && timeUnit->String == "s") multiplier = 1e9;
+
+        AddSample(table, side, name->String, "ns", false, 0.05, 0.0, GetNumber(benchmark, "real_time", 0.0) * multiplier);
+    }
+}
+
+// The program's --benchmark report: one sample per file of each percentile.
+// Tails and short scopes are noisier, so they get larger thresholds.
+static void AddFrameReportSamples(MetricTable* table, int side, const JSONValue& root)
+{
+    const char* percentiles[] = { "p50", "p95", "p99" };
+    const double frameThresholds[] = { 0.05, 0.10, 0.15 };
+    for (const char* frameKey : { "cpuFrameMs", "gpuFrameMs" })
+    {
+        const JSONValue* frame = root.Find(frameKey);
+        if (!frame)
+        {
+            continue;
+        }
+        for (int percentileIdx = 0; percentileIdx < 3; percentileIdx++)
+        {
+            const JSONValue* value = frame->Find(percentiles[percentileIdx]);
+            if (value)
+            {
+                AddSample(table, side, std::string(frameKey) + "." + percentiles[percentileIdx], "ms", false, frameThresholds[percentileIdx], 0.05, value->Number);
+            }
+        }
+    }
+
+    const double scopeThresholds[] = { 0.10, 0.15 };
+    for (const char* scopesKey : { "cpuScopesMs", "gpuScopesMs" })
+    {
+        const JSONValue* scopes = root.Find(scopesKey);
+        if (!scopes)
+        {
+            continue;
+        }
+        for (const auto& scope : scopes->Object)
+        {
+            for (int percentileIdx = 0; percentileIdx < 2; percentileIdx++)
+            {
+                const JSONValue* value = scope.second.Find(percentiles[percentileIdx]);
+                if (value)
+                {
+                    AddSample(table, side, std::string(scopesKey) + "." + scope.first + "." + percentiles[percentileIdx], "ms", false, scopeThresholds[percentileIdx], 0.05, value->Number);
+                }
+            }
+        }
+    }
+
+    if (const JSONValue* framesPerSecond = root.Find("framesPerSecond"))
+    {
+        AddSample(table, side, "framesPerSecond", "fps", true, 0.05, 0.0, framesPerSecond->Number);
+    }
+
+    // Allocations don't depend on timing, any change is real
+    if (const JSONValue* allocations = root.Find("allocations"))
+    {
+        AddSample(table, side, "allocations.countPerFrame", "", false, 0.01, 0.0, GetNumber(*allocations, "countPerFrame", 0.0));
+        AddSample(table, side, "allocations.bytesPerFrame", "B", false, 0.01, 0.0, GetNumber(*allocations, "bytesPerFrame", 0.0));
+    }
+}
+
+static void AddFileSamples(MetricTable* table, int side, const char* filename)
+{
+    JSONValue root;
+    LoadJSON(filename, &root);
+
+    const JSONValue* benchmarks = root.Find("benchmarks");
+    if (benchmarks && benchmarks->Type == JSONTYPE_ARRAY)
+    {
+        AddMicrobenchmarkSamples(table, side, root);
+    }
+    else if (root.Find("cpuFrameMs"))
+    {
+        AddFrameReportSamples(table, side, root);
+    }
+    else
+    {
+        fprintf(stderr, "%s: Neither microbenchmark results nor a benchmark report\n", filename);
+        exit(2);
+    }
+}
+
+static double GetMedian(std::vector<double> values)
+{
+    std::sort(begin(values), end(values));
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : 0.5 * (values[mid - 1] + values[mid]);
+}
+
+// Probability that U <= u when the samples come from the same distribution, without ties.
+// Counts the orderings of the two samples with each U, N(u; m, n) = N(u - n; m - 1, n) + N(u; m, n - 1).
+static double MannWhitneyExactCDF(int n1, int n2, int u)
+{
+    int maxU = n1 * n2;
+    // counts[m][n][u], built up from empty samples
+    std::vector<std::vector<std::vector<double>>> counts(n1 + 1, std::vector<std::vector<double>>(n2 + 1, std::vector<double>(maxU + 1, 0.0)));
+    for (int m = 0; m <= n1; m++)
+    {
+        for (int n = 0; n <= n2; n++)
+        {
+            if (m == 0 || n == 0)
+            {
+                counts[m][n][0] = 1.0;
+                continue;
+            }
+            for (int v = 0; v <= m * n; v++)
+            {
+                counts[m][n][v] = (v >= n ? counts[m - 1][n][v - n] : 0.0) + counts[m][n - 1][v];
+            }
+        }
+    }
+
+    double numOrderings = 0.0;
+    double numAtMostU = 0.0;
+    for (int v = 0; v <= maxU; v++)
+    {
+        numOrderings += counts[n1][n2][v];
+        if (v <= u)
+        {
+            numAtMostU += counts[n1][n2][v];
+        }
+    }
+    return numAtMostU / numOrderings;
+}
+
+// Two-sided p-value of the Mann-Whitney U test, that both samples come from the same distribution.
+// Exact for small samples without ties, normal approximation with tie correction otherwise.
+static double MannWhitneyPValue(const std::vector<double>& a, const std::vector<double>& b)
+{
+    int n1 = (int)a.size();
+    int n2 = (int)b.size();
+    if (n1 == 0 || n2 == 0)
+    {
+        return 1.0;
+    }
+
+    // Rank the pooled samples, ties get the average of their ranks
+    std::vector<std::pair<double, int>> pooled;
+    for (double value : a) pooled.emplace_back(value, 0);
+    for (double value : b) pooled.emplace_back(value, 1);
+    std::sort(begin(pooled), end(pooled));
+
+    int n = n1 + n2;
+    double rankSumA = 0.0;
+    double tieCorrection = 0.0;
+    bool hasTies = false;
+    for (int first = 0; first < n; )
+    {
+        int last = first;
+        while (last + 1 < n && pooled[last + 1].first == pooled[first].first)
+        {
+            last++;
+        }
+
+        double rank = 0.5 * (first + last) + 1.0;
+        for (int i = first; i <= last; i++)
+        {
+            if (pooled[i].second == 0)
+            {
+                rankSumA += rank;
+            }
+        }
+
+        double numTied = last - first + 1;
+        tieCorrection += numTied * numTied * numTied - numTied;
+        hasTies = hasTies || numTied > 1;
+        first = last + 1;
+    }
+
+    double u1 = rankSumA - n1 * (n1 + 1) / 2.0;
+    double u = std::min(u1, n1 * n2 - u1);
+
+    if (!hasTies && n <= 40)
+    {
+        return std::min(1.0, 2.0 * MannWhitneyExactCDF(n1, n2, (int)u));
+    }
+
+    double mean = n1 * n2 / 2.0;
+    double variance = n1 * n2 / 12.0 * ((n + 1) - tieCorrection / (n * (n - 1.0)));
+    if (variance <= 0.0)
+    {
+        return 1.0;
+    }
+
+    // Continuity corrected
+    double z = std::max(std::abs(u1 - mean) - 0.5, 0.0) / std::sqrt(variance);
+    return std::erfc(z / std::sqrt(2.0));
+}
+
+// Smallest p-value the exact test can give, reached when the samples don't overlap
+static double MannWhitneyMinPValue(int n1, int n2)
+{
+    // 2 / C(n1 + n2, n1)
+    double numOrderings = 1.0;
+    for (int i = 1; i <= n1; i++)
+    {
+        numOrderings = numOrderings * (n2 + i) / i;
+    }
+    return std::min(1.0, 2.0 / numOrderings);
+}
+
+// Times are printed in the largest unit they have at least one of
+static std::string FormatValue(double value, const char* unit)
+{
+    char buf[64];
+    if (strcmp(unit, "ns") == 0)
+    {
+        const char* units[] = { "ns", "us", "ms", "s" };
+        int unitIdx = 0;
+        while (unitIdx < 3 && std::abs(value) >= 1000.0)
+        {
+            value /= 1000.0;
+            unitIdx++;
+        }
+        snprintf(buf, sizeof(buf), "%.4g %s", value, units[unitIdx]);
+    }
+    else
+    {
+        snprintf(buf, sizeof(buf), "%.4g%s%s", value, unit[0] ? " " : "", unit);
+    }
+    return buf;
+}
+
+static bool ParseFlag(const char* arg, const char* flag, const char** value)
+{
+    size_t flagLength = strlen(flag);
+    if (strncmp(arg, flag, flagLength) != 0 || arg[flagLength] != '=')
+    {
+        return false;
+    }
+    *value = arg + flagLength + 1;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    double alpha = 0.05;
+    std::vector<std::pair<std::regex, double>> thresholdOverrides;
+    std::regex filter(".");
+    bool printAll = false;
+    bool failUnconfirmed = false;
+    std::vector<const char*> filenames[2];
+    bool hasSeparator = false;
+
+    for (int argIdx = 1; argIdx < argc; argIdx++)
+    {
+        const char* value;
+        if (ParseFlag(argv[argIdx], "--alpha", &value))
+        {
+            alpha = atof(value);
+        }
+        else if (ParseFlag(argv[argIdx], "--threshold", &value))
+        {
+            const char* separator = strrchr(value, '=');
+            if (!separator)
+            {
+                fprintf(stderr, "Expected --threshold=<regex>=<percent>, got %s\n", argv[argIdx]);
+                exit(2);
+            }
+            thresholdOverrides.emplace_back(std::regex(std::string(value, separator)), atof(separator + 1) / 100.0);
+        }
+        else if (ParseFlag(argv[argIdx], "--filter", &value))
+        {
+            filter = std::regex(value);
+        }
+        else if (strcmp(argv[argIdx], "--all") == 0)
+        {
+            printAll = true;
+        }
+        else if (strcmp(argv[argIdx], "--fail-unconfirmed") == 0)
+        {
+            failUnconfirmed = true;
+        }
+        else if (strcmp(argv[argIdx], "--") == 0)
+        {
+            hasSeparator = true;
+        }
+        else if (strncmp(argv[argIdx], "--", 2) == 0)
+        {
+            fprintf(stderr, "Unknown argument %s\n", argv[argIdx]);
+            exit(2);
+        }
+        else
+        {
+            filenames[hasSeparator].push_back(argv[argIdx]);
+        }
+    }
+
+    // Without a separator, the first file is the baseline and the second the contender
+    if (!hasSeparator && filenames[0].size() == 2)
+    {
+        filenames[1].push_back(filenames[0][1]);
+        filenames[0].pop_back();
+    }
+
+    if (filenames[0].empty() || filenames[1].empty())
+    {
+        fprintf(stderr, "Usage: %s [flags] <baseline.json> <contender.json>\n", argv[0]);
+        fprintf(stderr, "       %s [flags] <baseline.json>... -- <contender.json>...\n", argv[0]);
+        exit(2);
+    }
+
+    MetricTable table;
+    for (int side = 0; side < 2; side++)
+    {
+        for (const char* filename : filenames[side])
+        {
+            AddFileSamples(&table, side, filename);
+        }
+    }
+
+    for (Metric& metric : table.Metrics)
+    {
+        for (const auto& thresholdOverride : thresholdOverrides)
+        {
+            if (std::regex_search(metric.Name, thresholdOverride.first))
+            {
+                metric.Threshold = thresholdOverride.second;
+            }
+        }
+    }
+
+    int nameWidth = 6;
+    for (const Metric& metric : table.Metrics)
+    {
+        nameWidth = std::max(nameWidth, (int)metric.Name.size());
+    }
+
+    printf("%-*s %14s %14s %9s %8s  %s\n", nameWidth, "Metric", "Baseline", "Contender", "Change", "p-value", "Verdict");
+    printf("%s\n", std::string(nameWidth + 70, '-').c_str());
+
+    int numRegressions = 0;
+    int numImprovements = 0;
+    int numUnconfirmedRegressions = 0;
+    int numUnconfirmedImprovements = 0;
+    std::vector<std::string> unmatchedNames;
+    for (const Metric& metric : table.Metrics)
+    {
+        if (!std::regex_search(metric.Name, filter))
+        {
+            continue;
+        }
+
+        if (metric.Samples[0].empty() || metric.Samples[1].empty())
+        {
+            unmatchedNames.push_back(metric.Name + (metric.Samples[0].empty() ? " (contender only)" : " (baseline only)"));
+            continue;
+        }
+
+        double baseline = GetMedian(metric.Samples[0]);
+        double contender = GetMedian(metric.Samples[1]);
+        double change = baseline != 0.0 ? (contender - baseline) / std::abs(baseline) : (contender != 0.0 ? INFINITY : 0.0);
+        bool isWorse = metric.HigherIsBetter ? change < 0.0 : change > 0.0;
+
+        int n1 = (int)metric.Samples[0].size();
+        int n2 = (int)metric.Samples[1].size();
+        double pValue = MannWhitneyPValue(metric.Samples[0], metric.Samples[1]);
+        bool canBeSignificant = MannWhitneyMinPValue(n1, n2) <= alpha;
+
+        const char* verdict = "";
+        if (std::abs(change) < metric.Threshold || std::abs(contender - baseline) < metric.MinDelta)
+        {
+            // Unchanged
+        }
+        else if (!canBeSignificant)
+        {
+            // Too few samples for the test, so the threshold alone decides
+            verdict = isWorse ? "REGRESSION (unconfirmed)" : "improvement (unconfirmed)";
+            (isWorse ? numUnconfirmedRegressions : numUnconfirmedImprovements)++;
+        }
+        else if (pValue <= alpha)
+        {
+            verdict = isWorse ? "REGRESSION" : "improvement";
+            (isWorse ? numRegressions : numImprovements)++;
+        }
+        else
+        {
+            verdict = "noise";
+        }
+
+        if (!printAll && verdict[0] == '\0')
+        {
+            continue;
+        }
+
+        char changeText[32];
+        snprintf(changeText, sizeof(changeText), "%+.1f%%", 100.0 * change);
+
+        char pValueText[32];
+        if (canBeSignificant)
+        {
+            snprintf(pValueText, sizeof(pValueText), "%.4f", pValue);
+        }
+        else
+        {
+            snprintf(pValueText, sizeof(pValueText), "-");
+        }
+
+        printf("%-*s %14s %14s %9s %8s  %s\n", nameWidth, metric.Name.c_str(),
+            FormatValue(baseline, metric.Unit).c_str(), FormatValue(contender, metric.Unit).c_str(),
+            changeText, pValueText, verdict);
+    }
+
+    for (const std::string& name : unmatchedNames)
+    {
+        printf("%-*s %s\n", nameWidth, name.c_str(), "not compared");
+    }
+
+    printf("\n%d regressions, %d improvements\n", numRegressions, numImprovements);
+    if (numUnconfirmedRegressions + numUnconfirmedImprovements > 0)
+    {
+        printf("%d unconfirmed regressions, %d unconfirmed improvements: too few samples for a significance test, run more repetitions to confirm them%s\n",
+            numUnconfirmedRegressions, numUnconfirmedImprovements, failUnconfirmed ? "" : " (not failing, see --fail-unconfirmed)");
+    }
+
+    bool failed = numRegressions > 0 || (failUnconfirmed && numUnconfirmedRegressions > 0);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+#include "tracecapture.h"
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static void WriteJSONString(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            fputc('\\', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// Writes a complete ("X") event. Times are in nanoseconds from the start of the capture, trace events use microseconds.
+static void WriteCompleteEvent(FILE* f, bool* first, const char* name, const char* category, int tid, int64_t start, uint64_t duration, int frame, int depth)
+{
+    fprintf(f, "%s\n{\"name\":", *first ? "" : ",");
+    WriteJSONString(f, name);
+    fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d,\"depth\":%d}}",
+        category, tid, start / 1e3, duration / 1e3, frame, depth);
+    *first = false;
+}
+
+static void WriteThreadName(FILE* f, bool* first, int tid, const char* name)
+{
+    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", *first ? "" : ",", tid);
+    WriteJSONString(f, name);
+    fprintf(f, "}}");
+    *first = false;
+}
+
+static void WriteTraceCapture(TraceCapture* capture, int64_t gpuClockDrift)
+{
+    FILE* f = fopen(capture->Filename.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "Couldn't open %s for writing\n", capture->Filename.c_str());
+        return;
+    }
+
+    // The GPU gets a track after all CPU threads
+    int gpuTid = 0;
+    int64_t captureStart = INT64_MAX;
+    for (const CPUMarker& marker : capture->CPUMarkers)
+    {
+        gpuTid = std::max(gpuTid, marker.ThreadIdx + 1);
+        captureStart = std::min(captureStart, (int64_t)marker.Start);
+    }
+    if (capture->HasGPUTimestamps)
+    {
+        for (const GPUMarker& marker : capture->GPUMarkers)
+        {
+            captureStart = std::min(captureStart, (int64_t)marker.Start + capture->GPUClockOffset);
+        }
+    }
+
+    fprintf(f, "{\"traceEvents\":[");
+    bool first = true;
+
+    for (int tid = 0; tid < gpuTid; tid++)
+    {
+        char threadName[32];
+        snprintf(threadName, sizeof(threadName), tid == 0 ? "Main thread" : "Thread %d", tid);
+        WriteThreadName(f, &first, tid, threadName);
+    }
+    WriteThreadName(f, &first, gpuTid, "GPU");
+
+    for (const CPUMarker& marker : capture->CPUMarkers)
+    {
+        WriteCompleteEvent(f, &first, marker.Name, "CPU", marker.ThreadIdx, (int64_t)marker.Start - captureStart, marker.TimeElapsed, marker.Frame, marker.Depth);
+    }
+
+    // Without timestamps, the frame's CPU marker is the only anchor there is
+    int64_t approximateGPUTime = 0;
+    int approximateFrame = -1;
+    for (const GPUMarker& marker : capture->GPUMarkers)
+    {
+        int64_t start;
+        if (capture->HasGPUTimestamps)
+        {
+            start = (int64_t)marker.Start + capture->GPUClockOffset - captureStart;
+        }
+        else
+        {
+            if (marker.Frame != approximateFrame)
+            {
+                approximateFrame = marker.Frame;
+                approximateGPUTime = 0;
+                for (const CPUMarker& cpuMarker : capture->CPUMarkers)
+                {
+                    if (cpuMarker.Frame == marker.Frame && cpuMarker.Depth == 0 && cpuMarker.ThreadIdx == 0)
+                    {
+                        approximateGPUTime = (int64_t)cpuMarker.Start - captureStart;
+                        break;
+                    }
+                }
+            }
+            start = approximateGPUTime;
+            approximateGPUTime += marker.TimeElapsed;
+        }
+
+        WriteCompleteEvent(f, &first, marker.Name, "GPU", gpuTid, start, marker.TimeElapsed, marker.Frame, marker.Depth);
+    }
+
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"frames\":%d,\"gpuTimestamps\":%s,\"gpuClockDriftNs\":%lld}}\n",
+        capture->NumFramesCaptured, capture->HasGPUTimestamps ? "true" : "false", (long long)gpuClockDrift);
+
+    fclose(f);
+
+    printf("Wrote %d frames of profiling to %s\n", capture->NumFramesCaptured, capture->Filename.c_str());
+    capture->LastWrittenFilename = capture->Filename;
+}
+
+void StartTraceCapture(TraceCapture* capture, Profiler* profiler, const char* filename, int numFrames)
+{
+    capture->IsCapturing = true;
+    capture->NumFramesRequested = numFrames;
+    capture->Filename = filename;
+    capture->GPUClockOffset = profiler->CalibrateGPUClock();
+    capture->HasGPUTimestamps = profiler->HasGPUTimestamps();
+    capture->GPUMarkers.clear();
+    capture->CPUMarkers.clear();
+    capture->NumFramesCaptured = 0;
+}
+
+void AddTraceCaptureFrame(TraceCapture* capture, Profiler* profiler, const std::vector<GPUMarker>& gpuMarkers, const std::vector<CPUMarker>& cpuMarkers)
+{
+    if (!capture->IsCapturing || cpuMarkers.empty())
+    {
+        return;
+    }
+
+    capture->GPUMarkers.insert(end(capture->GPUMarkers), begin(gpuMarkers), end(gpuMarkers));
+    capture->CPUMarkers.insert(end(capture->CPUMarkers), begin(cpuMarkers), end(cpuMarkers));
+    capture->NumFramesCaptured++;
+
+    if (capture->NumFramesCaptured < capture->NumFramesRequested)
+    {
+        return;
+    }
+
+    // Calibrating again shows how far the clocks drifted apart during the capture
+    int64_t gpuClockDrift = profiler->CalibrateGPUClock() - capture->GPUClockOffset;
+
+    WriteTraceCapture(capture, gpuClockDrift);
+    capture->IsCapturing = false;
+    capture->GPUMarkers.clear();
+    capture->CPUMarkers.clear();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct GPUMarker;
+struct CPUMarker;
+class Profiler;
+
+// Captures a number of frames of profiler markers, and writes them as a Chrome Trace Event JSON file.
+// It opens in chrome://tracing or ui.perfetto.dev, with a track per CPU thread and one for the GPU.
+struct TraceCapture
+{
+    bool IsCapturing;
+    int NumFramesRequested;
+    std::string Filename;
+
+    int64_t GPUClockOffset; // Added to GPU timestamps to put them on the CPU timeline, see Profiler::CalibrateGPUClock
+    bool HasGPUTimestamps; // Without them, GPU markers are laid back to back from the start of their frame
+
+    std::vector<GPUMarker> GPUMarkers;
+    std::vector<CPUMarker> CPUMarkers;
+    int NumFramesCaptured;
+
+    std::string LastWrittenFilename; // For display once done
+};
+
+void StartTraceCapture(TraceCapture* capture, Profiler* profiler, const char* filename, int numFrames);
+
+// Adds a frame read back from the profiler, and writes the file once all frames are in.
+void AddTraceCaptureFrame(TraceCapture* capture, Profiler* profiler, const std::vector<GPUMarker>& gpuMarkers, const std::vector<CPUMarker>& cpuMarkers);